@@ -0,0 +1,518 @@
+#include "allocator.h"
+
+#include <algorithm>
+#include <map>
+#include <optional>
+#include <set>
+
+// smallest range handed out, a buddy of order n spans this size << n
+const vk::DeviceSize kMinAllocationSize = 256;
+
+struct MemoryBlock {
+    vk::DeviceMemory memory;
+    vk::DeviceSize size;
+    uint32_t memoryTypeIndex;
+    ResourceKind kind;
+    uint8_t *mapped{nullptr};
+    // free buddies per order, ordered so that low offsets are reused first
+    std::vector<std::set<vk::DeviceSize>> freeLists;
+    // live ranges, offset to order
+    std::map<vk::DeviceSize, uint32_t> allocations;
+    vk::DeviceSize allocatedBytes{0};
+
+    uint32_t maxOrder() const {
+        return static_cast<uint32_t>(freeLists.size()) - 1;
+    }
+    std::optional<vk::DeviceSize> acquire(uint32_t order);
+    void release(vk::DeviceSize offset, uint32_t order);
+};
+
+std::optional<vk::DeviceSize> MemoryBlock::acquire(uint32_t order) {
+    if (maxOrder() < order) { return std::nullopt; }
+    uint32_t k = order;
+    while (k <= maxOrder() && freeLists[k].empty()) { k++; }
+    if (maxOrder() < k) { return std::nullopt; }
+
+    vk::DeviceSize offset = *freeLists[k].begin();
+    freeLists[k].erase(freeLists[k].begin());
+    // split down, keeping the lower half and freeing the upper buddy
+    while (order < k) {
+        k--;
+        freeLists[k].insert(offset + (kMinAllocationSize << k));
+    }
+    allocations.emplace(offset, order);
+    allocatedBytes += kMinAllocationSize << order;
+    return offset;
+}
+
+void MemoryBlock::release(vk::DeviceSize offset, uint32_t order) {
+    allocations.erase(offset);
+    allocatedBytes -= kMinAllocationSize << order;
+    // merge with the buddy for as long as it is free as a whole
+    while (order < maxOrder()) {
+        vk::DeviceSize buddy = offset ^ (kMinAllocationSize << order);
+        auto it = freeLists[order].find(buddy);
+        if (it == freeLists[order].end()) { break; }
+        freeLists[order].erase(it);
+        offset = std::min(offset, buddy);
+        order++;
+    }
+    freeLists[order].insert(offset);
+}
+
+uint32_t orderForSize(vk::DeviceSize size) {
+    uint32_t order = 0;
+    while ((kMinAllocationSize << order) < size) { order++; }
+    return order;
+}
+
+uint32_t
+findMemoryType(const vk::PhysicalDeviceMemoryProperties &memoryProperties,
+               uint32_t typeBits, vk::MemoryPropertyFlags requirementsMask) {
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+        if ((typeBits & (1u << i)) &&
+            (memoryProperties.memoryTypes[i].propertyFlags &
+             requirementsMask) == requirementsMask) {
+            return i;
+        }
+    }
+    throw std::runtime_error("could not find a suitable memory type");
+}
+
+DeviceAllocator::DeviceAllocator(vk::PhysicalDevice physicalDevice,
+                                 vk::UniqueDevice &device, bool memoryBudget,
+                                 vk::DeviceSize blockSize)
+    : physicalDevice(physicalDevice), device(*device),
+      memoryProperties(physicalDevice.getMemoryProperties()),
+      maxMemoryAllocationCount(
+              physicalDevice.getProperties().limits.maxMemoryAllocationCount),
+      blockSize(kMinAllocationSize << orderForSize(blockSize)),
+      memoryBudget(memoryBudget),
+      typeStatistics(memoryProperties.memoryTypeCount) {}
+
+DeviceAllocator::~DeviceAllocator() noexcept {
+    for (auto &block : blocks) { device.freeMemory(block->memory); }
+}
+
+void DeviceAllocator::countAllocationCall() {
+    if (maxMemoryAllocationCount <= deviceAllocationCount) {
+        throw std::runtime_error("maxMemoryAllocationCount exceeded");
+    }
+    deviceAllocationCount++;
+}
+
+MemoryBlock *DeviceAllocator::createBlock(uint32_t memoryTypeIndex,
+                                          ResourceKind kind) {
+    countAllocationCall();
+    // small heaps, like the host visible part of vram, get smaller blocks so
+    // a few of them still fit
+    const vk::MemoryHeap &heap =
+            memoryProperties
+                    .memoryHeaps[memoryProperties.memoryTypes[memoryTypeIndex]
+                                         .heapIndex];
+    vk::DeviceSize size = blockSize;
+    while (kMinAllocationSize < size && heap.size / 8 < size) { size /= 2; }
+
+    auto block = std::make_unique<MemoryBlock>();
+    block->size = size;
+    block->memoryTypeIndex = memoryTypeIndex;
+    block->kind = kind;
+    try {
+        block->memory = device.allocateMemory(
+                vk::MemoryAllocateInfo(size, memoryTypeIndex));
+        if (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags &
+            vk::MemoryPropertyFlagBits::eHostVisible) {
+            block->mapped = static_cast<uint8_t *>(
+                    device.mapMemory(block->memory, 0, VK_WHOLE_SIZE));
+        }
+    } catch (...) {
+        // a failed map must not leak the memory behind it
+        if (block->memory) { device.freeMemory(block->memory); }
+        deviceAllocationCount--;
+        throw;
+    }
+    block->freeLists.resize(orderForSize(size) + 1);
+    block->freeLists.back().insert(0);
+
+    typeStatistics[memoryTypeIndex].blockBytes += size;
+    typeStatistics[memoryTypeIndex].blockCount++;
+    blocks.push_back(std::move(block));
+    return blocks.back().get();
+}
+
+void DeviceAllocator::destroyBlock(MemoryBlock *block) {
+    assert(block->allocations.empty());
+    typeStatistics[block->memoryTypeIndex].blockBytes -= block->size;
+    typeStatistics[block->memoryTypeIndex].blockCount--;
+    deviceAllocationCount--;
+    device.freeMemory(block->memory);
+    blocks.erase(std::find_if(
+            blocks.begin(), blocks.end(),
+            [block](const auto &b) { return b.get() == block; }));
+}
+
+Allocation DeviceAllocator::allocateDedicated(vk::DeviceSize size,
+                                              uint32_t memoryTypeIndex,
+                                              vk::Image image,
+                                              vk::Buffer buffer) {
+    countAllocationCall();
+    vk::StructureChain<vk::MemoryAllocateInfo, vk::MemoryDedicatedAllocateInfo>
+            allocateInfo({size, memoryTypeIndex}, {image, buffer});
+    if (!image && !buffer) {
+        allocateInfo.unlink<vk::MemoryDedicatedAllocateInfo>();
+    }
+
+    Allocation allocation;
+    try {
+        allocation.memory = device.allocateMemory(
+                allocateInfo.get<vk::MemoryAllocateInfo>());
+        if (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags &
+            vk::MemoryPropertyFlagBits::eHostVisible) {
+            allocation.mapped =
+                    device.mapMemory(allocation.memory, 0, VK_WHOLE_SIZE);
+        }
+    } catch (...) {
+        if (allocation.memory) { device.freeMemory(allocation.memory); }
+        deviceAllocationCount--;
+        throw;
+    }
+    allocation.size = size;
+    allocation.memoryTypeIndex = memoryTypeIndex;
+
+    TypeStatistics &statistics = typeStatistics[memoryTypeIndex];
+    statistics.blockBytes += size;
+    statistics.blockCount++;
+    statistics.allocationBytes += size;
+    statistics.allocationCount++;
+    return allocation;
+}
+
+Allocation DeviceAllocator::allocate(const vk::MemoryRequirements &requirements,
+                                     vk::MemoryPropertyFlags properties,
+                                     ResourceKind kind, bool dedicated) {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint32_t memoryTypeIndex = findMemoryType(
+            memoryProperties, requirements.memoryTypeBits, properties);
+
+    // buddies are aligned to their own size
+    vk::DeviceSize size = std::max(requirements.size, requirements.alignment);
+    if (dedicated || blockSize / 2 < size) {
+        return allocateDedicated(requirements.size, memoryTypeIndex, nullptr,
+                                 nullptr);
+    }
+
+    uint32_t order = orderForSize(size);
+    std::optional<vk::DeviceSize> offset;
+    MemoryBlock *block = nullptr;
+    for (auto &b : blocks) {
+        if (b->memoryTypeIndex != memoryTypeIndex || b->kind != kind) {
+            continue;
+        }
+        if ((offset = b->acquire(order))) {
+            block = b.get();
+            break;
+        }
+    }
+    if (!block) {
+        block = createBlock(memoryTypeIndex, kind);
+        offset = block->acquire(order);
+        if (!offset) {
+            // the heap only allowed a block smaller than the request
+            destroyBlock(block);
+            return allocateDedicated(requirements.size, memoryTypeIndex,
+                                     nullptr, nullptr);
+        }
+    }
+
+    Allocation allocation;
+    allocation.memory = block->memory;
+    allocation.offset = *offset;
+    allocation.size = kMinAllocationSize << order;
+    allocation.memoryTypeIndex = memoryTypeIndex;
+    allocation.mapped = block->mapped ? block->mapped + *offset : nullptr;
+    allocation.block = block;
+    allocation.order = order;
+
+    typeStatistics[memoryTypeIndex].allocationBytes += allocation.size;
+    typeStatistics[memoryTypeIndex].allocationCount++;
+    return allocation;
+}
+
+Allocation
+DeviceAllocator::allocateForBuffer(vk::Buffer buffer,
+                                   vk::MemoryPropertyFlags properties) {
+    auto requirements = device.getBufferMemoryRequirements2<
+            vk::MemoryRequirements2, vk::MemoryDedicatedRequirements>(
+            vk::BufferMemoryRequirementsInfo2(buffer));
+    const auto &memoryRequirements =
+            requirements.get<vk::MemoryRequirements2>().memoryRequirements;
+    const auto &dedicatedRequirements =
+            requirements.get<vk::MemoryDedicatedRequirements>();
+
+    Allocation allocation;
+    if (dedicatedRequirements.prefersDedicatedAllocation) {
+        std::lock_guard<std::mutex> lock(mutex);
+        allocation = allocateDedicated(
+                memoryRequirements.size,
+                findMemoryType(memoryProperties,
+                               memoryRequirements.memoryTypeBits, properties),
+                nullptr, buffer);
+    } else {
+        allocation = allocate(memoryRequirements, properties,
+                              ResourceKind::eLinear);
+    }
+    device.bindBufferMemory(buffer, allocation.memory, allocation.offset);
+    return allocation;
+}
+
+Allocation DeviceAllocator::allocateForImage(vk::Image image,
+                                             vk::MemoryPropertyFlags properties,
+                                             ResourceKind kind) {
+    auto requirements = device.getImageMemoryRequirements2<
+            vk::MemoryRequirements2, vk::MemoryDedicatedRequirements>(
+            vk::ImageMemoryRequirementsInfo2(image));
+    const auto &memoryRequirements =
+            requirements.get<vk::MemoryRequirements2>().memoryRequirements;
+    const auto &dedicatedRequirements =
+            requirements.get<vk::MemoryDedicatedRequirements>();
+
+    Allocation allocation;
+    // render targets and other large images get memory of their own, which
+    // lets the driver apply compression and placement tricks to them
+    if (dedicatedRequirements.prefersDedicatedAllocation ||
+        blockSize / 2 < memoryRequirements.size) {
+        std::lock_guard<std::mutex> lock(mutex);
+        allocation = allocateDedicated(
+                memoryRequirements.size,
+                findMemoryType(memoryProperties,
+                               memoryRequirements.memoryTypeBits, properties),
+                image, nullptr);
+    } else {
+        allocation = allocate(memoryRequirements, properties, kind);
+    }
+    device.bindImageMemory(image, allocation.memory, allocation.offset);
+    return allocation;
+}
+
+void DeviceAllocator::free(Allocation &allocation) {
+    if (!allocation) { return; }
+    std::lock_guard<std::mutex> lock(mutex);
+    TypeStatistics &statistics = typeStatistics[allocation.memoryTypeIndex];
+    statistics.allocationBytes -= allocation.size;
+    statistics.allocationCount--;
+
+    if (MemoryBlock *block = allocation.block) {
+        block->release(allocation.offset, allocation.order);
+        if (block->allocations.empty()) {
+            // keep one empty block per pool around, so that a resource
+            // freed and recreated every frame does not hit the driver
+            bool spare = std::any_of(
+                    blocks.begin(), blocks.end(), [block](const auto &b) {
+                        return b.get() != block &&
+                               b->memoryTypeIndex == block->memoryTypeIndex &&
+                               b->kind == block->kind &&
+                               b->allocations.empty();
+                    });
+            if (spare) { destroyBlock(block); }
+        }
+    } else {
+        statistics.blockBytes -= allocation.size;
+        statistics.blockCount--;
+        deviceAllocationCount--;
+        device.freeMemory(allocation.memory);
+    }
+    allocation = Allocation();
+}
+
+std::vector<HeapStatistics> DeviceAllocator::getHeapStatistics() const {
+    std::vector<HeapStatistics> heapStatistics(
+            memoryProperties.memoryHeapCount);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+            HeapStatistics &heap =
+                    heapStatistics[memoryProperties.memoryTypes[i].heapIndex];
+            heap.blockBytes += typeStatistics[i].blockBytes;
+            heap.allocationBytes += typeStatistics[i].allocationBytes;
+            heap.blockCount += typeStatistics[i].blockCount;
+            heap.allocationCount += typeStatistics[i].allocationCount;
+        }
+    }
+
+    if (memoryBudget) {
+        auto properties = physicalDevice.getMemoryProperties2<
+                vk::PhysicalDeviceMemoryProperties2,
+                vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+        const auto &budget =
+                properties.get<vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+        for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+            heapStatistics[i].budget = budget.heapBudget[i];
+            heapStatistics[i].usage = budget.heapUsage[i];
+        }
+    } else {
+        // without the extension, assume other processes leave us 80% of the
+        // heap and that we are its only user
+        for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+            heapStatistics[i].budget =
+                    memoryProperties.memoryHeaps[i].size * 8 / 10;
+            heapStatistics[i].usage = heapStatistics[i].blockBytes;
+        }
+    }
+    return heapStatistics;
+}
+
+void DeviceAllocator::report(std::ostream &os) const {
+    std::vector<HeapStatistics> heapStatistics = getHeapStatistics();
+    for (size_t i = 0; i < heapStatistics.size(); i++) {
+        const HeapStatistics &heap = heapStatistics[i];
+        if (heap.blockCount == 0) { continue; }
+        os << "heap " << i << ": " << heap.allocationCount
+           << " allocations in " << heap.blockCount << " blocks, "
+           << (heap.allocationBytes >> 10) << " of "
+           << (heap.blockBytes >> 10) << " KiB used, usage "
+           << (heap.usage >> 20) << " of " << (heap.budget >> 20)
+           << " MiB budget" << std::endl;
+    }
+}
+
+size_t DeviceAllocator::defragment(const DefragmentationMove &move,
+                                   size_t maxMoves) {
+    std::lock_guard<std::mutex> lock(mutex);
+    // emptiest blocks first, those are the cheapest to evacuate
+    std::vector<MemoryBlock *> candidates;
+    candidates.reserve(blocks.size());
+    for (auto &block : blocks) { candidates.push_back(block.get()); }
+    std::sort(candidates.begin(), candidates.end(),
+              [](const MemoryBlock *a, const MemoryBlock *b) {
+                  return a->allocatedBytes < b->allocatedBytes;
+              });
+
+    size_t moves = 0;
+    for (size_t i = 0; i < candidates.size() && moves < maxMoves; i++) {
+        MemoryBlock *source = candidates[i];
+        // copy, releasing ranges while iterating would invalidate the map
+        std::vector<std::pair<vk::DeviceSize, uint32_t>> ranges(
+                source->allocations.begin(), source->allocations.end());
+        for (const auto &[offset, order] : ranges) {
+            if (maxMoves <= moves) { break; }
+            // only fuller blocks of the same pool are destinations
+            MemoryBlock *destination = nullptr;
+            std::optional<vk::DeviceSize> destinationOffset;
+            for (size_t j = candidates.size(); i + 1 < j--;) {
+                MemoryBlock *block = candidates[j];
+                if (block->memoryTypeIndex != source->memoryTypeIndex ||
+                    block->kind != source->kind) {
+                    continue;
+                }
+                if ((destinationOffset = block->acquire(order))) {
+                    destination = block;
+                    break;
+                }
+            }
+            if (!destination) { break; }
+
+            Allocation from;
+            from.memory = source->memory;
+            from.offset = offset;
+            from.size = kMinAllocationSize << order;
+            from.memoryTypeIndex = source->memoryTypeIndex;
+            from.mapped = source->mapped ? source->mapped + offset : nullptr;
+            from.block = source;
+            from.order = order;
+            Allocation to = from;
+            to.memory = destination->memory;
+            to.offset = *destinationOffset;
+            to.mapped = destination->mapped
+                                ? destination->mapped + *destinationOffset
+                                : nullptr;
+            to.block = destination;
+
+            if (move(from, to)) {
+                source->release(offset, order);
+                moves++;
+            } else {
+                destination->release(*destinationOffset, order);
+            }
+        }
+    }
+
+    // release whatever was emptied, keeping one spare block per pool
+    for (MemoryBlock *block : candidates) {
+        if (!block->allocations.empty()) { continue; }
+        bool spare = std::any_of(
+                blocks.begin(), blocks.end(), [block](const auto &b) {
+                    return b.get() != block &&
+                           b->memoryTypeIndex == block->memoryTypeIndex &&
+                           b->kind == block->kind && b->allocations.empty();
+                });
+        if (spare) { destroyBlock(block); }
+    }
+    return moves;
+}
+
+BufferData::BufferData(DeviceAllocator &allocator, vk::DeviceSize size,
+                       vk::BufferUsageFlags usage,
+                       vk::MemoryPropertyFlags properties)
+    : allocator(&allocator) {
+    buffer = allocator.device.createBufferUnique(
+            vk::BufferCreateInfo(vk::BufferCreateFlags(), size, usage));
+    allocation = allocator.allocateForBuffer(*buffer, properties);
+}
+
+BufferData::BufferData(BufferData &&other) noexcept
+    : allocator(other.allocator), buffer(std::move(other.buffer)),
+      allocation(other.allocation) {
+    other.allocation = Allocation();
+}
+
+BufferData &BufferData::operator=(BufferData &&other) noexcept {
+    if (this != &other) {
+        buffer.reset();
+        if (allocator) { allocator->free(allocation); }
+        allocator = other.allocator;
+        buffer = std::move(other.buffer);
+        allocation = other.allocation;
+        other.allocation = Allocation();
+    }
+    return *this;
+}
+
+BufferData::~BufferData() noexcept {
+    buffer.reset();
+    if (allocator) { allocator->free(allocation); }
+}
+
+ImageData::ImageData(DeviceAllocator &allocator,
+                     const vk::ImageCreateInfo &imageCreateInfo,
+                     vk::MemoryPropertyFlags properties)
+    : allocator(&allocator) {
+    image = allocator.device.createImageUnique(imageCreateInfo);
+    allocation = allocator.allocateForImage(
+            *image, properties,
+            imageCreateInfo.tiling == vk::ImageTiling::eOptimal
+                    ? ResourceKind::eOptimal
+                    : ResourceKind::eLinear);
+}
+
+ImageData::ImageData(ImageData &&other) noexcept
+    : allocator(other.allocator), image(std::move(other.image)),
+      allocation(other.allocation) {
+    other.allocation = Allocation();
+}
+
+ImageData &ImageData::operator=(ImageData &&other) noexcept {
+    if (this != &other) {
+        image.reset();
+        if (allocator) { allocator->free(allocation); }
+        allocator = other.allocator;
+        image = std::move(other.image);
+        allocation = other.allocation;
+        other.allocation = Allocation();
+    }
+    return *this;
+}
+
+ImageData::~ImageData() noexcept {
+    image.reset();
+    if (allocator) { allocator->free(allocation); }
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+// device memory is reserved in blocks of this size and sub-allocated
+const vk::DeviceSize kDefaultMemoryBlockSize = 64ull << 20;
+
+struct MemoryBlock;
+
+// buffers and linear images must not share a bufferImageGranularity page with
+// optimally tiled images, so they are sub-allocated from separate blocks
+enum class ResourceKind { eLinear, eOptimal };
+
+// a range of device memory handed out by DeviceAllocator
+struct Allocation {
+    vk::DeviceMemory memory;
+    vk::DeviceSize offset{0};
+    vk::DeviceSize size{0};
+    uint32_t memoryTypeIndex{0};
+    // host address of offset when the memory type is host visible, blocks are
+    // mapped once for their whole lifetime
+    void *mapped{nullptr};
+
+    // the block the range was carved from, null for dedicated allocations
+    MemoryBlock *block{nullptr};
+    uint32_t order{0};
+
+    explicit operator bool() const { return static_cast<bool>(memory); }
+};
+
+struct HeapStatistics {
+    // reserved from the driver, including unused parts of blocks
+    vk::DeviceSize blockBytes{0};
+    // handed out to resources
+    vk::DeviceSize allocationBytes{0};
+    uint32_t blockCount{0};
+    uint32_t allocationCount{0};
+    // from VK_EXT_memory_budget if enabled, otherwise estimated from the heap
+    // size and this allocator's own usage
+    vk::DeviceSize budget{0};
+    vk::DeviceSize usage{0};
+};
+
+// asks the owner of `from` to move its resource into `to`: recreate and bind
+// the resource, copy the contents and return true, or return false to leave
+// it in place. must not call back into the allocator
+using DefragmentationMove =
+        std::function<bool(const Allocation &from, const Allocation &to)>;
+
+uint32_t
+findMemoryType(const vk::PhysicalDeviceMemoryProperties &memoryProperties,
+               uint32_t typeBits, vk::MemoryPropertyFlags requirementsMask);
+
+// sub-allocates device memory with a buddy scheme inside large blocks per
+// memory type, so resources cost a vkAllocateMemory only when a block fills
+// up or the resource is big enough to deserve dedicated memory
+struct DeviceAllocator {
+    vk::PhysicalDevice physicalDevice;
+    vk::Device device;
+    vk::PhysicalDeviceMemoryProperties memoryProperties;
+    uint32_t maxMemoryAllocationCount;
+    vk::DeviceSize blockSize;
+    // VK_EXT_memory_budget is enabled on the device
+    bool memoryBudget;
+
+    DeviceAllocator(vk::PhysicalDevice physicalDevice, vk::UniqueDevice &device,
+                    bool memoryBudget = false,
+                    vk::DeviceSize blockSize = kDefaultMemoryBlockSize);
+    ~DeviceAllocator() noexcept;
+    DeviceAllocator(const DeviceAllocator &) = delete;
+    DeviceAllocator &operator=(const DeviceAllocator &) = delete;
+
+    Allocation allocate(const vk::MemoryRequirements &requirements,
+                        vk::MemoryPropertyFlags properties, ResourceKind kind,
+                        bool dedicated = false);
+    // allocate and bind, with dedicated memory when the driver prefers it
+    Allocation allocateForBuffer(vk::Buffer buffer,
+                                 vk::MemoryPropertyFlags properties);
+    Allocation allocateForImage(vk::Image image,
+                                vk::MemoryPropertyFlags properties,
+                                ResourceKind kind = ResourceKind::eOptimal);
+    void free(Allocation &allocation);
+
+    // indexed by memory heap
+    std::vector<HeapStatistics> getHeapStatistics() const;
+    void report(std::ostream &os) const;
+    // evacuates the emptiest blocks of each pool into fuller ones and
+    // releases them, returns the number of allocations moved
+    size_t defragment(const DefragmentationMove &move, size_t maxMoves);
+
+private:
+    struct TypeStatistics {
+        vk::DeviceSize blockBytes{0};
+        vk::DeviceSize allocationBytes{0};
+        uint32_t blockCount{0};
+        uint32_t allocationCount{0};
+    };
+
+    Allocation allocateDedicated(vk::DeviceSize size, uint32_t memoryTypeIndex,
+                                 vk::Image image, vk::Buffer buffer);
+    MemoryBlock *createBlock(uint32_t memoryTypeIndex, ResourceKind kind);
+    void destroyBlock(MemoryBlock *block);
+    void countAllocationCall();
+
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<MemoryBlock>> blocks;
+    std::vector<TypeStatistics> typeStatistics;
+    uint32_t deviceAllocationCount{0};
+};
+
+// a buffer together with the memory bound to it
+struct BufferData {
+    DeviceAllocator *allocator{nullptr};
+    vk::UniqueBuffer buffer;
+    Allocation allocation;
+
+    BufferData() = default;
+    BufferData(DeviceAllocator &allocator, vk::DeviceSize size,
+               vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties);
+    BufferData(BufferData &&other) noexcept;
+    BufferData &operator=(BufferData &&other) noexcept;
+    ~BufferData() noexcept;
+};
+
+// an image together with the memory bound to it
+struct ImageData {
+    DeviceAllocator *allocator{nullptr};
+    vk::UniqueImage image;
+    Allocation allocation;
+
+    ImageData() = default;
+    ImageData(DeviceAllocator &allocator,
+              const vk::ImageCreateInfo &imageCreateInfo,
+              vk::MemoryPropertyFlags properties);
+    ImageData(ImageData &&other) noexcept;
+    ImageData &operator=(ImageData &&other) noexcept;
+    ~ImageData() noexcept;
+};
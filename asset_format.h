@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+// on-disk layout of an asset pack, shared by light_pack and the runtime. all
+// integers are little endian and every struct is used in place, straight from
+// the mapped file, so nothing here may change without bumping the version
+
+const uint32_t kAssetMagic = 0x4b41504c;// "LPAK"
+const uint32_t kAssetVersion = 1;
+// every section starts on this boundary. it is a multiple of every texel
+// block size and of optimalBufferCopyOffsetAlignment on current hardware,
+// and keeps sections from sharing cache lines
+const uint64_t kAssetAlignment = 256;
+const uint32_t kMaxAssetMips = 16;
+const uint32_t kAssetNameLength = 64;
+
+// a byte range of the file
+struct AssetSection {
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct AssetHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t meshCount;
+    uint32_t textureCount;
+    // arrays of AssetMesh and AssetTexture
+    uint64_t meshTableOffset;
+    uint64_t textureTableOffset;
+    // catches truncated files before anything is read past their end
+    uint64_t fileSize;
+};
+
+// the vertex format meshes are packed in, interleaved
+struct AssetVertex {
+    float position[3];
+    float normal[3];
+    float uv[2];
+};
+
+struct AssetMesh {
+    char name[kAssetNameLength];
+    // AssetVertex array, ordered by first use in the index stream
+    AssetSection vertices;
+    // 16 bit indices when the vertices fit, 32 bit otherwise
+    AssetSection indices;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t vertexStride;
+    // a VkIndexType
+    uint32_t indexType;
+    float boundsMin[3];
+    float boundsMax[3];
+};
+
+struct AssetTexture {
+    char name[kAssetNameLength];
+    // a VkFormat
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipCount;
+    // tightly packed rows, ready for vkCmdCopyBufferToImage
+    AssetSection mips[kMaxAssetMips];
+};
+
+static_assert(std::is_trivially_copyable<AssetHeader>::value &&
+              std::is_trivially_copyable<AssetMesh>::value &&
+              std::is_trivially_copyable<AssetTexture>::value);
+static_assert(sizeof(AssetHeader) == 40 && sizeof(AssetVertex) == 32 &&
+              sizeof(AssetMesh) == 136 && sizeof(AssetTexture) == 336);
@@ -0,0 +1,294 @@
+#include "asset_pack.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include "texel_block.h"
+
+namespace {
+
+uint64_t pageSize() {
+#if defined(_WIN32)
+    static const uint64_t size = [] {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return static_cast<uint64_t>(info.dwPageSize);
+    }();
+#else
+    static const uint64_t size = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+#endif
+    return size;
+}
+
+void checkSection(const AssetPack &pack, const AssetSection &section,
+                  const char *what) {
+    if (section.offset % kAssetAlignment != 0 ||
+        pack.file.size < section.offset ||
+        pack.file.size - section.offset < section.size) {
+        throw std::runtime_error(std::string("asset pack: bad ") + what +
+                                 " section");
+    }
+}
+
+}// namespace
+
+#if defined(_WIN32)
+
+MappedFile::MappedFile(const std::string &path) {
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              nullptr, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("failed to open " + path);
+    }
+    LARGE_INTEGER fileSize{};
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        CloseHandle(file);
+        throw std::runtime_error("failed to stat " + path);
+    }
+    size = static_cast<size_t>(fileSize.QuadPart);
+    HANDLE mapping =
+            CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    // the view keeps the mapping and the file referenced
+    CloseHandle(file);
+    void *view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)
+                         : nullptr;
+    if (mapping) { CloseHandle(mapping); }
+    if (!view) { throw std::runtime_error("failed to map " + path); }
+    data = static_cast<const uint8_t *>(view);
+}
+
+MappedFile::~MappedFile() noexcept {
+    if (data) { UnmapViewOfFile(data); }
+}
+
+void MappedFile::willNeed(uint64_t offset, uint64_t length) const {
+    uint64_t begin = offset / pageSize() * pageSize();
+    uint64_t end = std::min<uint64_t>(offset + length, size);
+    if (begin < end) {
+        WIN32_MEMORY_RANGE_ENTRY range{const_cast<uint8_t *>(data) + begin,
+                                       static_cast<SIZE_T>(end - begin)};
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+    }
+}
+
+void MappedFile::dontNeed(uint64_t offset, uint64_t length) const {
+    uint64_t begin = (offset + pageSize() - 1) / pageSize() * pageSize();
+    uint64_t end = std::min<uint64_t>(offset + length, size) / pageSize() *
+                   pageSize();
+    if (begin < end) {
+        // unlocking pages that are not locked takes them out of the working
+        // set, it reports ERROR_NOT_LOCKED while doing so
+        VirtualUnlock(const_cast<uint8_t *>(data) + begin,
+                      static_cast<SIZE_T>(end - begin));
+    }
+}
+
+#else
+
+MappedFile::MappedFile(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) { throw std::runtime_error("failed to open " + path); }
+    struct stat st {};
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        throw std::runtime_error("failed to stat " + path);
+    }
+    size = static_cast<size_t>(st.st_size);
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps the file referenced
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("failed to map " + path);
+    }
+    data = static_cast<const uint8_t *>(mapping);
+    // sections are read front to back
+    madvise(mapping, size, MADV_SEQUENTIAL);
+}
+
+MappedFile::~MappedFile() noexcept {
+    if (data) { munmap(const_cast<uint8_t *>(data), size); }
+}
+
+void MappedFile::willNeed(uint64_t offset, uint64_t length) const {
+    // from the page the range starts in, reading a bit of the section in
+    // front of it along is harmless
+    uint64_t begin = offset / pageSize() * pageSize();
+    uint64_t end = std::min<uint64_t>(offset + length, size);
+    if (begin < end) {
+        madvise(const_cast<uint8_t *>(data) + begin, end - begin,
+                MADV_WILLNEED);
+    }
+}
+
+void MappedFile::dontNeed(uint64_t offset, uint64_t length) const {
+    // only the pages entirely inside the range, the ones at its ends are
+    // shared with neighbouring sections
+    uint64_t begin = (offset + pageSize() - 1) / pageSize() * pageSize();
+    uint64_t end = std::min<uint64_t>(offset + length, size) / pageSize() *
+                   pageSize();
+    if (begin < end) {
+        madvise(const_cast<uint8_t *>(data) + begin, end - begin,
+                MADV_DONTNEED);
+    }
+}
+
+#endif
+
+AssetPack::AssetPack(const std::string &path) : file(path) {
+    header = reinterpret_cast<const AssetHeader *>(file.data);
+    if (file.size < sizeof(AssetHeader) || header->magic != kAssetMagic) {
+        throw std::runtime_error(path + ": not an asset pack");
+    }
+    if (header->version != kAssetVersion) {
+        throw std::runtime_error(path + ": asset pack version " +
+                                 std::to_string(header->version) +
+                                 ", expected " +
+                                 std::to_string(kAssetVersion));
+    }
+    if (header->fileSize != file.size) {
+        throw std::runtime_error(path + ": truncated asset pack");
+    }
+    checkSection(*this,
+                 {header->meshTableOffset,
+                  uint64_t(header->meshCount) * sizeof(AssetMesh)},
+                 "mesh table");
+    checkSection(*this,
+                 {header->textureTableOffset,
+                  uint64_t(header->textureCount) * sizeof(AssetTexture)},
+                 "texture table");
+    meshes = reinterpret_cast<const AssetMesh *>(file.data +
+                                                 header->meshTableOffset);
+    textures = reinterpret_cast<const AssetTexture *>(
+            file.data + header->textureTableOffset);
+
+    // ranges and sizes are checked, the contents are trusted to be what
+    // light_pack wrote
+    for (uint32_t i = 0; i < header->meshCount; i++) {
+        const AssetMesh &mesh = meshes[i];
+        checkSection(*this, mesh.vertices, "vertex");
+        checkSection(*this, mesh.indices, "index");
+        uint64_t indexSize = mesh.indexType == VK_INDEX_TYPE_UINT16 ? 2 : 4;
+        if (mesh.vertices.size !=
+                    uint64_t(mesh.vertexCount) * mesh.vertexStride ||
+            mesh.indices.size != mesh.indexCount * indexSize) {
+            throw std::runtime_error(path + ": inconsistent mesh");
+        }
+    }
+    for (uint32_t i = 0; i < header->textureCount; i++) {
+        const AssetTexture &texture = textures[i];
+        if (texture.mipCount == 0 || kMaxAssetMips < texture.mipCount ||
+            texture.width == 0 || texture.height == 0 ||
+            (std::max(texture.width, texture.height) >>
+             (texture.mipCount - 1)) == 0) {
+            throw std::runtime_error(path + ": inconsistent texture");
+        }
+        // the upload copies whole levels by the image's extent, a section of
+        // another size would be read past or leave the level short
+        for (uint32_t mip = 0; mip < texture.mipCount; mip++) {
+            checkSection(*this, texture.mips[mip], "mip");
+            std::optional<uint64_t> size =
+                    mipByteSize(static_cast<VkFormat>(texture.format),
+                                texture.width, texture.height, mip);
+            if (!size) {
+                throw std::runtime_error(path +
+                                         ": unsupported texture format " +
+                                         std::to_string(texture.format));
+            }
+            if (texture.mips[mip].size != *size) {
+                throw std::runtime_error(path + ": inconsistent texture");
+            }
+        }
+    }
+}
+
+MeshData loadMesh(const AssetPack &pack, uint32_t index,
+                  DeviceAllocator &allocator, UploadEngine &uploadEngine) {
+    const AssetMesh &mesh = pack.meshes[index];
+    MeshData data;
+    data.vertexCount = mesh.vertexCount;
+    data.indexCount = mesh.indexCount;
+    data.indexType = static_cast<vk::IndexType>(mesh.indexType);
+    data.vertices = BufferData(allocator, mesh.vertices.size,
+                               vk::BufferUsageFlagBits::eVertexBuffer |
+                                       vk::BufferUsageFlagBits::eTransferDst,
+                               vk::MemoryPropertyFlagBits::eDeviceLocal);
+    data.indices = BufferData(allocator, mesh.indices.size,
+                              vk::BufferUsageFlagBits::eIndexBuffer |
+                                      vk::BufferUsageFlagBits::eTransferDst,
+                              vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    pack.file.willNeed(mesh.vertices.offset,
+                       mesh.indices.offset + mesh.indices.size -
+                               mesh.vertices.offset);
+    uploadEngine.uploadBuffer(*data.vertices.buffer, 0,
+                              pack.data(mesh.vertices), mesh.vertices.size);
+    pack.file.dontNeed(mesh.vertices.offset, mesh.vertices.size);
+    data.uploadBatch =
+            uploadEngine.uploadBuffer(*data.indices.buffer, 0,
+                                      pack.data(mesh.indices),
+                                      mesh.indices.size);
+    pack.file.dontNeed(mesh.indices.offset, mesh.indices.size);
+    return data;
+}
+
+TextureData loadTexture(const AssetPack &pack, uint32_t index,
+                        vk::UniqueDevice &device, DeviceAllocator &allocator,
+                        UploadEngine &uploadEngine, uint32_t firstMip) {
+    const AssetTexture &texture = pack.textures[index];
+    auto format = static_cast<vk::Format>(texture.format);
+    firstMip = std::min(firstMip, texture.mipCount - 1);
+    uint32_t levelCount = texture.mipCount - firstMip;
+    TextureData data;
+    data.image = ImageData(
+            allocator,
+            vk::ImageCreateInfo(
+                    vk::ImageCreateFlags(), vk::ImageType::e2D, format,
+                    vk::Extent3D(std::max(1u, texture.width >> firstMip),
+                                 std::max(1u, texture.height >> firstMip), 1),
+                    levelCount, 1, vk::SampleCountFlagBits::e1,
+                    vk::ImageTiling::eOptimal,
+                    vk::ImageUsageFlagBits::eSampled |
+                            vk::ImageUsageFlagBits::eTransferDst),
+            vk::MemoryPropertyFlagBits::eDeviceLocal);
+    data.imageView = device->createImageViewUnique(vk::ImageViewCreateInfo(
+            vk::ImageViewCreateFlags(), *data.image.image,
+            vk::ImageViewType::e2D, format, vk::ComponentMapping(),
+            vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0,
+                                      levelCount, 0, 1)));
+
+    // a level at a time, so that no single copy needs the whole chain in
+    // the staging ring
+    for (uint32_t level = 0; level < levelCount; level++) {
+        uint32_t mip = firstMip + level;
+        const AssetSection &section = texture.mips[mip];
+        vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor,
+                                        level, 1, 0, 1);
+        vk::BufferImageCopy region(
+                0, 0, 0,
+                vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor,
+                                           level, 0, 1),
+                vk::Offset3D(0, 0, 0),
+                vk::Extent3D(std::max(1u, texture.width >> mip),
+                             std::max(1u, texture.height >> mip), 1));
+        if (mip + 1 < texture.mipCount) {
+            const AssetSection &next = texture.mips[mip + 1];
+            pack.file.willNeed(next.offset, next.size);
+        }
+        data.uploadBatch = uploadEngine.uploadImage(
+                *data.image.image, format, range, {region},
+                pack.data(section), section.size);
+        pack.file.dontNeed(section.offset, section.size);
+    }
+    return data;
+}
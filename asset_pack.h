@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <vulkan/vulkan.hpp>
+
+#include "allocator.h"
+#include "asset_format.h"
+#include "upload.h"
+
+// a whole file mapped read-only, pages are read in by the kernel as they are
+// touched and never copied to the heap
+struct MappedFile {
+    const uint8_t *data{nullptr};
+    size_t size{0};
+
+    explicit MappedFile(const std::string &path);
+    ~MappedFile() noexcept;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // hints that the range is about to be read, so the kernel reads ahead
+    void willNeed(uint64_t offset, uint64_t length) const;
+    // drops the range's pages, they are read again if touched. keeps the
+    // resident set of a large load at what is being copied
+    void dontNeed(uint64_t offset, uint64_t length) const;
+};
+
+// an asset pack as written by light_pack. opening validates the header and
+// the tables against the file size, after that entries are used in place
+struct AssetPack {
+    MappedFile file;
+    const AssetHeader *header;
+    const AssetMesh *meshes;
+    const AssetTexture *textures;
+
+    explicit AssetPack(const std::string &path);
+
+    const uint8_t *data(const AssetSection &section) const {
+        return file.data + section.offset;
+    }
+};
+
+struct MeshData {
+    BufferData vertices;
+    BufferData indices;
+    uint32_t vertexCount{0};
+    uint32_t indexCount{0};
+    vk::IndexType indexType{vk::IndexType::eUint32};
+    // usable once the upload engine completed this batch
+    uint64_t uploadBatch{0};
+};
+
+struct TextureData {
+    ImageData image;
+    vk::UniqueImageView imageView;
+    uint64_t uploadBatch{0};
+};
+
+// both copy the sections from the mapping straight into the staging ring and
+// let go of their pages afterwards. the texture's image starts at firstMip,
+// the levels above it are left in the pack
+MeshData loadMesh(const AssetPack &pack, uint32_t index,
+                  DeviceAllocator &allocator, UploadEngine &uploadEngine);
+TextureData loadTexture(const AssetPack &pack, uint32_t index,
+                        vk::UniqueDevice &device, DeviceAllocator &allocator,
+                        UploadEngine &uploadEngine, uint32_t firstMip = 0);
@@ -0,0 +1,502 @@
+// times the renderer's hot paths without a window and prints the samples as
+// json with percentiles, so that driver and library upgrades can be gated on
+// measured regressions. meant to run on lavapipe in ci, pick it with
+// VK_ICD_FILENAMES=/usr/share/vulkan/icd.d/lvp_icd.x86_64.json or, with
+// more than one driver installed, LIGHT_DEVICE=llvmpipe
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "allocator.h"
+#include "device.h"
+#include "headless_context.h"
+#include "jobs.h"
+#include "recorder.h"
+#include "render_graph.h"
+#include "scene.h"
+#include "submission.h"
+#include "swapchain.h"
+#include "upload.h"
+
+const uint32_t kDefaultIterations = 20;
+const uint32_t kDefaultFrameCount = 300;
+// frames not sampled, while caches and pools warm up
+const uint32_t kWarmupFrames = 10;
+const uint32_t kObjectCount = 4096;
+const uint32_t kFramesInFlight = 2;
+const uint32_t kImageCount = 3;
+const vk::Extent2D kExtent(1280, 720);
+const vk::Format kColorFormat = vk::Format::eB8G8R8A8Unorm;
+const uint32_t kAllocationCount = 4096;
+// has to fit the upload engine's staging ring
+const vk::DeviceSize kUploadSize = 16ull << 20;
+// device calls per sample of the dispatch benchmark
+const uint32_t kDispatchCalls = 100000;
+
+struct BenchOptions {
+    uint32_t iterations{kDefaultIterations};
+    uint32_t frameCount{kDefaultFrameCount};
+    uint32_t objectCount{kObjectCount};
+    uint32_t threadCount{std::max(1u, std::thread::hardware_concurrency())};
+    // json goes to stdout when empty
+    std::string outputPath;
+};
+
+// one benchmark's samples, in milliseconds
+struct BenchResult {
+    std::string name;
+    std::vector<double> samples;
+    // work per second at the median, when the benchmark has a unit of work
+    double throughput{0.0};
+    std::string throughputUnit;
+};
+
+// nearest rank on the sorted samples
+double percentile(const std::vector<double> &sorted, double p) {
+    return sorted[static_cast<size_t>(p * (sorted.size() - 1) + 0.5)];
+}
+
+double elapsedMilliseconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+                   std::chrono::steady_clock::now() - start)
+            .count();
+}
+
+double measure(const std::function<void()> &work) {
+    auto start = std::chrono::steady_clock::now();
+    work();
+    return elapsedMilliseconds(start);
+}
+
+std::string escape(const std::string &text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') { escaped += '\\'; }
+        escaped += c;
+    }
+    return escaped;
+}
+
+void writeJson(std::ostream &os, vk::PhysicalDevice physicalDevice,
+               const BenchOptions &options,
+               const std::vector<BenchResult> &results) {
+    vk::PhysicalDeviceProperties properties = physicalDevice.getProperties();
+    os << "{\n  \"device\": \"" << escape(properties.deviceName.data())
+       << "\",\n  \"device_type\": \""
+       << vk::to_string(properties.deviceType) << "\",\n  \"api_version\": \""
+       << VK_VERSION_MAJOR(properties.apiVersion) << "."
+       << VK_VERSION_MINOR(properties.apiVersion) << "."
+       << VK_VERSION_PATCH(properties.apiVersion)
+       << "\",\n  \"driver_version\": " << properties.driverVersion
+       << ",\n  \"threads\": " << options.threadCount
+       << ",\n  \"objects\": " << options.objectCount
+       << ",\n  \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult &result = results[i];
+        std::vector<double> sorted = result.samples;
+        std::sort(sorted.begin(), sorted.end());
+        double mean = 0.0;
+        for (double sample : sorted) { mean += sample; }
+        mean /= sorted.size();
+        os << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << result.name
+           << "\", \"unit\": \"ms\", \"samples\": " << sorted.size()
+           << ", \"min\": " << sorted.front() << ", \"mean\": " << mean
+           << ", \"p50\": " << percentile(sorted, 0.5)
+           << ", \"p90\": " << percentile(sorted, 0.9)
+           << ", \"p99\": " << percentile(sorted, 0.99)
+           << ", \"max\": " << sorted.back();
+        if (!result.throughputUnit.empty()) {
+            os << ", \"throughput\": " << result.throughput
+               << ", \"throughput_unit\": \"" << result.throughputUnit << "\"";
+        }
+        os << "}";
+    }
+    os << "\n  ]\n}" << std::endl;
+}
+
+// the instance extensions the swapchain benchmark needs, when the loader has
+// them. a headless surface needs no window system
+std::vector<std::string> getBenchInstanceExtensions() {
+    if (!isInstanceExtensionSupported(VK_KHR_SURFACE_EXTENSION_NAME) ||
+        !isInstanceExtensionSupported(VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME)) {
+        return {};
+    }
+    return {VK_KHR_SURFACE_EXTENSION_NAME,
+            VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME};
+}
+
+// instances and devices created and destroyed from scratch, the cost every
+// launch pays before anything else can start
+std::vector<BenchResult> benchStartup(const BenchOptions &options,
+                                      const std::vector<std::string> &
+                                              instanceExtensions) {
+    BenchResult instanceResult{"instance_creation"};
+    BenchResult selectionResult{"device_selection"};
+    BenchResult deviceResult{"device_creation"};
+    for (uint32_t i = 0; i < options.iterations; i++) {
+        vk::UniqueInstance instance;
+        instanceResult.samples.push_back(measure([&] {
+            instance = createInstance("light_bench", "light", 1, 1,
+                                      VK_API_VERSION_1_2, {},
+                                      instanceExtensions);
+        }));
+        vk::PhysicalDevice physicalDevice;
+        selectionResult.samples.push_back(measure([&] {
+            physicalDevice =
+                    selectPhysicalDevice(*instance, DeviceRequirements())
+                            .physicalDevice;
+        }));
+        QueueFamilyIndices families = findQueueFamilyIndices(physicalDevice);
+        // VK_KHR_swapchain needs VK_KHR_surface on the instance
+        bool swapchain = !instanceExtensions.empty() &&
+                         isDeviceExtensionSupported(
+                                 physicalDevice,
+                                 VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+        vk::UniqueDevice device;
+        deviceResult.samples.push_back(measure([&] {
+            device = createHeadlessDevice(physicalDevice, families, swapchain);
+        }));
+    }
+    return {instanceResult, selectionResult, deviceResult};
+}
+
+// the same cheap device call through the loader's trampoline and through the
+// device's own function table the default dispatcher holds
+std::vector<BenchResult> benchDispatch(const BenchOptions &options,
+                                       vk::UniqueInstance &instance,
+                                       vk::UniqueDevice &device) {
+    vk::DispatchLoaderDynamic loaderDispatch(
+            *instance, VULKAN_HPP_DEFAULT_DISPATCHER.vkGetInstanceProcAddr);
+    vk::UniqueFence fence = device->createFenceUnique(vk::FenceCreateInfo());
+    auto callThrough = [&](const std::string &name, const auto &dispatch) {
+        BenchResult result{name};
+        for (uint32_t i = 0; i < options.iterations; i++) {
+            result.samples.push_back(measure([&] {
+                for (uint32_t j = 0; j < kDispatchCalls; j++) {
+                    (void) device->getFenceStatus(*fence, dispatch);
+                }
+            }));
+        }
+        std::vector<double> sorted = result.samples;
+        std::sort(sorted.begin(), sorted.end());
+        result.throughput = kDispatchCalls * 1000.0 / percentile(sorted, 0.5);
+        result.throughputUnit = "calls/s";
+        return result;
+    };
+    return {callThrough("dispatch_loader", loaderDispatch),
+            callThrough("dispatch_device", VULKAN_HPP_DEFAULT_DISPATCHER)};
+}
+
+// swapchains with their views on a headless surface when there is one, and
+// the offscreen images headless runs of the renderer use instead
+std::vector<BenchResult>
+benchSwapchain(const BenchOptions &options, vk::UniqueInstance &instance,
+               vk::PhysicalDevice physicalDevice, vk::UniqueDevice &device,
+               DeviceAllocator &allocator, uint32_t graphicsFamily,
+               bool swapchain) {
+    std::vector<BenchResult> results;
+    if (swapchain) {
+        vk::UniqueSurfaceKHR surface = instance->createHeadlessSurfaceEXTUnique(
+                vk::HeadlessSurfaceCreateInfoEXT());
+        if (physicalDevice.getSurfaceSupportKHR(graphicsFamily, *surface)) {
+            BenchResult result{"swapchain_creation"};
+            std::optional<SwapchainData> swapchainData;
+            for (uint32_t i = 0; i < options.iterations; i++) {
+                // a surface has one swapchain at a time
+                swapchainData.reset();
+                result.samples.push_back(measure([&] {
+                    swapchainData.emplace(physicalDevice, device, *surface,
+                                          kExtent, graphicsFamily,
+                                          graphicsFamily,
+                                          PresentPolicy::eThroughput,
+                                          std::nullopt);
+                }));
+            }
+            results.push_back(result);
+        }
+    }
+
+    BenchResult result{"offscreen_image_creation"};
+    for (uint32_t i = 0; i < options.iterations; i++) {
+        std::optional<OffscreenData> offscreenData;
+        result.samples.push_back(measure([&] {
+            offscreenData.emplace(physicalDevice, device, allocator,
+                                  kColorFormat, kExtent, kImageCount);
+        }));
+    }
+    results.push_back(result);
+    return results;
+}
+
+// sub-allocations of mixed sizes, freed in random order
+BenchResult benchAllocation(const BenchOptions &options,
+                            DeviceAllocator &allocator) {
+    BenchResult result{"memory_allocation"};
+    std::mt19937 random(1);
+    std::uniform_int_distribution<int> sizeShift(8, 22);
+    std::vector<vk::DeviceSize> sizes(kAllocationCount);
+    for (vk::DeviceSize &size : sizes) {
+        size = vk::DeviceSize(1) << sizeShift(random);
+    }
+    std::vector<Allocation> allocations(kAllocationCount);
+    for (uint32_t i = 0; i < options.iterations; i++) {
+        result.samples.push_back(measure([&] {
+            for (uint32_t j = 0; j < kAllocationCount; j++) {
+                allocations[j] = allocator.allocate(
+                        vk::MemoryRequirements(sizes[j], 256, ~0u),
+                        vk::MemoryPropertyFlagBits::eDeviceLocal,
+                        ResourceKind::eLinear);
+            }
+            std::shuffle(allocations.begin(), allocations.end(), random);
+            for (Allocation &allocation : allocations) {
+                allocator.free(allocation);
+            }
+        }));
+    }
+    std::vector<double> sorted = result.samples;
+    std::sort(sorted.begin(), sorted.end());
+    result.throughput = kAllocationCount * 1000.0 / percentile(sorted, 0.5);
+    result.throughputUnit = "allocations/s";
+    return result;
+}
+
+// a buffer the size of a large mip level through the staging ring, from
+// the host copy until the transfer queue finished
+BenchResult benchUpload(const BenchOptions &options,
+                        DeviceAllocator &allocator,
+                        UploadEngine &uploadEngine) {
+    BenchResult result{"upload"};
+    BufferData buffer(allocator, kUploadSize,
+                      vk::BufferUsageFlagBits::eTransferDst,
+                      vk::MemoryPropertyFlagBits::eDeviceLocal);
+    std::vector<uint8_t> data(kUploadSize, 0x5a);
+    for (uint32_t i = 0; i < options.iterations; i++) {
+        result.samples.push_back(measure([&] {
+            uploadEngine.wait(uploadEngine.uploadBuffer(
+                    *buffer.buffer, 0, data.data(), kUploadSize));
+        }));
+    }
+    std::vector<double> sorted = result.samples;
+    std::sort(sorted.begin(), sorted.end());
+    result.throughput = (kUploadSize >> 20) * 1000.0 / percentile(sorted, 0.5);
+    result.throughputUnit = "MiB/s";
+    return result;
+}
+
+// the synthetic scene of the renderer: recording alone, then whole frames
+// through the frame graph and the scheduler with frames in flight
+std::vector<BenchResult> benchFrames(const BenchOptions &options,
+                                     vk::PhysicalDevice physicalDevice,
+                                     vk::UniqueDevice &device,
+                                     DeviceAllocator &allocator,
+                                     SubmissionScheduler &scheduler) {
+    uint32_t graphicsFamily = scheduler.familyIndex(QueueType::eGraphics);
+    OffscreenData offscreenData(physicalDevice, device, allocator,
+                                kColorFormat, kExtent, kImageCount);
+    vk::UniqueRenderPass renderPass = createRenderPass(device, kColorFormat);
+    std::vector<vk::UniqueFramebuffer> framebuffers = createFramebuffers(
+            device, renderPass, offscreenData.imageViews, kExtent);
+    JobSystem jobSystem(options.threadCount - 1);
+    ParallelRecorder recorder(device, graphicsFamily, kFramesInFlight,
+                              jobSystem.threadCount());
+
+    struct Frame {
+        vk::UniqueCommandPool commandPool;
+        vk::UniqueCommandBuffer commandBuffer;
+        TimelinePoint submitted;
+    };
+    std::vector<Frame> frames(kFramesInFlight);
+    for (Frame &frame : frames) {
+        frame.commandPool = device->createCommandPoolUnique(
+                vk::CommandPoolCreateInfo(
+                        vk::CommandPoolCreateFlagBits::eTransient,
+                        graphicsFamily));
+        frame.commandBuffer = std::move(
+                device->allocateCommandBuffersUnique(
+                              vk::CommandBufferAllocateInfo(
+                                      *frame.commandPool,
+                                      vk::CommandBufferLevel::ePrimary, 1))
+                        .front());
+    }
+
+    uint64_t frameNumber = 0;
+    uint32_t frameIndex = 0;
+    uint32_t imageIndex = 0;
+    // as headless runs of the renderer build it
+    RenderGraph graph(device, allocator);
+    ResourceHandle backbuffer = graph.importImage(
+            "backbuffer", kColorFormat, kExtent,
+            ResourceState{vk::ImageLayout::eUndefined,
+                          vk::PipelineStageFlagBits::eTransfer,
+                          {}},
+            ResourceState{vk::ImageLayout::eTransferSrcOptimal,
+                          vk::PipelineStageFlagBits::eTransfer,
+                          vk::AccessFlagBits::eTransferRead});
+    PassHandle scenePass = graph.addPass(
+            "scene", [&](vk::CommandBuffer commandBuffer) {
+                recordFrame(commandBuffer, *renderPass,
+                            *framebuffers[imageIndex], kExtent, frameNumber,
+                            jobSystem, recorder, frameIndex,
+                            options.objectCount);
+            });
+    graph.write(scenePass, backbuffer, ResourceUsage::eColorAttachment);
+    graph.compile();
+
+    auto recordGraph = [&](Frame &frame) {
+        device->resetCommandPool(*frame.commandPool,
+                                 vk::CommandPoolResetFlags());
+        frame.commandBuffer->begin(vk::CommandBufferBeginInfo(
+                vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+        graph.bindImage(backbuffer, *offscreenData.images[imageIndex].image,
+                        *offscreenData.imageViews[imageIndex]);
+        graph.execute(*frame.commandBuffer);
+        frame.commandBuffer->end();
+    };
+
+    // nothing is submitted, the same frame slot is recorded over and over
+    BenchResult recordResult{"command_recording"};
+    for (uint32_t i = 0; i < options.iterations; i++) {
+        recordResult.samples.push_back(measure([&] {
+            recorder.beginFrame(0);
+            recordGraph(frames[0]);
+        }));
+    }
+    std::vector<double> sorted = recordResult.samples;
+    std::sort(sorted.begin(), sorted.end());
+    recordResult.throughput =
+            options.objectCount * 1000.0 / percentile(sorted, 0.5);
+    recordResult.throughputUnit = "objects/s";
+
+    // from the start of one frame to the start of the next, which includes
+    // waiting for the gpu once the frames in flight are used up
+    BenchResult frameResult{"frame"};
+    auto frameStart = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < kWarmupFrames + options.frameCount; i++) {
+        frameIndex = static_cast<uint32_t>(frameNumber % kFramesInFlight);
+        imageIndex = static_cast<uint32_t>(frameNumber % kImageCount);
+        Frame &frame = frames[frameIndex];
+        scheduler.wait(frame.submitted);
+        recorder.beginFrame(frameIndex);
+        recordGraph(frame);
+
+        SubmissionTask task;
+        task.queue = QueueType::eGraphics;
+        task.commandBuffers = {*frame.commandBuffer};
+        frame.submitted = scheduler.submit(task);
+        scheduler.flush();
+        frameNumber++;
+
+        auto now = std::chrono::steady_clock::now();
+        if (kWarmupFrames < i) {
+            frameResult.samples.push_back(
+                    std::chrono::duration<double, std::milli>(now - frameStart)
+                            .count());
+        }
+        frameStart = now;
+    }
+    scheduler.waitIdle();
+    sorted = frameResult.samples;
+    std::sort(sorted.begin(), sorted.end());
+    frameResult.throughput = 1000.0 / percentile(sorted, 0.5);
+    frameResult.throughputUnit = "frames/s";
+    return {recordResult, frameResult};
+}
+
+BenchOptions parseBenchOptions(int argc, char *argv[]) {
+    BenchOptions options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--iterations" && i + 1 < argc) {
+            options.iterations = static_cast<uint32_t>(
+                    std::max(1ul, std::stoul(argv[++i])));
+        } else if (arg == "--frames" && i + 1 < argc) {
+            options.frameCount = static_cast<uint32_t>(
+                    std::max(2ul, std::stoul(argv[++i])));
+        } else if (arg == "--objects" && i + 1 < argc) {
+            options.objectCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else if (arg == "--threads" && i + 1 < argc) {
+            options.threadCount = static_cast<uint32_t>(
+                    std::max(1ul, std::stoul(argv[++i])));
+        } else if (arg == "--output" && i + 1 < argc) {
+            options.outputPath = argv[++i];
+        } else {
+            throw std::runtime_error("unknown option: " + arg);
+        }
+    }
+    return options;
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        BenchOptions options = parseBenchOptions(argc, argv);
+        std::vector<std::string> instanceExtensions =
+                getBenchInstanceExtensions();
+
+        std::vector<BenchResult> results;
+        std::cerr << "startup" << std::endl;
+        for (BenchResult &result : benchStartup(options, instanceExtensions)) {
+            results.push_back(std::move(result));
+        }
+
+        // the instance and device the remaining benchmarks run on
+        HeadlessContext context("light_bench", instanceExtensions);
+        context.deviceSelection.report(std::cerr);
+        vk::PhysicalDevice physicalDevice = context.physicalDevice;
+        vk::UniqueDevice &device = context.device;
+
+        std::cerr << "dispatch" << std::endl;
+        for (BenchResult &result :
+             benchDispatch(options, context.instance, device)) {
+            results.push_back(std::move(result));
+        }
+        std::cerr << "swapchain" << std::endl;
+        for (BenchResult &result :
+             benchSwapchain(options, context.instance, physicalDevice, device,
+                            context.allocator, context.families.graphics,
+                            context.swapchain)) {
+            results.push_back(std::move(result));
+        }
+        std::cerr << "allocation" << std::endl;
+        results.push_back(benchAllocation(options, context.allocator));
+        std::cerr << "upload" << std::endl;
+        results.push_back(
+                benchUpload(options, context.allocator, context.uploadEngine));
+        std::cerr << "frames" << std::endl;
+        for (BenchResult &result :
+             benchFrames(options, physicalDevice, device, context.allocator,
+                         context.scheduler)) {
+            results.push_back(std::move(result));
+        }
+        device->waitIdle();
+
+        if (options.outputPath.empty()) {
+            writeJson(std::cout, physicalDevice, options, results);
+        } else {
+            std::ofstream file(options.outputPath);
+            writeJson(file, physicalDevice, options, results);
+            if (!file) {
+                throw std::runtime_error("could not write " +
+                                         options.outputPath);
+            }
+        }
+    } catch (vk::SystemError &err) {
+        std::cerr << "vk::SystemError: " << err.what() << std::endl;
+        return EXIT_FAILURE;
+    } catch (std::exception &ex) {
+        std::cerr << "std::exception: " << ex.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,228 @@
+#include "bindless.h"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+bool enableBindlessFeatures(vk::PhysicalDevice physicalDevice,
+                            vk::PhysicalDeviceVulkan12Features &features) {
+    if (physicalDevice.getProperties().apiVersion < VK_API_VERSION_1_2) {
+        return false;
+    }
+    auto chain = physicalDevice.getFeatures2<
+            vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features>();
+    const auto &supported = chain.get<vk::PhysicalDeviceVulkan12Features>();
+    if (!supported.runtimeDescriptorArray ||
+        !supported.descriptorBindingPartiallyBound ||
+        !supported.descriptorBindingUpdateUnusedWhilePending ||
+        !supported.descriptorBindingSampledImageUpdateAfterBind ||
+        !supported.descriptorBindingStorageBufferUpdateAfterBind ||
+        !supported.shaderSampledImageArrayNonUniformIndexing ||
+        !supported.shaderStorageBufferArrayNonUniformIndexing) {
+        return false;
+    }
+    features.setRuntimeDescriptorArray(true)
+            .setDescriptorBindingPartiallyBound(true)
+            .setDescriptorBindingUpdateUnusedWhilePending(true)
+            .setDescriptorBindingSampledImageUpdateAfterBind(true)
+            .setDescriptorBindingStorageBufferUpdateAfterBind(true)
+            .setShaderSampledImageArrayNonUniformIndexing(true)
+            .setShaderStorageBufferArrayNonUniformIndexing(true);
+    return true;
+}
+
+BindlessIndexAllocator::BindlessIndexAllocator(uint32_t capacity)
+    : capacity(capacity) {}
+
+uint32_t BindlessIndexAllocator::allocate() {
+    if (!freeIndices.empty()) {
+        uint32_t index = freeIndices.back();
+        freeIndices.pop_back();
+        return index;
+    }
+    if (next == capacity) {
+        throw std::runtime_error("bindless descriptor array is full");
+    }
+    return next++;
+}
+
+void BindlessIndexAllocator::release(uint32_t index, uint64_t frameNumber) {
+    pending.emplace_back(frameNumber, index);
+}
+
+void BindlessIndexAllocator::collect(uint64_t completedFrame) {
+    while (!pending.empty() && pending.front().first <= completedFrame) {
+        freeIndices.push_back(pending.front().second);
+        pending.pop_front();
+    }
+}
+
+BindlessTable::BindlessTable(vk::PhysicalDevice physicalDevice,
+                             vk::UniqueDevice &device, uint32_t framesInFlight)
+    : device(*device), framesInFlight(framesInFlight), sampledImages(0),
+      storageBuffers(0), samplers(0) {
+    auto chain = physicalDevice.getProperties2<
+            vk::PhysicalDeviceProperties2,
+            vk::PhysicalDeviceDescriptorIndexingProperties>();
+    const auto &limits =
+            chain.get<vk::PhysicalDeviceDescriptorIndexingProperties>();
+    uint32_t sampledImageCount = std::min(
+            {kMaxBindlessSampledImages,
+             limits.maxPerStageDescriptorUpdateAfterBindSampledImages,
+             limits.maxDescriptorSetUpdateAfterBindSampledImages});
+    uint32_t storageBufferCount = std::min(
+            {kMaxBindlessStorageBuffers,
+             limits.maxPerStageDescriptorUpdateAfterBindStorageBuffers,
+             limits.maxDescriptorSetUpdateAfterBindStorageBuffers});
+    uint32_t samplerCount =
+            std::min({kMaxBindlessSamplers,
+                      limits.maxPerStageDescriptorUpdateAfterBindSamplers,
+                      limits.maxDescriptorSetUpdateAfterBindSamplers});
+    // all three arrays count against one per stage limit as well
+    uint32_t resourceLimit = limits.maxPerStageUpdateAfterBindResources;
+    if (resourceLimit < sampledImageCount + storageBufferCount + samplerCount) {
+        samplerCount = std::min(samplerCount, resourceLimit / 4);
+        sampledImageCount = std::min(sampledImageCount,
+                                     (resourceLimit - samplerCount) / 2);
+        storageBufferCount = std::min(
+                storageBufferCount,
+                resourceLimit - samplerCount - sampledImageCount);
+    }
+    sampledImages = BindlessIndexAllocator(sampledImageCount);
+    storageBuffers = BindlessIndexAllocator(storageBufferCount);
+    samplers = BindlessIndexAllocator(samplerCount);
+
+    vk::ShaderStageFlags stages = vk::ShaderStageFlagBits::eAllGraphics |
+                                  vk::ShaderStageFlagBits::eCompute;
+    std::array<vk::DescriptorSetLayoutBinding, 3> bindings = {
+            vk::DescriptorSetLayoutBinding(kBindlessSampledImageBinding,
+                                           vk::DescriptorType::eSampledImage,
+                                           sampledImageCount, stages),
+            vk::DescriptorSetLayoutBinding(kBindlessStorageBufferBinding,
+                                           vk::DescriptorType::eStorageBuffer,
+                                           storageBufferCount, stages),
+            vk::DescriptorSetLayoutBinding(kBindlessSamplerBinding,
+                                           vk::DescriptorType::eSampler,
+                                           samplerCount, stages)};
+    // slots are written while the set is bound, and most of them are empty
+    vk::DescriptorBindingFlags bindingFlag =
+            vk::DescriptorBindingFlagBits::ePartiallyBound |
+            vk::DescriptorBindingFlagBits::eUpdateAfterBind |
+            vk::DescriptorBindingFlagBits::eUpdateUnusedWhilePending;
+    std::array<vk::DescriptorBindingFlags, 3> bindingFlags = {
+            bindingFlag, bindingFlag, bindingFlag};
+    vk::StructureChain<vk::DescriptorSetLayoutCreateInfo,
+                       vk::DescriptorSetLayoutBindingFlagsCreateInfo>
+            layoutChain(
+                    vk::DescriptorSetLayoutCreateInfo(
+                            vk::DescriptorSetLayoutCreateFlagBits::
+                                    eUpdateAfterBindPool,
+                            bindings),
+                    vk::DescriptorSetLayoutBindingFlagsCreateInfo(
+                            bindingFlags));
+    descriptorSetLayout = device->createDescriptorSetLayoutUnique(
+            layoutChain.get<vk::DescriptorSetLayoutCreateInfo>());
+
+    std::array<vk::DescriptorPoolSize, 3> poolSizes = {
+            vk::DescriptorPoolSize(vk::DescriptorType::eSampledImage,
+                                   sampledImageCount),
+            vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer,
+                                   storageBufferCount),
+            vk::DescriptorPoolSize(vk::DescriptorType::eSampler,
+                                   samplerCount)};
+    descriptorPool = device->createDescriptorPoolUnique(
+            vk::DescriptorPoolCreateInfo(
+                    vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind, 1,
+                    poolSizes));
+    descriptorSet = device->allocateDescriptorSets(
+                                  vk::DescriptorSetAllocateInfo(
+                                          *descriptorPool,
+                                          *descriptorSetLayout))
+                            .front();
+
+    vk::PushConstantRange pushConstantRange(stages, 0,
+                                            kBindlessPushConstantSize);
+    pipelineLayout = device->createPipelineLayoutUnique(
+            vk::PipelineLayoutCreateInfo(vk::PipelineLayoutCreateFlags(),
+                                         *descriptorSetLayout,
+                                         pushConstantRange));
+}
+
+uint32_t BindlessTable::addSampledImage(vk::ImageView imageView,
+                                        vk::ImageLayout imageLayout) {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint32_t index = sampledImages.allocate();
+    vk::DescriptorImageInfo imageInfo(nullptr, imageView, imageLayout);
+    device.updateDescriptorSets(
+            vk::WriteDescriptorSet(descriptorSet, kBindlessSampledImageBinding,
+                                   index, vk::DescriptorType::eSampledImage,
+                                   imageInfo),
+            {});
+    return index;
+}
+
+uint32_t BindlessTable::addStorageBuffer(vk::Buffer buffer,
+                                         vk::DeviceSize offset,
+                                         vk::DeviceSize range) {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint32_t index = storageBuffers.allocate();
+    vk::DescriptorBufferInfo bufferInfo(buffer, offset, range);
+    device.updateDescriptorSets(
+            vk::WriteDescriptorSet(descriptorSet, kBindlessStorageBufferBinding,
+                                   index, vk::DescriptorType::eStorageBuffer,
+                                   {}, bufferInfo),
+            {});
+    return index;
+}
+
+uint32_t BindlessTable::addSampler(vk::Sampler sampler) {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint32_t index = samplers.allocate();
+    vk::DescriptorImageInfo imageInfo(sampler);
+    device.updateDescriptorSets(
+            vk::WriteDescriptorSet(descriptorSet, kBindlessSamplerBinding,
+                                   index, vk::DescriptorType::eSampler,
+                                   imageInfo),
+            {});
+    return index;
+}
+
+void BindlessTable::releaseSampledImage(uint32_t index) {
+    std::lock_guard<std::mutex> lock(mutex);
+    sampledImages.release(index, frameNumber);
+}
+
+void BindlessTable::releaseStorageBuffer(uint32_t index) {
+    std::lock_guard<std::mutex> lock(mutex);
+    storageBuffers.release(index, frameNumber);
+}
+
+void BindlessTable::releaseSampler(uint32_t index) {
+    std::lock_guard<std::mutex> lock(mutex);
+    samplers.release(index, frameNumber);
+}
+
+void BindlessTable::beginFrame(uint64_t frameNumber) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->frameNumber = frameNumber;
+    if (frameNumber < framesInFlight) { return; }
+    uint64_t completedFrame = frameNumber - framesInFlight;
+    sampledImages.collect(completedFrame);
+    storageBuffers.collect(completedFrame);
+    samplers.collect(completedFrame);
+}
+
+void BindlessTable::bind(vk::CommandBuffer commandBuffer,
+                         vk::PipelineBindPoint bindPoint) const {
+    commandBuffer.bindDescriptorSets(bindPoint, *pipelineLayout, 0,
+                                     descriptorSet, {});
+}
+
+void BindlessTable::report(std::ostream &os) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    os << "bindless: " << sampledImages.used() << "/"
+       << sampledImages.capacity << " sampled images, "
+       << storageBuffers.used() << "/" << storageBuffers.capacity
+       << " storage buffers, " << samplers.used() << "/" << samplers.capacity
+       << " samplers" << std::endl;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+// upper bounds of the descriptor arrays, lowered to the device limits
+const uint32_t kMaxBindlessSampledImages = 16384;
+const uint32_t kMaxBindlessStorageBuffers = 16384;
+const uint32_t kMaxBindlessSamplers = 256;
+// the push constant range every pipeline using the table gets, the minimum
+// the spec guarantees, enough for the indices a draw needs
+const uint32_t kBindlessPushConstantSize = 128;
+
+// binding numbers in the bindless set, the shaders declare the same
+const uint32_t kBindlessSampledImageBinding = 0;
+const uint32_t kBindlessStorageBufferBinding = 1;
+const uint32_t kBindlessSamplerBinding = 2;
+
+// turns on the descriptor indexing features the bindless table relies on,
+// false if the device lacks any of them. features goes into the pNext chain
+// of the device create info
+bool enableBindlessFeatures(vk::PhysicalDevice physicalDevice,
+                            vk::PhysicalDeviceVulkan12Features &features);
+
+// hands out slots of one descriptor array. released slots may still be read
+// by frames in flight, so they only return to the free list once the frame
+// that released them is known to be complete
+struct BindlessIndexAllocator {
+    explicit BindlessIndexAllocator(uint32_t capacity);
+
+    // throws when the array is full
+    uint32_t allocate();
+    void release(uint32_t index, uint64_t frameNumber);
+    // recycles everything released up to and including completedFrame
+    void collect(uint64_t completedFrame);
+    uint32_t used() const {
+        return next - static_cast<uint32_t>(freeIndices.size());
+    }
+
+    uint32_t capacity;
+
+private:
+    // never handed out so far
+    uint32_t next{0};
+    std::vector<uint32_t> freeIndices;
+    // frame number and index, oldest first
+    std::deque<std::pair<uint64_t, uint32_t>> pending;
+};
+
+// one descriptor set with large update-after-bind arrays of sampled images,
+// storage buffers and samplers, bound once per command buffer. draws select
+// their resources by index through push constants instead of binding sets
+struct BindlessTable {
+    vk::Device device;
+    uint32_t framesInFlight;
+    vk::UniqueDescriptorSetLayout descriptorSetLayout;
+    vk::UniqueDescriptorPool descriptorPool;
+    // owned by the pool
+    vk::DescriptorSet descriptorSet;
+    vk::UniquePipelineLayout pipelineLayout;
+    BindlessIndexAllocator sampledImages;
+    BindlessIndexAllocator storageBuffers;
+    BindlessIndexAllocator samplers;
+
+    BindlessTable(vk::PhysicalDevice physicalDevice, vk::UniqueDevice &device,
+                  uint32_t framesInFlight);
+    BindlessTable(const BindlessTable &) = delete;
+    BindlessTable &operator=(const BindlessTable &) = delete;
+
+    // return the slot the shaders index the array with. any thread may add
+    // and release, slots unused by pending frames are written in place
+    uint32_t addSampledImage(vk::ImageView imageView,
+                             vk::ImageLayout imageLayout =
+                                     vk::ImageLayout::eShaderReadOnlyOptimal);
+    uint32_t addStorageBuffer(vk::Buffer buffer, vk::DeviceSize offset = 0,
+                              vk::DeviceSize range = VK_WHOLE_SIZE);
+    uint32_t addSampler(vk::Sampler sampler);
+    void releaseSampledImage(uint32_t index);
+    void releaseStorageBuffer(uint32_t index);
+    void releaseSampler(uint32_t index);
+
+    // call once the frame's submission was waited for, frames up to
+    // frameNumber - framesInFlight are complete then
+    void beginFrame(uint64_t frameNumber);
+    void bind(vk::CommandBuffer commandBuffer,
+              vk::PipelineBindPoint bindPoint) const;
+
+    void report(std::ostream &os) const;
+
+private:
+    mutable std::mutex mutex;
+    // the frame being recorded, releases are keyed by it
+    uint64_t frameNumber{0};
+};
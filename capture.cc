@@ -0,0 +1,378 @@
+#include "capture.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+
+namespace {
+
+// largest payload of a stored deflate block
+const size_t kStoredBlockSize = 65535;
+
+CaptureFormat captureFormat(const std::string &path) {
+    auto dot = path.find_last_of('.');
+    std::string extension = dot == std::string::npos ? "" : path.substr(dot);
+    if (extension == ".png") { return CaptureFormat::ePng; }
+    if (extension == ".ppm") { return CaptureFormat::ePpm; }
+    if (extension == ".raw") { return CaptureFormat::eRaw; }
+    throw std::runtime_error("capture path must end in .png, .ppm or .raw: " +
+                             path);
+}
+
+// whether the red and blue channels are swapped, throws for formats that are
+// not four 8 bit channels
+bool isBgra(vk::Format format) {
+    switch (format) {
+        case vk::Format::eB8G8R8A8Unorm:
+        case vk::Format::eB8G8R8A8Srgb:
+            return true;
+        case vk::Format::eR8G8B8A8Unorm:
+        case vk::Format::eR8G8B8A8Srgb:
+            return false;
+        default:
+            throw std::runtime_error("capture of " + vk::to_string(format) +
+                                     " images is not supported");
+    }
+}
+
+// path with the frame number inserted before the extension
+std::string sequencePath(const std::string &path, uint64_t frameNumber) {
+    char number[32];
+    snprintf(number, sizeof(number), "_%06llu",
+             static_cast<unsigned long long>(frameNumber));
+    auto dot = path.find_last_of('.');
+    return path.substr(0, dot) + number + path.substr(dot);
+}
+
+const std::array<uint32_t, 256> &crcTable() {
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) {
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            t[n] = c;
+        }
+        return t;
+    }();
+    return table;
+}
+
+uint32_t crc32(const uint8_t *data, size_t size, uint32_t crc = 0) {
+    const auto &table = crcTable();
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+void appendBigEndian(std::vector<uint8_t> &out, uint32_t value) {
+    out.push_back(static_cast<uint8_t>(value >> 24));
+    out.push_back(static_cast<uint8_t>(value >> 16));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+void appendChunk(std::vector<uint8_t> &out, const char *type,
+                 const std::vector<uint8_t> &data) {
+    appendBigEndian(out, static_cast<uint32_t>(data.size()));
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    appendBigEndian(out, crc32(out.data() + start, out.size() - start));
+}
+
+// rgb rows, each behind a filter byte of 0, in stored deflate blocks. frames
+// are written faster than any compression would, a capture is meant to be
+// encoded again later anyway
+std::vector<uint8_t> encodePng(const uint8_t *pixels, vk::Extent2D extent,
+                               bool bgra) {
+    size_t rowSize = 1 + size_t(extent.width) * 3;
+    std::vector<uint8_t> filtered(rowSize * extent.height);
+    for (uint32_t y = 0; y < extent.height; y++) {
+        uint8_t *row = filtered.data() + y * rowSize;
+        const uint8_t *source = pixels + size_t(y) * extent.width * 4;
+        row[0] = 0;
+        for (uint32_t x = 0; x < extent.width; x++) {
+            row[1 + x * 3] = source[x * 4 + (bgra ? 2 : 0)];
+            row[2 + x * 3] = source[x * 4 + 1];
+            row[3 + x * 3] = source[x * 4 + (bgra ? 0 : 2)];
+        }
+    }
+
+    std::vector<uint8_t> zlib = {0x78, 0x01};
+    zlib.reserve(filtered.size() +
+                 (filtered.size() / kStoredBlockSize + 1) * 5 + 6);
+    size_t offset = 0;
+    do {
+        size_t size = std::min(kStoredBlockSize, filtered.size() - offset);
+        bool last = offset + size == filtered.size();
+        zlib.push_back(last ? 1 : 0);
+        zlib.push_back(static_cast<uint8_t>(size));
+        zlib.push_back(static_cast<uint8_t>(size >> 8));
+        zlib.push_back(static_cast<uint8_t>(~size));
+        zlib.push_back(static_cast<uint8_t>(~size >> 8));
+        zlib.insert(zlib.end(), filtered.begin() + offset,
+                    filtered.begin() + offset + size);
+        offset += size;
+    } while (offset < filtered.size());
+    // adler32, summed in runs short enough not to overflow
+    uint32_t a = 1, b = 0;
+    for (size_t i = 0; i < filtered.size();) {
+        size_t end = std::min(filtered.size(), i + 5552);
+        for (; i < end; i++) {
+            a += filtered[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    appendBigEndian(zlib, (b << 16) | a);
+
+    std::vector<uint8_t> header;
+    appendBigEndian(header, extent.width);
+    appendBigEndian(header, extent.height);
+    // 8 bit rgb, deflate, adaptive filtering, not interlaced
+    header.insert(header.end(), {8, 2, 0, 0, 0});
+
+    std::vector<uint8_t> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    png.reserve(zlib.size() + 64);
+    appendChunk(png, "IHDR", header);
+    appendChunk(png, "IDAT", zlib);
+    appendChunk(png, "IEND", {});
+    return png;
+}
+
+std::vector<uint8_t> encodePpm(const uint8_t *pixels, vk::Extent2D extent,
+                               bool bgra) {
+    std::string header = "P6\n" + std::to_string(extent.width) + " " +
+                         std::to_string(extent.height) + "\n255\n";
+    size_t pixelCount = size_t(extent.width) * extent.height;
+    std::vector<uint8_t> ppm(header.begin(), header.end());
+    ppm.resize(header.size() + pixelCount * 3);
+    uint8_t *out = ppm.data() + header.size();
+    for (size_t i = 0; i < pixelCount; i++) {
+        out[i * 3] = pixels[i * 4 + (bgra ? 2 : 0)];
+        out[i * 3 + 1] = pixels[i * 4 + 1];
+        out[i * 3 + 2] = pixels[i * 4 + (bgra ? 0 : 2)];
+    }
+    return ppm;
+}
+
+}// namespace
+
+FrameCapture::FrameCapture(DeviceAllocator &allocator, const std::string &path,
+                           uint32_t framesInFlight, uint32_t interval)
+    : allocator(&allocator), path(path), format(captureFormat(path)),
+      interval(std::max(1u, interval)),
+      slots(framesInFlight + kCaptureEncoderDepth),
+      frameSlots(framesInFlight, ~0u) {
+    if (format == CaptureFormat::eRaw) {
+        rawStream.open(path, std::ios::binary | std::ios::trunc);
+        if (!rawStream) {
+            throw std::runtime_error("could not open " + path);
+        }
+    }
+    encoder = std::thread([this] { encoderLoop(); });
+}
+
+FrameCapture::~FrameCapture() noexcept {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+    encoder.join();
+}
+
+void FrameCapture::addPass(RenderGraph &graph, ResourceHandle backbuffer) {
+    PassHandle pass = graph.addPass(
+            "capture",
+            [this, &graph, backbuffer](vk::CommandBuffer commandBuffer) {
+                if (currentSlot == ~0u) { return; }
+                vk::BufferImageCopy region(
+                        0, 0, 0,
+                        vk::ImageSubresourceLayers(
+                                vk::ImageAspectFlagBits::eColor, 0, 0, 1),
+                        vk::Offset3D(0, 0, 0),
+                        vk::Extent3D(currentExtent.width, currentExtent.height,
+                                     1));
+                commandBuffer.copyImageToBuffer(
+                        graph.image(backbuffer),
+                        vk::ImageLayout::eTransferSrcOptimal,
+                        *slots[currentSlot].buffer.buffer, region);
+                // read by the encoder once the frame's submission completed
+                commandBuffer.pipelineBarrier(
+                        vk::PipelineStageFlagBits::eTransfer,
+                        vk::PipelineStageFlagBits::eHost,
+                        vk::DependencyFlags(),
+                        vk::MemoryBarrier(vk::AccessFlagBits::eTransferWrite,
+                                          vk::AccessFlagBits::eHostRead),
+                        nullptr, nullptr);
+            },
+            true);
+    graph.read(pass, backbuffer, ResourceUsage::eTransferSrc);
+}
+
+void FrameCapture::beginFrame(uint32_t frameIndex, uint64_t frameNumber,
+                              vk::Format imageFormat,
+                              const vk::Extent2D &extent) {
+    auto start = std::chrono::steady_clock::now();
+    frameCount++;
+    // the copy the slot's previous frame recorded has completed
+    if (frameSlots[frameIndex] != ~0u) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            slots[frameSlots[frameIndex]].state = SlotState::eEncoding;
+            queue.push_back(frameSlots[frameIndex]);
+        }
+        condition.notify_one();
+        frameSlots[frameIndex] = ~0u;
+    }
+
+    currentSlot = ~0u;
+    currentExtent = extent;
+    if (frameNumber % interval == 0) {
+        isBgra(imageFormat);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (uint32_t i = 0; i < slots.size(); i++) {
+                if (slots[i].state == SlotState::eFree) {
+                    slots[i].state = SlotState::eCopying;
+                    currentSlot = i;
+                    break;
+                }
+            }
+        }
+        if (currentSlot == ~0u) {
+            droppedFrames++;
+        } else {
+            Slot &slot = slots[currentSlot];
+            vk::DeviceSize size =
+                    vk::DeviceSize(extent.width) * extent.height * 4;
+            if (slot.capacity < size) {
+                // cached memory makes the encoder's reads fast, coherent
+                // spares invalidating
+                vk::MemoryPropertyFlags properties =
+                        vk::MemoryPropertyFlagBits::eHostVisible |
+                        vk::MemoryPropertyFlagBits::eHostCoherent;
+                vk::BufferUsageFlags usage =
+                        vk::BufferUsageFlagBits::eTransferDst;
+                slot.buffer = BufferData();
+                try {
+                    slot.buffer = BufferData(
+                            *allocator, size, usage,
+                            properties |
+                                    vk::MemoryPropertyFlagBits::eHostCached);
+                } catch (const std::runtime_error &) {
+                    slot.buffer =
+                            BufferData(*allocator, size, usage, properties);
+                }
+                slot.capacity = size;
+            }
+            slot.format = imageFormat;
+            slot.extent = extent;
+            slot.frameNumber = frameNumber;
+            frameSlots[frameIndex] = currentSlot;
+            capturedFrames++;
+        }
+    }
+    renderThreadMilliseconds += std::chrono::duration<double, std::milli>(
+                                        std::chrono::steady_clock::now() -
+                                        start)
+                                        .count();
+}
+
+void FrameCapture::finish() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (uint32_t &slot : frameSlots) {
+        if (slot == ~0u) { continue; }
+        slots[slot].state = SlotState::eEncoding;
+        queue.push_back(slot);
+        slot = ~0u;
+    }
+    condition.notify_all();
+    condition.wait(lock, [this] {
+        for (const Slot &slot : slots) {
+            if (slot.state == SlotState::eEncoding) { return false; }
+        }
+        return true;
+    });
+    if (rawStream.is_open()) { rawStream.flush(); }
+}
+
+void FrameCapture::encoderLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        condition.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (queue.empty()) { return; }
+        uint32_t slot = queue.front();
+        queue.pop_front();
+        lock.unlock();
+        encode(slot);
+        lock.lock();
+        slots[slot].state = SlotState::eFree;
+        // finish() waits for the queue to drain
+        condition.notify_all();
+    }
+}
+
+void FrameCapture::encode(uint32_t index) {
+    auto start = std::chrono::steady_clock::now();
+    const Slot &slot = slots[index];
+    const auto *pixels =
+            static_cast<const uint8_t *>(slot.buffer.allocation.mapped);
+    bool bgra = isBgra(slot.format);
+    size_t written = 0;
+    if (format == CaptureFormat::eRaw) {
+        // rgba on disk whatever the swapchain's order
+        size_t size = size_t(slot.extent.width) * slot.extent.height * 4;
+        if (bgra) {
+            std::vector<uint8_t> rgba(pixels, pixels + size);
+            for (size_t i = 0; i < size; i += 4) {
+                std::swap(rgba[i], rgba[i + 2]);
+            }
+            rawStream.write(reinterpret_cast<const char *>(rgba.data()),
+                            static_cast<std::streamsize>(size));
+        } else {
+            rawStream.write(reinterpret_cast<const char *>(pixels),
+                            static_cast<std::streamsize>(size));
+        }
+        written = size;
+    } else {
+        std::vector<uint8_t> file =
+                format == CaptureFormat::ePng
+                        ? encodePng(pixels, slot.extent, bgra)
+                        : encodePpm(pixels, slot.extent, bgra);
+        std::ofstream out(sequencePath(path, slot.frameNumber),
+                          std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char *>(file.data()),
+                  static_cast<std::streamsize>(file.size()));
+        if (out) { written = file.size(); }
+    }
+
+    double milliseconds = std::chrono::duration<double, std::milli>(
+                                  std::chrono::steady_clock::now() - start)
+                                  .count();
+    std::lock_guard<std::mutex> lock(mutex);
+    encodedFrames++;
+    writtenBytes += written;
+    encodeMilliseconds += milliseconds;
+}
+
+void FrameCapture::report(std::ostream &os) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    os << "capture: " << capturedFrames << " frames captured, "
+       << droppedFrames << " dropped, " << encodedFrames << " encoded, "
+       << (writtenBytes >> 20) << " MiB written to " << path << std::endl;
+    if (frameCount != 0) {
+        os << "  render thread " << renderThreadMilliseconds / frameCount
+           << " ms, encoder "
+           << (encodedFrames ? encodeMilliseconds / encodedFrames : 0.0)
+           << " ms per frame" << std::endl;
+    }
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "allocator.h"
+#include "render_graph.h"
+
+// readback buffers beyond one per frame in flight, frames the encoder may
+// fall behind before captures are dropped
+const uint32_t kCaptureEncoderDepth = 3;
+
+enum class CaptureFormat { ePng, ePpm, eRaw };
+
+// copies the backbuffer of captured frames into host visible buffers and
+// writes them from a background thread. the copy is a pass of the frame
+// graph, its buffer is handed to the encoder once the frame is known to be
+// complete, framesInFlight frames later, so the render thread neither waits
+// nor touches the pixels. when the encoder falls behind, frames are dropped
+// instead of stalling rendering.
+//
+// png and ppm write one file per frame, the frame number appended to the
+// path's stem. raw appends tightly packed rgba8 frames to the path, as
+// ffmpeg reads with -f rawvideo -pix_fmt rgba
+struct FrameCapture {
+    enum class SlotState { eFree, eCopying, eEncoding };
+
+    struct Slot {
+        BufferData buffer;
+        vk::DeviceSize capacity{0};
+        SlotState state{SlotState::eFree};
+        vk::Format format{vk::Format::eUndefined};
+        vk::Extent2D extent;
+        uint64_t frameNumber{0};
+    };
+
+    DeviceAllocator *allocator;
+    std::string path;
+    CaptureFormat format;
+    // every interval-th frame is captured
+    uint32_t interval;
+    std::vector<Slot> slots;
+    // slot each frame in flight copies into, ~0u for none
+    std::vector<uint32_t> frameSlots;
+    // of the frame being recorded
+    uint32_t currentSlot{~0u};
+    vk::Extent2D currentExtent;
+
+    // statistics
+    uint64_t frameCount{0};
+    uint64_t capturedFrames{0};
+    uint64_t droppedFrames{0};
+    double renderThreadMilliseconds{0.0};
+    // written by the encoder, under mutex
+    uint64_t encodedFrames{0};
+    uint64_t writtenBytes{0};
+    double encodeMilliseconds{0.0};
+
+    FrameCapture(DeviceAllocator &allocator, const std::string &path,
+                 uint32_t framesInFlight, uint32_t interval = 1);
+    ~FrameCapture() noexcept;
+    FrameCapture(const FrameCapture &) = delete;
+    FrameCapture &operator=(const FrameCapture &) = delete;
+
+    // reads the backbuffer as a transfer source after the passes writing it
+    void addPass(RenderGraph &graph, ResourceHandle backbuffer);
+    // after the frame's submission was waited for, before the graph is
+    // executed: hands the frame's previous capture to the encoder and picks
+    // a buffer for this one
+    void beginFrame(uint32_t frameIndex, uint64_t frameNumber,
+                    vk::Format imageFormat, const vk::Extent2D &extent);
+    // once the device is idle: encodes what is still in flight and waits for
+    // the encoder to write everything
+    void finish();
+
+    void report(std::ostream &os) const;
+
+private:
+    void encode(uint32_t slot);
+    void encoderLoop();
+
+    mutable std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<uint32_t> queue;
+    bool stopping{false};
+    // the raw stream stays open across frames
+    std::ofstream rawStream;
+    std::thread encoder;
+};
@@ -0,0 +1,267 @@
+#include "debug_sink.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+// how often the drain thread looks for messages, the callbacks never wake it
+const std::chrono::milliseconds kDebugDrainInterval(20);
+
+namespace {
+
+template<size_t N>
+void copyString(char (&destination)[N], const char *source) {
+    if (!source) {
+        destination[0] = '\0';
+        return;
+    }
+    strncpy(destination, source, N - 1);
+    destination[N - 1] = '\0';
+}
+
+VKAPI_ATTR VkBool32 VKAPI_CALL debugMessageSinkCallback(
+        VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
+        VkDebugUtilsMessageTypeFlagsEXT messageTypes,
+        VkDebugUtilsMessengerCallbackDataEXT const *callbackData,
+        void *userData) {
+    static_cast<DebugMessageSink *>(userData)->push(messageSeverity,
+                                                    messageTypes, callbackData);
+    return VK_TRUE;
+}
+
+std::string format(const DebugMessage &message) {
+    std::ostringstream os;
+    os << vk::to_string(message.severity) << ": "
+       << vk::to_string(message.types) << ":\n";
+    os << "\t"
+       << "messageIDName   = <" << message.messageIdName << ">\n";
+    os << "\t"
+       << "messageIdNumber = " << message.messageIdNumber << "\n";
+    os << "\t"
+       << "message         = <" << message.message << ">\n";
+    if (0 < message.queueLabelCount) {
+        os << "\t"
+           << "Queue Labels:\n";
+        for (uint32_t i = 0; i < message.queueLabelCount; i++) {
+            os << "\t\t"
+               << "labelName = <" << message.queueLabels[i] << ">\n";
+        }
+    }
+    if (0 < message.commandBufferLabelCount) {
+        os << "\t"
+           << "CommandBuffer Labels:\n";
+        for (uint32_t i = 0; i < message.commandBufferLabelCount; i++) {
+            os << "\t\t"
+               << "labelName = <" << message.commandBufferLabels[i] << ">\n";
+        }
+    }
+    if (0 < message.objectCount) {
+        os << "\t"
+           << "Objects:\n";
+        for (uint32_t i = 0; i < message.objectCount; i++) {
+            const DebugMessage::Object &object = message.objects[i];
+            os << "\t\t"
+               << "Object " << i << "\n";
+            os << "\t\t\t"
+               << "objectType   = " << vk::to_string(object.type) << "\n";
+            os << "\t\t\t"
+               << "objectHandle = " << object.handle << "\n";
+            if (object.name[0]) {
+                os << "\t\t\t"
+                   << "objectName   = <" << object.name << ">\n";
+            }
+        }
+    }
+    return os.str();
+}
+
+}// namespace
+
+DebugMessageSink::DebugMessageSink(const DebugSinkConfig &config)
+    : config(config), slots(new Slot[kDebugMessageQueueSize]) {
+    static_assert((kDebugMessageQueueSize & (kDebugMessageQueueSize - 1)) == 0);
+    for (uint32_t i = 0; i < kDebugMessageQueueSize; i++) {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    if (!config.path.empty()) {
+        file.open(config.path, std::ios::app);
+        if (!file) {
+            throw std::runtime_error("failed to open debug log " +
+                                     config.path);
+        }
+    }
+    drainer = std::thread(&DebugMessageSink::drainMain, this);
+}
+
+DebugMessageSink::~DebugMessageSink() noexcept {
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    drainer.join();
+    writeSummary();
+}
+
+vk::DebugUtilsMessengerCreateInfoEXT DebugMessageSink::createInfo() {
+    // severities are single bits ordered from verbose to error, so every bit
+    // from the minimum upwards is wanted
+    vk::DebugUtilsMessageSeverityFlagsEXT severityFlags;
+    for (auto severity : {vk::DebugUtilsMessageSeverityFlagBitsEXT::eVerbose,
+                          vk::DebugUtilsMessageSeverityFlagBitsEXT::eInfo,
+                          vk::DebugUtilsMessageSeverityFlagBitsEXT::eWarning,
+                          vk::DebugUtilsMessageSeverityFlagBitsEXT::eError}) {
+        if (config.minSeverity <= severity) { severityFlags |= severity; }
+    }
+    vk::DebugUtilsMessageTypeFlagsEXT messageTypeFlags(
+            vk::DebugUtilsMessageTypeFlagBitsEXT::eGeneral |
+            vk::DebugUtilsMessageTypeFlagBitsEXT::ePerformance |
+            vk::DebugUtilsMessageTypeFlagBitsEXT::eValidation);
+    return vk::DebugUtilsMessengerCreateInfoEXT({}, severityFlags,
+                                                messageTypeFlags,
+                                                &debugMessageSinkCallback,
+                                                this);
+}
+
+bool DebugMessageSink::push(
+        VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
+        VkDebugUtilsMessageTypeFlagsEXT messageTypes,
+        const VkDebugUtilsMessengerCallbackDataEXT *callbackData) {
+    uint64_t position = enqueuePosition.load(std::memory_order_relaxed);
+    Slot *slot;
+    for (;;) {
+        slot = &slots[position & (kDebugMessageQueueSize - 1)];
+        uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+        int64_t difference = static_cast<int64_t>(sequence - position);
+        if (difference == 0) {
+            if (enqueuePosition.compare_exchange_weak(
+                        position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            // full, the drain thread is a whole ring behind
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            position = enqueuePosition.load(std::memory_order_relaxed);
+        }
+    }
+
+    DebugMessage &message = slot->message;
+    message.severity =
+            static_cast<vk::DebugUtilsMessageSeverityFlagBitsEXT>(
+                    messageSeverity);
+    message.types = vk::DebugUtilsMessageTypeFlagsEXT(messageTypes);
+    message.messageIdNumber = callbackData->messageIdNumber;
+    copyString(message.messageIdName, callbackData->pMessageIdName);
+    copyString(message.message, callbackData->pMessage);
+    message.queueLabelCount =
+            std::min(callbackData->queueLabelCount, kMaxDebugMessageLabels);
+    for (uint32_t i = 0; i < message.queueLabelCount; i++) {
+        copyString(message.queueLabels[i],
+                   callbackData->pQueueLabels[i].pLabelName);
+    }
+    message.commandBufferLabelCount =
+            std::min(callbackData->cmdBufLabelCount, kMaxDebugMessageLabels);
+    for (uint32_t i = 0; i < message.commandBufferLabelCount; i++) {
+        copyString(message.commandBufferLabels[i],
+                   callbackData->pCmdBufLabels[i].pLabelName);
+    }
+    message.objectCount =
+            std::min(callbackData->objectCount, kMaxDebugMessageObjects);
+    for (uint32_t i = 0; i < message.objectCount; i++) {
+        const VkDebugUtilsObjectNameInfoEXT &object =
+                callbackData->pObjects[i];
+        message.objects[i].type =
+                static_cast<vk::ObjectType>(object.objectType);
+        message.objects[i].handle = object.objectHandle;
+        copyString(message.objects[i].name, object.pObjectName);
+    }
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+bool DebugMessageSink::pop(DebugMessage &message) {
+    Slot &slot = slots[dequeuePosition & (kDebugMessageQueueSize - 1)];
+    if (slot.sequence.load(std::memory_order_acquire) != dequeuePosition + 1) {
+        return false;
+    }
+    message = slot.message;
+    // free for the producer one lap ahead
+    slot.sequence.store(dequeuePosition + kDebugMessageQueueSize,
+                        std::memory_order_release);
+    dequeuePosition++;
+    return true;
+}
+
+void DebugMessageSink::drainMain() {
+    auto message = std::make_unique<DebugMessage>();
+    for (;;) {
+        // read before draining, so nothing pushed before the destructor ran
+        // is left in the ring
+        bool stop = stopping.load(std::memory_order_acquire);
+        while (pop(*message)) { handle(*message); }
+        if (stop) { break; }
+        std::unique_lock<std::mutex> lock(wakeMutex);
+        wake.wait_for(lock, kDebugDrainInterval,
+                      [this]() { return stopping.load(); });
+    }
+}
+
+void DebugMessageSink::handle(const DebugMessage &message) {
+    IdCounter &counter = counters[message.messageIdNumber];
+    if (counter.name.empty()) { counter.name = message.messageIdName; }
+    counter.total++;
+
+    auto now = std::chrono::steady_clock::now();
+    if (std::chrono::seconds(1) <= now - counter.windowStart) {
+        if (0 < counter.windowSuppressed) {
+            write("<" + counter.name + ">: " +
+                  std::to_string(counter.windowSuppressed) +
+                  " more messages suppressed\n");
+        }
+        counter.windowStart = now;
+        counter.windowCount = 0;
+        counter.windowSuppressed = 0;
+    }
+    auto rate = config.idRates.find(message.messageIdNumber);
+    uint32_t limit = rate != config.idRates.end() ? rate->second
+                                                   : config.messagesPerSecond;
+    if (counter.windowCount < limit) {
+        counter.windowCount++;
+        write(format(message));
+    } else {
+        counter.suppressed++;
+        counter.windowSuppressed++;
+    }
+}
+
+void DebugMessageSink::write(const std::string &text) {
+    std::cerr << text;
+    if (file.is_open()) { file << text; }
+}
+
+void DebugMessageSink::writeSummary() {
+    uint64_t droppedCount = dropped.load();
+    if (counters.empty() && droppedCount == 0) { return; }
+    std::vector<std::pair<int32_t, const IdCounter *>> sorted;
+    for (const auto &[id, counter] : counters) {
+        sorted.emplace_back(id, &counter);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) {
+        return a.second->total > b.second->total;
+    });
+    std::ostringstream os;
+    os << "debug messages by id:\n";
+    for (const auto &[id, counter] : sorted) {
+        os << "\t<" << counter->name << "> " << id << ": " << counter->total
+           << " (" << counter->suppressed << " suppressed)\n";
+    }
+    if (0 < droppedCount) {
+        os << "\t" << droppedCount << " dropped, the queue was full\n";
+    }
+    write(os.str());
+    if (file.is_open()) { file.flush(); }
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <vulkan/vulkan.hpp>
+
+// messages the callbacks may queue ahead of the drain thread, a power of two
+const uint32_t kDebugMessageQueueSize = 1024;
+// longer strings are truncated when copied out of the callback
+const size_t kMaxDebugMessageLength = 2048;
+const size_t kMaxDebugNameLength = 128;
+const uint32_t kMaxDebugMessageLabels = 4;
+const uint32_t kMaxDebugMessageObjects = 4;
+// messages per id and second written out, the rest is only counted
+const uint32_t kDefaultDebugMessageRate = 10;
+
+// a copy of VkDebugUtilsMessengerCallbackDataEXT in fixed storage, so that
+// the callback never allocates
+struct DebugMessage {
+    struct Object {
+        vk::ObjectType type;
+        uint64_t handle;
+        char name[kMaxDebugNameLength];
+    };
+
+    vk::DebugUtilsMessageSeverityFlagBitsEXT severity;
+    vk::DebugUtilsMessageTypeFlagsEXT types;
+    int32_t messageIdNumber;
+    char messageIdName[kMaxDebugNameLength];
+    char message[kMaxDebugMessageLength];
+    uint32_t queueLabelCount;
+    char queueLabels[kMaxDebugMessageLabels][kMaxDebugNameLength];
+    uint32_t commandBufferLabelCount;
+    char commandBufferLabels[kMaxDebugMessageLabels][kMaxDebugNameLength];
+    uint32_t objectCount;
+    Object objects[kMaxDebugMessageObjects];
+};
+
+struct DebugSinkConfig {
+    // less severe messages are not even delivered by the driver
+    vk::DebugUtilsMessageSeverityFlagBitsEXT minSeverity{
+            vk::DebugUtilsMessageSeverityFlagBitsEXT::eWarning};
+    uint32_t messagesPerSecond{kDefaultDebugMessageRate};
+    // per messageIdNumber overrides of messagesPerSecond, 0 mutes an id
+    std::map<int32_t, uint32_t> idRates;
+    // messages are written to this file as well when not empty
+    std::string path;
+};
+
+// receives validation and debug messages. the callback only copies the
+// message into a lock-free multi-producer ring and returns, a background
+// thread formats them, folds repeats of one messageIdNumber into counters
+// and enforces the rate limits. a summary per id is written on destruction
+struct DebugMessageSink {
+    explicit DebugMessageSink(const DebugSinkConfig &config);
+    ~DebugMessageSink() noexcept;
+    DebugMessageSink(const DebugMessageSink &) = delete;
+    DebugMessageSink &operator=(const DebugMessageSink &) = delete;
+
+    // for vkCreateDebugUtilsMessengerEXT or the pNext chain of the instance
+    vk::DebugUtilsMessengerCreateInfoEXT createInfo();
+    // any thread, false if the ring is full and the message was dropped
+    bool push(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
+              VkDebugUtilsMessageTypeFlagsEXT messageTypes,
+              const VkDebugUtilsMessengerCallbackDataEXT *callbackData);
+
+private:
+    struct Slot {
+        // vyukov's bounded queue: equals the position when the slot is free
+        // for it, the position + 1 once it holds that position's message
+        std::atomic<uint64_t> sequence;
+        DebugMessage message;
+    };
+
+    struct IdCounter {
+        std::string name;
+        uint64_t total{0};
+        uint64_t suppressed{0};
+        // rate limiting window
+        std::chrono::steady_clock::time_point windowStart;
+        uint32_t windowCount{0};
+        uint64_t windowSuppressed{0};
+    };
+
+    bool pop(DebugMessage &message);
+    void drainMain();
+    void handle(const DebugMessage &message);
+    void write(const std::string &text);
+    void writeSummary();
+
+    DebugSinkConfig config;
+    std::unique_ptr<Slot[]> slots;
+    std::atomic<uint64_t> enqueuePosition{0};
+    // drain thread only
+    uint64_t dequeuePosition{0};
+    std::atomic<uint64_t> dropped{0};
+    std::map<int32_t, IdCounter> counters;
+    std::ofstream file;
+
+    std::atomic<bool> stopping{false};
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    std::thread drainer;
+};
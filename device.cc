@@ -0,0 +1,497 @@
+#include "device.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#if (VULKAN_HPP_DISPATCH_LOADER_DYNAMIC == 1)
+// the dispatcher every executable linking light_core calls through
+VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
+#endif
+
+namespace {
+
+// the first family with all of the required and none of the excluded
+// capabilities, families without graphics are backed by separate engines on
+// most gpus and run in parallel to rendering
+std::optional<uint32_t> findDedicatedQueueFamilyIndex(
+        const std::vector<vk::QueueFamilyProperties> &queueFamilyProperties,
+        vk::QueueFlags required, vk::QueueFlags excluded) {
+    for (uint32_t i = 0; i < queueFamilyProperties.size(); i++) {
+        vk::QueueFlags flags = queueFamilyProperties[i].queueFlags;
+        if ((flags & required) == required && !(flags & excluded)) {
+            return i;
+        }
+    }
+    return std::nullopt;
+}
+
+// far apart, so that the type outweighs everything else
+int64_t scoreDeviceType(vk::PhysicalDeviceType type) {
+    switch (type) {
+        case vk::PhysicalDeviceType::eDiscreteGpu:
+            return 40000;
+        case vk::PhysicalDeviceType::eIntegratedGpu:
+            return 30000;
+        case vk::PhysicalDeviceType::eVirtualGpu:
+            return 20000;
+        case vk::PhysicalDeviceType::eCpu:
+            return 10000;
+        default:
+            return 0;
+    }
+}
+
+void scoreCandidate(DeviceCandidate &candidate,
+                    const DeviceRequirements &requirements) {
+    vk::PhysicalDevice physicalDevice = candidate.physicalDevice;
+    if (candidate.properties.apiVersion < requirements.apiVersion) {
+        candidate.rejection = "api version too old";
+        return;
+    }
+    for (const std::string &extension : requirements.extensions) {
+        if (!isDeviceExtensionSupported(physicalDevice, extension.c_str())) {
+            candidate.rejection = "no " + extension;
+            return;
+        }
+    }
+
+    std::vector<vk::QueueFamilyProperties> queueFamilyProperties =
+            physicalDevice.getQueueFamilyProperties();
+    if (std::none_of(queueFamilyProperties.begin(), queueFamilyProperties.end(),
+                     [](const vk::QueueFamilyProperties &qfp) {
+                         return bool(qfp.queueFlags &
+                                     vk::QueueFlagBits::eGraphics);
+                     })) {
+        candidate.rejection = "no graphics queue";
+        return;
+    }
+    if (requirements.surface) {
+        bool present = false;
+        for (uint32_t i = 0; i < queueFamilyProperties.size() && !present;
+             i++) {
+            present = physicalDevice.getSurfaceSupportKHR(
+                    i, requirements.surface);
+        }
+        if (!present) {
+            candidate.rejection = "cannot present to the surface";
+            return;
+        }
+    }
+    if (requirements.timelineSemaphores &&
+        !physicalDevice
+                 .getFeatures2<vk::PhysicalDeviceFeatures2,
+                               vk::PhysicalDeviceVulkan12Features>()
+                 .get<vk::PhysicalDeviceVulkan12Features>()
+                 .timelineSemaphore) {
+        candidate.rejection = "no timeline semaphores";
+        return;
+    }
+    candidate.suitable = true;
+
+    candidate.score = scoreDeviceType(candidate.properties.deviceType);
+    // queues the scheduler runs in parallel to rendering
+    uint32_t graphics = findGraphicsQueueFamilyIndex(queueFamilyProperties);
+    if (findTransferQueueFamilyIndex(queueFamilyProperties, graphics) !=
+        graphics) {
+        candidate.score += 2000;
+    }
+    if (findComputeQueueFamilyIndex(queueFamilyProperties, graphics) !=
+        graphics) {
+        candidate.score += 2000;
+    }
+    // largest device local heap, a point per 16 MiB up to 64 GiB
+    vk::PhysicalDeviceMemoryProperties memoryProperties =
+            physicalDevice.getMemoryProperties();
+    vk::DeviceSize deviceLocal = 0;
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+        const vk::MemoryHeap &heap = memoryProperties.memoryHeaps[i];
+        if (heap.flags & vk::MemoryHeapFlagBits::eDeviceLocal) {
+            deviceLocal = std::max(deviceLocal, heap.size);
+        }
+    }
+    candidate.score += static_cast<int64_t>(
+            std::min<vk::DeviceSize>(deviceLocal >> 24, 4096));
+}
+
+std::string toLower(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(), [](char c) {
+        return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    });
+    return text;
+}
+
+bool matchesOverride(const std::string &value, size_t index,
+                     const DeviceCandidate &candidate) {
+    // an index when the whole value parses as one, a name part otherwise
+    uint64_t parsed = 0;
+    auto [end, error] =
+            std::from_chars(value.data(), value.data() + value.size(), parsed);
+    if (error == std::errc() && end == value.data() + value.size()) {
+        return parsed == index;
+    }
+    return toLower(candidate.properties.deviceName.data())
+                   .find(toLower(value)) != std::string::npos;
+}
+
+}// namespace
+
+void loadVulkan() {
+#if (VULKAN_HPP_DISPATCH_LOADER_DYNAMIC == 1)
+    static vk::DynamicLoader dl;
+    static bool loaded = false;
+    if (loaded) { return; }
+    auto vkGetInstanceProcAddr = dl.getProcAddress<PFN_vkGetInstanceProcAddr>(
+            "vkGetInstanceProcAddr");
+    VULKAN_HPP_DEFAULT_DISPATCHER.init(vkGetInstanceProcAddr);
+    loaded = true;
+#endif
+}
+
+bool isInstanceExtensionSupported(const char *extensionName) {
+    loadVulkan();
+    std::vector<vk::ExtensionProperties> extensionProperties =
+            vk::enumerateInstanceExtensionProperties();
+    return std::find_if(extensionProperties.begin(), extensionProperties.end(),
+                        [extensionName](const auto &ep) {
+                            return strcmp(extensionName, ep.extensionName) == 0;
+                        }) != extensionProperties.end();
+}
+
+vk::UniqueInstance
+createInstance(const std::string &appName, const std::string &engineName,
+               uint32_t appVersion, uint32_t engineVersion, uint32_t apiVersion,
+               const std::vector<std::string> &layers,
+               const std::vector<std::string> &extensions,
+               DebugMessageSink *debugSink) {
+    loadVulkan();
+
+#ifndef NDEBUG
+    std::vector<vk::LayerProperties> layerProperties =
+            vk::enumerateInstanceLayerProperties();
+    std::vector<vk::ExtensionProperties> extensionProperties =
+            vk::enumerateInstanceExtensionProperties();
+#endif
+
+    std::vector<const char *> enabledLayers;
+    enabledLayers.reserve(layers.size());
+    for (const auto &layer : layers) {
+        assert(std::find_if(layerProperties.begin(), layerProperties.end(),
+                            [layer](const auto &lp) {
+                                return layer == lp.layerName;
+                            }) != layerProperties.end());
+        enabledLayers.push_back(layer.data());
+    }
+
+#ifndef NDEBUG
+    // enable validation layer to find as much errors as possible
+    std::vector<std::string> instanceDebugLayers = {
+            // standard validation layer
+            "VK_LAYER_KHRONOS_validation",
+            "VK_LAYER_LUNARG_assistant_layer",
+            // RenderDoc
+            "VK_LAYER_RENDERDOC_Capture",
+    };
+    for (const auto &layer : instanceDebugLayers) {
+        if (std::find(layers.begin(), layers.end(), layer) == layers.end() &&
+            std::find_if(layerProperties.begin(), layerProperties.end(),
+                         [layer](const auto &lp) {
+                             return layer == lp.layerName;
+                         }) != layerProperties.end()) {
+            enabledLayers.push_back(layer.c_str());
+        }
+    }
+#endif
+
+    std::vector<const char *> enabledExtensions;
+    enabledExtensions.reserve(extensions.size());
+    for (const auto &ext : extensions) {
+        assert(std::find_if(extensionProperties.begin(),
+                            extensionProperties.end(), [ext](const auto &ep) {
+                                return ext == ep.extensionName;
+                            }) != extensionProperties.end());
+        enabledExtensions.push_back(ext.data());
+    }
+
+#if !defined(NDEBUG)
+    // in debug mode, use the following instance extensions
+    std::vector<std::string> instanceDebugExtensions = {
+            // assign internal names to Vulkan resources
+            VK_EXT_DEBUG_UTILS_EXTENSION_NAME,
+            // set up a Vulkan debug report callback function
+            VK_EXT_DEBUG_REPORT_EXTENSION_NAME,
+    };
+    for (const auto &ext : instanceDebugExtensions) {
+        if (std::find(extensions.begin(), extensions.end(), ext) ==
+                    extensions.end() &&
+            std::find_if(extensionProperties.begin(), extensionProperties.end(),
+                         [ext](const auto &ep) {
+                             return ext == ep.extensionName;
+                         }) != extensionProperties.end()) {
+            enabledExtensions.push_back(ext.c_str());
+        }
+    }
+#endif
+
+    vk::ApplicationInfo applicationInfo(appName.c_str(), appVersion,
+                                        engineName.c_str(), engineVersion,
+                                        apiVersion);
+#if defined(NDEBUG)
+    // in non-debug mode just use the InstanceCreateInfo for instance creation
+    vk::StructureChain<vk::InstanceCreateInfo> instanceCreateInfo(
+            {{}, &applicationInfo, enabledLayers, enabledExtensions});
+#else
+    // in debug mode, additionally hand the messages of instance creation and
+    // destruction to the debug sink
+    vk::StructureChain<vk::InstanceCreateInfo,
+                       vk::DebugUtilsMessengerCreateInfoEXT>
+            instanceCreateInfo(
+                    {{}, &applicationInfo, enabledLayers, enabledExtensions},
+                    debugSink ? debugSink->createInfo()
+                              : vk::DebugUtilsMessengerCreateInfoEXT());
+    if (!debugSink) {
+        instanceCreateInfo.unlink<vk::DebugUtilsMessengerCreateInfoEXT>();
+    }
+#endif
+
+    auto instance = vk::createInstanceUnique(
+            instanceCreateInfo.get<vk::InstanceCreateInfo>());
+#if (VULKAN_HPP_DISPATCH_LOADER_DYNAMIC == 1)
+    // initialize function pointers for instance
+    VULKAN_HPP_DEFAULT_DISPATCHER.init(*instance);
+#endif
+    return instance;
+}
+
+vk::UniqueDebugUtilsMessengerEXT
+createDebugUtilsMessenger(vk::UniqueInstance &instance,
+                          DebugMessageSink &debugSink) {
+    return instance->createDebugUtilsMessengerEXTUnique(
+            debugSink.createInfo());
+}
+
+uint32_t findGraphicsQueueFamilyIndex(
+        const std::vector<vk::QueueFamilyProperties> &queueFamilyProperties) {
+    // get the first index into queue family properties which support graphics
+    size_t graphicsQueueFamilyIndex = std::distance(
+            queueFamilyProperties.begin(),
+            std::find_if(
+                    queueFamilyProperties.begin(), queueFamilyProperties.end(),
+                    [](const vk::QueueFamilyProperties &qfp) {
+                        return qfp.queueFlags & vk::QueueFlagBits::eGraphics;
+                    }));
+    assert(graphicsQueueFamilyIndex < queueFamilyProperties.size());
+    return static_cast<uint32_t>(graphicsQueueFamilyIndex);
+}
+
+std::pair<uint32_t, uint32_t>
+findGraphicsAndPresentQueueFamilyIndex(vk::PhysicalDevice physicalDevice,
+                                       const VkSurfaceKHR &surface) {
+    auto queueFamilyProperties = physicalDevice.getQueueFamilyProperties();
+
+    uint32_t graphicsQueueFamilyIndex =
+            findGraphicsQueueFamilyIndex(queueFamilyProperties);
+
+    // determine a queue family that supports present
+    // first check if the graphics queue family is good enough
+    if (physicalDevice.getSurfaceSupportKHR(graphicsQueueFamilyIndex,
+                                            surface)) {
+        return std::make_pair(graphicsQueueFamilyIndex,
+                              graphicsQueueFamilyIndex);
+    }
+
+    // the graphics queue doesn't support present, look for an other
+    // family that supports both graphics and present
+    for (uint32_t i = 0; i < queueFamilyProperties.size(); i++) {
+        if ((queueFamilyProperties[i].queueFlags &
+             vk::QueueFlagBits::eGraphics) &&
+            physicalDevice.getSurfaceSupportKHR(i, surface)) {
+            return std::make_pair(i, i);
+        }
+    }
+    // there's nothing like a single family index that supports both
+    // graphics and present, look for an other family that supports
+    // present
+    for (uint32_t i = 0; i < queueFamilyProperties.size(); i++) {
+        if (physicalDevice.getSurfaceSupportKHR(i, surface)) {
+            return std::make_pair(graphicsQueueFamilyIndex, i);
+        }
+    }
+    throw std::runtime_error("could not find a queue for graphics or "
+                             "present");
+}
+
+uint32_t findTransferQueueFamilyIndex(
+        const std::vector<vk::QueueFamilyProperties> &queueFamilyProperties,
+        uint32_t graphicsQueueFamilyIndex) {
+    // prefer a pure copy engine, then async compute, which can copy as well
+    if (auto index = findDedicatedQueueFamilyIndex(
+                queueFamilyProperties, vk::QueueFlagBits::eTransfer,
+                vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute)) {
+        return *index;
+    }
+    if (auto index = findDedicatedQueueFamilyIndex(
+                queueFamilyProperties, vk::QueueFlagBits::eCompute,
+                vk::QueueFlagBits::eGraphics)) {
+        return *index;
+    }
+    return graphicsQueueFamilyIndex;
+}
+
+uint32_t findComputeQueueFamilyIndex(
+        const std::vector<vk::QueueFamilyProperties> &queueFamilyProperties,
+        uint32_t graphicsQueueFamilyIndex) {
+    if (auto index = findDedicatedQueueFamilyIndex(
+                queueFamilyProperties, vk::QueueFlagBits::eCompute,
+                vk::QueueFlagBits::eGraphics)) {
+        return *index;
+    }
+    return graphicsQueueFamilyIndex;
+}
+
+DeviceSelection selectPhysicalDevice(vk::Instance instance,
+                                     const DeviceRequirements &requirements) {
+    auto start = std::chrono::steady_clock::now();
+    DeviceSelection selection;
+    for (vk::PhysicalDevice physicalDevice :
+         instance.enumeratePhysicalDevices()) {
+        DeviceCandidate candidate;
+        candidate.physicalDevice = physicalDevice;
+        candidate.properties = physicalDevice.getProperties();
+        scoreCandidate(candidate, requirements);
+        selection.candidates.push_back(candidate);
+    }
+
+    std::optional<size_t> selected;
+    const char *value = std::getenv(kDeviceOverrideVariable);
+    if (value && *value) {
+        for (size_t i = 0; i < selection.candidates.size() && !selected; i++) {
+            if (matchesOverride(value, i, selection.candidates[i])) {
+                selected = i;
+            }
+        }
+        if (!selected) {
+            throw std::runtime_error(std::string(kDeviceOverrideVariable) +
+                                     "=" + value + " matches no device");
+        }
+        const DeviceCandidate &candidate = selection.candidates[*selected];
+        if (!candidate.suitable) {
+            throw std::runtime_error(
+                    std::string(candidate.properties.deviceName.data()) +
+                    " picked by " + kDeviceOverrideVariable +
+                    " is not suitable: " + candidate.rejection);
+        }
+        selection.overridden = true;
+    } else {
+        for (size_t i = 0; i < selection.candidates.size(); i++) {
+            const DeviceCandidate &candidate = selection.candidates[i];
+            // ties go to the order the loader reports devices in
+            if (candidate.suitable &&
+                (!selected ||
+                 selection.candidates[*selected].score < candidate.score)) {
+                selected = i;
+            }
+        }
+        if (!selected) {
+            throw std::runtime_error("no suitable physical device");
+        }
+    }
+    selection.selected = *selected;
+    selection.physicalDevice = selection.candidates[*selected].physicalDevice;
+    selection.milliseconds = std::chrono::duration<double, std::milli>(
+                                     std::chrono::steady_clock::now() - start)
+                                     .count();
+    return selection;
+}
+
+void DeviceSelection::report(std::ostream &os) const {
+    os << "physical device: "
+       << candidates[selected].properties.deviceName.data() << ", picked by "
+       << (overridden ? kDeviceOverrideVariable : "score") << " in "
+       << milliseconds << " ms" << std::endl;
+    for (size_t i = 0; i < candidates.size(); i++) {
+        const DeviceCandidate &candidate = candidates[i];
+        os << (i == selected ? "  * " : "    ") << i << " "
+           << candidate.properties.deviceName.data() << " ("
+           << vk::to_string(candidate.properties.deviceType) << "): ";
+        if (candidate.suitable) {
+            os << "score " << candidate.score;
+        } else {
+            os << candidate.rejection;
+        }
+        os << std::endl;
+    }
+}
+
+std::vector<std::string> getDeviceExtensions(vk::PhysicalDevice physicalDevice,
+                                             bool headless) {
+    std::vector<std::string> extensions;
+    if (!headless) {
+        extensions.emplace_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    }
+#ifndef NDEBUG
+    // debug marker allow the assignment of internal names to Vulkan resources.
+    // these internal names will conveniently be visible in debugger like
+    // RenderDoc. debug marker are only available if RenderDoc is enabled,
+    // software and most ci drivers do not have them
+    if (isDeviceExtensionSupported(physicalDevice,
+                                   VK_EXT_DEBUG_MARKER_EXTENSION_NAME)) {
+        extensions.emplace_back(VK_EXT_DEBUG_MARKER_EXTENSION_NAME);
+    }
+#endif
+    return extensions;
+}
+
+vk::UniqueDevice
+createDevice(vk::PhysicalDevice physicalDevice,
+             const std::vector<uint32_t> &queueFamilyIndices,
+             const std::vector<std::string> &extensions,
+             const vk::PhysicalDeviceFeatures *physicalDeviceFeatures,
+             const void *next) {
+    std::vector<const char *> enabledExtensions;
+    enabledExtensions.reserve(extensions.size());
+    for (const auto &ext : extensions) {
+        enabledExtensions.push_back(ext.c_str());
+    }
+
+    // one queue from each distinct family
+    float queuePriority = 0.0f;
+    std::vector<vk::DeviceQueueCreateInfo> deviceQueueCreateInfos;
+    for (uint32_t queueFamilyIndex : queueFamilyIndices) {
+        if (std::find_if(deviceQueueCreateInfos.begin(),
+                         deviceQueueCreateInfos.end(),
+                         [queueFamilyIndex](const auto &qci) {
+                             return qci.queueFamilyIndex == queueFamilyIndex;
+                         }) == deviceQueueCreateInfos.end()) {
+            deviceQueueCreateInfos.emplace_back(vk::DeviceQueueCreateFlags(),
+                                                queueFamilyIndex, 1,
+                                                &queuePriority);
+        }
+    }
+    vk::DeviceCreateInfo deviceCreateInfo(
+            vk::DeviceCreateFlags(), deviceQueueCreateInfos, {},
+            enabledExtensions, physicalDeviceFeatures);
+    deviceCreateInfo.pNext = next;
+    vk::UniqueDevice device =
+            physicalDevice.createDeviceUnique(deviceCreateInfo);
+#if (VULKAN_HPP_DISPATCH_LOADER_DYNAMIC == 1)
+    // device functions straight from the driver instead of through the loader
+    VULKAN_HPP_DEFAULT_DISPATCHER.init(*device);
+#endif
+    return device;
+}
+
+bool isDeviceExtensionSupported(vk::PhysicalDevice physicalDevice,
+                                const char *extensionName) {
+    std::vector<vk::ExtensionProperties> extensionProperties =
+            physicalDevice.enumerateDeviceExtensionProperties();
+    return std::find_if(extensionProperties.begin(), extensionProperties.end(),
+                        [extensionName](const auto &ep) {
+                            return strcmp(extensionName, ep.extensionName) == 0;
+                        }) != extensionProperties.end();
+}
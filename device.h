@@ -0,0 +1,95 @@
+#pragma once
+
+#include <optional>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "debug_sink.h"
+
+// points the default dispatcher at the loader, done by createInstance. only
+// needed first for the global commands that run before an instance exists
+void loadVulkan();
+bool isInstanceExtensionSupported(const char *extensionName);
+
+vk::UniqueInstance
+createInstance(const std::string &appName, const std::string &engineName,
+               uint32_t appVersion, uint32_t engineVersion, uint32_t apiVersion,
+               const std::vector<std::string> &layers = {},
+               const std::vector<std::string> &extensions = {},
+               DebugMessageSink *debugSink = nullptr);
+vk::UniqueDebugUtilsMessengerEXT
+createDebugUtilsMessenger(vk::UniqueInstance &instance,
+                          DebugMessageSink &debugSink);
+
+uint32_t findGraphicsQueueFamilyIndex(
+        const std::vector<vk::QueueFamilyProperties> &queueFamilyProperties);
+std::pair<uint32_t, uint32_t>
+findGraphicsAndPresentQueueFamilyIndex(vk::PhysicalDevice physicalDevice,
+                                       const VkSurfaceKHR &surface);
+uint32_t findTransferQueueFamilyIndex(
+        const std::vector<vk::QueueFamilyProperties> &queueFamilyProperties,
+        uint32_t graphicsQueueFamilyIndex);
+uint32_t findComputeQueueFamilyIndex(
+        const std::vector<vk::QueueFamilyProperties> &queueFamilyProperties,
+        uint32_t graphicsQueueFamilyIndex);
+
+// what a physical device has to offer to be picked at all
+struct DeviceRequirements {
+    uint32_t apiVersion{VK_API_VERSION_1_2};
+    std::vector<std::string> extensions;
+    // some queue family has to present to it, unless null
+    vk::SurfaceKHR surface;
+    bool timelineSemaphores{true};
+};
+
+struct DeviceCandidate {
+    vk::PhysicalDevice physicalDevice;
+    vk::PhysicalDeviceProperties properties;
+    // higher is better, only meaningful when suitable
+    int64_t score{0};
+    bool suitable{false};
+    // the first requirement the device failed
+    std::string rejection;
+};
+
+struct DeviceSelection {
+    vk::PhysicalDevice physicalDevice;
+    std::vector<DeviceCandidate> candidates;
+    // index into candidates
+    size_t selected{0};
+    // picked through kDeviceOverrideVariable instead of by score
+    bool overridden{false};
+    double milliseconds{0.0};
+
+    void report(std::ostream &os) const;
+};
+
+// a device index or a case insensitive part of the device name
+const char *const kDeviceOverrideVariable = "LIGHT_DEVICE";
+
+// scores every physical device on its type, dedicated transfer and compute
+// queues and device local memory, and picks the best one that meets the
+// requirements. the override variable picks a device by hand, which still
+// has to meet them
+DeviceSelection selectPhysicalDevice(vk::Instance instance,
+                                     const DeviceRequirements &requirements);
+
+// swapchain unless headless, debug markers in debug builds when supported
+std::vector<std::string> getDeviceExtensions(vk::PhysicalDevice physicalDevice,
+                                             bool headless);
+// one queue from each distinct family of queueFamilyIndices. the default
+// dispatcher loads the device's own function table afterwards, so device
+// calls skip the loader trampoline. there is one dispatcher, with more than
+// one device alive the last one created owns it
+vk::UniqueDevice
+createDevice(vk::PhysicalDevice physicalDevice,
+             const std::vector<uint32_t> &queueFamilyIndices,
+             const std::vector<std::string> &extensions = {},
+             const vk::PhysicalDeviceFeatures *physicalDeviceFeatures = nullptr,
+             const void *next = nullptr);
+bool isDeviceExtensionSupported(vk::PhysicalDevice physicalDevice,
+                                const char *extensionName);
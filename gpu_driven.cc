@@ -0,0 +1,900 @@
+#include "gpu_driven.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+// generated from shaders/ by glslangValidator
+#include "shaders/cull.comp.h"
+#include "shaders/hiz.comp.h"
+#include "shaders/mesh.frag.h"
+#include "shaders/mesh.vert.h"
+
+namespace {
+
+// the grid the instances are laid out on
+const float kInstanceSpacing = 3.0f;
+const float kInstanceRadius = 1.0f;
+const float kPi = 3.14159265358979f;
+
+// std140, matches CullUniforms in cull.comp
+struct CullUniforms {
+    Mat4 viewProjection;
+    Mat4 previousViewProjection;
+    std::array<Vec4, 6> frustumPlanes;
+    std::array<float, 2> pyramidSize;
+    uint32_t instanceCount;
+    uint32_t maxDrawsPerBucket;
+    uint32_t indexCount;
+    uint32_t pyramidLevels;
+    uint32_t occlusion;
+};
+
+struct DrawPushConstants {
+    Mat4 viewProjection;
+    uint32_t material;
+};
+
+struct PyramidPushConstants {
+    std::array<int32_t, 2> sourceSize;
+    std::array<int32_t, 2> destinationSize;
+};
+
+struct Vertex {
+    std::array<float, 3> position;
+    std::array<float, 3> normal;
+};
+
+// a unit cube with flat normals, faces counterclockwise seen from outside
+void createCube(std::vector<Vertex> &vertices,
+                std::vector<uint32_t> &indices) {
+    // normal and two tangents whose cross product is the normal
+    const std::array<std::array<std::array<float, 3>, 3>, 6> faces = {{
+            {{{1, 0, 0}, {0, 1, 0}, {0, 0, 1}}},
+            {{{-1, 0, 0}, {0, 0, 1}, {0, 1, 0}}},
+            {{{0, 1, 0}, {0, 0, 1}, {1, 0, 0}}},
+            {{{0, -1, 0}, {1, 0, 0}, {0, 0, 1}}},
+            {{{0, 0, 1}, {1, 0, 0}, {0, 1, 0}}},
+            {{{0, 0, -1}, {0, 1, 0}, {1, 0, 0}}},
+    }};
+    const std::array<std::array<float, 2>, 4> corners = {
+            {{-1, -1}, {1, -1}, {1, 1}, {-1, 1}}};
+    for (const auto &[n, u, v] : faces) {
+        auto base = static_cast<uint32_t>(vertices.size());
+        for (const auto &[a, b] : corners) {
+            vertices.push_back({{n[0] + a * u[0] + b * v[0],
+                                 n[1] + a * u[1] + b * v[1],
+                                 n[2] + a * u[2] + b * v[2]},
+                                n});
+        }
+        for (uint32_t i : {0u, 1u, 2u, 0u, 2u, 3u}) {
+            indices.push_back(base + i);
+        }
+    }
+}
+
+vk::UniqueShaderModule createShaderModule(vk::Device device,
+                                          const uint32_t *code, size_t size) {
+    return device.createShaderModuleUnique(
+            vk::ShaderModuleCreateInfo(vk::ShaderModuleCreateFlags(), size,
+                                       code));
+}
+
+vk::UniquePipeline createComputePipeline(vk::Device device,
+                                         vk::PipelineCache pipelineCache,
+                                         const uint32_t *code, size_t size,
+                                         vk::PipelineLayout layout) {
+    vk::UniqueShaderModule shader = createShaderModule(device, code, size);
+    vk::PipelineShaderStageCreateInfo stage(
+            vk::PipelineShaderStageCreateFlags(),
+            vk::ShaderStageFlagBits::eCompute, *shader, "main");
+    return device
+            .createComputePipelineUnique(
+                    pipelineCache,
+                    vk::ComputePipelineCreateInfo(vk::PipelineCreateFlags(),
+                                                  stage, layout))
+            .value;
+}
+
+vk::Format chooseDepthFormat(vk::PhysicalDevice physicalDevice) {
+    // the pyramid pass samples the depth, D16 is guaranteed to allow that
+    vk::FormatFeatureFlags required =
+            vk::FormatFeatureFlagBits::eDepthStencilAttachment |
+            vk::FormatFeatureFlagBits::eSampledImage;
+    for (vk::Format format : {vk::Format::eD32Sfloat, vk::Format::eD16Unorm}) {
+        if ((physicalDevice.getFormatProperties(format).optimalTilingFeatures &
+             required) == required) {
+            return format;
+        }
+    }
+    throw std::runtime_error("no sampleable depth format");
+}
+
+// compiled on a worker of the pipeline compiler
+vk::UniquePipeline createDrawPipeline(vk::Device device,
+                                      vk::PipelineCache pipelineCache,
+                                      vk::PipelineLayout layout,
+                                      vk::RenderPass renderPass) {
+    vk::UniqueShaderModule vertexShader =
+            createShaderModule(device, kMeshVertSpirv, sizeof(kMeshVertSpirv));
+    vk::UniqueShaderModule fragmentShader =
+            createShaderModule(device, kMeshFragSpirv, sizeof(kMeshFragSpirv));
+    std::array<vk::PipelineShaderStageCreateInfo, 2> stages = {
+            vk::PipelineShaderStageCreateInfo(
+                    vk::PipelineShaderStageCreateFlags(),
+                    vk::ShaderStageFlagBits::eVertex, *vertexShader, "main"),
+            vk::PipelineShaderStageCreateInfo(
+                    vk::PipelineShaderStageCreateFlags(),
+                    vk::ShaderStageFlagBits::eFragment, *fragmentShader,
+                    "main")};
+
+    vk::VertexInputBindingDescription binding(0, sizeof(Vertex),
+                                              vk::VertexInputRate::eVertex);
+    std::array<vk::VertexInputAttributeDescription, 2> attributes = {
+            vk::VertexInputAttributeDescription(
+                    0, 0, vk::Format::eR32G32B32Sfloat,
+                    offsetof(Vertex, position)),
+            vk::VertexInputAttributeDescription(
+                    1, 0, vk::Format::eR32G32B32Sfloat,
+                    offsetof(Vertex, normal))};
+    vk::PipelineVertexInputStateCreateInfo vertexInputState(
+            vk::PipelineVertexInputStateCreateFlags(), binding, attributes);
+    vk::PipelineInputAssemblyStateCreateInfo inputAssemblyState(
+            vk::PipelineInputAssemblyStateCreateFlags(),
+            vk::PrimitiveTopology::eTriangleList);
+    // viewport and scissor are dynamic, so a resize keeps the pipeline
+    vk::PipelineViewportStateCreateInfo viewportState(
+            vk::PipelineViewportStateCreateFlags(), 1, nullptr, 1, nullptr);
+    vk::PipelineRasterizationStateCreateInfo rasterizationState(
+            vk::PipelineRasterizationStateCreateFlags(), false, false,
+            vk::PolygonMode::eFill, vk::CullModeFlagBits::eBack,
+            vk::FrontFace::eCounterClockwise, false, 0.0f, 0.0f, 0.0f, 1.0f);
+    vk::PipelineMultisampleStateCreateInfo multisampleState;
+    vk::PipelineDepthStencilStateCreateInfo depthStencilState(
+            vk::PipelineDepthStencilStateCreateFlags(), true, true,
+            vk::CompareOp::eLess);
+    vk::PipelineColorBlendAttachmentState colorBlendAttachment;
+    colorBlendAttachment.setColorWriteMask(
+            vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
+            vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA);
+    vk::PipelineColorBlendStateCreateInfo colorBlendState(
+            vk::PipelineColorBlendStateCreateFlags(), false,
+            vk::LogicOp::eCopy, colorBlendAttachment);
+    std::array<vk::DynamicState, 2> dynamicStates = {
+            vk::DynamicState::eViewport, vk::DynamicState::eScissor};
+    vk::PipelineDynamicStateCreateInfo dynamicState(
+            vk::PipelineDynamicStateCreateFlags(), dynamicStates);
+
+    return device
+            .createGraphicsPipelineUnique(
+                    pipelineCache,
+                    vk::GraphicsPipelineCreateInfo(
+                            vk::PipelineCreateFlags(), stages,
+                            &vertexInputState, &inputAssemblyState, nullptr,
+                            &viewportState, &rasterizationState,
+                            &multisampleState, &depthStencilState,
+                            &colorBlendState, &dynamicState, layout,
+                            renderPass, 0))
+            .value;
+}
+
+}// namespace
+
+bool enableGpuDrivenFeatures(vk::PhysicalDevice physicalDevice,
+                             vk::PhysicalDeviceFeatures &features,
+                             vk::PhysicalDeviceVulkan12Features &features12) {
+    if (physicalDevice.getProperties().apiVersion < VK_API_VERSION_1_2) {
+        return false;
+    }
+    auto chain = physicalDevice.getFeatures2<
+            vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features>();
+    const auto &supported = chain.get<vk::PhysicalDeviceFeatures2>().features;
+    if (!chain.get<vk::PhysicalDeviceVulkan12Features>().drawIndirectCount ||
+        !supported.multiDrawIndirect || !supported.drawIndirectFirstInstance) {
+        return false;
+    }
+    features.setMultiDrawIndirect(true).setDrawIndirectFirstInstance(true);
+    features12.setDrawIndirectCount(true);
+    return true;
+}
+
+GpuDrivenRenderer::GpuDrivenRenderer(
+        vk::PhysicalDevice physicalDevice, vk::UniqueDevice &device,
+        DeviceAllocator &allocator, UploadEngine &uploadEngine,
+        PipelineCompiler &pipelineCompiler, vk::Format colorFormat,
+        uint32_t framesInFlight, uint32_t instanceCount)
+    : device(*device), allocator(&allocator), uploadEngine(&uploadEngine),
+      pipelineCompiler(&pipelineCompiler),
+      instanceCount(std::max(1u, instanceCount)),
+      maxDrawsPerBucket((this->instanceCount + kGpuMaterialCount - 1) /
+                        kGpuMaterialCount),
+      colorFormat(colorFormat),
+      depthFormat(chooseDepthFormat(physicalDevice)), viewProjection{},
+      previousViewProjection{} {
+    std::vector<Vertex> cubeVertices;
+    std::vector<uint32_t> cubeIndices;
+    createCube(cubeVertices, cubeIndices);
+    indexCount = static_cast<uint32_t>(cubeIndices.size());
+
+    // a cube of cubes around the origin, close enough to hide each other
+    auto side = static_cast<uint32_t>(
+            std::ceil(std::cbrt(static_cast<double>(this->instanceCount))));
+    float offset = (side - 1) * kInstanceSpacing / 2.0f;
+    std::vector<GpuInstance> instanceData(this->instanceCount);
+    for (uint32_t i = 0; i < this->instanceCount; i++) {
+        uint32_t hash = i * 2654435761u;
+        GpuInstance &instance = instanceData[i];
+        instance.sphere = {(i % side) * kInstanceSpacing - offset,
+                           (i / side % side) * kInstanceSpacing - offset,
+                           (i / side / side) * kInstanceSpacing - offset,
+                           kInstanceRadius};
+        instance.color = {0.2f + 0.8f * (hash & 0xff) / 255.0f,
+                          0.2f + 0.8f * ((hash >> 8) & 0xff) / 255.0f,
+                          0.2f + 0.8f * ((hash >> 16) & 0xff) / 255.0f, 1.0f};
+        instance.material = i % kGpuMaterialCount;
+    }
+
+    vk::DeviceSize vertexBytes = cubeVertices.size() * sizeof(Vertex);
+    vk::DeviceSize indexBytes = cubeIndices.size() * sizeof(uint32_t);
+    vk::DeviceSize instanceBytes = instanceData.size() * sizeof(GpuInstance);
+    vertices = BufferData(allocator, vertexBytes,
+                          vk::BufferUsageFlagBits::eVertexBuffer |
+                                  vk::BufferUsageFlagBits::eTransferDst,
+                          vk::MemoryPropertyFlagBits::eDeviceLocal);
+    indices = BufferData(allocator, indexBytes,
+                         vk::BufferUsageFlagBits::eIndexBuffer |
+                                 vk::BufferUsageFlagBits::eTransferDst,
+                         vk::MemoryPropertyFlagBits::eDeviceLocal);
+    instances = BufferData(allocator, instanceBytes,
+                           vk::BufferUsageFlagBits::eStorageBuffer |
+                                   vk::BufferUsageFlagBits::eTransferDst,
+                           vk::MemoryPropertyFlagBits::eDeviceLocal);
+    uploadEngine.uploadBuffer(*vertices.buffer, 0, cubeVertices.data(),
+                              vertexBytes);
+    uploadEngine.uploadBuffer(*indices.buffer, 0, cubeIndices.data(),
+                              indexBytes);
+    uploadBatch = uploadEngine.uploadBuffer(*instances.buffer, 0,
+                                            instanceData.data(), instanceBytes);
+
+    drawCommands = BufferData(
+            allocator,
+            kGpuMaterialCount * maxDrawsPerBucket *
+                    sizeof(vk::DrawIndexedIndirectCommand),
+            vk::BufferUsageFlagBits::eStorageBuffer |
+                    vk::BufferUsageFlagBits::eIndirectBuffer,
+            vk::MemoryPropertyFlagBits::eDeviceLocal);
+    drawCounts = BufferData(allocator, kGpuMaterialCount * sizeof(uint32_t),
+                            vk::BufferUsageFlagBits::eStorageBuffer |
+                                    vk::BufferUsageFlagBits::eIndirectBuffer |
+                                    vk::BufferUsageFlagBits::eTransferSrc |
+                                    vk::BufferUsageFlagBits::eTransferDst,
+                            vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    frames.resize(framesInFlight);
+    for (FrameResources &frame : frames) {
+        frame.uniforms = BufferData(
+                allocator, sizeof(CullUniforms),
+                vk::BufferUsageFlagBits::eUniformBuffer,
+                vk::MemoryPropertyFlagBits::eHostVisible |
+                        vk::MemoryPropertyFlagBits::eHostCoherent);
+        frame.readback = BufferData(
+                allocator, kGpuMaterialCount * sizeof(uint32_t),
+                vk::BufferUsageFlagBits::eTransferDst,
+                vk::MemoryPropertyFlagBits::eHostVisible |
+                        vk::MemoryPropertyFlagBits::eHostCoherent);
+    }
+
+    pyramidSampler = this->device.createSamplerUnique(vk::SamplerCreateInfo(
+            vk::SamplerCreateFlags(), vk::Filter::eNearest,
+            vk::Filter::eNearest, vk::SamplerMipmapMode::eNearest,
+            vk::SamplerAddressMode::eClampToEdge,
+            vk::SamplerAddressMode::eClampToEdge,
+            vk::SamplerAddressMode::eClampToEdge, 0.0f, false, 1.0f, false,
+            vk::CompareOp::eNever, 0.0f, VK_LOD_CLAMP_NONE));
+
+    createPipelines();
+
+    vk::DescriptorPoolSize poolSize(vk::DescriptorType::eStorageBuffer, 1);
+    drawDescriptorPool = this->device.createDescriptorPoolUnique(
+            vk::DescriptorPoolCreateInfo(vk::DescriptorPoolCreateFlags(), 1,
+                                         poolSize));
+    drawDescriptorSet = this->device
+                                .allocateDescriptorSets(
+                                        vk::DescriptorSetAllocateInfo(
+                                                *drawDescriptorPool,
+                                                *drawDescriptorSetLayout))
+                                .front();
+    vk::DescriptorBufferInfo instancesInfo(*instances.buffer, 0,
+                                           VK_WHOLE_SIZE);
+    this->device.updateDescriptorSets(
+            vk::WriteDescriptorSet(drawDescriptorSet, 0, 0,
+                                   vk::DescriptorType::eStorageBuffer, {},
+                                   instancesInfo),
+            {});
+}
+
+GpuDrivenRenderer::~GpuDrivenRenderer() noexcept {
+    pipelineCompiler->waitIdle();
+}
+
+void GpuDrivenRenderer::createPipelines() {
+    vk::ShaderStageFlags compute = vk::ShaderStageFlagBits::eCompute;
+    std::array<vk::DescriptorSetLayoutBinding, 5> cullBindings = {
+            vk::DescriptorSetLayoutBinding(
+                    0, vk::DescriptorType::eUniformBuffer, 1, compute),
+            vk::DescriptorSetLayoutBinding(
+                    1, vk::DescriptorType::eStorageBuffer, 1, compute),
+            vk::DescriptorSetLayoutBinding(
+                    2, vk::DescriptorType::eStorageBuffer, 1, compute),
+            vk::DescriptorSetLayoutBinding(
+                    3, vk::DescriptorType::eStorageBuffer, 1, compute),
+            vk::DescriptorSetLayoutBinding(
+                    4, vk::DescriptorType::eCombinedImageSampler, 1, compute)};
+    cullDescriptorSetLayout = device.createDescriptorSetLayoutUnique(
+            vk::DescriptorSetLayoutCreateInfo(
+                    vk::DescriptorSetLayoutCreateFlags(), cullBindings));
+    cullPipelineLayout = device.createPipelineLayoutUnique(
+            vk::PipelineLayoutCreateInfo(vk::PipelineLayoutCreateFlags(),
+                                         *cullDescriptorSetLayout));
+
+    std::array<vk::DescriptorSetLayoutBinding, 2> pyramidBindings = {
+            vk::DescriptorSetLayoutBinding(
+                    0, vk::DescriptorType::eCombinedImageSampler, 1, compute),
+            vk::DescriptorSetLayoutBinding(
+                    1, vk::DescriptorType::eStorageImage, 1, compute)};
+    pyramidDescriptorSetLayout = device.createDescriptorSetLayoutUnique(
+            vk::DescriptorSetLayoutCreateInfo(
+                    vk::DescriptorSetLayoutCreateFlags(), pyramidBindings));
+    vk::PushConstantRange pyramidPushConstants(compute, 0,
+                                               sizeof(PyramidPushConstants));
+    pyramidPipelineLayout = device.createPipelineLayoutUnique(
+            vk::PipelineLayoutCreateInfo(vk::PipelineLayoutCreateFlags(),
+                                         *pyramidDescriptorSetLayout,
+                                         pyramidPushConstants));
+
+    vk::DescriptorSetLayoutBinding drawBinding(
+            0, vk::DescriptorType::eStorageBuffer, 1,
+            vk::ShaderStageFlagBits::eVertex);
+    drawDescriptorSetLayout = device.createDescriptorSetLayoutUnique(
+            vk::DescriptorSetLayoutCreateInfo(
+                    vk::DescriptorSetLayoutCreateFlags(), drawBinding));
+    vk::PushConstantRange drawPushConstants(
+            vk::ShaderStageFlagBits::eVertex |
+                    vk::ShaderStageFlagBits::eFragment,
+            0, sizeof(DrawPushConstants));
+    drawPipelineLayout = device.createPipelineLayoutUnique(
+            vk::PipelineLayoutCreateInfo(vk::PipelineLayoutCreateFlags(),
+                                         *drawDescriptorSetLayout,
+                                         drawPushConstants));
+
+    // queued, the first frames skip the passes until they are compiled
+    vk::PipelineLayout cullLayout = *cullPipelineLayout;
+    cullPipeline = pipelineCompiler->compile(
+            "cull",
+            PipelineKey()
+                    .add(kCullCompSpirv, sizeof(kCullCompSpirv))
+                    .add(cullLayout),
+            [device = device, cullLayout](vk::PipelineCache cache) {
+                return createComputePipeline(device, cache, kCullCompSpirv,
+                                             sizeof(kCullCompSpirv),
+                                             cullLayout);
+            });
+    vk::PipelineLayout pyramidLayout = *pyramidPipelineLayout;
+    pyramidPipeline = pipelineCompiler->compile(
+            "depth pyramid",
+            PipelineKey()
+                    .add(kHizCompSpirv, sizeof(kHizCompSpirv))
+                    .add(pyramidLayout),
+            [device = device, pyramidLayout](vk::PipelineCache cache) {
+                return createComputePipeline(device, cache, kHizCompSpirv,
+                                             sizeof(kHizCompSpirv),
+                                             pyramidLayout);
+            });
+
+    renderPass = createRenderPass(colorFormat);
+    drawPipeline = requestDrawPipeline(colorFormat);
+}
+
+// the graph places the transitions, the attachments stay in the layouts it
+// hands them in. depth is stored for the pyramid pass
+vk::UniqueRenderPass
+GpuDrivenRenderer::createRenderPass(vk::Format colorFormat) const {
+    std::array<vk::AttachmentDescription, 2> attachments = {
+            vk::AttachmentDescription(
+                    vk::AttachmentDescriptionFlags(), colorFormat,
+                    vk::SampleCountFlagBits::e1, vk::AttachmentLoadOp::eClear,
+                    vk::AttachmentStoreOp::eStore,
+                    vk::AttachmentLoadOp::eDontCare,
+                    vk::AttachmentStoreOp::eDontCare,
+                    vk::ImageLayout::eColorAttachmentOptimal,
+                    vk::ImageLayout::eColorAttachmentOptimal),
+            vk::AttachmentDescription(
+                    vk::AttachmentDescriptionFlags(), depthFormat,
+                    vk::SampleCountFlagBits::e1, vk::AttachmentLoadOp::eClear,
+                    vk::AttachmentStoreOp::eStore,
+                    vk::AttachmentLoadOp::eDontCare,
+                    vk::AttachmentStoreOp::eDontCare,
+                    vk::ImageLayout::eDepthStencilAttachmentOptimal,
+                    vk::ImageLayout::eDepthStencilAttachmentOptimal)};
+    vk::AttachmentReference colorReference(
+            0, vk::ImageLayout::eColorAttachmentOptimal);
+    vk::AttachmentReference depthReference(
+            1, vk::ImageLayout::eDepthStencilAttachmentOptimal);
+    vk::SubpassDescription subpass(vk::SubpassDescriptionFlags(),
+                                   vk::PipelineBindPoint::eGraphics, {},
+                                   colorReference, {}, &depthReference);
+    return device.createRenderPassUnique(vk::RenderPassCreateInfo(
+            vk::RenderPassCreateFlags(), attachments, subpass));
+}
+
+PipelineHandle GpuDrivenRenderer::requestDrawPipeline(vk::Format colorFormat) {
+    vk::PipelineLayout layout = *drawPipelineLayout;
+    PipelineKey key;
+    key.add(kMeshVertSpirv, sizeof(kMeshVertSpirv))
+            .add(kMeshFragSpirv, sizeof(kMeshFragSpirv))
+            .add(layout)
+            .add(colorFormat)
+            .add(depthFormat);
+    // against a render pass of its own, any compatible one will do and the
+    // renderer's may be replaced before the compilation ran
+    return pipelineCompiler->compile(
+            "mesh draw", key,
+            [this, layout, colorFormat](vk::PipelineCache cache) {
+                vk::UniqueRenderPass compatible = createRenderPass(colorFormat);
+                return createDrawPipeline(device, cache, layout, *compatible);
+            });
+}
+
+void GpuDrivenRenderer::resize(
+        vk::Format colorFormat,
+        const std::vector<vk::UniqueImageView> &colorViews,
+        const vk::Extent2D &extent, uint64_t retireFrame) {
+    if (targets) {
+        targets->retireFrame = retireFrame;
+        // the render pass and the pipeline only depend on the format, the
+        // compiler keeps the pipelines of every format requested
+        if (colorFormat != this->colorFormat) {
+            targets->renderPass = std::move(renderPass);
+        }
+        retiredTargets.push_back(std::move(targets));
+    }
+    if (!renderPass) {
+        this->colorFormat = colorFormat;
+        renderPass = createRenderPass(colorFormat);
+        drawPipeline = requestDrawPipeline(colorFormat);
+    }
+
+    targets = std::make_unique<Targets>();
+    targets->extent = extent;
+    targets->depth = ImageData(
+            *allocator,
+            vk::ImageCreateInfo(
+                    vk::ImageCreateFlags(), vk::ImageType::e2D, depthFormat,
+                    vk::Extent3D(extent, 1), 1, 1,
+                    vk::SampleCountFlagBits::e1, vk::ImageTiling::eOptimal,
+                    vk::ImageUsageFlagBits::eDepthStencilAttachment |
+                            vk::ImageUsageFlagBits::eSampled),
+            vk::MemoryPropertyFlagBits::eDeviceLocal);
+    targets->depthView = device.createImageViewUnique(vk::ImageViewCreateInfo(
+            vk::ImageViewCreateFlags(), *targets->depth.image,
+            vk::ImageViewType::e2D, depthFormat, vk::ComponentMapping(),
+            vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eDepth, 0, 1,
+                                      0, 1)));
+
+    // level 0 has the extent of the depth buffer, so that the culling shader
+    // can pick levels by the size of the screen rectangle
+    targets->pyramidLevels =
+            static_cast<uint32_t>(std::floor(std::log2(
+                    std::max(extent.width, extent.height)))) +
+            1;
+    targets->pyramid = ImageData(
+            *allocator,
+            vk::ImageCreateInfo(
+                    vk::ImageCreateFlags(), vk::ImageType::e2D,
+                    vk::Format::eR32Sfloat, vk::Extent3D(extent, 1),
+                    targets->pyramidLevels, 1, vk::SampleCountFlagBits::e1,
+                    vk::ImageTiling::eOptimal,
+                    vk::ImageUsageFlagBits::eStorage |
+                            vk::ImageUsageFlagBits::eSampled |
+                            vk::ImageUsageFlagBits::eTransferDst),
+            vk::MemoryPropertyFlagBits::eDeviceLocal);
+    targets->pyramidView = device.createImageViewUnique(
+            vk::ImageViewCreateInfo(
+                    vk::ImageViewCreateFlags(), *targets->pyramid.image,
+                    vk::ImageViewType::e2D, vk::Format::eR32Sfloat,
+                    vk::ComponentMapping(),
+                    vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor,
+                                              0, targets->pyramidLevels, 0,
+                                              1)));
+    for (uint32_t level = 0; level < targets->pyramidLevels; level++) {
+        targets->pyramidLevelViews.push_back(device.createImageViewUnique(
+                vk::ImageViewCreateInfo(
+                        vk::ImageViewCreateFlags(), *targets->pyramid.image,
+                        vk::ImageViewType::e2D, vk::Format::eR32Sfloat,
+                        vk::ComponentMapping(),
+                        vk::ImageSubresourceRange(
+                                vk::ImageAspectFlagBits::eColor, level, 1, 0,
+                                1))));
+    }
+
+    for (const auto &colorView : colorViews) {
+        std::array<vk::ImageView, 2> attachments = {*colorView,
+                                                    *targets->depthView};
+        targets->framebuffers.push_back(device.createFramebufferUnique(
+                vk::FramebufferCreateInfo(vk::FramebufferCreateFlags(),
+                                          *renderPass, attachments,
+                                          extent.width, extent.height, 1)));
+    }
+
+    auto frameCount = static_cast<uint32_t>(frames.size());
+    uint32_t levels = targets->pyramidLevels;
+    std::array<vk::DescriptorPoolSize, 4> poolSizes = {
+            vk::DescriptorPoolSize(vk::DescriptorType::eUniformBuffer,
+                                   frameCount),
+            vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer,
+                                   3 * frameCount),
+            vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler,
+                                   frameCount + levels),
+            vk::DescriptorPoolSize(vk::DescriptorType::eStorageImage,
+                                   levels)};
+    targets->descriptorPool = device.createDescriptorPoolUnique(
+            vk::DescriptorPoolCreateInfo(vk::DescriptorPoolCreateFlags(),
+                                         frameCount + levels, poolSizes));
+    std::vector<vk::DescriptorSetLayout> cullLayouts(
+            frameCount, *cullDescriptorSetLayout);
+    targets->cullDescriptorSets = device.allocateDescriptorSets(
+            vk::DescriptorSetAllocateInfo(*targets->descriptorPool,
+                                          cullLayouts));
+    std::vector<vk::DescriptorSetLayout> pyramidLayouts(
+            levels, *pyramidDescriptorSetLayout);
+    targets->pyramidDescriptorSets = device.allocateDescriptorSets(
+            vk::DescriptorSetAllocateInfo(*targets->descriptorPool,
+                                          pyramidLayouts));
+
+    std::vector<vk::WriteDescriptorSet> writes;
+    // referenced by the writes until they are submitted
+    std::deque<vk::DescriptorBufferInfo> bufferInfos;
+    std::deque<vk::DescriptorImageInfo> imageInfos;
+    vk::DescriptorBufferInfo instancesInfo(*instances.buffer, 0,
+                                           VK_WHOLE_SIZE);
+    vk::DescriptorBufferInfo commandsInfo(*drawCommands.buffer, 0,
+                                          VK_WHOLE_SIZE);
+    vk::DescriptorBufferInfo countsInfo(*drawCounts.buffer, 0, VK_WHOLE_SIZE);
+    // the culling pass samples the pyramid as a graph read
+    vk::DescriptorImageInfo pyramidInfo(
+            *pyramidSampler, *targets->pyramidView,
+            vk::ImageLayout::eShaderReadOnlyOptimal);
+    for (uint32_t i = 0; i < frameCount; i++) {
+        vk::DescriptorSet set = targets->cullDescriptorSets[i];
+        bufferInfos.emplace_back(*frames[i].uniforms.buffer, 0,
+                                 sizeof(CullUniforms));
+        writes.push_back(vk::WriteDescriptorSet(
+                set, 0, 0, vk::DescriptorType::eUniformBuffer, {},
+                bufferInfos.back()));
+        writes.push_back(vk::WriteDescriptorSet(
+                set, 1, 0, vk::DescriptorType::eStorageBuffer, {},
+                instancesInfo));
+        writes.push_back(vk::WriteDescriptorSet(
+                set, 2, 0, vk::DescriptorType::eStorageBuffer, {},
+                commandsInfo));
+        writes.push_back(vk::WriteDescriptorSet(
+                set, 3, 0, vk::DescriptorType::eStorageBuffer, {},
+                countsInfo));
+        writes.push_back(vk::WriteDescriptorSet(
+                set, 4, 0, vk::DescriptorType::eCombinedImageSampler,
+                pyramidInfo));
+    }
+    for (uint32_t level = 0; level < levels; level++) {
+        vk::DescriptorSet set = targets->pyramidDescriptorSets[level];
+        // level 0 reads the depth buffer, every other level the one below,
+        // which stays in the general layout while the pass writes the next
+        if (level == 0) {
+            imageInfos.emplace_back(*pyramidSampler, *targets->depthView,
+                                    vk::ImageLayout::eShaderReadOnlyOptimal);
+        } else {
+            imageInfos.emplace_back(*pyramidSampler,
+                                    *targets->pyramidLevelViews[level - 1],
+                                    vk::ImageLayout::eGeneral);
+        }
+        writes.push_back(vk::WriteDescriptorSet(
+                set, 0, 0, vk::DescriptorType::eCombinedImageSampler,
+                imageInfos.back()));
+        imageInfos.emplace_back(nullptr, *targets->pyramidLevelViews[level],
+                                vk::ImageLayout::eGeneral);
+        writes.push_back(vk::WriteDescriptorSet(
+                set, 1, 0, vk::DescriptorType::eStorageImage,
+                imageInfos.back()));
+    }
+    device.updateDescriptorSets(writes, {});
+}
+
+void GpuDrivenRenderer::addPasses(RenderGraph &graph,
+                                  ResourceHandle backbuffer) {
+    using Stage = vk::PipelineStageFlagBits;
+    // the previous frame drew from the commands and copied the counts, the
+    // culling pass overwrites both
+    ResourceState indirectState{vk::ImageLayout::eUndefined,
+                                Stage::eDrawIndirect | Stage::eTransfer,
+                                {}};
+    ResourceHandle instanceBuffer = graph.importBuffer(
+            "instances", instanceCount * sizeof(GpuInstance),
+            ResourceState{vk::ImageLayout::eUndefined, Stage::eTopOfPipe, {}});
+    ResourceHandle commandBuffer = graph.importBuffer(
+            "draw commands",
+            kGpuMaterialCount * maxDrawsPerBucket *
+                    sizeof(vk::DrawIndexedIndirectCommand),
+            indirectState);
+    ResourceHandle countBuffer = graph.importBuffer(
+            "draw counts", kGpuMaterialCount * sizeof(uint32_t),
+            indirectState);
+    // the depth is cleared by the scene pass, but the previous frame's
+    // pyramid pass may still be reading it
+    ResourceHandle depth = graph.importImage(
+            "depth", depthFormat, targets->extent,
+            ResourceState{vk::ImageLayout::eUndefined, Stage::eComputeShader,
+                          {}});
+    // the pyramid is left behind by the previous frame's pyramid pass, or
+    // was cleared by beginFrame
+    ResourceHandle pyramid = graph.importImage(
+            "depth pyramid", vk::Format::eR32Sfloat, targets->extent,
+            ResourceState{vk::ImageLayout::eGeneral, Stage::eComputeShader,
+                          vk::AccessFlagBits::eShaderWrite});
+    graph.bindBuffer(instanceBuffer, *instances.buffer);
+    graph.bindBuffer(commandBuffer, *drawCommands.buffer);
+    graph.bindBuffer(countBuffer, *drawCounts.buffer);
+    graph.bindImage(depth, *targets->depth.image, *targets->depthView);
+    graph.bindImage(pyramid, *targets->pyramid.image, *targets->pyramidView);
+
+    PassHandle cullPass = graph.addPass(
+            "cull", [this](vk::CommandBuffer cb) { recordCull(cb); });
+    graph.read(cullPass, instanceBuffer, ResourceUsage::eStorageRead);
+    graph.read(cullPass, pyramid, ResourceUsage::eSampled);
+    graph.write(cullPass, countBuffer, ResourceUsage::eTransferDst);
+    graph.write(cullPass, countBuffer, ResourceUsage::eStorageWrite);
+    graph.write(cullPass, commandBuffer, ResourceUsage::eStorageWrite);
+
+    PassHandle scenePass = graph.addPass(
+            "scene", [this](vk::CommandBuffer cb) { recordScene(cb); });
+    graph.read(scenePass, instanceBuffer, ResourceUsage::eStorageRead);
+    graph.read(scenePass, commandBuffer, ResourceUsage::eIndirect);
+    graph.read(scenePass, countBuffer, ResourceUsage::eIndirect);
+    graph.write(scenePass, backbuffer, ResourceUsage::eColorAttachment);
+    graph.write(scenePass, depth, ResourceUsage::eDepthAttachment);
+
+    // feeds the next frame's culling, which the graph cannot see
+    PassHandle pyramidPass = graph.addPass(
+            "depth pyramid",
+            [this](vk::CommandBuffer cb) { recordPyramid(cb); });
+    graph.read(pyramidPass, depth, ResourceUsage::eSampled);
+    graph.write(pyramidPass, pyramid, ResourceUsage::eStorageWrite);
+    graph.markOutput(pyramid);
+
+    PassHandle statisticsPass = graph.addPass(
+            "cull statistics",
+            [this](vk::CommandBuffer cb) { recordStatistics(cb); }, true);
+    graph.read(statisticsPass, countBuffer, ResourceUsage::eTransferSrc);
+}
+
+void GpuDrivenRenderer::beginFrame(vk::CommandBuffer commandBuffer,
+                                   uint32_t frameIndex, uint32_t imageIndex,
+                                   uint64_t frameNumber) {
+    this->frameIndex = frameIndex;
+    this->imageIndex = imageIndex;
+    while (!retiredTargets.empty() &&
+           retiredTargets.front()->retireFrame <= frameNumber) {
+        retiredTargets.pop_front();
+    }
+
+    FrameResources &frame = frames[frameIndex];
+    if (frame.readbackPending) {
+        const auto *counts =
+                static_cast<const uint32_t *>(frame.readback.allocation.mapped);
+        visibleInstances = 0;
+        for (uint32_t i = 0; i < kGpuMaterialCount; i++) {
+            visibleInstances += std::min(counts[i], maxDrawsPerBucket);
+        }
+    }
+    // the instances are used from the frame that acquired their upload on
+    ready = ready || uploadEngine->isComplete(uploadBatch);
+    if (!pipelineCompiler->isReady(cullPipeline) ||
+        !pipelineCompiler->isReady(pyramidPipeline) ||
+        !pipelineCompiler->isReady(drawPipeline)) {
+        fallbackFrames++;
+    }
+
+    if (!targets->initialized) {
+        // nothing is occluded by a pyramid at the far plane
+        vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0,
+                                        VK_REMAINING_MIP_LEVELS, 0, 1);
+        commandBuffer.pipelineBarrier(
+                vk::PipelineStageFlagBits::eTopOfPipe,
+                vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(),
+                nullptr, nullptr,
+                vk::ImageMemoryBarrier(
+                        {}, vk::AccessFlagBits::eTransferWrite,
+                        vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral,
+                        VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
+                        *targets->pyramid.image, range));
+        commandBuffer.clearColorImage(
+                *targets->pyramid.image, vk::ImageLayout::eGeneral,
+                vk::ClearColorValue(std::array<float, 4>({{1, 1, 1, 1}})),
+                range);
+        commandBuffer.pipelineBarrier(
+                vk::PipelineStageFlagBits::eTransfer,
+                vk::PipelineStageFlagBits::eComputeShader,
+                vk::DependencyFlags(),
+                vk::MemoryBarrier(vk::AccessFlagBits::eTransferWrite,
+                                  vk::AccessFlagBits::eShaderRead),
+                nullptr, nullptr);
+        targets->initialized = true;
+    }
+
+    updateCamera(frameNumber);
+    CullUniforms uniforms;
+    uniforms.viewProjection = viewProjection;
+    uniforms.previousViewProjection = previousViewProjection;
+    uniforms.frustumPlanes = frustumPlanes(viewProjection);
+    uniforms.pyramidSize = {static_cast<float>(targets->extent.width),
+                            static_cast<float>(targets->extent.height)};
+    uniforms.instanceCount = instanceCount;
+    uniforms.maxDrawsPerBucket = maxDrawsPerBucket;
+    uniforms.indexCount = indexCount;
+    uniforms.pyramidLevels = targets->pyramidLevels;
+    // the first frame has no previous camera to reproject with
+    uniforms.occlusion = frameNumber == 0 ? 0 : 1;
+    memcpy(frame.uniforms.allocation.mapped, &uniforms, sizeof(uniforms));
+}
+
+void GpuDrivenRenderer::updateCamera(uint64_t frameNumber) {
+    // circles the grid from just outside, most of it is in view and the
+    // front rows hide the ones behind them
+    auto side = static_cast<float>(
+            std::ceil(std::cbrt(static_cast<double>(instanceCount))));
+    float size = side * kInstanceSpacing;
+    float angle = static_cast<float>(frameNumber % 3600) * 0.1f *
+                  kPi / 180.0f;
+    Vec3 eye = {std::cos(angle) * size, size * 0.3f, std::sin(angle) * size};
+    float aspect = static_cast<float>(targets->extent.width) /
+                   static_cast<float>(targets->extent.height);
+    previousViewProjection = viewProjection;
+    viewProjection = perspective(kPi / 3.0f, aspect, 0.5f, size * 3.0f) *
+                     lookAt(eye, {0.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f});
+}
+
+void GpuDrivenRenderer::recordCull(vk::CommandBuffer commandBuffer) {
+    commandBuffer.fillBuffer(*drawCounts.buffer, 0, VK_WHOLE_SIZE, 0);
+    commandBuffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer,
+            vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(),
+            vk::MemoryBarrier(vk::AccessFlagBits::eTransferWrite,
+                              vk::AccessFlagBits::eShaderRead |
+                                      vk::AccessFlagBits::eShaderWrite),
+            nullptr, nullptr);
+    // zero counts draw nothing until the instances arrived
+    if (!ready) { return; }
+    vk::Pipeline pipeline = pipelineCompiler->get(cullPipeline);
+    if (!pipeline) { return; }
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+    commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+                                     *cullPipelineLayout, 0,
+                                     targets->cullDescriptorSets[frameIndex],
+                                     {});
+    commandBuffer.dispatch(
+            (instanceCount + kCullWorkgroupSize - 1) / kCullWorkgroupSize, 1,
+            1);
+}
+
+void GpuDrivenRenderer::recordScene(vk::CommandBuffer commandBuffer) {
+    const vk::Extent2D &extent = targets->extent;
+    std::array<vk::ClearValue, 2> clearValues = {
+            vk::ClearValue(vk::ClearColorValue(
+                    std::array<float, 4>({{0.05f, 0.05f, 0.08f, 1.0f}}))),
+            vk::ClearValue(vk::ClearDepthStencilValue(1.0f, 0))};
+    commandBuffer.beginRenderPass(
+            vk::RenderPassBeginInfo(*renderPass,
+                                    *targets->framebuffers[imageIndex],
+                                    vk::Rect2D(vk::Offset2D(0, 0), extent),
+                                    clearValues),
+            vk::SubpassContents::eInline);
+    // the clear alone until the pipeline is compiled
+    vk::Pipeline pipeline = pipelineCompiler->get(drawPipeline);
+    if (!pipeline) {
+        commandBuffer.endRenderPass();
+        return;
+    }
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+    commandBuffer.setViewport(
+            0, vk::Viewport(0.0f, 0.0f, static_cast<float>(extent.width),
+                            static_cast<float>(extent.height), 0.0f, 1.0f));
+    commandBuffer.setScissor(0, vk::Rect2D(vk::Offset2D(0, 0), extent));
+    commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics,
+                                     *drawPipelineLayout, 0,
+                                     drawDescriptorSet, {});
+    commandBuffer.bindVertexBuffers(0, *vertices.buffer, {0});
+    commandBuffer.bindIndexBuffer(*indices.buffer, 0, vk::IndexType::eUint32);
+    DrawPushConstants pushConstants{viewProjection, 0};
+    for (uint32_t bucket = 0; bucket < kGpuMaterialCount; bucket++) {
+        pushConstants.material = bucket;
+        commandBuffer.pushConstants(drawPipelineLayout.get(),
+                                    vk::ShaderStageFlagBits::eVertex |
+                                            vk::ShaderStageFlagBits::eFragment,
+                                    0, sizeof(pushConstants), &pushConstants);
+        commandBuffer.drawIndexedIndirectCount(
+                *drawCommands.buffer,
+                bucket * maxDrawsPerBucket *
+                        sizeof(vk::DrawIndexedIndirectCommand),
+                *drawCounts.buffer, bucket * sizeof(uint32_t),
+                maxDrawsPerBucket, sizeof(vk::DrawIndexedIndirectCommand));
+    }
+    commandBuffer.endRenderPass();
+}
+
+void GpuDrivenRenderer::recordPyramid(vk::CommandBuffer commandBuffer) {
+    // without it the pyramid stays at the far plane and occludes nothing
+    vk::Pipeline pipeline = pipelineCompiler->get(pyramidPipeline);
+    if (!pipeline) { return; }
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+    vk::Extent2D source = targets->extent;
+    for (uint32_t level = 0; level < targets->pyramidLevels; level++) {
+        vk::Extent2D destination =
+                level == 0 ? source
+                           : vk::Extent2D(std::max(1u, source.width / 2),
+                                          std::max(1u, source.height / 2));
+        if (0 < level) {
+            // the level below is complete before it is reduced
+            commandBuffer.pipelineBarrier(
+                    vk::PipelineStageFlagBits::eComputeShader,
+                    vk::PipelineStageFlagBits::eComputeShader,
+                    vk::DependencyFlags(),
+                    vk::MemoryBarrier(vk::AccessFlagBits::eShaderWrite,
+                                      vk::AccessFlagBits::eShaderRead),
+                    nullptr, nullptr);
+        }
+        PyramidPushConstants pushConstants{
+                {static_cast<int32_t>(source.width),
+                 static_cast<int32_t>(source.height)},
+                {static_cast<int32_t>(destination.width),
+                 static_cast<int32_t>(destination.height)}};
+        commandBuffer.bindDescriptorSets(
+                vk::PipelineBindPoint::eCompute, *pyramidPipelineLayout, 0,
+                targets->pyramidDescriptorSets[level], {});
+        commandBuffer.pushConstants(pyramidPipelineLayout.get(),
+                                    vk::ShaderStageFlagBits::eCompute, 0,
+                                    sizeof(pushConstants), &pushConstants);
+        commandBuffer.dispatch(
+                (destination.width + kPyramidWorkgroupSize - 1) /
+                        kPyramidWorkgroupSize,
+                (destination.height + kPyramidWorkgroupSize - 1) /
+                        kPyramidWorkgroupSize,
+                1);
+        source = destination;
+    }
+}
+
+void GpuDrivenRenderer::recordStatistics(vk::CommandBuffer commandBuffer) {
+    FrameResources &frame = frames[frameIndex];
+    commandBuffer.copyBuffer(
+            *drawCounts.buffer, *frame.readback.buffer,
+            vk::BufferCopy(0, 0, kGpuMaterialCount * sizeof(uint32_t)));
+    // read on the host once the frame's submission completed
+    commandBuffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer,
+            vk::PipelineStageFlagBits::eHost, vk::DependencyFlags(),
+            vk::MemoryBarrier(vk::AccessFlagBits::eTransferWrite,
+                              vk::AccessFlagBits::eHostRead),
+            nullptr, nullptr);
+    frame.readbackPending = true;
+}
+
+void GpuDrivenRenderer::report(std::ostream &os) const {
+    os << "gpu driven: " << visibleInstances << "/" << instanceCount
+       << " instances visible, " << kGpuMaterialCount
+       << " indirect count draws per frame";
+    if (fallbackFrames != 0) {
+        os << ", " << fallbackFrames << " frames waited for pipelines";
+    }
+    os << std::endl;
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <array>
+#include <deque>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "allocator.h"
+#include "pipeline_compiler.h"
+#include "render_graph.h"
+#include "simd_math.h"
+#include "upload.h"
+
+// draws are bucketed by material, one indirect count draw per bucket
+const uint32_t kGpuMaterialCount = 4;
+// invocations per workgroup of the culling shader
+const uint32_t kCullWorkgroupSize = 64;
+// and of the depth pyramid shader, in each dimension
+const uint32_t kPyramidWorkgroupSize = 8;
+
+// one instance as the shaders see it, std430
+struct GpuInstance {
+    // xyz center, w bounding sphere radius
+    std::array<float, 4> sphere;
+    std::array<float, 4> color;
+    uint32_t material;
+    uint32_t padding[3];
+};
+
+// drawIndirectCount, multiDrawIndirect and drawIndirectFirstInstance,
+// false if the device lacks one of them
+bool enableGpuDrivenFeatures(vk::PhysicalDevice physicalDevice,
+                             vk::PhysicalDeviceFeatures &features,
+                             vk::PhysicalDeviceVulkan12Features &features12);
+
+// the scene drawn without the cpu touching single objects: instances live in
+// a storage buffer, a compute pass tests them against the frustum and a depth
+// pyramid of the previous frame, and appends a draw command per survivor to
+// its material bucket. the scene pass issues one vkCmdDrawIndexedIndirectCount
+// per bucket, and the depth it leaves behind is reduced into the next pyramid
+struct GpuDrivenRenderer {
+    // everything tied to the extent of the render targets. replaced on
+    // resize, the old set lives on until the frames using it finished
+    struct Targets {
+        vk::Extent2D extent;
+        ImageData depth;
+        vk::UniqueImageView depthView;
+        ImageData pyramid;
+        uint32_t pyramidLevels{0};
+        vk::UniqueImageView pyramidView;
+        std::vector<vk::UniqueImageView> pyramidLevelViews;
+        std::vector<vk::UniqueFramebuffer> framebuffers;
+        vk::UniqueDescriptorPool descriptorPool;
+        // per frame in flight
+        std::vector<vk::DescriptorSet> cullDescriptorSets;
+        // per pyramid level
+        std::vector<vk::DescriptorSet> pyramidDescriptorSets;
+        // the pyramid still has to be cleared to the far plane
+        bool initialized{false};
+        // set when retired with a render pass of another format
+        vk::UniqueRenderPass renderPass;
+        uint64_t retireFrame{0};
+    };
+
+    struct FrameResources {
+        BufferData uniforms;
+        // the bucket counts, copied back for statistics
+        BufferData readback;
+        bool readbackPending{false};
+    };
+
+    vk::Device device;
+    DeviceAllocator *allocator;
+    const UploadEngine *uploadEngine;
+    PipelineCompiler *pipelineCompiler;
+    uint32_t instanceCount;
+    uint32_t maxDrawsPerBucket;
+    uint32_t indexCount{0};
+    vk::Format colorFormat;
+    vk::Format depthFormat;
+
+    BufferData vertices;
+    BufferData indices;
+    BufferData instances;
+    BufferData drawCommands;
+    BufferData drawCounts;
+    // the upload batch the static buffers went out with
+    uint64_t uploadBatch{0};
+    bool ready{false};
+
+    vk::UniqueSampler pyramidSampler;
+    vk::UniqueDescriptorSetLayout cullDescriptorSetLayout;
+    vk::UniqueDescriptorSetLayout pyramidDescriptorSetLayout;
+    vk::UniqueDescriptorSetLayout drawDescriptorSetLayout;
+    vk::UniquePipelineLayout cullPipelineLayout;
+    vk::UniquePipelineLayout pyramidPipelineLayout;
+    vk::UniquePipelineLayout drawPipelineLayout;
+    // compiled in the background, passes whose pipeline is not ready yet are
+    // skipped and the frame shows the cleared backbuffer
+    PipelineHandle cullPipeline{kNoPipeline};
+    PipelineHandle pyramidPipeline{kNoPipeline};
+    vk::UniqueRenderPass renderPass;
+    PipelineHandle drawPipeline{kNoPipeline};
+    vk::UniqueDescriptorPool drawDescriptorPool;
+    vk::DescriptorSet drawDescriptorSet;
+
+    std::vector<FrameResources> frames;
+    std::unique_ptr<Targets> targets;
+    std::deque<std::unique_ptr<Targets>> retiredTargets;
+
+    // the frame being recorded
+    uint32_t frameIndex{0};
+    uint32_t imageIndex{0};
+    Mat4 viewProjection;
+    Mat4 previousViewProjection;
+    // instances drawn by the last frame read back
+    uint32_t visibleInstances{0};
+    // frames recorded while a pipeline was still compiling
+    uint64_t fallbackFrames{0};
+
+    GpuDrivenRenderer(vk::PhysicalDevice physicalDevice,
+                      vk::UniqueDevice &device, DeviceAllocator &allocator,
+                      UploadEngine &uploadEngine,
+                      PipelineCompiler &pipelineCompiler,
+                      vk::Format colorFormat, uint32_t framesInFlight,
+                      uint32_t instanceCount);
+    // waits for the compilations that read the renderer's layouts
+    ~GpuDrivenRenderer() noexcept;
+    GpuDrivenRenderer(const GpuDrivenRenderer &) = delete;
+    GpuDrivenRenderer &operator=(const GpuDrivenRenderer &) = delete;
+
+    // creates the render targets and a framebuffer per color view. the
+    // previous ones are released once retireFrame has started
+    void resize(vk::Format colorFormat,
+                const std::vector<vk::UniqueImageView> &colorViews,
+                const vk::Extent2D &extent, uint64_t retireFrame);
+    // imports the renderer's buffers and images and adds the cull, scene,
+    // pyramid and statistics passes, the scene pass writes the backbuffer
+    void addPasses(RenderGraph &graph, ResourceHandle backbuffer);
+    // after the frame's submission was waited for and the uploads were
+    // acquired, before the graph is executed
+    void beginFrame(vk::CommandBuffer commandBuffer, uint32_t frameIndex,
+                    uint32_t imageIndex, uint64_t frameNumber);
+
+    void report(std::ostream &os) const;
+
+private:
+    void createPipelines();
+    vk::UniqueRenderPass createRenderPass(vk::Format colorFormat) const;
+    PipelineHandle requestDrawPipeline(vk::Format colorFormat);
+    void updateCamera(uint64_t frameNumber);
+    void recordCull(vk::CommandBuffer commandBuffer);
+    void recordScene(vk::CommandBuffer commandBuffer);
+    void recordPyramid(vk::CommandBuffer commandBuffer);
+    void recordStatistics(vk::CommandBuffer commandBuffer);
+};
@@ -0,0 +1,48 @@
+#include "headless_context.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+QueueFamilyIndices findQueueFamilyIndices(vk::PhysicalDevice physicalDevice) {
+    std::vector<vk::QueueFamilyProperties> properties =
+            physicalDevice.getQueueFamilyProperties();
+    uint32_t graphics = findGraphicsQueueFamilyIndex(properties);
+    return {graphics, findTransferQueueFamilyIndex(properties, graphics),
+            findComputeQueueFamilyIndex(properties, graphics)};
+}
+
+vk::UniqueDevice createHeadlessDevice(vk::PhysicalDevice physicalDevice,
+                                      const QueueFamilyIndices &families,
+                                      bool swapchain) {
+    vk::PhysicalDeviceVulkan12Features vulkan12Features;
+    if (!enableTimelineSemaphores(physicalDevice, vulkan12Features)) {
+        throw std::runtime_error("timeline semaphores not supported");
+    }
+    return createDevice(physicalDevice,
+                        {families.graphics, families.transfer,
+                         families.compute},
+                        getDeviceExtensions(physicalDevice, !swapchain),
+                        nullptr, &vulkan12Features);
+}
+
+HeadlessContext::HeadlessContext(
+        const std::string &appName,
+        const std::vector<std::string> &instanceExtensions,
+        vk::DeviceSize stagingSize)
+    : instance(createInstance(appName, "light", 1, 1, VK_API_VERSION_1_2, {},
+                              instanceExtensions)),
+      deviceSelection(selectPhysicalDevice(*instance, DeviceRequirements())),
+      physicalDevice(deviceSelection.physicalDevice),
+      families(findQueueFamilyIndices(physicalDevice)),
+      swapchain(std::find(instanceExtensions.begin(),
+                          instanceExtensions.end(),
+                          VK_KHR_SURFACE_EXTENSION_NAME) !=
+                        instanceExtensions.end() &&
+                isDeviceExtensionSupported(physicalDevice,
+                                           VK_KHR_SWAPCHAIN_EXTENSION_NAME)),
+      device(createHeadlessDevice(physicalDevice, families, swapchain)),
+      scheduler(device, families.graphics, families.compute,
+                families.transfer),
+      allocator(physicalDevice, device),
+      uploadEngine(physicalDevice, device, allocator, scheduler, stagingSize) {
+}
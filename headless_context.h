@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "allocator.h"
+#include "device.h"
+#include "submission.h"
+#include "upload.h"
+
+struct QueueFamilyIndices {
+    uint32_t graphics;
+    uint32_t transfer;
+    uint32_t compute;
+};
+
+QueueFamilyIndices findQueueFamilyIndices(vk::PhysicalDevice physicalDevice);
+// as the renderer creates it, with the features the scheduler requires.
+// VK_KHR_swapchain only with swapchain, which needs VK_KHR_surface on the
+// instance
+vk::UniqueDevice createHeadlessDevice(vk::PhysicalDevice physicalDevice,
+                                      const QueueFamilyIndices &families,
+                                      bool swapchain);
+
+// an instance, the selected device and the scheduler, allocator and upload
+// engine on it, without a window. what the tests and the benchmark run on
+struct HeadlessContext {
+    vk::UniqueInstance instance;
+    DeviceSelection deviceSelection;
+    vk::PhysicalDevice physicalDevice;
+    QueueFamilyIndices families;
+    // the instance extensions include VK_KHR_surface and the device has
+    // VK_KHR_swapchain
+    bool swapchain;
+    vk::UniqueDevice device;
+    SubmissionScheduler scheduler;
+    DeviceAllocator allocator;
+    UploadEngine uploadEngine;
+
+    explicit HeadlessContext(
+            const std::string &appName,
+            const std::vector<std::string> &instanceExtensions = {},
+            vk::DeviceSize stagingSize = kDefaultStagingSize);
+    HeadlessContext(const HeadlessContext &) = delete;
+    HeadlessContext &operator=(const HeadlessContext &) = delete;
+};
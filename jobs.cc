@@ -0,0 +1,182 @@
+#include "jobs.h"
+
+#include <cassert>
+
+const uint32_t kJobDequeCapacity = 4096;
+
+WorkStealingDeque::WorkStealingDeque(uint32_t capacity)
+    : buffer(new std::atomic<Job *>[capacity]), mask(capacity - 1) {
+    assert((capacity & (capacity - 1)) == 0);
+}
+
+bool WorkStealingDeque::push(Job *job) {
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    int64_t t = top.load(std::memory_order_acquire);
+    if (mask < b - t) { return false; }
+    buffer[b & mask].store(job, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(b + 1, std::memory_order_relaxed);
+    return true;
+}
+
+Job *WorkStealingDeque::pop() {
+    int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top.load(std::memory_order_relaxed);
+    if (b < t) {
+        // empty
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    Job *job = buffer[b & mask].load(std::memory_order_relaxed);
+    if (t == b) {
+        // the last job, race the thieves for it
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                         std::memory_order_relaxed)) {
+            job = nullptr;
+        }
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return job;
+}
+
+Job *WorkStealingDeque::steal() {
+    int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom.load(std::memory_order_acquire);
+    if (b <= t) { return nullptr; }
+    Job *job = buffer[t & mask].load(std::memory_order_relaxed);
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                     std::memory_order_relaxed)) {
+        // lost against the owner or another thief
+        return nullptr;
+    }
+    return job;
+}
+
+JobSystem::JobSystem(uint32_t workerCount) {
+    deques.reserve(workerCount + 1);
+    inboxes.reserve(workerCount + 1);
+    for (uint32_t i = 0; i <= workerCount; i++) {
+        deques.push_back(
+                std::make_unique<WorkStealingDeque>(kJobDequeCapacity));
+        inboxes.push_back(std::make_unique<Inbox>());
+    }
+    workers.reserve(workerCount);
+    for (uint32_t i = 1; i <= workerCount; i++) {
+        workers.emplace_back(&JobSystem::workerMain, this, i);
+    }
+}
+
+JobSystem::~JobSystem() noexcept {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &worker : workers) { worker.join(); }
+}
+
+void JobSystem::drainInbox(uint32_t threadIndex) {
+    Inbox &inbox = *inboxes[threadIndex];
+    if (!inbox.pending.load(std::memory_order_acquire)) { return; }
+    std::lock_guard<std::mutex> lock(inbox.mutex);
+    size_t pushed = 0;
+    // handed over highest index first, so pop returns the lowest
+    while (pushed < inbox.jobs.size() &&
+           deques[threadIndex]->push(inbox.jobs[pushed])) {
+        pushed++;
+    }
+    inbox.jobs.erase(inbox.jobs.begin(), inbox.jobs.begin() + pushed);
+    inbox.pending.store(!inbox.jobs.empty(), std::memory_order_release);
+}
+
+bool JobSystem::execute(uint32_t threadIndex) {
+    drainInbox(threadIndex);
+    Job *job = deques[threadIndex]->pop();
+    for (size_t i = 1; !job && i < deques.size(); i++) {
+        job = deques[(threadIndex + i) % deques.size()]->steal();
+    }
+    // a worker that has not woken up yet still holds its share in the inbox
+    for (size_t i = 1; !job && i < inboxes.size(); i++) {
+        Inbox &inbox = *inboxes[(threadIndex + i) % inboxes.size()];
+        if (!inbox.pending.load(std::memory_order_acquire)) { continue; }
+        std::lock_guard<std::mutex> lock(inbox.mutex);
+        if (inbox.jobs.empty()) { continue; }
+        // the highest index, the one its owner would run last
+        job = inbox.jobs.front();
+        inbox.jobs.erase(inbox.jobs.begin());
+        inbox.pending.store(!inbox.jobs.empty(), std::memory_order_release);
+    }
+    if (!job) { return false; }
+    queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+    executedJobs.fetch_add(1, std::memory_order_relaxed);
+    if (job->index % threadCount() != threadIndex) {
+        stolenJobs.fetch_add(1, std::memory_order_relaxed);
+    }
+    (*job->function)(job->index, threadIndex);
+    // release, so the owner sees everything the job wrote once it is done
+    job->remaining->fetch_sub(1, std::memory_order_release);
+    return true;
+}
+
+void JobSystem::workerMain(uint32_t threadIndex) {
+    while (!stopping.load(std::memory_order_relaxed)) {
+        if (execute(threadIndex)) { continue; }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [this]() {
+            return stopping.load(std::memory_order_relaxed) ||
+                   0 < queuedJobs.load(std::memory_order_relaxed);
+        });
+    }
+}
+
+void JobSystem::parallelFor(
+        uint32_t count,
+        const std::function<void(uint32_t index, uint32_t threadIndex)>
+                &function) {
+    if (workers.empty() || count == 1) {
+        for (uint32_t i = 0; i < count; i++) { function(i, 0); }
+        return;
+    }
+
+    std::atomic<uint32_t> remaining{count};
+    std::vector<Job> jobs(count);
+    for (uint32_t i = 0; i < count; i++) {
+        jobs[i] = {&function, i, &remaining};
+    }
+    queuedJobs.fetch_add(count, std::memory_order_relaxed);
+    // index i goes to thread i % threadCount, each share in reverse so that
+    // its thread runs the first indices and thieves take from the far end
+    uint32_t threads = threadCount();
+    for (uint32_t threadIndex = 1;
+         threadIndex < threads && threadIndex < count; threadIndex++) {
+        Inbox &inbox = *inboxes[threadIndex];
+        std::lock_guard<std::mutex> lock(inbox.mutex);
+        uint32_t last = threadIndex +
+                        (count - 1 - threadIndex) / threads * threads;
+        for (uint32_t i = last; threadIndex <= i && i < count; i -= threads) {
+            inbox.jobs.push_back(&jobs[i]);
+        }
+        inbox.pending.store(true, std::memory_order_release);
+    }
+    for (uint32_t i = (count - 1) / threads * threads; i < count;
+         i -= threads) {
+        if (!deques[0]->push(&jobs[i])) {
+            queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+            function(i, 0);
+            remaining.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+    {
+        // taken so that a worker between its check and its wait cannot miss
+        // the notification
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wake.notify_all();
+
+    while (0 < remaining.load(std::memory_order_acquire)) {
+        if (!execute(0)) { std::this_thread::yield(); }
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// work items of a parallelFor live on the caller's stack until it returns
+struct Job {
+    const std::function<void(uint32_t index, uint32_t threadIndex)> *function;
+    uint32_t index;
+    std::atomic<uint32_t> *remaining;
+};
+
+// chase-lev deque: the owning thread pushes and pops at the bottom without
+// contention, other threads steal from the top
+struct WorkStealingDeque {
+    explicit WorkStealingDeque(uint32_t capacity);
+
+    // owner only, false when full
+    bool push(Job *job);
+    // owner only
+    Job *pop();
+    // any thread
+    Job *steal();
+
+private:
+    std::unique_ptr<std::atomic<Job *>[]> buffer;
+    int64_t mask;
+    std::atomic<int64_t> top{0};
+    std::atomic<int64_t> bottom{0};
+};
+
+// a fixed pool of workers that steal from each other's deques. the thread
+// that owns the system takes part as thread 0, so a system with no workers
+// runs everything inline. parallelFor hands the jobs out round robin, every
+// thread works through its own share and only steals once that ran dry
+struct JobSystem {
+    explicit JobSystem(uint32_t workerCount);
+    ~JobSystem() noexcept;
+    JobSystem(const JobSystem &) = delete;
+    JobSystem &operator=(const JobSystem &) = delete;
+
+    uint32_t threadCount() const {
+        return static_cast<uint32_t>(workers.size()) + 1;
+    }
+    // jobs run off the deques so far, and those of them that a thread other
+    // than the one they were handed to ran
+    uint64_t executedJobCount() const {
+        return executedJobs.load(std::memory_order_relaxed);
+    }
+    uint64_t stolenJobCount() const {
+        return stolenJobs.load(std::memory_order_relaxed);
+    }
+    // runs function(index, threadIndex) for every index below count and
+    // returns once all of them finished. owner thread only, not reentrant
+    void parallelFor(
+            uint32_t count,
+            const std::function<void(uint32_t index, uint32_t threadIndex)>
+                    &function);
+
+private:
+    // jobs handed to a worker by the owner, which cannot push onto another
+    // thread's deque. the worker moves them onto its own deque
+    struct Inbox {
+        std::mutex mutex;
+        std::vector<Job *> jobs;
+        std::atomic<bool> pending{false};
+    };
+
+    // moves the thread's handed jobs onto its deque
+    void drainInbox(uint32_t threadIndex);
+    // runs one job from the thread's own deque or a stolen one
+    bool execute(uint32_t threadIndex);
+    void workerMain(uint32_t threadIndex);
+
+    std::vector<std::unique_ptr<WorkStealingDeque>> deques;
+    std::vector<std::unique_ptr<Inbox>> inboxes;
+    std::vector<std::thread> workers;
+    std::atomic<bool> stopping{false};
+    // pushed and not yet taken by any thread, idle workers sleep while 0
+    std::atomic<uint32_t> queuedJobs{0};
+    std::atomic<uint64_t> executedJobs{0};
+    std::atomic<uint64_t> stolenJobs{0};
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+};
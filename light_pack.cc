@@ -0,0 +1,448 @@
+// packs meshes (wavefront obj) and textures (binary ppm) into an asset pack
+// that light maps and uploads without parsing:
+//
+//   light_pack -o scene.lpak mesh.obj albedo.ppm ...
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+#include "asset_format.h"
+#include "texel_block.h"
+
+namespace {
+
+struct Mesh {
+    std::string name;
+    std::vector<AssetVertex> vertices;
+    std::vector<uint32_t> indices;
+};
+
+struct Texture {
+    std::string name;
+    uint32_t width;
+    uint32_t height;
+    // rgba8, largest level first
+    std::vector<std::vector<uint8_t>> mips;
+};
+
+std::string baseName(const std::string &path) {
+    size_t slash = path.find_last_of("/\\");
+    std::string name =
+            slash == std::string::npos ? path : path.substr(slash + 1);
+    return name.substr(0, name.find_last_of('.'));
+}
+
+bool hasExtension(const std::string &path, const std::string &extension) {
+    return extension.size() <= path.size() &&
+           std::equal(extension.rbegin(), extension.rend(), path.rbegin(),
+                      [](char a, char b) { return a == std::tolower(b); });
+}
+
+// obj indices are 1-based, negative ones count back from the last element
+uint32_t resolveIndex(long index, size_t count, const std::string &path) {
+    long resolved = index < 0 ? static_cast<long>(count) + index : index - 1;
+    if (resolved < 0 || static_cast<size_t>(resolved) >= count) {
+        throw std::runtime_error(path + ": index out of range");
+    }
+    return static_cast<uint32_t>(resolved);
+}
+
+Mesh loadObj(const std::string &path) {
+    std::ifstream file(path);
+    if (!file) { throw std::runtime_error("failed to open " + path); }
+
+    std::vector<std::array<float, 3>> positions;
+    std::vector<std::array<float, 3>> normals;
+    std::vector<std::array<float, 2>> uvs;
+    Mesh mesh;
+    mesh.name = baseName(path);
+    // position, uv and normal index, ~0u where missing, to the vertex
+    struct Key {
+        uint32_t position, uv, normal;
+        bool operator==(const Key &o) const {
+            return position == o.position && uv == o.uv && normal == o.normal;
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key &k) const {
+            return (static_cast<size_t>(k.position) * 73856093u) ^
+                   (static_cast<size_t>(k.uv) * 19349663u) ^
+                   (static_cast<size_t>(k.normal) * 83492791u);
+        }
+    };
+    std::unordered_map<Key, uint32_t, KeyHash> vertexIndices;
+
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream is(line);
+        std::string type;
+        is >> type;
+        if (type == "v") {
+            std::array<float, 3> p{};
+            is >> p[0] >> p[1] >> p[2];
+            positions.push_back(p);
+        } else if (type == "vn") {
+            std::array<float, 3> n{};
+            is >> n[0] >> n[1] >> n[2];
+            normals.push_back(n);
+        } else if (type == "vt") {
+            std::array<float, 2> t{};
+            is >> t[0] >> t[1];
+            // obj puts v = 0 at the bottom, vulkan at the top
+            uvs.push_back({t[0], 1.0f - t[1]});
+        } else if (type == "f") {
+            std::vector<uint32_t> face;
+            std::string corner;
+            while (is >> corner) {
+                Key key{~0u, ~0u, ~0u};
+                // v, v/vt, v//vn or v/vt/vn
+                size_t first = corner.find('/');
+                key.position = resolveIndex(std::stol(corner.substr(0, first)),
+                                            positions.size(), path);
+                if (first != std::string::npos) {
+                    size_t second = corner.find('/', first + 1);
+                    std::string uv = corner.substr(
+                            first + 1, second == std::string::npos
+                                               ? std::string::npos
+                                               : second - first - 1);
+                    if (!uv.empty()) {
+                        key.uv = resolveIndex(std::stol(uv), uvs.size(), path);
+                    }
+                    if (second != std::string::npos) {
+                        key.normal = resolveIndex(
+                                std::stol(corner.substr(second + 1)),
+                                normals.size(), path);
+                    }
+                }
+                auto [it, inserted] = vertexIndices.emplace(
+                        key, static_cast<uint32_t>(mesh.vertices.size()));
+                if (inserted) {
+                    AssetVertex vertex{};
+                    std::copy_n(positions[key.position].data(), 3,
+                                vertex.position);
+                    if (key.normal != ~0u) {
+                        std::copy_n(normals[key.normal].data(), 3,
+                                    vertex.normal);
+                    }
+                    if (key.uv != ~0u) {
+                        std::copy_n(uvs[key.uv].data(), 2, vertex.uv);
+                    }
+                    mesh.vertices.push_back(vertex);
+                }
+                face.push_back(it->second);
+            }
+            // polygons are fanned around their first corner
+            for (size_t i = 2; i < face.size(); i++) {
+                mesh.indices.insert(mesh.indices.end(),
+                                    {face[0], face[i - 1], face[i]});
+            }
+        }
+    }
+    if (mesh.indices.empty()) {
+        throw std::runtime_error(path + ": no faces");
+    }
+
+    if (normals.empty()) {
+        // area weighted smooth normals for files that have none
+        for (auto &vertex : mesh.vertices) {
+            std::fill_n(vertex.normal, 3, 0.0f);
+        }
+        for (size_t i = 0; i < mesh.indices.size(); i += 3) {
+            const float *a = mesh.vertices[mesh.indices[i]].position;
+            const float *b = mesh.vertices[mesh.indices[i + 1]].position;
+            const float *c = mesh.vertices[mesh.indices[i + 2]].position;
+            float e0[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+            float e1[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+            float n[3] = {e0[1] * e1[2] - e0[2] * e1[1],
+                          e0[2] * e1[0] - e0[0] * e1[2],
+                          e0[0] * e1[1] - e0[1] * e1[0]};
+            for (size_t j = 0; j < 3; j++) {
+                float *normal = mesh.vertices[mesh.indices[i + j]].normal;
+                for (int k = 0; k < 3; k++) { normal[k] += n[k]; }
+            }
+        }
+        for (auto &vertex : mesh.vertices) {
+            float *n = vertex.normal;
+            float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            if (0.0f < length) {
+                for (int k = 0; k < 3; k++) { n[k] /= length; }
+            }
+        }
+    }
+    return mesh;
+}
+
+// vertices in the order the index stream first touches them, so that vertex
+// fetches walk memory forwards instead of jumping around
+void optimizeVertexOrder(Mesh &mesh) {
+    std::vector<uint32_t> remap(mesh.vertices.size(), ~0u);
+    std::vector<AssetVertex> vertices;
+    vertices.reserve(mesh.vertices.size());
+    for (uint32_t &index : mesh.indices) {
+        if (remap[index] == ~0u) {
+            remap[index] = static_cast<uint32_t>(vertices.size());
+            vertices.push_back(mesh.vertices[index]);
+        }
+        index = remap[index];
+    }
+    mesh.vertices = std::move(vertices);
+}
+
+float srgbToLinear(uint8_t value) {
+    float c = value / 255.0f;
+    return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+uint8_t linearToSrgb(float c) {
+    c = c <= 0.0031308f ? c * 12.92f
+                        : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+    return static_cast<uint8_t>(std::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+Texture loadPpm(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) { throw std::runtime_error("failed to open " + path); }
+    // header fields are separated by whitespace and may have comments
+    auto field = [&file]() {
+        std::string token;
+        while (file >> token && token[0] == '#') {
+            file.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        }
+        return token;
+    };
+    if (field() != "P6") {
+        throw std::runtime_error(path + ": not a binary ppm");
+    }
+    Texture texture;
+    texture.name = baseName(path);
+    texture.width = static_cast<uint32_t>(std::stoul(field()));
+    texture.height = static_cast<uint32_t>(std::stoul(field()));
+    if (field() != "255") {
+        throw std::runtime_error(path + ": only 8 bit ppm is supported");
+    }
+    file.get();
+
+    std::vector<uint8_t> rgb(size_t(texture.width) * texture.height * 3);
+    if (!file.read(reinterpret_cast<char *>(rgb.data()),
+                   static_cast<std::streamsize>(rgb.size()))) {
+        throw std::runtime_error(path + ": truncated");
+    }
+    std::vector<uint8_t> rgba(size_t(texture.width) * texture.height * 4);
+    for (size_t i = 0; i < size_t(texture.width) * texture.height; i++) {
+        std::copy_n(&rgb[i * 3], 3, &rgba[i * 4]);
+        rgba[i * 4 + 3] = 255;
+    }
+    texture.mips.push_back(std::move(rgba));
+    return texture;
+}
+
+// box filtered down to 1x1, averaged in linear space
+void generateMips(Texture &texture) {
+    uint32_t width = texture.width;
+    uint32_t height = texture.height;
+    while ((1 < width || 1 < height) && texture.mips.size() < kMaxAssetMips) {
+        uint32_t mipWidth = std::max(1u, width / 2);
+        uint32_t mipHeight = std::max(1u, height / 2);
+        const std::vector<uint8_t> &source = texture.mips.back();
+        std::vector<uint8_t> mip(size_t(mipWidth) * mipHeight * 4);
+        for (uint32_t y = 0; y < mipHeight; y++) {
+            for (uint32_t x = 0; x < mipWidth; x++) {
+                uint32_t x0 = std::min(x * 2, width - 1);
+                uint32_t x1 = std::min(x * 2 + 1, width - 1);
+                uint32_t y0 = std::min(y * 2, height - 1);
+                uint32_t y1 = std::min(y * 2 + 1, height - 1);
+                for (uint32_t c = 0; c < 4; c++) {
+                    auto at = [&](uint32_t sx, uint32_t sy) {
+                        return source[(size_t(sy) * width + sx) * 4 + c];
+                    };
+                    uint8_t &out = mip[(size_t(y) * mipWidth + x) * 4 + c];
+                    if (c == 3) {
+                        out = static_cast<uint8_t>(
+                                (at(x0, y0) + at(x1, y0) + at(x0, y1) +
+                                 at(x1, y1) + 2) /
+                                4);
+                    } else {
+                        out = linearToSrgb(
+                                (srgbToLinear(at(x0, y0)) +
+                                 srgbToLinear(at(x1, y0)) +
+                                 srgbToLinear(at(x0, y1)) +
+                                 srgbToLinear(at(x1, y1))) /
+                                4.0f);
+                    }
+                }
+            }
+        }
+        texture.mips.push_back(std::move(mip));
+        width = mipWidth;
+        height = mipHeight;
+    }
+}
+
+void copyName(char (&destination)[kAssetNameLength], const std::string &name) {
+    memset(destination, 0, kAssetNameLength);
+    strncpy(destination, name.c_str(), kAssetNameLength - 1);
+}
+
+// sections are appended at aligned offsets, the tables are written last
+struct PackWriter {
+    std::ofstream file;
+    uint64_t offset{0};
+
+    explicit PackWriter(const std::string &path)
+        : file(path, std::ios::binary | std::ios::trunc) {
+        if (!file) { throw std::runtime_error("failed to create " + path); }
+    }
+
+    void pad(uint64_t alignment) {
+        static const char zeros[kAssetAlignment] = {};
+        uint64_t aligned = (offset + alignment - 1) / alignment * alignment;
+        file.write(zeros, static_cast<std::streamsize>(aligned - offset));
+        offset = aligned;
+    }
+
+    AssetSection append(const void *data, uint64_t size) {
+        pad(kAssetAlignment);
+        AssetSection section{offset, size};
+        file.write(static_cast<const char *>(data),
+                   static_cast<std::streamsize>(size));
+        offset += size;
+        return section;
+    }
+};
+
+void writePack(const std::string &path, const std::vector<Mesh> &meshes,
+               const std::vector<Texture> &textures) {
+    PackWriter writer(path);
+    AssetHeader header{};
+    header.magic = kAssetMagic;
+    header.version = kAssetVersion;
+    header.meshCount = static_cast<uint32_t>(meshes.size());
+    header.textureCount = static_cast<uint32_t>(textures.size());
+    // the header is rewritten once the tables are placed
+    writer.append(&header, sizeof(header));
+
+    std::vector<AssetMesh> meshTable;
+    for (const Mesh &mesh : meshes) {
+        AssetMesh entry{};
+        copyName(entry.name, mesh.name);
+        entry.vertexCount = static_cast<uint32_t>(mesh.vertices.size());
+        entry.indexCount = static_cast<uint32_t>(mesh.indices.size());
+        entry.vertexStride = sizeof(AssetVertex);
+        entry.vertices = writer.append(mesh.vertices.data(),
+                                       mesh.vertices.size() *
+                                               sizeof(AssetVertex));
+        if (mesh.vertices.size() <= 0xffff) {
+            std::vector<uint16_t> indices(mesh.indices.begin(),
+                                          mesh.indices.end());
+            entry.indexType = VK_INDEX_TYPE_UINT16;
+            entry.indices = writer.append(indices.data(),
+                                          indices.size() * sizeof(uint16_t));
+        } else {
+            entry.indexType = VK_INDEX_TYPE_UINT32;
+            entry.indices = writer.append(mesh.indices.data(),
+                                          mesh.indices.size() *
+                                                  sizeof(uint32_t));
+        }
+        std::fill_n(entry.boundsMin, 3, std::numeric_limits<float>::max());
+        std::fill_n(entry.boundsMax, 3, -std::numeric_limits<float>::max());
+        for (const AssetVertex &vertex : mesh.vertices) {
+            for (int k = 0; k < 3; k++) {
+                entry.boundsMin[k] =
+                        std::min(entry.boundsMin[k], vertex.position[k]);
+                entry.boundsMax[k] =
+                        std::max(entry.boundsMax[k], vertex.position[k]);
+            }
+        }
+        meshTable.push_back(entry);
+    }
+
+    std::vector<AssetTexture> textureTable;
+    for (const Texture &texture : textures) {
+        AssetTexture entry{};
+        copyName(entry.name, texture.name);
+        entry.format = VK_FORMAT_R8G8B8A8_SRGB;
+        entry.width = texture.width;
+        entry.height = texture.height;
+        entry.mipCount = static_cast<uint32_t>(texture.mips.size());
+        for (uint32_t i = 0; i < entry.mipCount; i++) {
+            // the runtime refuses levels of any other size
+            std::optional<uint64_t> size =
+                    mipByteSize(static_cast<VkFormat>(entry.format),
+                                entry.width, entry.height, i);
+            if (!size || texture.mips[i].size() != *size) {
+                throw std::runtime_error(texture.name + ": mip " +
+                                         std::to_string(i) +
+                                         " does not match its format");
+            }
+            entry.mips[i] = writer.append(texture.mips[i].data(),
+                                          texture.mips[i].size());
+        }
+        textureTable.push_back(entry);
+    }
+
+    header.meshTableOffset =
+            writer.append(meshTable.data(),
+                          meshTable.size() * sizeof(AssetMesh))
+                    .offset;
+    header.textureTableOffset =
+            writer.append(textureTable.data(),
+                          textureTable.size() * sizeof(AssetTexture))
+                    .offset;
+    header.fileSize = writer.offset;
+    writer.file.seekp(0);
+    writer.file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    if (!writer.file.flush()) {
+        throw std::runtime_error("failed to write " + path);
+    }
+}
+
+}// namespace
+
+int main(int argc, char *argv[]) {
+    try {
+        std::string output;
+        std::vector<Mesh> meshes;
+        std::vector<Texture> textures;
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "-o" && i + 1 < argc) {
+                output = argv[++i];
+            } else if (hasExtension(arg, ".obj")) {
+                meshes.push_back(loadObj(arg));
+                optimizeVertexOrder(meshes.back());
+            } else if (hasExtension(arg, ".ppm")) {
+                textures.push_back(loadPpm(arg));
+                generateMips(textures.back());
+            } else {
+                throw std::runtime_error("unknown input: " + arg);
+            }
+        }
+        if (output.empty()) {
+            std::cerr << "usage: light_pack -o <pack> "
+                         "<mesh.obj|texture.ppm>..."
+                      << std::endl;
+            return EXIT_FAILURE;
+        }
+        writePack(output, meshes, textures);
+        std::cout << output << ": " << meshes.size() << " meshes, "
+                  << textures.size() << " textures" << std::endl;
+    } catch (std::exception &ex) {
+        std::cerr << "std::exception: " << ex.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -1,20 +1,55 @@
+#include <chrono>
+#include <cmath>
+#include <deque>
 #include <iostream>
+#include <optional>
 
 #define VULKAN_HPP_DISPATCH_LOADER_DYNAMIC 1
 
 #include <vulkan/vulkan.hpp>
 
-#if (VULKAN_HPP_DISPATCH_LOADER_DYNAMIC == 1)
-VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
-#endif
-
 #define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>// GLFW should be included after vulkan
 
+#include "allocator.h"
+#include "asset_pack.h"
+#include "bindless.h"
+#include "capture.h"
+#include "debug_sink.h"
+#include "device.h"
+#include "gpu_driven.h"
+#include "jobs.h"
+#include "pipeline_cache.h"
+#include "pipeline_compiler.h"
+#include "profiler.h"
+#include "recorder.h"
+#include "render_graph.h"
+#include "scene.h"
+#include "submission.h"
+#include "swapchain.h"
+#include "texture_streamer.h"
+#include "upload.h"
+
 const char *const kAppName = "Light";
 const char *const kEngineName = "Vulkan";
 const uint32_t kWidth = 64;
 const uint32_t kHeight = 64;
+const uint32_t kOffscreenImageCount = 3;
+const uint32_t kFramesInFlight = 2;
+const uint64_t kHeadlessFrameCount = 1000;
+const size_t kPresentStatsWindow = 1024;
+const uint32_t kObjectCount = 4096;
+const vk::DeviceSize kDefaultTextureBudget = 256ull << 20;
+// the loop of textured quads the viewer walks along, see
+// requestVisibleTextures
+const float kTextureSpacing = 4.0f;
+const float kTextureQuadSize = 2.0f;
+const float kTextureViewDistance = 32.0f;
+const float kTextureNearDistance = 0.5f;
+// units per frame
+const float kViewerSpeed = 0.05f;
+// tangent of half the viewer's 60 degree vertical field of view
+const float kViewerHalfFovTangent = 0.57735f;
 
 #pragma region classes
 
@@ -53,137 +88,13 @@ Window::~Window() noexcept { glfwDestroyWindow(window); }
 
 #pragma endregion
 
-#pragma region math utils
-
-template<typename T>
-VULKAN_HPP_INLINE constexpr const T &clamp(const T &v, const T &low,
-                                           const T &height) {
-    return v < low ? low : height < v ? height : v;
-}
-
-#pragma endregion
-
 #pragma region vulkan utils
 
-VKAPI_ATTR VkBool32 VKAPI_CALL debugUtilsMessengerCallback(
-        VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
-        VkDebugUtilsMessageTypeFlagsEXT messageTypes,
-        VkDebugUtilsMessengerCallbackDataEXT const *callbackData,
-        void * /*userData*/) {
-    std::cerr << vk::to_string(
-                         static_cast<vk::DebugUtilsMessageSeverityFlagBitsEXT>(
-                                 messageSeverity))
-              << ": "
-              << vk::to_string(static_cast<vk::DebugUtilsMessageTypeFlagsEXT>(
-                         messageTypes))
-              << ":\n";
-    std::cerr << "\t"
-              << "messageIDName   = <" << callbackData->pMessageIdName << ">\n";
-    std::cerr << "\t"
-              << "messageIdNumber = " << callbackData->messageIdNumber << "\n";
-    std::cerr << "\t"
-              << "message         = <" << callbackData->pMessage << ">\n";
-    if (0 < callbackData->queueLabelCount) {
-        std::cerr << "\t"
-                  << "Queue Labels:\n";
-        for (uint8_t i = 0; i < callbackData->queueLabelCount; i++) {
-            std::cerr << "\t\t"
-                      << "labelName = <"
-                      << callbackData->pQueueLabels[i].pLabelName << ">\n";
-        }
-    }
-    if (0 < callbackData->cmdBufLabelCount) {
-        std::cerr << "\t"
-                  << "CommandBuffer Labels:\n";
-        for (uint8_t i = 0; i < callbackData->cmdBufLabelCount; i++) {
-            std::cerr << "\t\t"
-                      << "labelName = <"
-                      << callbackData->pCmdBufLabels[i].pLabelName << ">\n";
-        }
-    }
-    if (0 < callbackData->objectCount) {
-        std::cerr << "\t"
-                  << "Objects:\n";
-        for (uint8_t i = 0; i < callbackData->objectCount; i++) {
-            std::cerr << "\t\t"
-                      << "Object " << i << "\n";
-            std::cerr << "\t\t\t"
-                      << "objectType   = "
-                      << vk::to_string(static_cast<vk::ObjectType>(
-                                 callbackData->pObjects[i].objectType))
-                      << "\n";
-            std::cerr << "\t\t\t"
-                      << "objectHandle = "
-                      << callbackData->pObjects[i].objectHandle << "\n";
-            if (callbackData->pObjects[i].pObjectName) {
-                std::cerr << "\t\t\t"
-                          << "objectName   = <"
-                          << callbackData->pObjects[i].pObjectName << ">\n";
-            }
-        }
-    }
-    return VK_TRUE;
-}
-
-vk::UniqueInstance
-createInstance(const std::string &appName, const std::string &engineName,
-               uint32_t appVersion, uint32_t engineVersion, uint32_t apiVersion,
-               const std::vector<std::string> &layers = {},
-               const std::vector<std::string> &extensions = {}) {
-#if (VULKAN_HPP_DISPATCH_LOADER_DYNAMIC == 1)
-    static vk::DynamicLoader dl;
-    auto vkGetInstanceProcAddr = dl.getProcAddress<PFN_vkGetInstanceProcAddr>(
-            "vkGetInstanceProcAddr");
-    VULKAN_HPP_DEFAULT_DISPATCHER.init(vkGetInstanceProcAddr);
-#endif
-
-#ifndef NDEBUG
-    std::vector<vk::LayerProperties> layerProperties =
-            vk::enumerateInstanceLayerProperties();
-    std::vector<vk::ExtensionProperties> extensionProperties =
-            vk::enumerateInstanceExtensionProperties();
-#endif
-
-    std::vector<const char *> enabledLayers;
-    enabledLayers.reserve(layers.size());
-    for (const auto &layer : layers) {
-        assert(std::find_if(layerProperties.begin(), layerProperties.end(),
-                            [layer](const auto &lp) {
-                                return layer == lp.layerName;
-                            }) != layerProperties.end());
-        enabledLayers.push_back(layer.data());
-    }
-
-#ifndef NDEBUG
-    // enable validation layer to find as much errors as possible
-    std::vector<std::string> instanceDebugLayers = {
-            // standard validation layer
-            "VK_LAYER_KHRONOS_validation",
-            "VK_LAYER_LUNARG_assistant_layer",
-            // RenderDoc
-            "VK_LAYER_RENDERDOC_Capture",
-    };
-    for (const auto &layer : instanceDebugLayers) {
-        if (std::find(layers.begin(), layers.end(), layer) == layers.end() &&
-            std::find_if(layerProperties.begin(), layerProperties.end(),
-                         [layer](const auto &lp) {
-                             return layer == lp.layerName;
-                         }) != layerProperties.end()) {
-            enabledLayers.push_back(layer.c_str());
-        }
-    }
-#endif
-
-    std::vector<const char *> enabledExtensions;
-    enabledExtensions.reserve(extensions.size());
-    for (const auto &ext : extensions) {
-        assert(std::find_if(extensionProperties.begin(),
-                            extensionProperties.end(), [ext](const auto &ep) {
-                                return ext == ep.extensionName;
-                            }) != extensionProperties.end());
-        enabledExtensions.push_back(ext.data());
-    }
-
+std::vector<std::string> getInstanceExtensions(bool headless) {
+    std::vector<std::string> extensions;
+    // offscreen rendering needs neither a surface nor glfw
+    if (headless) { return extensions; }
+    extensions.emplace_back(VK_KHR_SURFACE_EXTENSION_NAME);
     // register glfw required instance extensions (this needs glfwInit() first)
     uint32_t glfwExtensionCount{0};
     auto glfwExtensions =
@@ -192,175 +103,13 @@ createInstance(const std::string &appName, const std::string &engineName,
     for (uint32_t i = 0; i < glfwExtensionCount; ++i) {
         auto ext = glfwExtensions[i];
         if (std::find(extensions.begin(), extensions.end(), ext) ==
-                    extensions.end() &&
-            std::find_if(extensionProperties.begin(), extensionProperties.end(),
-                         [ext](const auto &ep) {
-                             return strcmp(ext, ep.extensionName) == 0;
-                         }) != extensionProperties.end()) {
-            enabledExtensions.push_back(ext);
-        }
-    }
-
-#if !defined(NDEBUG)
-    // in debug mode, use the following instance extensions
-    std::vector<std::string> instanceDebugExtensions = {
-            // assign internal names to Vulkan resources
-            VK_EXT_DEBUG_UTILS_EXTENSION_NAME,
-            // set up a Vulkan debug report callback function
-            VK_EXT_DEBUG_REPORT_EXTENSION_NAME,
-    };
-    for (const auto &ext : instanceDebugExtensions) {
-        if (std::find(extensions.begin(), extensions.end(), ext) ==
-                    extensions.end() &&
-            std::find_if(extensionProperties.begin(), extensionProperties.end(),
-                         [ext](const auto &ep) {
-                             return ext == ep.extensionName;
-                         }) != extensionProperties.end()) {
-            enabledExtensions.push_back(ext.c_str());
+            extensions.end()) {
+            extensions.emplace_back(ext);
         }
     }
-#endif
-
-    vk::ApplicationInfo applicationInfo(appName.c_str(), appVersion,
-                                        engineName.c_str(), engineVersion,
-                                        apiVersion);
-#if defined(NDEBUG)
-    // in non-debug mode just use the InstanceCreateInfo for instance creation
-    vk::StructureChain<vk::InstanceCreateInfo> instanceCreateInfo(
-            {{}, &applicationInfo, enabledLayers, enabledExtensions});
-#else
-    // in debug mode, additionally use the debugUtilsMessengerCallback in instance creation
-    vk::DebugUtilsMessageSeverityFlagsEXT severityFlags(
-            vk::DebugUtilsMessageSeverityFlagBitsEXT::eWarning |
-            vk::DebugUtilsMessageSeverityFlagBitsEXT::eError);
-    vk::DebugUtilsMessageTypeFlagsEXT messageTypeFlags(
-            vk::DebugUtilsMessageTypeFlagBitsEXT::eGeneral |
-            vk::DebugUtilsMessageTypeFlagBitsEXT::ePerformance |
-            vk::DebugUtilsMessageTypeFlagBitsEXT::eValidation);
-    vk::StructureChain<vk::InstanceCreateInfo,
-                       vk::DebugUtilsMessengerCreateInfoEXT>
-            instanceCreateInfo(
-                    {{}, &applicationInfo, enabledLayers, enabledExtensions},
-                    {{},
-                     severityFlags,
-                     messageTypeFlags,
-                     &debugUtilsMessengerCallback});
-#endif
-
-    auto instance = vk::createInstanceUnique(
-            instanceCreateInfo.get<vk::InstanceCreateInfo>());
-#if (VULKAN_HPP_DISPATCH_LOADER_DYNAMIC == 1)
-    // initialize function pointers for instance
-    VULKAN_HPP_DEFAULT_DISPATCHER.init(*instance);
-#endif
-    return instance;
-}
-
-vk::UniqueDebugUtilsMessengerEXT
-createDebugUtilsMessenger(vk::UniqueInstance &instance) {
-    vk::DebugUtilsMessageSeverityFlagsEXT severityFlags(
-            vk::DebugUtilsMessageSeverityFlagBitsEXT::eWarning |
-            vk::DebugUtilsMessageSeverityFlagBitsEXT::eError);
-    vk::DebugUtilsMessageTypeFlagsEXT messageTypeFlags(
-            vk::DebugUtilsMessageTypeFlagBitsEXT::eGeneral |
-            vk::DebugUtilsMessageTypeFlagBitsEXT::ePerformance |
-            vk::DebugUtilsMessageTypeFlagBitsEXT::eValidation);
-    return instance->createDebugUtilsMessengerEXTUnique(
-            vk::DebugUtilsMessengerCreateInfoEXT({}, severityFlags,
-                                                 messageTypeFlags,
-                                                 &debugUtilsMessengerCallback));
-}
-
-uint32_t findGraphicsQueueFamilyIndex(
-        const std::vector<vk::QueueFamilyProperties> &queueFamilyProperties) {
-    // get the first index into queue family properties which support graphics
-    size_t graphicsQueueFamilyIndex = std::distance(
-            queueFamilyProperties.begin(),
-            std::find_if(
-                    queueFamilyProperties.begin(), queueFamilyProperties.end(),
-                    [](const vk::QueueFamilyProperties &qfp) {
-                        return qfp.queueFlags & vk::QueueFlagBits::eGraphics;
-                    }));
-    assert(graphicsQueueFamilyIndex < queueFamilyProperties.size());
-    return static_cast<uint32_t>(graphicsQueueFamilyIndex);
-}
-
-std::pair<uint32_t, uint32_t>
-findGraphicsAndPresentQueueFamilyIndex(vk::PhysicalDevice physicalDevice,
-                                       const VkSurfaceKHR &surface) {
-    auto queueFamilyProperties = physicalDevice.getQueueFamilyProperties();
-
-    uint32_t graphicsQueueFamilyIndex =
-            findGraphicsQueueFamilyIndex(queueFamilyProperties);
-
-    // determine a queue family that supports present
-    // first check if the graphics queue family is good enough
-    if (physicalDevice.getSurfaceSupportKHR(graphicsQueueFamilyIndex,
-                                            surface)) {
-        return std::make_pair(graphicsQueueFamilyIndex,
-                              graphicsQueueFamilyIndex);
-    }
-
-    // the graphics queue doesn't support present, look for an other
-    // family that supports both graphics and present
-    for (uint32_t i = 0; i < queueFamilyProperties.size(); i++) {
-        if ((queueFamilyProperties[i].queueFlags &
-             vk::QueueFlagBits::eGraphics) &&
-            physicalDevice.getSurfaceSupportKHR(i, surface)) {
-            return std::make_pair(i, i);
-        }
-    }
-    // there's nothing like a single family index that supports both
-    // graphics and present, look for an other family that supports
-    // present
-    for (uint32_t i = 0; i < queueFamilyProperties.size(); i++) {
-        if (physicalDevice.getSurfaceSupportKHR(i, surface)) {
-            return std::make_pair(graphicsQueueFamilyIndex, i);
-        }
-    }
-    throw std::runtime_error("could not find a queue for graphics or "
-                             "present");
-}
-
-std::vector<std::string> getInstanceExtensions() {
-    std::vector<std::string> extensions;
-    extensions.emplace_back(VK_KHR_SURFACE_EXTENSION_NAME);
-    return extensions;
-}
-
-std::vector<std::string> getDeviceExtensions() {
-    std::vector<std::string> extensions;
-    extensions.emplace_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
-#ifndef NDEBUG
-    // debug marker allow the assignment of internal names to Vulkan resources.
-    // these internal names will conveniently be visible in debugger like RenderDoc.
-    // debug marker are only available if RenderDoc is enabled.
-    extensions.emplace_back(VK_EXT_DEBUG_MARKER_EXTENSION_NAME);
-#endif
     return extensions;
 }
 
-vk::UniqueDevice
-createDevice(vk::PhysicalDevice physicalDevice, uint32_t queueFamilyIndex,
-             const std::vector<std::string> &extensions = {},
-             const vk::PhysicalDeviceFeatures *physicalDeviceFeatures = nullptr,
-             const void *next = nullptr) {
-    std::vector<const char *> enabledExtensions;
-    enabledExtensions.reserve(extensions.size());
-    for (const auto &ext : extensions) {
-        enabledExtensions.push_back(ext.c_str());
-    }
-
-    float queuePriority = 0.0f;
-    vk::DeviceQueueCreateInfo deviceQueueCreateInfo(
-            vk::DeviceQueueCreateFlags(), queueFamilyIndex, 1, &queuePriority);
-    vk::DeviceCreateInfo deviceCreateInfo(
-            vk::DeviceCreateFlags(), deviceQueueCreateInfo, {},
-            enabledExtensions, physicalDeviceFeatures);
-    deviceCreateInfo.pNext = next;
-    return physicalDevice.createDeviceUnique(deviceCreateInfo);
-}
-
 Window createWindow(const std::string &windowName, const vk::Extent2D &extent) {
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
     glfwWindowHint(GLFW_VISIBLE, true);
@@ -396,133 +145,746 @@ Surface::Surface(vk::UniqueInstance &instance, const std::string &windowName,
     surface = vk::UniqueSurfaceKHR(surf, deleter);
 }
 
-int main() {
+#pragma region present
+
+// cpu side intervals between consecutive presents over a rolling window, with
+// the presentation engine blocking acquire or present these follow the
+// display cadence
+struct PresentStats {
+    std::vector<float> intervals;
+    size_t next{0};
+    uint64_t presentCount{0};
+    std::chrono::steady_clock::time_point lastPresent;
+
+    void record();
+    void report(std::ostream &os) const;
+};
+
+void PresentStats::record() {
+    auto now = std::chrono::steady_clock::now();
+    if (0 < presentCount++) {
+        float ms = std::chrono::duration<float, std::milli>(now - lastPresent)
+                           .count();
+        if (intervals.size() < kPresentStatsWindow) {
+            intervals.push_back(ms);
+        } else {
+            intervals[next] = ms;
+            next = (next + 1) % kPresentStatsWindow;
+        }
+    }
+    lastPresent = now;
+}
+
+void PresentStats::report(std::ostream &os) const {
+    if (intervals.empty()) { return; }
+    std::vector<float> sorted = intervals;
+    std::sort(sorted.begin(), sorted.end());
+    auto percentile = [&sorted](float p) {
+        return sorted[static_cast<size_t>(p * (sorted.size() - 1))];
+    };
+    float median = percentile(0.5f);
+    // intervals well above the median are frames that missed their vblank
+    size_t hitches = std::count_if(sorted.begin(), sorted.end(),
+                                   [median](float ms) {
+                                       return ms > 1.5f * median;
+                                   });
+    os << "present interval over last " << sorted.size()
+       << " frames: min " << sorted.front() << " ms, p50 " << median
+       << " ms, p99 " << percentile(0.99f) << " ms, max " << sorted.back()
+       << " ms, " << hitches << " hitches" << std::endl;
+}
+
+#pragma endregion
+
+// a replaced swapchain together with everything created for its images, kept
+// alive until the frames that were recorded against it have finished
+struct RetiredSwapchain {
+    SwapchainData swapchainData;
+    std::vector<vk::UniqueFramebuffer> framebuffers;
+    vk::UniqueRenderPass renderPass;
+    uint64_t retireFrame;
+};
+
+#pragma region streaming
+
+// the streamer's only source of requests, an estimate of what is on screen:
+// the pack's textures hang on a loop of quads the viewer walks along, one
+// every kTextureSpacing units. the ones within kTextureViewDistance ahead ask
+// for the level their distance calls for, the rest are not looked at and age
+// out of the budget
+void requestVisibleTextures(TextureStreamer &textureStreamer,
+                            uint64_t frameNumber, const vk::Extent2D &extent) {
+    auto count = static_cast<uint32_t>(textureStreamer.textures.size());
+    if (count == 0) { return; }
+    float loop = count * kTextureSpacing;
+    float walked = std::fmod(frameNumber * kViewerSpeed, loop);
+    // pixels a unit spans at distance one
+    float projection = extent.height * 0.5f / kViewerHalfFovTangent;
+    for (uint32_t i = 0; i < count; i++) {
+        float ahead = i * kTextureSpacing - walked;
+        if (ahead < 0.0f) { ahead += loop; }
+        if (kTextureViewDistance < ahead) { continue; }
+        float distance = std::max(ahead, kTextureNearDistance);
+        textureStreamer.request(
+                i, textureStreamer.mipForProjectedSize(
+                           i, kTextureQuadSize * projection / distance));
+    }
+}
+
+#pragma endregion
+
+#pragma region frame
+
+// everything one frame in flight owns, so that recording the next frame never
+// touches resources the gpu may still be using for a previous one
+struct FrameData {
+    vk::UniqueCommandPool commandPool;
+    vk::UniqueCommandBuffer commandBuffer;
+    vk::UniqueSemaphore imageAvailableSemaphore;
+    vk::UniqueSemaphore renderFinishedSemaphore;
+    // the frame's graphics submission, the default point is reached already
+    TimelinePoint submitted;
+
+    FrameData(vk::UniqueDevice &device, uint32_t queueFamilyIndex);
+};
+
+FrameData::FrameData(vk::UniqueDevice &device, uint32_t queueFamilyIndex) {
+    // the pool is reset as a whole once per frame
+    commandPool = device->createCommandPoolUnique(vk::CommandPoolCreateInfo(
+            vk::CommandPoolCreateFlagBits::eTransient, queueFamilyIndex));
+    commandBuffer = std::move(device->allocateCommandBuffersUnique(
+                                            vk::CommandBufferAllocateInfo(
+                                                    commandPool.get(),
+                                                    vk::CommandBufferLevel::
+                                                            ePrimary,
+                                                    1))
+                                      .front());
+    imageAvailableSemaphore =
+            device->createSemaphoreUnique(vk::SemaphoreCreateInfo());
+    renderFinishedSemaphore =
+            device->createSemaphoreUnique(vk::SemaphoreCreateInfo());
+}
+
+#pragma endregion
+
+struct Options {
+    // render into device-owned images instead of a window surface
+    bool headless{false};
+    // how many frames the cpu may record ahead of the gpu
+    uint32_t framesInFlight{kFramesInFlight};
+    // recording threads, including the main thread
+    uint32_t threadCount{std::max(1u, std::thread::hardware_concurrency())};
+    uint32_t objectCount{kObjectCount};
+    // cull and draw the objects on the gpu instead of recording them
+    bool gpuDriven{false};
+    // stop after this many frames, 0 runs until the window is closed
+    uint64_t frameCount{0};
+    PresentPolicy presentPolicy{PresentPolicy::eLowLatency};
+    // used instead of the policy's choice when the surface supports it
+    std::optional<vk::PresentModeKHR> presentMode;
+    std::string pipelineCachePath{kDefaultPipelineCachePath};
+    // chrome trace of every frame's cpu and gpu zones, empty for none
+    std::string tracePath;
+    // asset pack written by light_pack, meshes are uploaded at startup and
+    // textures streamed
+    std::string assetPath;
+    // memory the streamed textures may use, lowered to the heap budget
+    vk::DeviceSize textureBudget{kDefaultTextureBudget};
+    // frames written to disk, .png or .ppm sequences or a .raw stream, empty
+    // for none
+    std::string capturePath;
+    uint32_t captureInterval{1};
+    // filtering and rate limits of validation messages, debug builds only
+    DebugSinkConfig debugSink;
+};
+
+PresentPolicy parsePresentPolicy(const std::string &name) {
+    if (name == "latency") { return PresentPolicy::eLowLatency; }
+    if (name == "throughput") { return PresentPolicy::eThroughput; }
+    if (name == "vsync") { return PresentPolicy::eVsync; }
+    throw std::runtime_error("unknown present policy: " + name);
+}
+
+vk::PresentModeKHR parsePresentMode(const std::string &name) {
+    if (name == "mailbox") { return vk::PresentModeKHR::eMailbox; }
+    if (name == "immediate") { return vk::PresentModeKHR::eImmediate; }
+    if (name == "fifo-relaxed") { return vk::PresentModeKHR::eFifoRelaxed; }
+    if (name == "fifo") { return vk::PresentModeKHR::eFifo; }
+    throw std::runtime_error("unknown present mode: " + name);
+}
+
+vk::DebugUtilsMessageSeverityFlagBitsEXT
+parseDebugSeverity(const std::string &name) {
+    using Severity = vk::DebugUtilsMessageSeverityFlagBitsEXT;
+    if (name == "verbose") { return Severity::eVerbose; }
+    if (name == "info") { return Severity::eInfo; }
+    if (name == "warning") { return Severity::eWarning; }
+    if (name == "error") { return Severity::eError; }
+    throw std::runtime_error("unknown debug severity: " + name);
+}
+
+Options parseOptions(int argc, char *argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--headless") {
+            options.headless = true;
+        } else if (arg == "--frames-in-flight" && i + 1 < argc) {
+            options.framesInFlight = static_cast<uint32_t>(
+                    std::max(1ul, std::stoul(argv[++i])));
+        } else if (arg == "--threads" && i + 1 < argc) {
+            options.threadCount = static_cast<uint32_t>(
+                    std::max(1ul, std::stoul(argv[++i])));
+        } else if (arg == "--objects" && i + 1 < argc) {
+            options.objectCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else if (arg == "--gpu-driven") {
+            options.gpuDriven = true;
+        } else if (arg == "--frames" && i + 1 < argc) {
+            options.frameCount = std::stoull(argv[++i]);
+        } else if (arg == "--present-policy" && i + 1 < argc) {
+            options.presentPolicy = parsePresentPolicy(argv[++i]);
+        } else if (arg == "--present-mode" && i + 1 < argc) {
+            options.presentMode = parsePresentMode(argv[++i]);
+        } else if (arg == "--pipeline-cache" && i + 1 < argc) {
+            options.pipelineCachePath = argv[++i];
+        } else if (arg == "--assets" && i + 1 < argc) {
+            options.assetPath = argv[++i];
+        } else if (arg == "--texture-budget" && i + 1 < argc) {
+            // in MiB
+            options.textureBudget = std::stoull(argv[++i]) << 20;
+        } else if (arg == "--capture" && i + 1 < argc) {
+            options.capturePath = argv[++i];
+        } else if (arg == "--capture-interval" && i + 1 < argc) {
+            // every n-th frame
+            options.captureInterval = static_cast<uint32_t>(
+                    std::max(1ul, std::stoul(argv[++i])));
+        } else if (arg == "--trace" && i + 1 < argc) {
+            options.tracePath = argv[++i];
+        } else if (arg == "--debug-severity" && i + 1 < argc) {
+            options.debugSink.minSeverity = parseDebugSeverity(argv[++i]);
+        } else if (arg == "--debug-rate" && i + 1 < argc) {
+            options.debugSink.messagesPerSecond =
+                    static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else if (arg == "--debug-mute" && i + 1 < argc) {
+            // by messageIdNumber, as printed with every message
+            options.debugSink.idRates[static_cast<int32_t>(
+                    std::stol(argv[++i], nullptr, 0))] = 0;
+        } else if (arg == "--debug-log" && i + 1 < argc) {
+            options.debugSink.path = argv[++i];
+        } else {
+            throw std::runtime_error("unknown option: " + arg);
+        }
+    }
+    // LIGHT_HEADLESS=1 lets display-less machines opt in without arguments
+    if (const char *env = std::getenv("LIGHT_HEADLESS"); env && *env == '1') {
+        options.headless = true;
+    }
+    // without a window there is nothing to close, so always stop eventually
+    if (options.headless && options.frameCount == 0) {
+        options.frameCount = kHeadlessFrameCount;
+    }
+    return options;
+}
+
+int main(int argc, char *argv[]) {
+    auto launchTime = std::chrono::steady_clock::now();
     try {
-        static auto glfwCtx = GlfwContext();
+        Options options = parseOptions(argc, argv);
+
+        // glfw is only needed for presenting to a window
+        static std::optional<GlfwContext> glfwCtx;
+        if (!options.headless) { glfwCtx.emplace(); }
 
-        vk::UniqueInstance instance =
-                createInstance(kAppName, kEngineName, 1, 1, VK_API_VERSION_1_2,
-                               {}, getInstanceExtensions());
+        // outlives the instance, which reports its own destruction to it
+        std::optional<DebugMessageSink> debugSink;
+#ifndef NDEBUG
+        debugSink.emplace(options.debugSink);
+#endif
+        vk::UniqueInstance instance = createInstance(
+                kAppName, kEngineName, 1, 1, VK_API_VERSION_1_2, {},
+                getInstanceExtensions(options.headless),
+                debugSink ? &*debugSink : nullptr);
 #ifndef NDEBUG
         vk::UniqueDebugUtilsMessengerEXT debugUtilsMessenger =
-                createDebugUtilsMessenger(instance);
+                createDebugUtilsMessenger(instance, *debugSink);
 #endif
 
-        vk::PhysicalDevice physicalDevice =
-                instance->enumeratePhysicalDevices().front();
-
-        Surface surface(instance, kAppName, {kWidth, kHeight});
-
-        const auto &[graphicsQueueFamilyIndex, presentQueueFamilyIndex] =
-                findGraphicsAndPresentQueueFamilyIndex(physicalDevice,
-                                                       *surface.surface);
-
-        vk::UniqueDevice device =
-                createDevice(physicalDevice, graphicsQueueFamilyIndex,
-                             getDeviceExtensions());
-
-        // create a command pool to allocate a command buffer from
-        vk::UniqueCommandPool commandPool = device->createCommandPoolUnique(
-                vk::CommandPoolCreateInfo(vk::CommandPoolCreateFlags(),
-                                          graphicsQueueFamilyIndex));
-        // allocate command buffer from the command pool
-        vk::UniqueCommandBuffer commandBuffer = std::move(
-                device->allocateCommandBuffersUnique(
-                              vk::CommandBufferAllocateInfo(
-                                      commandPool.get(),
-                                      vk::CommandBufferLevel::ePrimary, 1))
-                        .front());
-
-        // get the supported surface formats
-        std::vector<vk::SurfaceFormatKHR> formats =
-                physicalDevice.getSurfaceFormatsKHR(*surface.surface);
-        assert(!formats.empty());
-        vk::Format format = (formats[0].format == vk::Format::eUndefined)
-                                    ? vk::Format::eB8G8R8A8Unorm
-                                    : formats[0].format;
-
-        vk::SurfaceCapabilitiesKHR surfaceCapabilities =
-                physicalDevice.getSurfaceCapabilitiesKHR(*surface.surface);
-        VkExtent2D swapchainExtent;
-        if (surfaceCapabilities.currentExtent.width ==
-            std::numeric_limits<uint32_t>::max()) {
-            // if the surface size is undefined, the size is set to the size of
-            // the images requested
-            swapchainExtent.width =
-                    clamp(kWidth, surfaceCapabilities.minImageExtent.width,
-                          surfaceCapabilities.maxImageExtent.width);
-            swapchainExtent.height =
-                    clamp(kHeight, surfaceCapabilities.minImageExtent.height,
-                          surfaceCapabilities.maxImageExtent.height);
+        // the window comes first, the device has to be able to present to it
+        std::optional<Surface> surface;
+        DeviceRequirements deviceRequirements;
+        if (!options.headless) {
+            surface.emplace(instance, kAppName, vk::Extent2D(kWidth, kHeight));
+            deviceRequirements.extensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+            deviceRequirements.surface = *surface->surface;
+        }
+        DeviceSelection deviceSelection =
+                selectPhysicalDevice(*instance, deviceRequirements);
+        deviceSelection.report(std::cout);
+        vk::PhysicalDevice physicalDevice = deviceSelection.physicalDevice;
+
+        uint32_t graphicsQueueFamilyIndex, presentQueueFamilyIndex;
+        if (options.headless) {
+            graphicsQueueFamilyIndex = findGraphicsQueueFamilyIndex(
+                    physicalDevice.getQueueFamilyProperties());
+            presentQueueFamilyIndex = graphicsQueueFamilyIndex;
         } else {
-            // if the surface size is defined, the swap chain size must match
-            swapchainExtent = surfaceCapabilities.currentExtent;
+            std::tie(graphicsQueueFamilyIndex, presentQueueFamilyIndex) =
+                    findGraphicsAndPresentQueueFamilyIndex(physicalDevice,
+                                                           *surface->surface);
         }
 
-        // FIFO present mode is guaranteed by the spec to be supported
-        vk::PresentModeKHR swapchainPresentMode = vk::PresentModeKHR::eFifo;
-
-        vk::SurfaceTransformFlagBitsKHR transform =
-                (surfaceCapabilities.supportedTransforms &
-                 vk::SurfaceTransformFlagBitsKHR::eIdentity)
-                        ? vk::SurfaceTransformFlagBitsKHR::eIdentity
-                        : surfaceCapabilities.currentTransform;
-
-        vk::CompositeAlphaFlagBitsKHR compositeAlpha =
-                (surfaceCapabilities.supportedCompositeAlpha &
-                 vk::CompositeAlphaFlagBitsKHR::ePreMultiplied)
-                        ? vk::CompositeAlphaFlagBitsKHR::ePreMultiplied
-                : (surfaceCapabilities.supportedCompositeAlpha &
-                   vk::CompositeAlphaFlagBitsKHR::ePostMultiplied)
-                        ? vk::CompositeAlphaFlagBitsKHR::ePostMultiplied
-                : (surfaceCapabilities.supportedCompositeAlpha &
-                   vk::CompositeAlphaFlagBitsKHR::eInherit)
-                        ? vk::CompositeAlphaFlagBitsKHR::eInherit
-                        : vk::CompositeAlphaFlagBitsKHR::eOpaque;
-
-        vk::SwapchainCreateInfoKHR swapchainCreateInfo(
-                vk::SwapchainCreateFlagsKHR(), *surface.surface,
-                surfaceCapabilities.minImageCount, format,
-                vk::ColorSpaceKHR::eSrgbNonlinear, swapchainExtent, 1,
-                vk::ImageUsageFlagBits::eColorAttachment,
-                vk::SharingMode::eExclusive, {}, transform, compositeAlpha,
-                swapchainPresentMode, true, nullptr);
-
-        if (graphicsQueueFamilyIndex != presentQueueFamilyIndex) {
-            // if the graphics and present queues are from different queue
-            // families, we either have to explicitly transfer ownership of
-            // images between the queues, or we have to create the swapchain
-            // with imageSharingMode as VK_SHARING_MODE_CONCURRENT
-
-            uint32_t queueFamilyIndices[2] = {
-                    static_cast<uint32_t>(graphicsQueueFamilyIndex),
-                    static_cast<uint32_t>(presentQueueFamilyIndex)};
-
-            swapchainCreateInfo.imageSharingMode = vk::SharingMode::eConcurrent;
-            swapchainCreateInfo.queueFamilyIndexCount = 2;
-            swapchainCreateInfo.pQueueFamilyIndices = queueFamilyIndices;
+        std::vector<std::string> deviceExtensions =
+                getDeviceExtensions(physicalDevice, options.headless);
+        // lets the allocator report real budgets instead of guessing them
+        bool memoryBudget = isDeviceExtensionSupported(
+                physicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        if (memoryBudget) {
+            deviceExtensions.emplace_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        }
+        // puts gpu timestamps on the cpu timeline of the profiler
+        bool calibratedTimestamps = isDeviceExtensionSupported(
+                physicalDevice, VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+        if (calibratedTimestamps) {
+            deviceExtensions.emplace_back(
+                    VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
         }
 
-        vk::UniqueSwapchainKHR swapchain =
-                device->createSwapchainKHRUnique(swapchainCreateInfo);
-
-        std::vector<vk::Image> swapchainImages =
-                device->getSwapchainImagesKHR(swapchain.get());
-
-        std::vector<vk::UniqueImageView> imageViews;
-        imageViews.reserve(swapchainImages.size());
-        vk::ComponentMapping componentMapping(
-                vk::ComponentSwizzle::eR, vk::ComponentSwizzle::eG,
-                vk::ComponentSwizzle::eB, vk::ComponentSwizzle::eA);
-        vk::ImageSubresourceRange subresourceRange(
-                vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
-        for (const auto &image : swapchainImages) {
-            vk::ImageViewCreateInfo imageViewCreateInfo(
-                    vk::ImageViewCreateFlags(), image, vk::ImageViewType::e2D,
-                    format, componentMapping, subresourceRange);
-            imageViews.push_back(
-                    device->createImageViewUnique(imageViewCreateInfo));
+        std::vector<vk::QueueFamilyProperties> queueFamilyProperties =
+                physicalDevice.getQueueFamilyProperties();
+        uint32_t transferQueueFamilyIndex = findTransferQueueFamilyIndex(
+                queueFamilyProperties, graphicsQueueFamilyIndex);
+        uint32_t computeQueueFamilyIndex = findComputeQueueFamilyIndex(
+                queueFamilyProperties, graphicsQueueFamilyIndex);
+        std::cout << "queue families: graphics " << graphicsQueueFamilyIndex
+                  << ", present " << presentQueueFamilyIndex << ", transfer "
+                  << transferQueueFamilyIndex << ", compute "
+                  << computeQueueFamilyIndex << std::endl;
+
+        // descriptor indexing is core in vulkan 1.2, but off unless asked for
+        vk::PhysicalDeviceFeatures deviceFeatures;
+        vk::PhysicalDeviceVulkan12Features vulkan12Features;
+        bool bindless =
+                enableBindlessFeatures(physicalDevice, vulkan12Features);
+        // so are indirect count draws
+        bool gpuDriven = options.gpuDriven &&
+                         enableGpuDrivenFeatures(physicalDevice, deviceFeatures,
+                                                 vulkan12Features);
+        if (options.gpuDriven && !gpuDriven) {
+            std::cout << "gpu driven: indirect count draws not supported, "
+                         "recording on the cpu"
+                      << std::endl;
+        }
+        // every submission is ordered and waited for through timelines
+        if (!enableTimelineSemaphores(physicalDevice, vulkan12Features)) {
+            throw std::runtime_error("timeline semaphores not supported");
+        }
+
+        auto deviceStart = std::chrono::steady_clock::now();
+        vk::UniqueDevice device = createDevice(
+                physicalDevice,
+                {graphicsQueueFamilyIndex, presentQueueFamilyIndex,
+                 transferQueueFamilyIndex, computeQueueFamilyIndex},
+                deviceExtensions, &deviceFeatures, &vulkan12Features);
+        std::cout << "device: created in "
+                  << std::chrono::duration<double, std::milli>(
+                             std::chrono::steady_clock::now() - deviceStart)
+                             .count()
+                  << " ms" << std::endl;
+
+        // loaded right away, so that pipelines created during startup
+        // already compile from it
+        PipelineCache pipelineCache(physicalDevice, device,
+                                    options.pipelineCachePath);
+        std::cout << "pipeline cache: "
+                  << (pipelineCache.warm ? "warm, " : "cold, ")
+                  << pipelineCache.loadedBytes << " bytes loaded in "
+                  << pipelineCache.loadMilliseconds << " ms" << std::endl;
+        // pipelines compile on their own threads while startup goes on,
+        // frames skip what is not ready instead of waiting for it
+        PipelineCompiler pipelineCompiler(pipelineCache, options.threadCount);
+
+        SubmissionScheduler scheduler(device, graphicsQueueFamilyIndex,
+                                      computeQueueFamilyIndex,
+                                      transferQueueFamilyIndex);
+        DeviceAllocator allocator(physicalDevice, device, memoryBudget);
+        UploadEngine uploadEngine(physicalDevice, device, allocator,
+                                  scheduler);
+
+        std::optional<BindlessTable> bindlessTable;
+        if (bindless) {
+            bindlessTable.emplace(physicalDevice, device,
+                                  options.framesInFlight);
+            bindlessTable->report(std::cout);
+        } else {
+            std::cout << "bindless: descriptor indexing not supported"
+                      << std::endl;
+        }
+
+        // the pack stays mapped, textures are streamed from it
+        std::optional<AssetPack> assetPack;
+        std::vector<MeshData> meshes;
+        std::optional<TextureStreamer> textureStreamer;
+        if (!options.assetPath.empty()) {
+            auto loadStart = std::chrono::steady_clock::now();
+            assetPack.emplace(options.assetPath);
+            for (uint32_t i = 0; i < assetPack->header->meshCount; i++) {
+                meshes.push_back(
+                        loadMesh(*assetPack, i, allocator, uploadEngine));
+            }
+            // only the low mips for now, the rest follows on demand
+            textureStreamer.emplace(device, allocator, uploadEngine,
+                                    *assetPack,
+                                    bindlessTable ? &*bindlessTable : nullptr,
+                                    options.framesInFlight,
+                                    options.textureBudget);
+            uploadEngine.flush();
+            scheduler.flush();
+            std::cout << "assets: " << meshes.size() << " meshes, "
+                      << textureStreamer->textures.size() << " textures, "
+                      << (textureStreamer->streamedBytes >> 20)
+                      << " MiB staged in "
+                      << std::chrono::duration<double, std::milli>(
+                                 std::chrono::steady_clock::now() -
+                                 loadStart)
+                                 .count()
+                      << " ms" << std::endl;
+        }
+
+        // offscreen images can always be copied from, swapchain images only
+        // when asked for
+        std::optional<FrameCapture> capture;
+        vk::ImageUsageFlags swapchainUsage;
+        if (!options.capturePath.empty()) {
+            capture.emplace(allocator, options.capturePath,
+                            options.framesInFlight, options.captureInterval);
+            swapchainUsage = vk::ImageUsageFlagBits::eTransferSrc;
+        }
+
+        std::optional<SwapchainData> swapchainData;
+        std::optional<OffscreenData> offscreenData;
+        if (options.headless) {
+            offscreenData.emplace(physicalDevice, device, allocator,
+                                  vk::Format::eB8G8R8A8Unorm,
+                                  vk::Extent2D(kWidth, kHeight),
+                                  kOffscreenImageCount);
+        } else {
+            swapchainData.emplace(physicalDevice, device, *surface->surface,
+                                  surface->extent, graphicsQueueFamilyIndex,
+                                  presentQueueFamilyIndex,
+                                  options.presentPolicy, options.presentMode,
+                                  swapchainUsage);
+            std::cout << "present mode "
+                      << vk::to_string(swapchainData->presentMode) << ", "
+                      << swapchainData->images.size() << " images"
+                      << std::endl;
+        }
+        vk::Format colorFormat = options.headless ? offscreenData->format
+                                                  : swapchainData->format;
+        vk::Extent2D extent = options.headless ? offscreenData->extent
+                                               : swapchainData->extent;
+
+        // the image may still be read by the presentation engine, or a copy,
+        // when the frame starts. offscreen images are left ready to be copied
+        // from, swapchain images ready to be presented
+        ResourceState backbufferInitialState{
+                vk::ImageLayout::eUndefined,
+                options.headless
+                        ? vk::PipelineStageFlagBits::eTransfer
+                        : vk::PipelineStageFlagBits::eColorAttachmentOutput,
+                {}};
+        ResourceState backbufferFinalState =
+                options.headless
+                        ? ResourceState{vk::ImageLayout::eTransferSrcOptimal,
+                                        vk::PipelineStageFlagBits::eTransfer,
+                                        vk::AccessFlagBits::eTransferRead}
+                        : ResourceState{
+                                  vk::ImageLayout::ePresentSrcKHR,
+                                  vk::PipelineStageFlagBits::eBottomOfPipe,
+                                  {}};
+        vk::UniqueRenderPass renderPass =
+                createRenderPass(device, colorFormat);
+        std::vector<vk::UniqueFramebuffer> framebuffers = createFramebuffers(
+                device, renderPass,
+                options.headless ? offscreenData->imageViews
+                                 : swapchainData->imageViews,
+                extent);
+
+        std::optional<GpuDrivenRenderer> gpuRenderer;
+        if (gpuDriven) {
+            gpuRenderer.emplace(physicalDevice, device, allocator,
+                                uploadEngine, pipelineCompiler,
+                                colorFormat, options.framesInFlight,
+                                options.objectCount);
+            gpuRenderer->resize(colorFormat,
+                                options.headless ? offscreenData->imageViews
+                                                 : swapchainData->imageViews,
+                                extent, 0);
+        }
+
+        vk::Queue presentQueue = device->getQueue(presentQueueFamilyIndex, 0);
+
+        // outlives the job system, whose workers record zones into it
+        Profiler profiler(physicalDevice, device, graphicsQueueFamilyIndex,
+                          options.framesInFlight, calibratedTimestamps,
+                          options.tracePath);
+
+        JobSystem jobSystem(options.threadCount - 1);
+        ParallelRecorder recorder(device, graphicsQueueFamilyIndex,
+                                  options.framesInFlight,
+                                  jobSystem.threadCount());
+        std::chrono::duration<double, std::micro> recordTime(0);
+
+        std::vector<FrameData> frames;
+        frames.reserve(options.framesInFlight);
+        for (uint32_t i = 0; i < options.framesInFlight; i++) {
+            frames.emplace_back(device, graphicsQueueFamilyIndex);
+        }
+        // the submission of the frame that last rendered to each image, images
+        // can be handed out of order and must not be written by two frames at
+        // once
+        std::vector<TimelinePoint> imageSubmissions(framebuffers.size());
+
+        uint64_t frameNumber = 0;
+        // the frame being recorded, read by the passes of the frame graph
+        uint32_t frameIndex = 0;
+        uint32_t imageIndex = 0;
+
+        RenderGraph frameGraph(device, allocator);
+        ResourceHandle backbuffer = 0;
+        // the graph holds no transient resources yet, so it can be rebuilt
+        // while frames are in flight
+        auto buildFrameGraph = [&]() {
+            frameGraph.reset();
+            backbuffer = frameGraph.importImage("backbuffer", colorFormat,
+                                                extent, backbufferInitialState,
+                                                backbufferFinalState);
+            if (gpuRenderer) {
+                gpuRenderer->addPasses(frameGraph, backbuffer);
+            } else {
+                PassHandle scenePass = frameGraph.addPass(
+                        "scene", [&](vk::CommandBuffer commandBuffer) {
+                            recordFrame(commandBuffer, *renderPass,
+                                        *framebuffers[imageIndex], extent,
+                                        frameNumber, jobSystem, recorder,
+                                        frameIndex, options.objectCount);
+                        });
+                frameGraph.write(scenePass, backbuffer,
+                                 ResourceUsage::eColorAttachment);
+            }
+            if (capture) { capture->addPass(frameGraph, backbuffer); }
+            frameGraph.compile();
+        };
+        frameGraph.profiler = &profiler;
+        buildFrameGraph();
+        frameGraph.report(std::cout);
+
+        // swapchains replaced on resize, oldest first
+        std::deque<RetiredSwapchain> retiredSwapchains;
+        // hands the current swapchain to the driver as oldSwapchain and keeps
+        // rendering going, instead of idling the device the old images and
+        // their framebuffers are released once the frames in flight drained
+        auto recreateSwapchain = [&]() {
+            int width = 0, height = 0;
+            glfwGetFramebufferSize(surface->window.window, &width, &height);
+            // a minimized window has no extent to create a swapchain with
+            while ((width == 0 || height == 0) &&
+                   !glfwWindowShouldClose(surface->window.window)) {
+                glfwWaitEvents();
+                glfwGetFramebufferSize(surface->window.window, &width,
+                                       &height);
+            }
+            if (width == 0 || height == 0) { return; }
+            surface->extent = vk::Extent2D(static_cast<uint32_t>(width),
+                                           static_cast<uint32_t>(height));
+
+            retiredSwapchains.push_back(
+                    {std::move(*swapchainData), std::move(framebuffers),
+                     vk::UniqueRenderPass(), frameNumber + frames.size()});
+            swapchainData.emplace(
+                    physicalDevice, device, *surface->surface, surface->extent,
+                    graphicsQueueFamilyIndex, presentQueueFamilyIndex,
+                    options.presentPolicy, options.presentMode, swapchainUsage,
+                    *retiredSwapchains.back().swapchainData.swapchain);
+            // the render pass only depends on the format, not on the extent
+            if (swapchainData->format != colorFormat) {
+                colorFormat = swapchainData->format;
+                retiredSwapchains.back().renderPass = std::move(renderPass);
+                renderPass = createRenderPass(device, colorFormat);
+            }
+            extent = swapchainData->extent;
+            framebuffers = createFramebuffers(
+                    device, renderPass, swapchainData->imageViews, extent);
+            imageSubmissions.assign(framebuffers.size(), TimelinePoint());
+            if (gpuRenderer) {
+                gpuRenderer->resize(colorFormat, swapchainData->imageViews,
+                                    extent, frameNumber + frames.size());
+            }
+            buildFrameGraph();
+        };
+
+        PresentStats presentStats;
+        auto startTime = std::chrono::steady_clock::now();
+        while (options.frameCount == 0 || frameNumber < options.frameCount) {
+            if (surface) {
+                glfwPollEvents();
+                if (glfwWindowShouldClose(surface->window.window)) { break; }
+            }
+
+            ProfileZone frameZone("frame");
+            frameIndex = static_cast<uint32_t>(frameNumber % frames.size());
+            FrameData &frame = frames[frameIndex];
+            {
+                // only blocks if the cpu is a full ring of frames ahead
+                ProfileZone zone("wait for frame");
+                scheduler.wait(frame.submitted);
+            }
+            profiler.beginFrame(frameIndex, frameNumber);
+            recorder.beginFrame(frameIndex);
+            if (bindlessTable) { bindlessTable->beginFrame(frameNumber); }
+
+            // every frame up to this one's predecessor in the slot is done
+            while (!retiredSwapchains.empty() &&
+                   retiredSwapchains.front().retireFrame <= frameNumber) {
+                retiredSwapchains.pop_front();
+            }
+
+            bool swapchainStale = false;
+            if (swapchainData) {
+                int width = 0, height = 0;
+                glfwGetFramebufferSize(surface->window.window, &width,
+                                       &height);
+                if (static_cast<uint32_t>(width) != surface->extent.width ||
+                    static_cast<uint32_t>(height) != surface->extent.height) {
+                    recreateSwapchain();
+                    continue;
+                }
+                try {
+                    ProfileZone zone("acquire");
+                    vk::ResultValue<uint32_t> acquired =
+                            device->acquireNextImageKHR(
+                                    *swapchainData->swapchain,
+                                    std::numeric_limits<uint64_t>::max(),
+                                    *frame.imageAvailableSemaphore, nullptr);
+                    imageIndex = acquired.value;
+                    // the semaphore is signaled, so this frame still has to
+                    // be presented before the swapchain is replaced
+                    swapchainStale =
+                            acquired.result == vk::Result::eSuboptimalKHR;
+                } catch (vk::OutOfDateKHRError &) {
+                    recreateSwapchain();
+                    continue;
+                }
+            } else {
+                imageIndex = static_cast<uint32_t>(frameNumber %
+                                                   framebuffers.size());
+            }
+            scheduler.wait(imageSubmissions[imageIndex]);
+
+            device->resetCommandPool(*frame.commandPool,
+                                     vk::CommandPoolResetFlags());
+            frame.commandBuffer->begin(vk::CommandBufferBeginInfo(
+                    vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+            profiler.beginCommandBuffer(*frame.commandBuffer);
+            // take over whatever finished streaming in since the last frame
+            uploadEngine.acquire(*frame.commandBuffer);
+            if (textureStreamer) {
+                requestVisibleTextures(*textureStreamer, frameNumber, extent);
+                textureStreamer->update(frameNumber);
+            }
+            if (capture) {
+                capture->beginFrame(frameIndex, frameNumber, colorFormat,
+                                    extent);
+            }
+            if (gpuRenderer) {
+                gpuRenderer->beginFrame(*frame.commandBuffer, frameIndex,
+                                        imageIndex, frameNumber);
+            }
+            auto recordStart = std::chrono::steady_clock::now();
+            if (swapchainData) {
+                frameGraph.bindImage(backbuffer,
+                                     swapchainData->images[imageIndex],
+                                     *swapchainData->imageViews[imageIndex]);
+            } else {
+                frameGraph.bindImage(
+                        backbuffer, *offscreenData->images[imageIndex].image,
+                        *offscreenData->imageViews[imageIndex]);
+            }
+            {
+                ProfileZone zone("record");
+                frameGraph.execute(*frame.commandBuffer);
+            }
+            recordTime += std::chrono::steady_clock::now() - recordStart;
+            frame.commandBuffer->end();
+
+            SubmissionTask task;
+            task.queue = QueueType::eGraphics;
+            task.commandBuffers = {*frame.commandBuffer};
+            if (swapchainData) {
+                task.semaphoreWaits = {
+                        {*frame.imageAvailableSemaphore,
+                         vk::PipelineStageFlagBits::eColorAttachmentOutput}};
+                task.semaphoreSignals = {*frame.renderFinishedSemaphore};
+            }
+            {
+                ProfileZone zone("submit");
+                frame.submitted = scheduler.submit(task);
+                imageSubmissions[imageIndex] = frame.submitted;
+                // uploads queued while recording go out as one transfer batch
+                uploadEngine.flush();
+                scheduler.flush();
+            }
+            if (frameNumber == 0) {
+                std::cout << "first frame submitted "
+                          << std::chrono::duration<double, std::milli>(
+                                     std::chrono::steady_clock::now() -
+                                     launchTime)
+                                     .count()
+                          << " ms after launch ("
+                          << (pipelineCache.warm ? "warm" : "cold")
+                          << " start)" << std::endl;
+            }
+
+            if (swapchainData) {
+                vk::PresentInfoKHR presentInfo(
+                        1, &*frame.renderFinishedSemaphore, 1,
+                        &*swapchainData->swapchain, &imageIndex);
+                try {
+                    ProfileZone zone("present");
+                    vk::Result result = presentQueue.presentKHR(presentInfo);
+                    swapchainStale |= result == vk::Result::eSuboptimalKHR;
+                } catch (vk::OutOfDateKHRError &) { swapchainStale = true; }
+                presentStats.record();
+            }
+            frameNumber++;
+
+            if (swapchainStale) { recreateSwapchain(); }
+        }
+        device->waitIdle();
+
+        std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - startTime;
+        // the encoder catching up is not part of the frame time
+        if (capture) { capture->finish(); }
+        std::cout << frameNumber << " frames in " << elapsed.count()
+                  << " s (" << frameNumber / elapsed.count() << " fps, "
+                  << options.framesInFlight << " in flight)" << std::endl;
+        if (gpuRenderer) {
+            gpuRenderer->report(std::cout);
+        } else if (0 < frameNumber) {
+            std::cout << "recorded " << options.objectCount
+                      << " objects per frame on " << jobSystem.threadCount()
+                      << " threads in " << recordTime.count() / frameNumber
+                      << " us, " << jobSystem.stolenJobCount() << " of "
+                      << jobSystem.executedJobCount() << " jobs stolen"
+                      << std::endl;
         }
+        if (textureStreamer) { textureStreamer->report(std::cout); }
+        if (capture) { capture->report(std::cout); }
+        presentStats.report(std::cout);
+        scheduler.report(std::cout);
+        pipelineCompiler.report(std::cout);
+        profiler.report(std::cout);
+        allocator.report(std::cout);
     } catch (vk::SystemError &err) {
         std::cerr << "vk::SystemError: " << err.what() << std::endl;
         exit(EXIT_FAILURE);
@@ -0,0 +1,122 @@
+// times the scalar and vector paths of the math module on a million objects:
+// frustum culling of boxes and world matrix updates of a hierarchy
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "simd_math.h"
+
+const size_t kDefaultObjectCount = 1000000;
+const int kRuns = 7;
+// children per hierarchy root, in chains of this depth
+const uint32_t kNodesPerRoot = 16;
+const uint32_t kChainDepth = 4;
+
+// best of kRuns, in milliseconds
+double time(const std::function<void()> &work) {
+    double best = 1e30;
+    for (int run = 0; run < kRuns; run++) {
+        auto start = std::chrono::steady_clock::now();
+        work();
+        best = std::min(best, std::chrono::duration<double, std::milli>(
+                                      std::chrono::steady_clock::now() - start)
+                                      .count());
+    }
+    return best;
+}
+
+void print(const char *name, size_t count, double scalar, double simd) {
+    std::cout << name << ": scalar " << scalar << " ms, "
+              << simdInstructionSet() << " " << simd << " ms, "
+              << scalar * 1e6 / count << " vs " << simd * 1e6 / count
+              << " ns per object, " << scalar / simd << "x" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    size_t count = argc > 1 ? std::stoul(argv[1]) : kDefaultObjectCount;
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+    // boxes scattered around the camera, about a third of them in view
+    AabbArray boxes;
+    boxes.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        Vec3 center = {unit(random) * 100.0f, unit(random) * 100.0f,
+                       unit(random) * 100.0f};
+        float extent = 0.5f + std::abs(unit(random));
+        boxes.push_back({center.x - extent, center.y - extent,
+                         center.z - extent},
+                        {center.x + extent, center.y + extent,
+                         center.z + extent});
+    }
+    std::array<Vec4, 6> planes = frustumPlanes(
+            perspective(1.2f, 16.0f / 9.0f, 0.5f, 150.0f) *
+            lookAt({0.0f, 0.0f, 0.0f}, {1.0f, 0.2f, 0.5f},
+                   {0.0f, 1.0f, 0.0f}));
+    std::vector<uint32_t> visible(count);
+    size_t scalarVisible = 0, simdVisible = 0;
+    double scalarCull = time([&] {
+        scalarVisible = cullAabbsScalar(planes, boxes, visible.data());
+    });
+    double simdCull = time(
+            [&] { simdVisible = cullAabbs(planes, boxes, visible.data()); });
+    print("frustum cull", count, scalarCull, simdCull);
+    std::cout << "  " << simdVisible << " of " << count << " visible"
+              << std::endl;
+    if (scalarVisible != simdVisible) {
+        std::cerr << "cull mismatch: " << scalarVisible << " scalar, "
+                  << simdVisible << " vector" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // shallow trees, as scenes of props on a few levels of groups are
+    TransformHierarchy hierarchy;
+    hierarchy.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        uint32_t parent = kNoParent;
+        if (i % kNodesPerRoot != 0) {
+            // the previous node, or its root when a chain is deep enough
+            parent = static_cast<uint32_t>(
+                    i % kChainDepth == 0 ? i - i % kNodesPerRoot : i - 1);
+        }
+        Vec3 axis = {unit(random), unit(random), unit(random)};
+        float length = std::sqrt(axis.x * axis.x + axis.y * axis.y +
+                                 axis.z * axis.z) +
+                       1e-6f;
+        float half = unit(random) * 1.5f;
+        float s = std::sin(half) / length;
+        hierarchy.add(parent,
+                      {unit(random) * 10.0f, unit(random) * 10.0f,
+                       unit(random) * 10.0f},
+                      {axis.x * s, axis.y * s, axis.z * s, std::cos(half)},
+                      0.9f + 0.2f * std::abs(unit(random)));
+    }
+    double scalarUpdate = time([&] { hierarchy.updateScalar(); });
+    std::vector<Mat4> reference = hierarchy.world;
+    double simdUpdate = time([&] { hierarchy.update(); });
+    print("hierarchy update", count, scalarUpdate, simdUpdate);
+
+    float error = 0.0f;
+    for (size_t i = 0; i < count; i++) {
+        for (int c = 0; c < 4; c++) {
+            for (int row = 0; row < 4; row++) {
+                error = std::max(error,
+                                 std::abs(reference[i].columns[c][row] -
+                                          hierarchy.world[i].columns[c][row]));
+            }
+        }
+    }
+    std::cout << "  largest difference " << error << std::endl;
+    if (1e-3f < error) {
+        std::cerr << "hierarchy mismatch" << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
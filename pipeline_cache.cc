@@ -0,0 +1,192 @@
+#include "pipeline_cache.h"
+
+#if defined(_WIN32)
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+const uint32_t kPipelineCacheMagic = 0x4843504c; // "LPCH"
+const uint32_t kPipelineCacheVersion = 1;
+
+// precedes the driver's blob on disk. the driver's own header carries vendor,
+// device and cache uuid but not the driver version, and nothing to detect a
+// truncated file with
+struct PipelineCacheFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+    uint64_t dataSize;
+    uint64_t dataHash;
+};
+
+uint64_t hashPipelineCacheData(const std::vector<uint8_t> &data) {
+    // fnv-1a, enough to tell a torn or foreign file from a good one
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (uint8_t byte : data) {
+        hash ^= byte;
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+PipelineCache::PipelineCache(vk::PhysicalDevice physicalDevice,
+                             vk::UniqueDevice &device, const std::string &path)
+    : device(*device),
+      physicalDeviceProperties(physicalDevice.getProperties()), path(path) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<uint8_t> data = load();
+    cache = device->createPipelineCacheUnique(vk::PipelineCacheCreateInfo(
+            vk::PipelineCacheCreateFlags(), data.size(), data.data()));
+    loadMilliseconds = std::chrono::duration<double, std::milli>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+    loadedBytes = data.size();
+    warm = !data.empty();
+}
+
+PipelineCache::~PipelineCache() noexcept {
+    try {
+        save();
+    } catch (std::exception &ex) {
+        std::cerr << "pipeline cache: " << ex.what() << std::endl;
+    }
+}
+
+std::vector<uint8_t> PipelineCache::load() const {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) { return {}; }
+
+    PipelineCacheFileHeader header{};
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        header.magic != kPipelineCacheMagic ||
+        header.version != kPipelineCacheVersion ||
+        header.vendorID != physicalDeviceProperties.vendorID ||
+        header.deviceID != physicalDeviceProperties.deviceID ||
+        header.driverVersion != physicalDeviceProperties.driverVersion ||
+        memcmp(header.pipelineCacheUUID,
+               physicalDeviceProperties.pipelineCacheUUID.data(),
+               VK_UUID_SIZE) != 0) {
+        return {};
+    }
+
+    // the size is as untrusted as the rest of the file, a corrupt one must
+    // not decide how much is allocated
+    std::streampos dataStart = file.tellg();
+    file.seekg(0, std::ios::end);
+    std::streampos fileEnd = file.tellg();
+    file.seekg(dataStart);
+    if (!file || fileEnd < dataStart ||
+        header.dataSize != static_cast<uint64_t>(fileEnd - dataStart)) {
+        return {};
+    }
+
+    std::vector<uint8_t> data(header.dataSize);
+    if (!file.read(reinterpret_cast<char *>(data.data()), data.size()) ||
+        hashPipelineCacheData(data) != header.dataHash) {
+        return {};
+    }
+
+    // VkPipelineCacheHeaderVersionOne, checked again in case the file was
+    // written by a build with a different idea of the outer header
+    uint32_t driverHeader[4];
+    if (data.size() < sizeof(driverHeader) + VK_UUID_SIZE) { return {}; }
+    memcpy(driverHeader, data.data(), sizeof(driverHeader));
+    if (driverHeader[0] < sizeof(driverHeader) + VK_UUID_SIZE ||
+        driverHeader[1] != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+        driverHeader[2] != physicalDeviceProperties.vendorID ||
+        driverHeader[3] != physicalDeviceProperties.deviceID ||
+        memcmp(data.data() + sizeof(driverHeader),
+               physicalDeviceProperties.pipelineCacheUUID.data(),
+               VK_UUID_SIZE) != 0) {
+        return {};
+    }
+    return data;
+}
+
+vk::UniquePipelineCache PipelineCache::createWorkerCache() {
+    std::vector<uint8_t> data;
+    if (warm) {
+        std::lock_guard<std::mutex> lock(mutex);
+        data = device.getPipelineCacheData(*cache);
+    }
+    return device.createPipelineCacheUnique(vk::PipelineCacheCreateInfo(
+            vk::PipelineCacheCreateFlags(), data.size(), data.data()));
+}
+
+void PipelineCache::merge(const std::vector<vk::PipelineCache> &caches) {
+    if (caches.empty()) { return; }
+    std::lock_guard<std::mutex> lock(mutex);
+    device.mergePipelineCaches(*cache, caches);
+}
+
+void PipelineCache::save() {
+    std::vector<uint8_t> data;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        data = device.getPipelineCacheData(*cache);
+    }
+
+    PipelineCacheFileHeader header{};
+    header.magic = kPipelineCacheMagic;
+    header.version = kPipelineCacheVersion;
+    header.vendorID = physicalDeviceProperties.vendorID;
+    header.deviceID = physicalDeviceProperties.deviceID;
+    header.driverVersion = physicalDeviceProperties.driverVersion;
+    memcpy(header.pipelineCacheUUID,
+           physicalDeviceProperties.pipelineCacheUUID.data(), VK_UUID_SIZE);
+    header.dataSize = data.size();
+    header.dataHash = hashPipelineCacheData(data);
+
+    // write next to the target, make it durable and rename over it, which
+    // is atomic. a crash leaves either the old file or the new one
+    std::string temporaryPath = path + ".tmp";
+    FILE *file = fopen(temporaryPath.c_str(), "wb");
+    if (!file) { throw std::runtime_error("could not open " + temporaryPath); }
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(data.data(), 1, data.size(), file) == data.size() &&
+                   fflush(file) == 0;
+#if defined(_WIN32)
+    written = written && _commit(_fileno(file)) == 0;
+#else
+    written = written && fsync(fileno(file)) == 0;
+#endif
+    if (fclose(file) != 0 || !written) {
+        std::remove(temporaryPath.c_str());
+        throw std::runtime_error("could not write " + temporaryPath);
+    }
+#if defined(_WIN32)
+    // rename refuses to replace an existing file there
+    bool replaced = MoveFileExA(temporaryPath.c_str(), path.c_str(),
+                                MOVEFILE_REPLACE_EXISTING |
+                                        MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    bool replaced = std::rename(temporaryPath.c_str(), path.c_str()) == 0;
+#endif
+    if (!replaced) {
+        std::remove(temporaryPath.c_str());
+        throw std::runtime_error("could not replace " + path);
+    }
+#if !defined(_WIN32)
+    // the rename itself is only durable once the directory is
+    std::string directory =
+            std::filesystem::path(path).parent_path().string();
+    int fd = open(directory.empty() ? "." : directory.c_str(), O_RDONLY);
+    if (0 <= fd) {
+        fsync(fd);
+        close(fd);
+    }
+#endif
+}
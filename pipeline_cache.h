@@ -0,0 +1,44 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+const char *const kDefaultPipelineCachePath = "light_pipeline_cache.bin";
+
+// a vk::PipelineCache persisted across runs. the blob on disk is prefixed with
+// a header identifying the device and driver it was produced by, a blob from
+// anything else is ignored rather than handed to the driver
+struct PipelineCache {
+    vk::Device device;
+    vk::PhysicalDeviceProperties physicalDeviceProperties;
+    std::string path;
+    vk::UniquePipelineCache cache;
+    // a valid blob was loaded, pipelines should compile from the cache
+    bool warm{false};
+    double loadMilliseconds{0.0};
+    size_t loadedBytes{0};
+
+    PipelineCache(vk::PhysicalDevice physicalDevice, vk::UniqueDevice &device,
+                  const std::string &path = kDefaultPipelineCachePath);
+    // writes the cache back
+    ~PipelineCache() noexcept;
+    PipelineCache(const PipelineCache &) = delete;
+    PipelineCache &operator=(const PipelineCache &) = delete;
+
+    // a cache for one worker thread, so that threads compiling in parallel
+    // do not contend on the driver's lock of a shared cache. starts out with
+    // the persistent cache's contents, so a warm start stays warm
+    vk::UniquePipelineCache createWorkerCache();
+    // folds worker caches into the persistent one
+    void merge(const std::vector<vk::PipelineCache> &caches);
+    // replaces the file atomically, a crash never leaves a torn blob behind
+    void save();
+
+private:
+    std::vector<uint8_t> load() const;
+
+    std::mutex mutex;
+};
@@ -0,0 +1,181 @@
+#include "pipeline_compiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+PipelineKey &PipelineKey::add(const void *data, size_t size) {
+    const auto *begin = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; i++) {
+        value ^= begin[i];
+        value *= 0x100000001b3ull;
+    }
+    bytes.insert(bytes.end(), begin, begin + size);
+    return *this;
+}
+
+PipelineCompiler::PipelineCompiler(PipelineCache &pipelineCache,
+                                   uint32_t threadCount)
+    : pipelineCache(&pipelineCache) {
+    threadCount = std::max(1u, threadCount);
+    for (uint32_t i = 0; i < threadCount; i++) {
+        workerCaches.push_back(pipelineCache.createWorkerCache());
+    }
+    for (uint32_t i = 0; i < threadCount; i++) {
+        workers.emplace_back([this, i] { workerMain(i); });
+    }
+}
+
+PipelineCompiler::~PipelineCompiler() noexcept {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &worker : workers) { worker.join(); }
+
+    std::vector<vk::PipelineCache> caches;
+    for (const vk::UniquePipelineCache &cache : workerCaches) {
+        caches.push_back(*cache);
+    }
+    try {
+        pipelineCache->merge(caches);
+    } catch (std::exception &ex) {
+        std::cerr << "pipeline compiler: " << ex.what() << std::endl;
+    }
+}
+
+PipelineHandle PipelineCompiler::compile(const std::string &name,
+                                         const PipelineKey &key,
+                                         PipelineBuilder build) {
+    PipelineHandle handle;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        requestCount++;
+        auto range = handles.equal_range(key.value);
+        for (auto found = range.first; found != range.second; found++) {
+            if (entries[found->second].key == key.bytes) {
+                deduplicatedCount++;
+                return found->second;
+            }
+        }
+        handle = static_cast<PipelineHandle>(entries.size());
+        entries.emplace_back();
+        Entry &entry = entries.back();
+        entry.name = name;
+        entry.key = key.bytes;
+        entry.build = std::move(build);
+        handles.emplace(key.value, handle);
+        queue.push_back(handle);
+    }
+    wake.notify_one();
+    return handle;
+}
+
+vk::Pipeline PipelineCompiler::get(PipelineHandle handle) {
+    if (handle == kNoPipeline) { return nullptr; }
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry &entry = entries[handle];
+    if (!entry.done) {
+        notReadyCount++;
+        return nullptr;
+    }
+    if (entry.error) {
+        if (!entry.errorReported) {
+            entry.errorReported = true;
+            try {
+                std::rethrow_exception(entry.error);
+            } catch (std::exception &ex) {
+                std::cerr << "pipeline compiler: " << entry.name
+                          << " failed: " << ex.what() << std::endl;
+            } catch (...) {
+                std::cerr << "pipeline compiler: " << entry.name << " failed"
+                          << std::endl;
+            }
+        }
+        return nullptr;
+    }
+    return *entry.pipeline;
+}
+
+bool PipelineCompiler::isReady(PipelineHandle handle) const {
+    if (handle == kNoPipeline) { return false; }
+    std::lock_guard<std::mutex> lock(mutex);
+    const Entry &entry = entries[handle];
+    return entry.done && !entry.error;
+}
+
+vk::Pipeline PipelineCompiler::wait(PipelineHandle handle) {
+    std::unique_lock<std::mutex> lock(mutex);
+    const Entry &entry = entries[handle];
+    if (!entry.done) {
+        stallCount++;
+        finished.wait(lock, [&entry] { return entry.done; });
+    }
+    if (entry.error) { std::rethrow_exception(entry.error); }
+    return *entry.pipeline;
+}
+
+void PipelineCompiler::waitIdle() noexcept {
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock,
+                  [this] { return queue.empty() && compilingCount == 0; });
+}
+
+void PipelineCompiler::workerMain(uint32_t threadIndex) {
+    vk::PipelineCache cache = *workerCaches[threadIndex];
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [this] { return stopping || !queue.empty(); });
+        // queued work is finished first, owners may be waiting on it
+        if (queue.empty()) { return; }
+        Entry &entry = entries[queue.front()];
+        queue.pop_front();
+        compilingCount++;
+        lock.unlock();
+
+        auto start = std::chrono::steady_clock::now();
+        vk::UniquePipeline pipeline;
+        std::exception_ptr error;
+        try {
+            pipeline = entry.build(cache);
+        } catch (...) { error = std::current_exception(); }
+        double milliseconds = std::chrono::duration<double, std::milli>(
+                                      std::chrono::steady_clock::now() - start)
+                                      .count();
+
+        lock.lock();
+        entry.pipeline = std::move(pipeline);
+        entry.error = error;
+        entry.milliseconds = milliseconds;
+        // the captured state is not needed anymore
+        entry.build = nullptr;
+        entry.done = true;
+        compilingCount--;
+        finished.notify_all();
+    }
+}
+
+void PipelineCompiler::report(std::ostream &os) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    double total = 0.0, slowest = 0.0;
+    uint32_t failed = 0, pending = 0;
+    for (const Entry &entry : entries) {
+        if (!entry.done) {
+            pending++;
+            continue;
+        }
+        if (entry.error) { failed++; }
+        total += entry.milliseconds;
+        slowest = std::max(slowest, entry.milliseconds);
+    }
+    os << "pipeline compiler: " << entries.size() << " pipelines on "
+       << workers.size() << " threads, " << deduplicatedCount << " of "
+       << requestCount << " requests deduplicated, " << total
+       << " ms compiling, slowest " << slowest << " ms" << std::endl;
+    os << "  " << notReadyCount << " lookups not ready, " << stallCount
+       << " stalls";
+    if (pending != 0) { os << ", " << pending << " pending"; }
+    if (failed != 0) { os << ", " << failed << " failed"; }
+    os << std::endl;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "pipeline_cache.h"
+
+using PipelineHandle = uint32_t;
+const PipelineHandle kNoPipeline = ~0u;
+
+// everything a pipeline is built from, pipelines with equal keys are compiled
+// once. value is the bytes' fnv-1a, lookups compare the bytes on a match so
+// that a collision cannot hand out a different pipeline
+struct PipelineKey {
+    uint64_t value{0xcbf29ce484222325ull};
+    std::vector<uint8_t> bytes;
+
+    PipelineKey &add(const void *data, size_t size);
+    template<typename T>
+    PipelineKey &add(const T &data) {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "hash the fields of structs with pointers");
+        return add(&data, sizeof(T));
+    }
+};
+
+// creates the pipeline against the given cache. runs on a worker thread, so
+// it must only read state that outlives the compilation
+using PipelineBuilder =
+        std::function<vk::UniquePipeline(vk::PipelineCache cache)>;
+
+// compiles pipelines on a pool of workers while the caller goes on with
+// startup or rendering. compile() returns a handle right away, get() never
+// blocks and returns a null pipeline until the compilation finished, so
+// draws whose pipeline is not ready are skipped instead of stalling the
+// frame. every worker compiles against its own cache, they are merged into
+// the persistent one when the compiler is destroyed
+struct PipelineCompiler {
+    struct Entry {
+        std::string name;
+        std::vector<uint8_t> key;
+        PipelineBuilder build;
+        vk::UniquePipeline pipeline;
+        // set once the build finished, successfully or not
+        bool done{false};
+        std::exception_ptr error;
+        // get() printed the error, later calls stay quiet
+        bool errorReported{false};
+        double milliseconds{0.0};
+    };
+
+    PipelineCache *pipelineCache;
+
+    // statistics
+    uint32_t requestCount{0};
+    uint32_t deduplicatedCount{0};
+    // get() found the pipeline still compiling, each a hitch avoided
+    uint64_t notReadyCount{0};
+    // wait() had to block
+    uint32_t stallCount{0};
+
+    PipelineCompiler(PipelineCache &pipelineCache, uint32_t threadCount);
+    // waits for the queued compilations and merges the worker caches
+    ~PipelineCompiler() noexcept;
+    PipelineCompiler(const PipelineCompiler &) = delete;
+    PipelineCompiler &operator=(const PipelineCompiler &) = delete;
+
+    // queues the build unless a pipeline with the same key was requested
+    // before, in which case that one's handle is returned
+    PipelineHandle compile(const std::string &name, const PipelineKey &key,
+                           PipelineBuilder build);
+    // null while compiling, and for good when the build failed. the failure
+    // is printed by the first call that sees it, a frame loop carries on
+    // without the pass
+    vk::Pipeline get(PipelineHandle handle);
+    // compiled successfully, a failed build never becomes ready
+    bool isReady(PipelineHandle handle) const;
+    // blocks until the pipeline is compiled, rethrows when the build failed
+    vk::Pipeline wait(PipelineHandle handle);
+    // blocks until nothing is queued or compiling, errors are left for get()
+    void waitIdle() noexcept;
+
+    void report(std::ostream &os) const;
+
+private:
+    void workerMain(uint32_t threadIndex);
+
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    // stable addresses, workers build into entries while others are added
+    std::deque<Entry> entries;
+    // by key value, entries whose values collide share a bucket
+    std::unordered_multimap<uint64_t, PipelineHandle> handles;
+    std::deque<PipelineHandle> queue;
+    uint32_t compilingCount{0};
+    bool stopping{false};
+    std::vector<vk::UniquePipelineCache> workerCaches;
+    std::vector<std::thread> workers;
+};
@@ -0,0 +1,349 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <iomanip>
+#include <iostream>
+
+// the trace shows the gpu as one more thread
+const uint32_t kGpuThreadId = 1000;
+
+#if defined(_WIN32)
+// steady_clock is not in query performance counter ticks, no calibration
+const bool kHostTimeDomainSupported = false;
+#else
+// steady_clock reads CLOCK_MONOTONIC
+const bool kHostTimeDomainSupported = true;
+#endif
+
+namespace {
+
+struct ThreadRegistration {
+    uint64_t generation{0};
+    ProfileThreadBuffer *buffer{nullptr};
+};
+
+thread_local ThreadRegistration threadRegistration;
+std::atomic<uint64_t> nextGeneration{1};
+
+std::string escapeJson(const std::string &s) {
+    std::string escaped;
+    escaped.reserve(s.size());
+    for (char c : s) {
+        if (c == '"' || c == '\\') { escaped.push_back('\\'); }
+        escaped.push_back(c);
+    }
+    return escaped;
+}
+
+double percentile(const std::vector<double> &sorted, double p) {
+    size_t index = static_cast<size_t>(p * static_cast<double>(sorted.size()));
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+}// namespace
+
+std::atomic<Profiler *> Profiler::active{nullptr};
+
+ProfileThreadBuffer::ProfileThreadBuffer(uint32_t threadId)
+    : threadId(threadId), events(new CpuZoneEvent[kProfileThreadBufferSize]) {}
+
+void ProfileThreadBuffer::push(const CpuZoneEvent &event) {
+    uint64_t h = head.load(std::memory_order_relaxed);
+    if (kProfileThreadBufferSize <= h - tail.load(std::memory_order_acquire)) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    events[h % kProfileThreadBufferSize] = event;
+    head.store(h + 1, std::memory_order_release);
+}
+
+Profiler::Profiler(vk::PhysicalDevice physicalDevice, vk::UniqueDevice &device,
+                   uint32_t queueFamilyIndex, uint32_t framesInFlight,
+                   bool calibratedTimestamps, const std::string &tracePath)
+    : device(*device), framesInFlight(framesInFlight),
+      epoch(std::chrono::steady_clock::now()),
+      generation(nextGeneration.fetch_add(1)) {
+    uint32_t validBits = physicalDevice.getQueueFamilyProperties()
+                                 [queueFamilyIndex]
+                                         .timestampValidBits;
+    timestampPeriod =
+            validBits ? physicalDevice.getProperties().limits.timestampPeriod
+                      : 0.0;
+    timestampMask = validBits < 64 ? (1ull << validBits) - 1 : ~0ull;
+
+    calibrated = false;
+    if (calibratedTimestamps && kHostTimeDomainSupported &&
+        0.0 < timestampPeriod) {
+        std::vector<vk::TimeDomainEXT> timeDomains =
+                physicalDevice.getCalibrateableTimeDomainsEXT();
+        auto has = [&](vk::TimeDomainEXT domain) {
+            return std::find(timeDomains.begin(), timeDomains.end(), domain) !=
+                   timeDomains.end();
+        };
+        calibrated = has(vk::TimeDomainEXT::eDevice) &&
+                     has(vk::TimeDomainEXT::eClockMonotonic);
+    }
+
+    if (0.0 < timestampPeriod) {
+        gpuFrames.resize(framesInFlight);
+        for (auto &gpuFrame : gpuFrames) {
+            gpuFrame.queryPool =
+                    device->createQueryPoolUnique(vk::QueryPoolCreateInfo(
+                            vk::QueryPoolCreateFlags(),
+                            vk::QueryType::eTimestamp, 2 * kMaxGpuZones));
+        }
+    }
+    if (calibrated) { calibrate(); }
+
+    if (!tracePath.empty()) {
+        trace.open(tracePath, std::ios::trunc);
+        if (!trace) {
+            throw std::runtime_error("failed to open trace file " + tracePath);
+        }
+        trace << "{\"traceEvents\":[\n"
+              << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+              << kGpuThreadId << ",\"args\":{\"name\":\"gpu\"}}";
+        firstTraceEvent = false;
+    }
+
+    active.store(this, std::memory_order_release);
+}
+
+Profiler::~Profiler() noexcept {
+    Profiler *self = this;
+    active.compare_exchange_strong(self, nullptr);
+    if (trace.is_open()) {
+        collectCpu();
+        trace << "\n]}\n";
+    }
+}
+
+int64_t Profiler::now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now() - epoch)
+            .count();
+}
+
+ProfileThreadBuffer *Profiler::threadBuffer() {
+    if (threadRegistration.generation != generation) {
+        std::lock_guard<std::mutex> lock(threadBuffersMutex);
+        threadBuffers.push_back(std::make_unique<ProfileThreadBuffer>(
+                static_cast<uint32_t>(threadBuffers.size())));
+        threadRegistration = {generation, threadBuffers.back().get()};
+    }
+    return threadRegistration.buffer;
+}
+
+void Profiler::beginFrame(uint32_t frameIndex, uint64_t frameNumber) {
+    this->frameIndex = frameIndex;
+    this->frameNumber = frameNumber;
+    collectCpu();
+    if (gpuFrames.empty()) { return; }
+    // the gpu clock drifts against the cpu clock, recalibrate now and then
+    if (calibrated && frameNumber % kCalibrationInterval == 0) { calibrate(); }
+    collectGpu(gpuFrames[frameIndex]);
+}
+
+void Profiler::beginCommandBuffer(vk::CommandBuffer commandBuffer) {
+    openZones.clear();
+    if (gpuFrames.empty()) { return; }
+    GpuFrame &gpuFrame = gpuFrames[frameIndex];
+    commandBuffer.resetQueryPool(*gpuFrame.queryPool, 0, 2 * kMaxGpuZones);
+    gpuFrame.zones.clear();
+    gpuFrame.queryCount = 0;
+    gpuFrame.pending = true;
+    gpuFrame.anchor = now();
+}
+
+void Profiler::beginGpuZone(vk::CommandBuffer commandBuffer,
+                            const std::string &name) {
+    // shows up in renderdoc and in validation messages
+    if (VULKAN_HPP_DEFAULT_DISPATCHER.vkCmdBeginDebugUtilsLabelEXT) {
+        commandBuffer.beginDebugUtilsLabelEXT(
+                vk::DebugUtilsLabelEXT(name.c_str()));
+    }
+    if (gpuFrames.empty() ||
+        2 * kMaxGpuZones < gpuFrames[frameIndex].queryCount + 2) {
+        openZones.push_back(~0u);
+        return;
+    }
+    GpuFrame &gpuFrame = gpuFrames[frameIndex];
+    // the end query is reserved right away, so nested zones cannot run out
+    // of queries halfway
+    GpuZone zone{name, gpuFrame.queryCount, gpuFrame.queryCount + 1};
+    gpuFrame.queryCount += 2;
+    commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe,
+                                 *gpuFrame.queryPool, zone.beginQuery);
+    openZones.push_back(static_cast<uint32_t>(gpuFrame.zones.size()));
+    gpuFrame.zones.push_back(std::move(zone));
+}
+
+void Profiler::endGpuZone(vk::CommandBuffer commandBuffer) {
+    assert(!openZones.empty());
+    uint32_t zone = openZones.back();
+    openZones.pop_back();
+    if (zone != ~0u) {
+        GpuFrame &gpuFrame = gpuFrames[frameIndex];
+        commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe,
+                                     *gpuFrame.queryPool,
+                                     gpuFrame.zones[zone].endQuery);
+    }
+    if (VULKAN_HPP_DEFAULT_DISPATCHER.vkCmdEndDebugUtilsLabelEXT) {
+        commandBuffer.endDebugUtilsLabelEXT();
+    }
+}
+
+void Profiler::calibrate() {
+    std::array<vk::CalibratedTimestampInfoEXT, 2> infos = {
+            vk::CalibratedTimestampInfoEXT(vk::TimeDomainEXT::eDevice),
+            vk::CalibratedTimestampInfoEXT(vk::TimeDomainEXT::eClockMonotonic)};
+    std::array<uint64_t, 2> timestamps;
+    uint64_t maxDeviation;
+    if (device.getCalibratedTimestampsEXT(
+                static_cast<uint32_t>(infos.size()), infos.data(),
+                timestamps.data(), &maxDeviation) != vk::Result::eSuccess) {
+        return;
+    }
+    calibrationTicks = timestamps[0] & timestampMask;
+    calibrationTime =
+            static_cast<int64_t>(timestamps[1]) -
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    epoch.time_since_epoch())
+                    .count();
+}
+
+void Profiler::collectCpu() {
+    std::map<const char *, double> frameTotals;
+    {
+        std::lock_guard<std::mutex> lock(threadBuffersMutex);
+        for (auto &buffer : threadBuffers) {
+            uint64_t t = buffer->tail.load(std::memory_order_relaxed);
+            uint64_t h = buffer->head.load(std::memory_order_acquire);
+            for (; t != h; t++) {
+                const CpuZoneEvent &event =
+                        buffer->events[t % kProfileThreadBufferSize];
+                frameTotals[event.name] += (event.end - event.begin) / 1e6;
+                if (trace.is_open()) {
+                    writeTraceEvent(event.name, buffer->threadId, event.begin,
+                                    event.end);
+                }
+            }
+            buffer->tail.store(h, std::memory_order_release);
+        }
+    }
+    for (const auto &[name, milliseconds] : frameTotals) {
+        addSample(cpuStatistics, name, milliseconds);
+    }
+}
+
+void Profiler::collectGpu(GpuFrame &gpuFrame) {
+    if (!gpuFrame.pending || gpuFrame.queryCount == 0) { return; }
+    gpuFrame.pending = false;
+    std::vector<uint64_t> ticks(gpuFrame.queryCount);
+    if (device.getQueryPoolResults(*gpuFrame.queryPool, 0, gpuFrame.queryCount,
+                                   ticks.size() * sizeof(uint64_t),
+                                   ticks.data(), sizeof(uint64_t),
+                                   vk::QueryResultFlagBits::e64) !=
+        vk::Result::eSuccess) {
+        return;
+    }
+    for (auto &t : ticks) { t &= timestampMask; }
+    uint64_t firstTicks = *std::min_element(ticks.begin(), ticks.end());
+    auto toTime = [&](uint64_t t) {
+        if (calibrated) {
+            return calibrationTime +
+                   static_cast<int64_t>(
+                           static_cast<double>(static_cast<int64_t>(
+                                   t - calibrationTicks)) *
+                           timestampPeriod);
+        }
+        return gpuFrame.anchor +
+               static_cast<int64_t>(static_cast<double>(t - firstTicks) *
+                                    timestampPeriod);
+    };
+
+    std::map<std::string, double> frameTotals;
+    for (const auto &zone : gpuFrame.zones) {
+        int64_t begin = toTime(ticks[zone.beginQuery]);
+        int64_t end = toTime(ticks[zone.endQuery]);
+        frameTotals[zone.name] += (end - begin) / 1e6;
+        if (trace.is_open()) {
+            writeTraceEvent(zone.name, kGpuThreadId, begin, end);
+        }
+    }
+    for (const auto &[name, milliseconds] : frameTotals) {
+        addSample(gpuStatistics, name, milliseconds);
+    }
+}
+
+void Profiler::addSample(std::map<std::string, ZoneStatistics> &statistics,
+                         const std::string &name, double milliseconds) {
+    ZoneStatistics &zone = statistics[name];
+    zone.samples.push_back(milliseconds);
+    if (kProfileWindow < zone.samples.size()) { zone.samples.pop_front(); }
+}
+
+void Profiler::writeTraceEvent(const std::string &name, uint32_t threadId,
+                               int64_t begin, int64_t end) {
+    // chrome wants microseconds
+    trace << (firstTraceEvent ? "" : ",\n") << std::fixed
+          << std::setprecision(3) << "{\"name\":\"" << escapeJson(name)
+          << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << threadId
+          << ",\"ts\":" << begin / 1e3 << ",\"dur\":" << (end - begin) / 1e3
+          << "}";
+    firstTraceEvent = false;
+}
+
+void Profiler::report(std::ostream &os) const {
+    auto print = [&](const char *kind,
+                     const std::map<std::string, ZoneStatistics> &statistics) {
+        for (const auto &[name, zone] : statistics) {
+            if (zone.samples.empty()) { continue; }
+            std::vector<double> sorted(zone.samples.begin(),
+                                       zone.samples.end());
+            std::sort(sorted.begin(), sorted.end());
+            os << kind << " " << name << ": p50 " << percentile(sorted, 0.50)
+               << " ms, p95 " << percentile(sorted, 0.95) << " ms, p99 "
+               << percentile(sorted, 0.99) << " ms, max " << sorted.back()
+               << " ms" << std::endl;
+        }
+    };
+    os << "profile over the last " << kProfileWindow << " frames"
+       << (gpuFrames.empty() ? ", no gpu timestamps"
+                             : calibrated ? ", gpu calibrated"
+                                          : ", gpu uncalibrated")
+       << std::endl;
+    print("cpu", cpuStatistics);
+    print("gpu", gpuStatistics);
+    uint64_t dropped = 0;
+    std::lock_guard<std::mutex> lock(threadBuffersMutex);
+    for (const auto &buffer : threadBuffers) {
+        dropped += buffer->dropped.load(std::memory_order_relaxed);
+    }
+    if (0 < dropped) {
+        os << dropped << " cpu zones dropped, buffers full" << std::endl;
+    }
+}
+
+ProfileZone::ProfileZone(const char *name)
+    : profiler(Profiler::active.load(std::memory_order_acquire)), name(name),
+      begin(profiler ? profiler->now() : 0) {}
+
+ProfileZone::~ProfileZone() noexcept {
+    if (profiler) {
+        profiler->threadBuffer()->push({name, begin, profiler->now()});
+    }
+}
+
+GpuProfileZone::GpuProfileZone(Profiler *profiler,
+                               vk::CommandBuffer commandBuffer,
+                               const std::string &name)
+    : profiler(profiler), commandBuffer(commandBuffer) {
+    if (profiler) { profiler->beginGpuZone(commandBuffer, name); }
+}
+
+GpuProfileZone::~GpuProfileZone() noexcept {
+    if (profiler) { profiler->endGpuZone(commandBuffer); }
+}
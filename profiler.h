@@ -0,0 +1,159 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+// zones one thread may record between two collections, more are dropped
+const uint32_t kProfileThreadBufferSize = 16384;
+// timestamp pairs per frame in flight
+const uint32_t kMaxGpuZones = 256;
+// frames the percentile summary is computed over
+const size_t kProfileWindow = 256;
+// frames between two calibrations of the gpu clock against the cpu clock
+const uint64_t kCalibrationInterval = 64;
+
+// a finished cpu zone, times in nanoseconds since the profiler started. names
+// are string literals, zones never copy them
+struct CpuZoneEvent {
+    const char *name;
+    int64_t begin;
+    int64_t end;
+};
+
+// single producer, single consumer ring. the owning thread appends zones
+// without locks, the collector drains them once per frame
+struct ProfileThreadBuffer {
+    uint32_t threadId;
+    std::unique_ptr<CpuZoneEvent[]> events;
+    std::atomic<uint64_t> head{0};
+    std::atomic<uint64_t> tail{0};
+    std::atomic<uint64_t> dropped{0};
+
+    explicit ProfileThreadBuffer(uint32_t threadId);
+    void push(const CpuZoneEvent &event);
+};
+
+// cpu zones on every thread and gpu timestamps around command buffer regions,
+// collected once per frame into a rolling percentile summary and, if a path
+// is given, streamed to a chrome trace (chrome://tracing, perfetto). gpu
+// times are put on the cpu timeline with VK_EXT_calibrated_timestamps when
+// the device has it, otherwise they are anchored at the start of recording
+struct Profiler {
+    struct GpuZone {
+        std::string name;
+        uint32_t beginQuery;
+        uint32_t endQuery;
+    };
+
+    struct GpuFrame {
+        vk::UniqueQueryPool queryPool;
+        std::vector<GpuZone> zones;
+        uint32_t queryCount{0};
+        // recorded and not yet read back
+        bool pending{false};
+        // cpu time the first query is mapped to without calibration
+        int64_t anchor{0};
+    };
+
+    struct ZoneStatistics {
+        // milliseconds per frame, oldest first
+        std::deque<double> samples;
+    };
+
+    // the profiler zones record into, null when there is none
+    static std::atomic<Profiler *> active;
+
+    vk::Device device;
+    uint32_t framesInFlight;
+    // nanoseconds per gpu tick, 0 when the queue has no timestamps
+    double timestampPeriod;
+    uint64_t timestampMask;
+    bool calibrated;
+    std::vector<GpuFrame> gpuFrames;
+    uint32_t frameIndex{0};
+    uint64_t frameNumber{0};
+    std::vector<uint32_t> openZones;
+    // gpu ticks and cpu time of the last calibration
+    uint64_t calibrationTicks{0};
+    int64_t calibrationTime{0};
+    std::map<std::string, ZoneStatistics> cpuStatistics;
+    std::map<std::string, ZoneStatistics> gpuStatistics;
+
+    Profiler(vk::PhysicalDevice physicalDevice, vk::UniqueDevice &device,
+             uint32_t queueFamilyIndex, uint32_t framesInFlight,
+             bool calibratedTimestamps, const std::string &tracePath = "");
+    // closes the trace
+    ~Profiler() noexcept;
+    Profiler(const Profiler &) = delete;
+    Profiler &operator=(const Profiler &) = delete;
+
+    int64_t now() const;
+    ProfileThreadBuffer *threadBuffer();
+
+    // collects the cpu zones and the frame slot's previous gpu zones. the
+    // slot's submission must have been waited for
+    void beginFrame(uint32_t frameIndex, uint64_t frameNumber);
+    // resets the frame's queries, before the first gpu zone is recorded
+    void beginCommandBuffer(vk::CommandBuffer commandBuffer);
+    // a timestamp pair plus a debug utils label where the extension is on.
+    // zones nest, and open and close on the same command buffer
+    void beginGpuZone(vk::CommandBuffer commandBuffer, const std::string &name);
+    void endGpuZone(vk::CommandBuffer commandBuffer);
+
+    // p50, p95, p99 and max per zone over the last kProfileWindow frames
+    void report(std::ostream &os) const;
+
+private:
+    void calibrate();
+    void collectCpu();
+    void collectGpu(GpuFrame &gpuFrame);
+    void addSample(std::map<std::string, ZoneStatistics> &statistics,
+                   const std::string &name, double milliseconds);
+    void writeTraceEvent(const std::string &name, uint32_t threadId,
+                         int64_t begin, int64_t end);
+
+    std::chrono::steady_clock::time_point epoch;
+    // tells this profiler apart from an earlier one at the same address,
+    // threads register their buffer once per profiler
+    uint64_t generation;
+    mutable std::mutex threadBuffersMutex;
+    std::vector<std::unique_ptr<ProfileThreadBuffer>> threadBuffers;
+    std::ofstream trace;
+    bool firstTraceEvent{true};
+};
+
+// records the enclosing scope on the calling thread
+struct ProfileZone {
+    explicit ProfileZone(const char *name);
+    ~ProfileZone() noexcept;
+    ProfileZone(const ProfileZone &) = delete;
+    ProfileZone &operator=(const ProfileZone &) = delete;
+
+private:
+    Profiler *profiler;
+    const char *name;
+    int64_t begin;
+};
+
+// a gpu zone around the enclosing scope's commands
+struct GpuProfileZone {
+    GpuProfileZone(Profiler *profiler, vk::CommandBuffer commandBuffer,
+                   const std::string &name);
+    ~GpuProfileZone() noexcept;
+    GpuProfileZone(const GpuProfileZone &) = delete;
+    GpuProfileZone &operator=(const GpuProfileZone &) = delete;
+
+private:
+    Profiler *profiler;
+    vk::CommandBuffer commandBuffer;
+};
@@ -0,0 +1,68 @@
+#include "recorder.h"
+
+#include "profiler.h"
+
+ParallelRecorder::ParallelRecorder(vk::UniqueDevice &device,
+                                   uint32_t queueFamilyIndex,
+                                   uint32_t framesInFlight,
+                                   uint32_t threadCount)
+    : device(*device), threadCount(threadCount),
+      threadFrames(framesInFlight * threadCount) {
+    for (auto &threadFrame : threadFrames) {
+        threadFrame.commandPool =
+                device->createCommandPoolUnique(vk::CommandPoolCreateInfo(
+                        vk::CommandPoolCreateFlagBits::eTransient,
+                        queueFamilyIndex));
+    }
+}
+
+void ParallelRecorder::beginFrame(uint32_t frameIndex) {
+    for (uint32_t i = 0; i < threadCount; i++) {
+        ThreadFrame &threadFrame = threadFrames[frameIndex * threadCount + i];
+        if (threadFrame.used == 0) { continue; }
+        device.resetCommandPool(*threadFrame.commandPool,
+                                vk::CommandPoolResetFlags());
+        threadFrame.used = 0;
+    }
+}
+
+vk::CommandBuffer ParallelRecorder::acquireSecondary(uint32_t frameIndex,
+                                                     uint32_t threadIndex) {
+    ThreadFrame &threadFrame =
+            threadFrames[frameIndex * threadCount + threadIndex];
+    if (threadFrame.used == threadFrame.commandBuffers.size()) {
+        // grows to the high water mark once, then buffers are reused
+        threadFrame.commandBuffers.push_back(std::move(
+                device.allocateCommandBuffersUnique(
+                              vk::CommandBufferAllocateInfo(
+                                      *threadFrame.commandPool,
+                                      vk::CommandBufferLevel::eSecondary, 1))
+                        .front()));
+    }
+    return *threadFrame.commandBuffers[threadFrame.used++];
+}
+
+void ParallelRecorder::record(
+        JobSystem &jobSystem, vk::CommandBuffer primary, uint32_t frameIndex,
+        const vk::CommandBufferInheritanceInfo &inheritanceInfo,
+        uint32_t chunkCount,
+        const std::function<void(vk::CommandBuffer commandBuffer,
+                                 uint32_t chunk)> &recordChunk) {
+    assert(jobSystem.threadCount() <= threadCount);
+    std::vector<vk::CommandBuffer> chunks(chunkCount);
+    jobSystem.parallelFor(
+            chunkCount, [&](uint32_t chunk, uint32_t threadIndex) {
+                ProfileZone zone("record chunk");
+                vk::CommandBuffer commandBuffer =
+                        acquireSecondary(frameIndex, threadIndex);
+                commandBuffer.begin(vk::CommandBufferBeginInfo(
+                        vk::CommandBufferUsageFlagBits::eOneTimeSubmit |
+                                vk::CommandBufferUsageFlagBits::
+                                        eRenderPassContinue,
+                        &inheritanceInfo));
+                recordChunk(commandBuffer, chunk);
+                commandBuffer.end();
+                chunks[chunk] = commandBuffer;
+            });
+    if (!chunks.empty()) { primary.executeCommands(chunks); }
+}
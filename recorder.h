@@ -0,0 +1,44 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "jobs.h"
+
+// records secondary command buffers on all threads of a JobSystem. every
+// thread has a command pool of its own per frame in flight, so recording
+// takes no locks, neither in this code nor inside the driver
+struct ParallelRecorder {
+    struct ThreadFrame {
+        vk::UniqueCommandPool commandPool;
+        std::vector<vk::UniqueCommandBuffer> commandBuffers;
+        // handed out since the pool was last reset
+        size_t used{0};
+    };
+
+    vk::Device device;
+    uint32_t threadCount;
+    // indexed by frame * threadCount + thread
+    std::vector<ThreadFrame> threadFrames;
+
+    ParallelRecorder(vk::UniqueDevice &device, uint32_t queueFamilyIndex,
+                     uint32_t framesInFlight, uint32_t threadCount);
+
+    // recycles the frame's pools, the frame's submission must be complete
+    void beginFrame(uint32_t frameIndex);
+    // splits the work into chunkCount secondary command buffers recorded in
+    // parallel, and executes them on the primary in chunk order, so the
+    // result does not depend on which thread recorded what
+    void record(JobSystem &jobSystem, vk::CommandBuffer primary,
+                uint32_t frameIndex,
+                const vk::CommandBufferInheritanceInfo &inheritanceInfo,
+                uint32_t chunkCount,
+                const std::function<void(vk::CommandBuffer commandBuffer,
+                                         uint32_t chunk)> &recordChunk);
+
+private:
+    vk::CommandBuffer acquireSecondary(uint32_t frameIndex,
+                                       uint32_t threadIndex);
+};
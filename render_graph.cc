@@ -0,0 +1,584 @@
+#include "render_graph.h"
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+#include "profiler.h"
+
+namespace {
+
+struct UsageInfo {
+    vk::ImageLayout layout;
+    vk::PipelineStageFlags stages;
+    vk::AccessFlags access;
+    bool write;
+    vk::ImageUsageFlags imageUsage;
+    vk::BufferUsageFlags bufferUsage;
+};
+
+UsageInfo getUsageInfo(ResourceUsage usage) {
+    using Stage = vk::PipelineStageFlagBits;
+    using Access = vk::AccessFlagBits;
+    switch (usage) {
+        case ResourceUsage::eColorAttachment:
+            return {vk::ImageLayout::eColorAttachmentOptimal,
+                    Stage::eColorAttachmentOutput,
+                    Access::eColorAttachmentRead |
+                            Access::eColorAttachmentWrite,
+                    true,
+                    vk::ImageUsageFlagBits::eColorAttachment,
+                    {}};
+        case ResourceUsage::eDepthAttachment:
+            return {vk::ImageLayout::eDepthStencilAttachmentOptimal,
+                    Stage::eEarlyFragmentTests | Stage::eLateFragmentTests,
+                    Access::eDepthStencilAttachmentRead |
+                            Access::eDepthStencilAttachmentWrite,
+                    true,
+                    vk::ImageUsageFlagBits::eDepthStencilAttachment,
+                    {}};
+        case ResourceUsage::eSampled:
+            return {vk::ImageLayout::eShaderReadOnlyOptimal,
+                    Stage::eFragmentShader | Stage::eComputeShader,
+                    Access::eShaderRead,
+                    false,
+                    vk::ImageUsageFlagBits::eSampled,
+                    {}};
+        case ResourceUsage::eStorageRead:
+            // instance data is read by vertex shaders as well
+            return {vk::ImageLayout::eGeneral,
+                    Stage::eVertexShader | Stage::eFragmentShader |
+                            Stage::eComputeShader,
+                    Access::eShaderRead,
+                    false,
+                    vk::ImageUsageFlagBits::eStorage,
+                    vk::BufferUsageFlagBits::eStorageBuffer};
+        case ResourceUsage::eStorageWrite:
+            return {vk::ImageLayout::eGeneral,
+                    Stage::eComputeShader,
+                    Access::eShaderRead | Access::eShaderWrite,
+                    true,
+                    vk::ImageUsageFlagBits::eStorage,
+                    vk::BufferUsageFlagBits::eStorageBuffer};
+        case ResourceUsage::eTransferSrc:
+            return {vk::ImageLayout::eTransferSrcOptimal,
+                    Stage::eTransfer,
+                    Access::eTransferRead,
+                    false,
+                    vk::ImageUsageFlagBits::eTransferSrc,
+                    vk::BufferUsageFlagBits::eTransferSrc};
+        case ResourceUsage::eTransferDst:
+            return {vk::ImageLayout::eTransferDstOptimal,
+                    Stage::eTransfer,
+                    Access::eTransferWrite,
+                    true,
+                    vk::ImageUsageFlagBits::eTransferDst,
+                    vk::BufferUsageFlagBits::eTransferDst};
+        case ResourceUsage::eIndirect:
+            return {vk::ImageLayout::eUndefined,
+                    Stage::eDrawIndirect,
+                    Access::eIndirectCommandRead,
+                    false,
+                    {},
+                    vk::BufferUsageFlagBits::eIndirectBuffer};
+        case ResourceUsage::eVertexInput:
+            return {vk::ImageLayout::eUndefined,
+                    Stage::eVertexInput,
+                    Access::eVertexAttributeRead | Access::eIndexRead,
+                    false,
+                    {},
+                    vk::BufferUsageFlagBits::eVertexBuffer |
+                            vk::BufferUsageFlagBits::eIndexBuffer};
+        case ResourceUsage::eUniform:
+            return {vk::ImageLayout::eUndefined,
+                    Stage::eVertexShader | Stage::eFragmentShader |
+                            Stage::eComputeShader,
+                    Access::eUniformRead,
+                    false,
+                    {},
+                    vk::BufferUsageFlagBits::eUniformBuffer};
+    }
+    throw std::runtime_error("unknown resource usage");
+}
+
+const vk::AccessFlags kWriteAccess =
+        vk::AccessFlagBits::eShaderWrite |
+        vk::AccessFlagBits::eColorAttachmentWrite |
+        vk::AccessFlagBits::eDepthStencilAttachmentWrite |
+        vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eHostWrite |
+        vk::AccessFlagBits::eMemoryWrite;
+
+vk::ImageAspectFlags getAspectMask(vk::Format format) {
+    switch (format) {
+        case vk::Format::eD16Unorm:
+        case vk::Format::eX8D24UnormPack32:
+        case vk::Format::eD32Sfloat:
+            return vk::ImageAspectFlagBits::eDepth;
+        case vk::Format::eD16UnormS8Uint:
+        case vk::Format::eD24UnormS8Uint:
+        case vk::Format::eD32SfloatS8Uint:
+            return vk::ImageAspectFlagBits::eDepth |
+                   vk::ImageAspectFlagBits::eStencil;
+        case vk::Format::eS8Uint:
+            return vk::ImageAspectFlagBits::eStencil;
+        default:
+            return vk::ImageAspectFlagBits::eColor;
+    }
+}
+
+// what the barrier placement knows about a resource between passes
+struct TrackedState {
+    vk::ImageLayout layout{vk::ImageLayout::eUndefined};
+    // the last write, or layout transition, and its stages
+    vk::PipelineStageFlags writeStages;
+    vk::AccessFlags writeAccess;
+    // reads since the last write, a write has to wait for them
+    vk::PipelineStageFlags readStages;
+    // stages and accesses the last write was already made visible to
+    vk::PipelineStageFlags visibleStages;
+    vk::AccessFlags visibleAccess;
+};
+
+}// namespace
+
+RenderGraph::RenderGraph(vk::UniqueDevice &device, DeviceAllocator &allocator)
+    : device(*device), allocator(&allocator) {}
+
+RenderGraph::~RenderGraph() noexcept { reset(); }
+
+ResourceHandle
+RenderGraph::importImage(const std::string &name, vk::Format format,
+                         const vk::Extent2D &extent,
+                         const ResourceState &initialState,
+                         std::optional<ResourceState> finalState) {
+    Resource resource;
+    resource.name = name;
+    resource.image = true;
+    resource.imported = true;
+    resource.format = format;
+    resource.extent = extent;
+    resource.aspect = getAspectMask(format);
+    resource.initialState = initialState;
+    resource.finalState = finalState;
+    resources.push_back(std::move(resource));
+    return static_cast<ResourceHandle>(resources.size() - 1);
+}
+
+ResourceHandle
+RenderGraph::importBuffer(const std::string &name, vk::DeviceSize size,
+                          const ResourceState &initialState,
+                          std::optional<ResourceState> finalState) {
+    Resource resource;
+    resource.name = name;
+    resource.image = false;
+    resource.imported = true;
+    resource.size = size;
+    resource.initialState = initialState;
+    resource.finalState = finalState;
+    resources.push_back(std::move(resource));
+    return static_cast<ResourceHandle>(resources.size() - 1);
+}
+
+ResourceHandle RenderGraph::createImage(const std::string &name,
+                                        vk::Format format,
+                                        const vk::Extent2D &extent) {
+    Resource resource;
+    resource.name = name;
+    resource.image = true;
+    resource.imported = false;
+    resource.format = format;
+    resource.extent = extent;
+    resource.aspect = getAspectMask(format);
+    resources.push_back(std::move(resource));
+    return static_cast<ResourceHandle>(resources.size() - 1);
+}
+
+ResourceHandle RenderGraph::createBuffer(const std::string &name,
+                                         vk::DeviceSize size) {
+    Resource resource;
+    resource.name = name;
+    resource.image = false;
+    resource.imported = false;
+    resource.size = size;
+    resources.push_back(std::move(resource));
+    return static_cast<ResourceHandle>(resources.size() - 1);
+}
+
+PassHandle RenderGraph::addPass(
+        const std::string &name,
+        std::function<void(vk::CommandBuffer commandBuffer)> execute,
+        bool sideEffects) {
+    assert(!compiled);
+    Pass pass;
+    pass.name = name;
+    pass.execute = std::move(execute);
+    pass.sideEffects = sideEffects;
+    passes.push_back(std::move(pass));
+    return static_cast<PassHandle>(passes.size() - 1);
+}
+
+void RenderGraph::read(PassHandle pass, ResourceHandle resource,
+                       ResourceUsage usage) {
+    assert(!compiled);
+    UsageInfo info = getUsageInfo(usage);
+    assert(!info.write);
+    resources[resource].imageUsage |= info.imageUsage;
+    resources[resource].bufferUsage |= info.bufferUsage;
+    passes[pass].accesses.push_back({resource, usage, false});
+}
+
+void RenderGraph::write(PassHandle pass, ResourceHandle resource,
+                        ResourceUsage usage) {
+    assert(!compiled);
+    UsageInfo info = getUsageInfo(usage);
+    resources[resource].imageUsage |= info.imageUsage;
+    resources[resource].bufferUsage |= info.bufferUsage;
+    passes[pass].accesses.push_back({resource, usage, true});
+}
+
+void RenderGraph::markOutput(ResourceHandle resource) {
+    resources[resource].output = true;
+}
+
+void RenderGraph::compile() {
+    assert(!compiled);
+    cull();
+    for (uint32_t i = 0; i < passes.size(); i++) {
+        if (!passes[i].live) { continue; }
+        for (const auto &access : passes[i].accesses) {
+            Resource &resource = resources[access.resource];
+            resource.firstPass = std::min(resource.firstPass, i);
+            resource.lastPass = std::max(resource.lastPass, i);
+        }
+    }
+    allocateTransients();
+    placeBarriers();
+    compiled = true;
+}
+
+void RenderGraph::cull() {
+    // walk backwards from the outputs, a pass lives if a live pass or an
+    // output consumes something it writes
+    std::vector<bool> needed(resources.size());
+    for (size_t i = 0; i < resources.size(); i++) {
+        needed[i] = resources[i].output || resources[i].finalState;
+    }
+    for (size_t i = passes.size(); 0 < i--;) {
+        Pass &pass = passes[i];
+        pass.live = pass.sideEffects;
+        for (const auto &access : pass.accesses) {
+            pass.live |= access.write && needed[access.resource];
+        }
+        if (!pass.live) { continue; }
+        for (const auto &access : pass.accesses) {
+            if (!access.write) { needed[access.resource] = true; }
+        }
+    }
+}
+
+void RenderGraph::allocateTransients() {
+    std::vector<ResourceHandle> transients;
+    std::vector<vk::MemoryRequirements> requirements(resources.size());
+    for (ResourceHandle i = 0; i < resources.size(); i++) {
+        Resource &resource = resources[i];
+        // transients only used by culled passes are never created
+        if (resource.imported || resource.firstPass == ~0u) { continue; }
+        if (resource.image) {
+            resource.ownedImage = device.createImageUnique(vk::ImageCreateInfo(
+                    vk::ImageCreateFlags(), vk::ImageType::e2D,
+                    resource.format,
+                    vk::Extent3D(resource.extent.width, resource.extent.height,
+                                 1),
+                    1, 1, vk::SampleCountFlagBits::e1,
+                    vk::ImageTiling::eOptimal, resource.imageUsage,
+                    vk::SharingMode::eExclusive, {},
+                    vk::ImageLayout::eUndefined));
+            resource.vkImage = *resource.ownedImage;
+            requirements[i] =
+                    device.getImageMemoryRequirements(resource.vkImage);
+        } else {
+            resource.ownedBuffer =
+                    device.createBufferUnique(vk::BufferCreateInfo(
+                            vk::BufferCreateFlags(), resource.size,
+                            resource.bufferUsage));
+            resource.vkBuffer = *resource.ownedBuffer;
+            requirements[i] =
+                    device.getBufferMemoryRequirements(resource.vkBuffer);
+        }
+        transients.push_back(i);
+    }
+
+    // greedy interval assignment: in order of first use, each transient
+    // moves into the best fitting slot whose occupants are all done by then
+    std::sort(transients.begin(), transients.end(),
+              [this](ResourceHandle a, ResourceHandle b) {
+                  return resources[a].firstPass < resources[b].firstPass;
+              });
+    for (ResourceHandle handle : transients) {
+        Resource &resource = resources[handle];
+        const vk::MemoryRequirements &reqs = requirements[handle];
+        ResourceKind kind =
+                resource.image ? ResourceKind::eOptimal : ResourceKind::eLinear;
+        uint32_t best = ~0u;
+        for (uint32_t i = 0; i < aliasSlots.size(); i++) {
+            const AliasSlot &slot = aliasSlots[i];
+            if (slot.kind != kind ||
+                !(slot.requirements.memoryTypeBits & reqs.memoryTypeBits) ||
+                resource.firstPass <=
+                        resources[slot.resources.back()].lastPass) {
+                continue;
+            }
+            auto waste = [&](const AliasSlot &s) {
+                return std::max(s.requirements.size, reqs.size) -
+                       std::min(s.requirements.size, reqs.size);
+            };
+            if (best == ~0u || waste(slot) < waste(aliasSlots[best])) {
+                best = i;
+            }
+        }
+        if (best == ~0u) {
+            aliasSlots.push_back({kind, reqs, Allocation(), {}});
+            best = static_cast<uint32_t>(aliasSlots.size() - 1);
+        } else {
+            vk::MemoryRequirements &merged = aliasSlots[best].requirements;
+            merged.size = std::max(merged.size, reqs.size);
+            merged.alignment = std::max(merged.alignment, reqs.alignment);
+            merged.memoryTypeBits &= reqs.memoryTypeBits;
+        }
+        aliasSlots[best].resources.push_back(handle);
+        resource.aliasSlot = best;
+    }
+
+    for (auto &slot : aliasSlots) {
+        slot.allocation =
+                allocator->allocate(slot.requirements,
+                                    vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                    slot.kind);
+        for (ResourceHandle handle : slot.resources) {
+            Resource &resource = resources[handle];
+            if (resource.image) {
+                device.bindImageMemory(resource.vkImage,
+                                       slot.allocation.memory,
+                                       slot.allocation.offset);
+                resource.ownedImageView =
+                        device.createImageViewUnique(vk::ImageViewCreateInfo(
+                                vk::ImageViewCreateFlags(), resource.vkImage,
+                                vk::ImageViewType::e2D, resource.format, {},
+                                vk::ImageSubresourceRange(resource.aspect, 0,
+                                                          1, 0, 1)));
+                resource.vkImageView = *resource.ownedImageView;
+            } else {
+                device.bindBufferMemory(resource.vkBuffer,
+                                        slot.allocation.memory,
+                                        slot.allocation.offset);
+            }
+        }
+    }
+}
+
+void RenderGraph::placeBarriers() {
+    barrierBatches.assign(passes.size() + 1, BarrierBatch());
+
+    // the stages and writes of each resource's last live pass, which the next
+    // occupant of its memory has to wait for
+    std::vector<vk::PipelineStageFlags> lastStages(resources.size());
+    std::vector<vk::AccessFlags> lastWrites(resources.size());
+    for (uint32_t i = 0; i < passes.size(); i++) {
+        if (!passes[i].live) { continue; }
+        for (const auto &access : passes[i].accesses) {
+            UsageInfo info = getUsageInfo(access.usage);
+            if (resources[access.resource].lastPass == i) {
+                lastStages[access.resource] |= info.stages;
+            }
+            if (access.write) {
+                lastWrites[access.resource] |= info.access & kWriteAccess;
+            }
+        }
+    }
+
+    std::vector<TrackedState> states(resources.size());
+    for (ResourceHandle i = 0; i < resources.size(); i++) {
+        const Resource &resource = resources[i];
+        TrackedState &state = states[i];
+        if (resource.imported) {
+            // whatever happened before the graph is treated as a write
+            state.layout = resource.initialState.layout;
+            state.writeStages = resource.initialState.stages;
+            state.writeAccess = resource.initialState.access;
+        } else if (resource.aliasSlot != ~0u) {
+            // contents start undefined, but the memory may still be in use by
+            // the previous occupant, or by the slot's last occupant in the
+            // previous execution of the graph
+            const auto &occupants = aliasSlots[resource.aliasSlot].resources;
+            auto it = std::find(occupants.begin(), occupants.end(), i);
+            ResourceHandle previous =
+                    it == occupants.begin() ? occupants.back() : *(it - 1);
+            state.writeStages = lastStages[previous];
+            state.writeAccess = lastWrites[previous];
+        }
+    }
+
+    auto transition = [&](BarrierBatch &batch, ResourceHandle handle,
+                          const ResourceState &target, bool write) {
+        const Resource &resource = resources[handle];
+        TrackedState &state = states[handle];
+        bool layoutChange = resource.image && state.layout != target.layout;
+        if (layoutChange || write) {
+            // wait for the last write and for every read since
+            batch.srcStages |= state.writeStages | state.readStages;
+            batch.dstStages |= target.stages;
+            if (layoutChange) {
+                batch.imageBarriers.emplace_back(
+                        handle,
+                        vk::ImageMemoryBarrier(
+                                state.writeAccess, target.access, state.layout,
+                                target.layout, VK_QUEUE_FAMILY_IGNORED,
+                                VK_QUEUE_FAMILY_IGNORED, nullptr,
+                                vk::ImageSubresourceRange(
+                                        resource.aspect, 0,
+                                        VK_REMAINING_MIP_LEVELS, 0,
+                                        VK_REMAINING_ARRAY_LAYERS)));
+            } else if (state.writeAccess) {
+                batch.memoryBarrier.srcAccessMask |= state.writeAccess;
+                batch.memoryBarrier.dstAccessMask |= target.access;
+            }
+            // a layout transition is a write later readers have to wait for
+            state.layout = target.layout;
+            state.writeStages = target.stages;
+            state.writeAccess = write ? target.access & kWriteAccess
+                                      : vk::AccessFlags();
+            state.readStages = vk::PipelineStageFlags();
+            state.visibleStages = target.stages;
+            state.visibleAccess = target.access;
+        } else {
+            // read after read needs nothing, read after write needs the
+            // write made visible once per stage and access
+            if (state.writeStages &&
+                ((target.stages & ~state.visibleStages) ||
+                 (target.access & ~state.visibleAccess))) {
+                batch.srcStages |= state.writeStages;
+                batch.dstStages |= target.stages;
+                batch.memoryBarrier.srcAccessMask |= state.writeAccess;
+                batch.memoryBarrier.dstAccessMask |= target.access;
+                state.visibleStages |= target.stages;
+                state.visibleAccess |= target.access;
+            }
+            state.readStages |= target.stages;
+        }
+    };
+
+    for (uint32_t i = 0; i < passes.size(); i++) {
+        if (!passes[i].live) { continue; }
+        // a resource used several ways by one pass is transitioned once
+        std::vector<std::pair<ResourceHandle, UsageInfo>> merged;
+        for (const auto &access : passes[i].accesses) {
+            UsageInfo info = getUsageInfo(access.usage);
+            auto it = std::find_if(
+                    merged.begin(), merged.end(),
+                    [&](const auto &m) { return m.first == access.resource; });
+            if (it == merged.end()) {
+                merged.emplace_back(access.resource, info);
+                continue;
+            }
+            assert(!resources[access.resource].image ||
+                   it->second.layout == info.layout);
+            it->second.stages |= info.stages;
+            it->second.access |= info.access;
+            it->second.write |= info.write;
+        }
+        for (const auto &[handle, info] : merged) {
+            transition(barrierBatches[i], handle,
+                       {info.layout, info.stages, info.access}, info.write);
+        }
+    }
+
+    for (ResourceHandle i = 0; i < resources.size(); i++) {
+        if (!resources[i].finalState) { continue; }
+        // leaving the graph counts as a write, so that everything before
+        // is waited for
+        transition(barrierBatches.back(), i, *resources[i].finalState, true);
+    }
+}
+
+void RenderGraph::execute(vk::CommandBuffer commandBuffer) {
+    assert(compiled);
+    auto record = [&](const BarrierBatch &batch) {
+        if (batch.empty()) { return; }
+        std::vector<vk::ImageMemoryBarrier> imageBarriers;
+        imageBarriers.reserve(batch.imageBarriers.size());
+        for (const auto &[handle, barrier] : batch.imageBarriers) {
+            assert(resources[handle].vkImage);
+            imageBarriers.push_back(barrier);
+            imageBarriers.back().setImage(resources[handle].vkImage);
+        }
+        std::vector<vk::MemoryBarrier> memoryBarriers;
+        if (batch.memoryBarrier.srcAccessMask ||
+            batch.memoryBarrier.dstAccessMask) {
+            memoryBarriers.push_back(batch.memoryBarrier);
+        }
+        commandBuffer.pipelineBarrier(
+                batch.srcStages ? batch.srcStages
+                                : vk::PipelineStageFlagBits::eTopOfPipe,
+                batch.dstStages ? batch.dstStages
+                                : vk::PipelineStageFlagBits::eBottomOfPipe,
+                vk::DependencyFlags(), memoryBarriers, {}, imageBarriers);
+    };
+    for (size_t i = 0; i < passes.size(); i++) {
+        if (!passes[i].live) { continue; }
+        GpuProfileZone zone(profiler, commandBuffer, passes[i].name);
+        record(barrierBatches[i]);
+        passes[i].execute(commandBuffer);
+    }
+    record(barrierBatches.back());
+}
+
+void RenderGraph::reset() {
+    passes.clear();
+    barrierBatches.clear();
+    // resources go before the memory they are bound to
+    resources.clear();
+    for (auto &slot : aliasSlots) { allocator->free(slot.allocation); }
+    aliasSlots.clear();
+    compiled = false;
+}
+
+void RenderGraph::bindImage(ResourceHandle resource, vk::Image image,
+                            vk::ImageView imageView) {
+    assert(resources[resource].imported && resources[resource].image);
+    resources[resource].vkImage = image;
+    resources[resource].vkImageView = imageView;
+}
+
+void RenderGraph::bindBuffer(ResourceHandle resource, vk::Buffer buffer) {
+    assert(resources[resource].imported && !resources[resource].image);
+    resources[resource].vkBuffer = buffer;
+}
+
+void RenderGraph::report(std::ostream &os) const {
+    size_t livePasses = 0;
+    for (const auto &pass : passes) { livePasses += pass.live; }
+    size_t batches = 0, imageBarriers = 0;
+    for (const auto &batch : barrierBatches) {
+        batches += !batch.empty();
+        imageBarriers += batch.imageBarriers.size();
+    }
+    vk::DeviceSize transientBytes = 0, slotBytes = 0;
+    for (const auto &slot : aliasSlots) {
+        slotBytes += slot.requirements.size;
+        for (ResourceHandle handle : slot.resources) {
+            const Resource &resource = resources[handle];
+            transientBytes +=
+                    resource.image ? device.getImageMemoryRequirements(
+                                                   resource.vkImage)
+                                                 .size
+                                   : device.getBufferMemoryRequirements(
+                                                   resource.vkBuffer)
+                                                 .size;
+        }
+    }
+    os << "render graph: " << livePasses << " of " << passes.size()
+       << " passes live, " << batches << " barrier batches with "
+       << imageBarriers << " image barriers, " << slotBytes / 1024
+       << " KiB of transient memory for " << transientBytes / 1024 << " KiB"
+       << std::endl;
+}
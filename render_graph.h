@@ -0,0 +1,174 @@
+#pragma once
+
+#include <functional>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "allocator.h"
+
+struct Profiler;
+
+using ResourceHandle = uint32_t;
+using PassHandle = uint32_t;
+
+// how a pass touches a resource, each maps to a layout, stages and accesses
+enum class ResourceUsage {
+    eColorAttachment,
+    eDepthAttachment,
+    eSampled,
+    eStorageRead,
+    eStorageWrite,
+    eTransferSrc,
+    eTransferDst,
+    eIndirect,
+    eVertexInput,
+    eUniform,
+};
+
+struct ResourceState {
+    vk::ImageLayout layout{vk::ImageLayout::eUndefined};
+    vk::PipelineStageFlags stages;
+    vk::AccessFlags access;
+};
+
+// a frame described as passes that declare what they read and write. compile()
+// drops passes nothing depends on, places the barriers between passes, one
+// batched vkCmdPipelineBarrier per pass at most, and lets transient resources
+// whose lifetimes do not overlap share memory. a compiled graph is executed
+// every frame until it is reset, imported resources may be rebound in between
+struct RenderGraph {
+    struct Resource {
+        std::string name;
+        bool image;
+        bool imported;
+        vk::Format format{vk::Format::eUndefined};
+        vk::Extent2D extent;
+        vk::DeviceSize size{0};
+        vk::ImageAspectFlags aspect;
+        vk::ImageUsageFlags imageUsage;
+        vk::BufferUsageFlags bufferUsage;
+        // imported resources only
+        ResourceState initialState;
+        std::optional<ResourceState> finalState;
+        bool output{false};
+
+        vk::Image vkImage;
+        vk::ImageView vkImageView;
+        vk::Buffer vkBuffer;
+        // transient resources only
+        vk::UniqueImage ownedImage;
+        vk::UniqueImageView ownedImageView;
+        vk::UniqueBuffer ownedBuffer;
+        uint32_t aliasSlot{~0u};
+        // first and last live pass using the resource
+        uint32_t firstPass{~0u};
+        uint32_t lastPass{0};
+    };
+
+    struct Access {
+        ResourceHandle resource;
+        ResourceUsage usage;
+        bool write;
+    };
+
+    struct Pass {
+        std::string name;
+        std::function<void(vk::CommandBuffer commandBuffer)> execute;
+        std::vector<Access> accesses;
+        // kept even if none of its writes are consumed
+        bool sideEffects{false};
+        bool live{false};
+    };
+
+    // the barriers recorded before a pass, or after the last one
+    struct BarrierBatch {
+        vk::PipelineStageFlags srcStages;
+        vk::PipelineStageFlags dstStages;
+        vk::MemoryBarrier memoryBarrier;
+        // resource and the barrier, the image handle is filled in on execute
+        std::vector<std::pair<ResourceHandle, vk::ImageMemoryBarrier>>
+                imageBarriers;
+
+        bool empty() const {
+            return !srcStages && !dstStages && imageBarriers.empty();
+        }
+    };
+
+    struct AliasSlot {
+        ResourceKind kind;
+        vk::MemoryRequirements requirements;
+        Allocation allocation;
+        // resources placed in the slot, in order of first use
+        std::vector<ResourceHandle> resources;
+    };
+
+    vk::Device device;
+    DeviceAllocator *allocator;
+    std::vector<Resource> resources;
+    std::vector<Pass> passes;
+    std::vector<AliasSlot> aliasSlots;
+    // indexed by pass, plus one trailing batch for the final states
+    std::vector<BarrierBatch> barrierBatches;
+    bool compiled{false};
+    // when set, every pass and its barriers are a gpu zone of their own
+    Profiler *profiler{nullptr};
+
+    RenderGraph(vk::UniqueDevice &device, DeviceAllocator &allocator);
+    ~RenderGraph() noexcept;
+    RenderGraph(const RenderGraph &) = delete;
+    RenderGraph &operator=(const RenderGraph &) = delete;
+
+    // externally owned resources, with the state they are in when the graph
+    // starts and, for outputs, the state they have to be left in
+    ResourceHandle importImage(const std::string &name, vk::Format format,
+                               const vk::Extent2D &extent,
+                               const ResourceState &initialState,
+                               std::optional<ResourceState> finalState =
+                                       std::nullopt);
+    ResourceHandle importBuffer(const std::string &name, vk::DeviceSize size,
+                                const ResourceState &initialState,
+                                std::optional<ResourceState> finalState =
+                                        std::nullopt);
+    // resources that only live within a frame and are created by compile()
+    ResourceHandle createImage(const std::string &name, vk::Format format,
+                               const vk::Extent2D &extent);
+    ResourceHandle createBuffer(const std::string &name, vk::DeviceSize size);
+
+    PassHandle
+    addPass(const std::string &name,
+            std::function<void(vk::CommandBuffer commandBuffer)> execute,
+            bool sideEffects = false);
+    void read(PassHandle pass, ResourceHandle resource, ResourceUsage usage);
+    void write(PassHandle pass, ResourceHandle resource, ResourceUsage usage);
+    // keeps the passes producing a resource alive without a final state
+    void markOutput(ResourceHandle resource);
+
+    void compile();
+    void execute(vk::CommandBuffer commandBuffer);
+    // drops passes, resources and transient memory, ready to be rebuilt
+    void reset();
+
+    void bindImage(ResourceHandle resource, vk::Image image,
+                   vk::ImageView imageView);
+    void bindBuffer(ResourceHandle resource, vk::Buffer buffer);
+    vk::Image image(ResourceHandle resource) const {
+        return resources[resource].vkImage;
+    }
+    vk::ImageView imageView(ResourceHandle resource) const {
+        return resources[resource].vkImageView;
+    }
+    vk::Buffer buffer(ResourceHandle resource) const {
+        return resources[resource].vkBuffer;
+    }
+
+    void report(std::ostream &os) const;
+
+private:
+    void cull();
+    void allocateTransients();
+    void placeBarriers();
+};
@@ -0,0 +1,92 @@
+#include "scene.h"
+
+#include <algorithm>
+#include <array>
+
+vk::UniqueRenderPass createRenderPass(vk::UniqueDevice &device,
+                                      vk::Format colorFormat) {
+    vk::AttachmentDescription colorAttachment(
+            vk::AttachmentDescriptionFlags(), colorFormat,
+            vk::SampleCountFlagBits::e1, vk::AttachmentLoadOp::eClear,
+            vk::AttachmentStoreOp::eStore, vk::AttachmentLoadOp::eDontCare,
+            vk::AttachmentStoreOp::eDontCare,
+            vk::ImageLayout::eColorAttachmentOptimal,
+            vk::ImageLayout::eColorAttachmentOptimal);
+    vk::AttachmentReference colorReference(
+            0, vk::ImageLayout::eColorAttachmentOptimal);
+    vk::SubpassDescription subpass(vk::SubpassDescriptionFlags(),
+                                   vk::PipelineBindPoint::eGraphics, {},
+                                   colorReference);
+    return device->createRenderPassUnique(vk::RenderPassCreateInfo(
+            vk::RenderPassCreateFlags(), colorAttachment, subpass));
+}
+
+std::vector<vk::UniqueFramebuffer>
+createFramebuffers(vk::UniqueDevice &device, vk::UniqueRenderPass &renderPass,
+                   const std::vector<vk::UniqueImageView> &imageViews,
+                   const vk::Extent2D &extent) {
+    std::vector<vk::UniqueFramebuffer> framebuffers;
+    framebuffers.reserve(imageViews.size());
+    for (const auto &imageView : imageViews) {
+        vk::FramebufferCreateInfo framebufferCreateInfo(
+                vk::FramebufferCreateFlags(), *renderPass, *imageView,
+                extent.width, extent.height, 1);
+        framebuffers.push_back(
+                device->createFramebufferUnique(framebufferCreateInfo));
+    }
+    return framebuffers;
+}
+
+void recordObjects(vk::CommandBuffer commandBuffer, const vk::Extent2D &extent,
+                   uint32_t firstObject, uint32_t objectCount,
+                   uint64_t frameNumber) {
+    for (uint32_t i = firstObject; i < firstObject + objectCount; i++) {
+        uint32_t hash = i * 2654435761u + static_cast<uint32_t>(frameNumber);
+        uint32_t size = 1 + (hash >> 28);
+        vk::Rect2D rect(vk::Offset2D(static_cast<int32_t>(
+                                             (hash & 0xffff) % extent.width),
+                                     static_cast<int32_t>(
+                                             (hash >> 16) % extent.height)),
+                        vk::Extent2D(size, size));
+        rect.extent.width =
+                std::min(rect.extent.width, extent.width - rect.offset.x);
+        rect.extent.height =
+                std::min(rect.extent.height, extent.height - rect.offset.y);
+        vk::ClearAttachment clearAttachment(
+                vk::ImageAspectFlagBits::eColor, 0,
+                vk::ClearValue(vk::ClearColorValue(std::array<float, 4>(
+                        {{(hash & 0xff) / 255.0f, ((hash >> 8) & 0xff) / 255.0f,
+                          ((hash >> 16) & 0xff) / 255.0f, 1.0f}}))));
+        commandBuffer.clearAttachments(clearAttachment,
+                                       vk::ClearRect(rect, 0, 1));
+    }
+}
+
+void recordFrame(vk::CommandBuffer commandBuffer, vk::RenderPass renderPass,
+                 vk::Framebuffer framebuffer, const vk::Extent2D &extent,
+                 uint64_t frameNumber, JobSystem &jobSystem,
+                 ParallelRecorder &recorder, uint32_t frameIndex,
+                 uint32_t objectCount) {
+    float t = static_cast<float>(frameNumber % 256) / 255.0f;
+    vk::ClearValue clearValue(vk::ClearColorValue(
+            std::array<float, 4>({{t, 0.2f, 1.0f - t, 1.0f}})));
+    commandBuffer.beginRenderPass(
+            vk::RenderPassBeginInfo(renderPass, framebuffer,
+                                    vk::Rect2D(vk::Offset2D(0, 0), extent),
+                                    clearValue),
+            vk::SubpassContents::eSecondaryCommandBuffers);
+    // chunks do not depend on the thread count, so every thread count
+    // records the same command stream
+    uint32_t chunkCount =
+            (objectCount + kObjectsPerChunk - 1) / kObjectsPerChunk;
+    recorder.record(
+            jobSystem, commandBuffer, frameIndex,
+            vk::CommandBufferInheritanceInfo(renderPass, 0, framebuffer),
+            chunkCount, [&](vk::CommandBuffer secondary, uint32_t chunk) {
+                uint32_t first = chunk * kObjectsPerChunk;
+                recordObjects(secondary, extent, first,
+                              std::min(kObjectsPerChunk, objectCount - first),
+                              frameNumber);
+            });
+    commandBuffer.endRenderPass();
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "jobs.h"
+#include "recorder.h"
+
+// objects recorded into one secondary command buffer
+const uint32_t kObjectsPerChunk = 256;
+
+// the layout transitions and dependencies around the pass are placed by the
+// render graph, so the attachment stays in the layout the graph hands it in
+vk::UniqueRenderPass createRenderPass(vk::UniqueDevice &device,
+                                      vk::Format colorFormat);
+std::vector<vk::UniqueFramebuffer>
+createFramebuffers(vk::UniqueDevice &device, vk::UniqueRenderPass &renderPass,
+                   const std::vector<vk::UniqueImageView> &imageViews,
+                   const vk::Extent2D &extent);
+
+// the synthetic scene: every object is a small clear of its own, which costs
+// about as much to record as a draw and needs no pipeline
+void recordObjects(vk::CommandBuffer commandBuffer, const vk::Extent2D &extent,
+                   uint32_t firstObject, uint32_t objectCount,
+                   uint64_t frameNumber);
+// clears the framebuffer and records the objects in chunks on the job system
+void recordFrame(vk::CommandBuffer commandBuffer, vk::RenderPass renderPass,
+                 vk::Framebuffer framebuffer, const vk::Extent2D &extent,
+                 uint64_t frameNumber, JobSystem &jobSystem,
+                 ParallelRecorder &recorder, uint32_t frameIndex,
+                 uint32_t objectCount);
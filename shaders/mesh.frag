@@ -0,0 +1,27 @@
+#version 450
+
+layout(push_constant) uniform Draw {
+    mat4 viewProjection;
+    uint material;
+} draw;
+
+layout(location = 0) in vec3 color;
+layout(location = 1) in vec3 normal;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    const vec3 light = normalize(vec3(0.4, 0.8, 0.5));
+    float diffuse = max(dot(normalize(normal), light), 0.0);
+    // every bucket is shaded a little differently, so they can be told apart
+    vec3 shaded;
+    switch (draw.material) {
+        case 0: shaded = color * (0.25 + 0.75 * diffuse); break;
+        case 1: shaded = color; break;
+        case 2: shaded = mix(color, vec3(1.0), pow(1.0 - abs(normal.z), 4.0));
+                break;
+        default: shaded = color * (0.5 + 0.5 * floor(diffuse * 4.0) / 4.0);
+                 break;
+    }
+    outColor = vec4(shaded, 1.0);
+}
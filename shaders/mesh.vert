@@ -0,0 +1,35 @@
+#version 450
+
+struct Instance {
+    vec4 sphere;
+    vec4 color;
+    uint material;
+    uint padding0;
+    uint padding1;
+    uint padding2;
+};
+
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 normal;
+
+// the draw commands carry the instance index as firstInstance
+layout(std430, set = 0, binding = 0) readonly buffer Instances {
+    Instance instances[];
+};
+
+layout(push_constant) uniform Draw {
+    mat4 viewProjection;
+    uint material;
+} draw;
+
+layout(location = 0) out vec3 outColor;
+layout(location = 1) out vec3 outNormal;
+
+void main() {
+    Instance instance = instances[gl_InstanceIndex];
+    // the unit cube's corners touch the bounding sphere
+    vec3 world = instance.sphere.xyz + position * instance.sphere.w * 0.57735;
+    gl_Position = draw.viewProjection * vec4(world, 1.0);
+    outColor = instance.color.rgb;
+    outNormal = normal;
+}
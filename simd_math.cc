@@ -0,0 +1,381 @@
+#include "simd_math.h"
+
+#include <algorithm>
+
+namespace {
+
+// the columns of a rotation by q scaled by s, as nine floats column by column
+void rotationScale(float x, float y, float z, float w, float s, float *m) {
+    float xx = x * x, yy = y * y, zz = z * z;
+    float xy = x * y, xz = x * z, yz = y * z;
+    float wx = w * x, wy = w * y, wz = w * z;
+    m[0] = (1.0f - 2.0f * (yy + zz)) * s;
+    m[1] = 2.0f * (xy + wz) * s;
+    m[2] = 2.0f * (xz - wy) * s;
+    m[3] = 2.0f * (xy - wz) * s;
+    m[4] = (1.0f - 2.0f * (xx + zz)) * s;
+    m[5] = 2.0f * (yz + wx) * s;
+    m[6] = 2.0f * (xz + wy) * s;
+    m[7] = 2.0f * (yz - wx) * s;
+    m[8] = (1.0f - 2.0f * (xx + yy)) * s;
+}
+
+// the corner of box i farthest along the plane's normal is inside, so at
+// least part of the box is
+bool insideScalar(const float (&planes)[6][4], const AabbArray &boxes,
+                  size_t i) {
+    for (const float *plane : planes) {
+        float x = 0.0f < plane[0] ? boxes.maxX[i] : boxes.minX[i];
+        float y = 0.0f < plane[1] ? boxes.maxY[i] : boxes.minY[i];
+        float z = 0.0f < plane[2] ? boxes.maxZ[i] : boxes.minZ[i];
+        if (plane[0] * x + plane[1] * y + plane[2] * z + plane[3] < 0.0f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void planeFloats(const std::array<Vec4, 6> &planes, float (&out)[6][4]) {
+    for (size_t p = 0; p < planes.size(); p++) { planes[p].store(out[p]); }
+}
+
+size_t cullTail(const float (&planes)[6][4], const AabbArray &boxes,
+                size_t first, uint32_t *visible, size_t count) {
+    for (size_t i = first; i < boxes.size(); i++) {
+        visible[count] = static_cast<uint32_t>(i);
+        count += insideScalar(planes, boxes, i);
+    }
+    return count;
+}
+
+#if !defined(LIGHT_SIMD_SCALAR)
+// which array each coordinate of a plane's farthest corner comes from, so
+// that the vector loop loads instead of selecting
+struct PlaneCorner {
+    const float *x;
+    const float *y;
+    const float *z;
+};
+
+std::array<PlaneCorner, 6> planeCorners(const float (&planes)[6][4],
+                                        const AabbArray &boxes) {
+    std::array<PlaneCorner, 6> corners;
+    for (size_t p = 0; p < 6; p++) {
+        corners[p] = {0.0f < planes[p][0] ? boxes.maxX.data()
+                                          : boxes.minX.data(),
+                      0.0f < planes[p][1] ? boxes.maxY.data()
+                                          : boxes.minY.data(),
+                      0.0f < planes[p][2] ? boxes.maxZ.data()
+                                          : boxes.minZ.data()};
+    }
+    return corners;
+}
+#endif
+
+}// namespace
+
+const char *simdInstructionSet() {
+#if defined(LIGHT_SIMD_AVX2)
+    return "avx2";
+#elif defined(LIGHT_SIMD_SSE)
+    return "sse2";
+#elif defined(LIGHT_SIMD_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
+
+Mat4 Mat4::identity() {
+    return {{Vec4(1.0f, 0.0f, 0.0f, 0.0f), Vec4(0.0f, 1.0f, 0.0f, 0.0f),
+             Vec4(0.0f, 0.0f, 1.0f, 0.0f), Vec4(0.0f, 0.0f, 0.0f, 1.0f)}};
+}
+
+Mat4 Mat4::translation(const Vec3 &t) {
+    Mat4 m = identity();
+    m.columns[3] = Vec4::point(t);
+    return m;
+}
+
+Mat4 Mat4::scale(const Vec3 &s) {
+    return {{Vec4(s.x, 0.0f, 0.0f, 0.0f), Vec4(0.0f, s.y, 0.0f, 0.0f),
+             Vec4(0.0f, 0.0f, s.z, 0.0f), Vec4(0.0f, 0.0f, 0.0f, 1.0f)}};
+}
+
+Mat4 Mat4::rotation(const Quat &q) {
+    float m[9];
+    rotationScale(q.x, q.y, q.z, q.w, 1.0f, m);
+    return {{Vec4(m[0], m[1], m[2], 0.0f), Vec4(m[3], m[4], m[5], 0.0f),
+             Vec4(m[6], m[7], m[8], 0.0f), Vec4(0.0f, 0.0f, 0.0f, 1.0f)}};
+}
+
+Mat4 perspective(float fovY, float aspect, float near, float far) {
+    float f = 1.0f / std::tan(fovY / 2.0f);
+    return {{Vec4(f / aspect, 0.0f, 0.0f, 0.0f), Vec4(0.0f, -f, 0.0f, 0.0f),
+             Vec4(0.0f, 0.0f, far / (near - far), -1.0f),
+             Vec4(0.0f, 0.0f, near * far / (near - far), 0.0f)}};
+}
+
+Mat4 lookAt(const Vec3 &eye, const Vec3 &center, const Vec3 &up) {
+    Vec4 e = Vec4::direction(eye);
+    Vec4 f = normalize3(Vec4::direction(center) - e);
+    Vec4 s = normalize3(cross3(f, Vec4::direction(up)));
+    Vec4 u = cross3(s, f);
+    return {{Vec4(s[0], u[0], -f[0], 0.0f), Vec4(s[1], u[1], -f[1], 0.0f),
+             Vec4(s[2], u[2], -f[2], 0.0f),
+             Vec4(-dot3(s, e), -dot3(u, e), dot3(f, e), 1.0f)}};
+}
+
+std::array<Vec4, 6> frustumPlanes(const Mat4 &viewProjection) {
+    // the rows of the matrix are the columns of its transpose
+    Vec4 r0 = viewProjection.columns[0], r1 = viewProjection.columns[1];
+    Vec4 r2 = viewProjection.columns[2], r3 = viewProjection.columns[3];
+    transpose(r0, r1, r2, r3);
+    auto normalized = [](Vec4 plane) {
+        return plane * (1.0f / std::sqrt(dot3(plane, plane)));
+    };
+    return {normalized(r3 + r0), normalized(r3 - r0), normalized(r3 + r1),
+            normalized(r3 - r1), normalized(r2),      normalized(r3 - r2)};
+}
+
+void AabbArray::reserve(size_t count) {
+    for (auto *v : {&minX, &minY, &minZ, &maxX, &maxY, &maxZ}) {
+        v->reserve(count);
+    }
+}
+
+void AabbArray::push_back(const Vec3 &min, const Vec3 &max) {
+    minX.push_back(min.x);
+    minY.push_back(min.y);
+    minZ.push_back(min.z);
+    maxX.push_back(max.x);
+    maxY.push_back(max.y);
+    maxZ.push_back(max.z);
+}
+
+size_t cullAabbsScalar(const std::array<Vec4, 6> &planes,
+                       const AabbArray &boxes, uint32_t *visible) {
+    float p[6][4];
+    planeFloats(planes, p);
+    return cullTail(p, boxes, 0, visible, 0);
+}
+
+size_t cullAabbs(const std::array<Vec4, 6> &planes, const AabbArray &boxes,
+                 uint32_t *visible) {
+    float p[6][4];
+    planeFloats(planes, p);
+    size_t count = 0;
+    size_t i = 0;
+#if !defined(LIGHT_SIMD_SCALAR)
+    std::array<PlaneCorner, 6> corners = planeCorners(p, boxes);
+#endif
+    // indices are written unconditionally and only kept by advancing count,
+    // which leaves no branch for the visibility pattern to mispredict
+#if defined(LIGHT_SIMD_AVX2)
+    __m256 nx[6], ny[6], nz[6], d[6];
+    for (int k = 0; k < 6; k++) {
+        nx[k] = _mm256_set1_ps(p[k][0]);
+        ny[k] = _mm256_set1_ps(p[k][1]);
+        nz[k] = _mm256_set1_ps(p[k][2]);
+        d[k] = _mm256_set1_ps(p[k][3]);
+    }
+    for (; i + 8 <= boxes.size(); i += 8) {
+        __m256 outside = _mm256_setzero_ps();
+        for (int k = 0; k < 6; k++) {
+            __m256 distance = _mm256_fmadd_ps(
+                    nx[k], _mm256_loadu_ps(corners[k].x + i),
+                    _mm256_fmadd_ps(
+                            ny[k], _mm256_loadu_ps(corners[k].y + i),
+                            _mm256_fmadd_ps(nz[k],
+                                            _mm256_loadu_ps(corners[k].z + i),
+                                            d[k])));
+            outside = _mm256_or_ps(
+                    outside,
+                    _mm256_cmp_ps(distance, _mm256_setzero_ps(), _CMP_LT_OQ));
+        }
+        auto inside = static_cast<uint32_t>(~_mm256_movemask_ps(outside));
+        for (uint32_t lane = 0; lane < 8; lane++) {
+            visible[count] = static_cast<uint32_t>(i) + lane;
+            count += (inside >> lane) & 1u;
+        }
+    }
+#elif defined(LIGHT_SIMD_SSE) || defined(LIGHT_SIMD_NEON)
+    Vec4 nx[6], ny[6], nz[6], d[6];
+    for (int k = 0; k < 6; k++) {
+        nx[k] = Vec4::splat(p[k][0]);
+        ny[k] = Vec4::splat(p[k][1]);
+        nz[k] = Vec4::splat(p[k][2]);
+        d[k] = Vec4::splat(p[k][3]);
+    }
+    for (; i + 4 <= boxes.size(); i += 4) {
+#if defined(LIGHT_SIMD_SSE)
+        __m128 outside = _mm_setzero_ps();
+#else
+        uint32x4_t outside = vdupq_n_u32(0);
+#endif
+        for (int k = 0; k < 6; k++) {
+            Vec4 distance = multiplyAdd(
+                    nx[k], Vec4::load(corners[k].x + i),
+                    multiplyAdd(ny[k], Vec4::load(corners[k].y + i),
+                                multiplyAdd(nz[k],
+                                            Vec4::load(corners[k].z + i),
+                                            d[k])));
+#if defined(LIGHT_SIMD_SSE)
+            outside = _mm_or_ps(outside,
+                                _mm_cmplt_ps(distance.v, _mm_setzero_ps()));
+#else
+            outside = vorrq_u32(outside,
+                                vcltq_f32(distance.v, vdupq_n_f32(0.0f)));
+#endif
+        }
+#if defined(LIGHT_SIMD_SSE)
+        auto inside = static_cast<uint32_t>(~_mm_movemask_ps(outside));
+#else
+        // one bit per lane, like movemask
+        const uint32_t laneBits[4] = {1, 2, 4, 8};
+        uint32_t inside = ~vaddvq_u32(
+                vandq_u32(outside, vld1q_u32(laneBits)));
+#endif
+        for (uint32_t lane = 0; lane < 4; lane++) {
+            visible[count] = static_cast<uint32_t>(i) + lane;
+            count += (inside >> lane) & 1u;
+        }
+    }
+#endif
+    return cullTail(p, boxes, i, visible, count);
+}
+
+void TransformHierarchy::reserve(size_t count) {
+    parents.reserve(count);
+    for (auto *v : {&positionX, &positionY, &positionZ, &rotationX,
+                    &rotationY, &rotationZ, &rotationW, &scales}) {
+        v->reserve(count);
+    }
+    world.reserve(count);
+}
+
+uint32_t TransformHierarchy::add(uint32_t parent, const Vec3 &position,
+                                 const Quat &rotation, float scale) {
+    auto node = static_cast<uint32_t>(size());
+    parents.push_back(parent);
+    for (auto *v : {&positionX, &positionY, &positionZ, &rotationX,
+                    &rotationY, &rotationZ, &rotationW, &scales}) {
+        v->push_back(0.0f);
+    }
+    world.push_back(Mat4::identity());
+    setLocal(node, position, rotation, scale);
+    return node;
+}
+
+void TransformHierarchy::setLocal(uint32_t node, const Vec3 &position,
+                                  const Quat &rotation, float scale) {
+    positionX[node] = position.x;
+    positionY[node] = position.y;
+    positionZ[node] = position.z;
+    rotationX[node] = rotation.x;
+    rotationY[node] = rotation.y;
+    rotationZ[node] = rotation.z;
+    rotationW[node] = rotation.w;
+    scales[node] = scale;
+}
+
+void TransformHierarchy::update() {
+    Mat4 locals[kTransformBatchSize];
+    Vec4 one = Vec4::splat(1.0f);
+    Vec4 two = Vec4::splat(2.0f);
+    for (size_t first = 0; first < size(); first += kTransformBatchSize) {
+        size_t count = std::min(kTransformBatchSize, size() - first);
+        size_t i = 0;
+        // four nodes per register, one matrix element per variable, then a
+        // transpose turns lanes into columns
+        for (; i + 4 <= count; i += 4) {
+            size_t node = first + i;
+            Vec4 x = Vec4::load(&rotationX[node]);
+            Vec4 y = Vec4::load(&rotationY[node]);
+            Vec4 z = Vec4::load(&rotationZ[node]);
+            Vec4 w = Vec4::load(&rotationW[node]);
+            Vec4 s = Vec4::load(&scales[node]);
+            Vec4 s2 = two * s;
+            Vec4 xx = x * x, yy = y * y, zz = z * z;
+            Vec4 xy = x * y, xz = x * z, yz = y * z;
+            Vec4 wx = w * x, wy = w * y, wz = w * z;
+            std::array<std::array<Vec4, 4>, 4> columns = {{
+                    {(one - two * (yy + zz)) * s, s2 * (xy + wz),
+                     s2 * (xz - wy), Vec4::zero()},
+                    {s2 * (xy - wz), (one - two * (xx + zz)) * s,
+                     s2 * (yz + wx), Vec4::zero()},
+                    {s2 * (xz + wy), s2 * (yz - wx),
+                     (one - two * (xx + yy)) * s, Vec4::zero()},
+                    {Vec4::load(&positionX[node]),
+                     Vec4::load(&positionY[node]),
+                     Vec4::load(&positionZ[node]), one},
+            }};
+            for (int c = 0; c < 4; c++) {
+                auto &column = columns[c];
+                transpose(column[0], column[1], column[2], column[3]);
+                for (int lane = 0; lane < 4; lane++) {
+                    locals[i + lane].columns[c] = column[lane];
+                }
+            }
+        }
+        for (; i < count; i++) {
+            size_t node = first + i;
+            float m[9];
+            rotationScale(rotationX[node], rotationY[node], rotationZ[node],
+                          rotationW[node], scales[node], m);
+            locals[i] = {{Vec4(m[0], m[1], m[2], 0.0f),
+                          Vec4(m[3], m[4], m[5], 0.0f),
+                          Vec4(m[6], m[7], m[8], 0.0f),
+                          Vec4(positionX[node], positionY[node],
+                               positionZ[node], 1.0f)}};
+        }
+
+        for (i = 0; i < count; i++) {
+            uint32_t parent = parents[first + i];
+            world[first + i] = parent == kNoParent
+                                       ? locals[i]
+                                       : world[parent] * locals[i];
+        }
+    }
+}
+
+void TransformHierarchy::updateScalar() {
+    for (size_t node = 0; node < size(); node++) {
+        float local[16];
+        float r[9];
+        rotationScale(rotationX[node], rotationY[node], rotationZ[node],
+                      rotationW[node], scales[node], r);
+        for (int c = 0; c < 3; c++) {
+            for (int row = 0; row < 3; row++) {
+                local[c * 4 + row] = r[c * 3 + row];
+            }
+            local[c * 4 + 3] = 0.0f;
+        }
+        local[12] = positionX[node];
+        local[13] = positionY[node];
+        local[14] = positionZ[node];
+        local[15] = 1.0f;
+
+        float result[16];
+        if (parents[node] == kNoParent) {
+            std::copy(local, local + 16, result);
+        } else {
+            float parent[16];
+            for (int c = 0; c < 4; c++) {
+                world[parents[node]].columns[c].store(parent + c * 4);
+            }
+            for (int c = 0; c < 4; c++) {
+                for (int row = 0; row < 4; row++) {
+                    float sum = 0.0f;
+                    for (int k = 0; k < 4; k++) {
+                        sum += parent[k * 4 + row] * local[c * 4 + k];
+                    }
+                    result[c * 4 + row] = sum;
+                }
+            }
+        }
+        for (int c = 0; c < 4; c++) {
+            world[node].columns[c] = Vec4::load(result + c * 4);
+        }
+    }
+}
@@ -0,0 +1,324 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// the widest instruction set the compiler targets is used, LIGHT_SIMD_SCALAR
+// forces the plain c++ fallback. avx2 only widens the batch functions, the
+// vector types stay four floats wide. neon needs aarch64
+#if defined(LIGHT_SIMD_SCALAR)
+#elif defined(__AVX2__) && defined(__FMA__)
+#define LIGHT_SIMD_AVX2 1
+#define LIGHT_SIMD_SSE 1
+#elif defined(__SSE2__) || defined(_M_X64)
+#define LIGHT_SIMD_SSE 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define LIGHT_SIMD_NEON 1
+#endif
+
+#if defined(LIGHT_SIMD_SSE)
+#include <immintrin.h>
+#elif defined(LIGHT_SIMD_NEON)
+#include <arm_neon.h>
+#endif
+
+// "avx2", "sse2", "neon" or "scalar"
+const char *simdInstructionSet();
+
+// plain storage, for apis and tables
+struct Vec3 {
+    float x, y, z;
+};
+
+// unit quaternion, w is the real part
+struct Quat {
+    float x, y, z, w;
+};
+
+// four floats in one register
+struct alignas(16) Vec4 {
+#if defined(LIGHT_SIMD_SSE)
+    __m128 v;
+#elif defined(LIGHT_SIMD_NEON)
+    float32x4_t v;
+#else
+    std::array<float, 4> v;
+#endif
+
+    Vec4() = default;
+    Vec4(float x, float y, float z, float w);
+    static Vec4 splat(float s);
+    static Vec4 zero() { return splat(0.0f); }
+    // a point has w 1, a direction w 0
+    static Vec4 point(const Vec3 &p) { return {p.x, p.y, p.z, 1.0f}; }
+    static Vec4 direction(const Vec3 &d) { return {d.x, d.y, d.z, 0.0f}; }
+    // p need not be aligned
+    static Vec4 load(const float *p);
+    void store(float *p) const;
+
+    float operator[](int i) const {
+        alignas(16) float lanes[4];
+        store(lanes);
+        return lanes[i];
+    }
+};
+
+// column major, columns are vectors
+struct alignas(16) Mat4 {
+    std::array<Vec4, 4> columns;
+
+    static Mat4 identity();
+    static Mat4 translation(const Vec3 &t);
+    static Mat4 scale(const Vec3 &s);
+    static Mat4 rotation(const Quat &q);
+};
+
+#if defined(LIGHT_SIMD_SSE)
+
+inline Vec4::Vec4(float x, float y, float z, float w)
+    : v(_mm_setr_ps(x, y, z, w)) {}
+inline Vec4 Vec4::splat(float s) {
+    Vec4 r;
+    r.v = _mm_set1_ps(s);
+    return r;
+}
+inline Vec4 Vec4::load(const float *p) {
+    Vec4 r;
+    r.v = _mm_loadu_ps(p);
+    return r;
+}
+inline void Vec4::store(float *p) const { _mm_storeu_ps(p, v); }
+
+#define LIGHT_VEC4_BINARY(op, intrinsic)                                       \
+    inline Vec4 operator op(Vec4 a, Vec4 b) {                                 \
+        Vec4 r;                                                                \
+        r.v = intrinsic(a.v, b.v);                                             \
+        return r;                                                              \
+    }
+LIGHT_VEC4_BINARY(+, _mm_add_ps)
+LIGHT_VEC4_BINARY(-, _mm_sub_ps)
+LIGHT_VEC4_BINARY(*, _mm_mul_ps)
+LIGHT_VEC4_BINARY(/, _mm_div_ps)
+#undef LIGHT_VEC4_BINARY
+
+inline Vec4 min(Vec4 a, Vec4 b) {
+    Vec4 r;
+    r.v = _mm_min_ps(a.v, b.v);
+    return r;
+}
+inline Vec4 max(Vec4 a, Vec4 b) {
+    Vec4 r;
+    r.v = _mm_max_ps(a.v, b.v);
+    return r;
+}
+// a * b + c
+inline Vec4 multiplyAdd(Vec4 a, Vec4 b, Vec4 c) {
+    Vec4 r;
+#if defined(LIGHT_SIMD_AVX2)
+    r.v = _mm_fmadd_ps(a.v, b.v, c.v);
+#else
+    r.v = _mm_add_ps(_mm_mul_ps(a.v, b.v), c.v);
+#endif
+    return r;
+}
+// the lane broadcast to all four
+template<int lane>
+inline Vec4 broadcast(Vec4 a) {
+    Vec4 r;
+    r.v = _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(lane, lane, lane, lane));
+    return r;
+}
+inline void transpose(Vec4 &a, Vec4 &b, Vec4 &c, Vec4 &d) {
+    _MM_TRANSPOSE4_PS(a.v, b.v, c.v, d.v);
+}
+
+#elif defined(LIGHT_SIMD_NEON)
+
+inline Vec4::Vec4(float x, float y, float z, float w) {
+    const float lanes[4] = {x, y, z, w};
+    v = vld1q_f32(lanes);
+}
+inline Vec4 Vec4::splat(float s) {
+    Vec4 r;
+    r.v = vdupq_n_f32(s);
+    return r;
+}
+inline Vec4 Vec4::load(const float *p) {
+    Vec4 r;
+    r.v = vld1q_f32(p);
+    return r;
+}
+inline void Vec4::store(float *p) const { vst1q_f32(p, v); }
+
+#define LIGHT_VEC4_BINARY(op, intrinsic)                                       \
+    inline Vec4 operator op(Vec4 a, Vec4 b) {                                 \
+        Vec4 r;                                                                \
+        r.v = intrinsic(a.v, b.v);                                             \
+        return r;                                                              \
+    }
+LIGHT_VEC4_BINARY(+, vaddq_f32)
+LIGHT_VEC4_BINARY(-, vsubq_f32)
+LIGHT_VEC4_BINARY(*, vmulq_f32)
+LIGHT_VEC4_BINARY(/, vdivq_f32)
+#undef LIGHT_VEC4_BINARY
+
+inline Vec4 min(Vec4 a, Vec4 b) {
+    Vec4 r;
+    r.v = vminq_f32(a.v, b.v);
+    return r;
+}
+inline Vec4 max(Vec4 a, Vec4 b) {
+    Vec4 r;
+    r.v = vmaxq_f32(a.v, b.v);
+    return r;
+}
+inline Vec4 multiplyAdd(Vec4 a, Vec4 b, Vec4 c) {
+    Vec4 r;
+    r.v = vfmaq_f32(c.v, a.v, b.v);
+    return r;
+}
+template<int lane>
+inline Vec4 broadcast(Vec4 a) {
+    Vec4 r;
+    r.v = vdupq_laneq_f32(a.v, lane);
+    return r;
+}
+inline void transpose(Vec4 &a, Vec4 &b, Vec4 &c, Vec4 &d) {
+    float32x4x2_t ab = vtrnq_f32(a.v, b.v);
+    float32x4x2_t cd = vtrnq_f32(c.v, d.v);
+    a.v = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+    b.v = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+    c.v = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+    d.v = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+}
+
+#else
+
+inline Vec4::Vec4(float x, float y, float z, float w) : v{x, y, z, w} {}
+inline Vec4 Vec4::splat(float s) { return {s, s, s, s}; }
+inline Vec4 Vec4::load(const float *p) { return {p[0], p[1], p[2], p[3]}; }
+inline void Vec4::store(float *p) const {
+    for (int i = 0; i < 4; i++) { p[i] = v[i]; }
+}
+
+#define LIGHT_VEC4_BINARY(op)                                                  \
+    inline Vec4 operator op(Vec4 a, Vec4 b) {                                 \
+        return {a.v[0] op b.v[0], a.v[1] op b.v[1], a.v[2] op b.v[2],         \
+                a.v[3] op b.v[3]};                                             \
+    }
+LIGHT_VEC4_BINARY(+)
+LIGHT_VEC4_BINARY(-)
+LIGHT_VEC4_BINARY(*)
+LIGHT_VEC4_BINARY(/)
+#undef LIGHT_VEC4_BINARY
+
+inline Vec4 min(Vec4 a, Vec4 b) {
+    return {std::fmin(a.v[0], b.v[0]), std::fmin(a.v[1], b.v[1]),
+            std::fmin(a.v[2], b.v[2]), std::fmin(a.v[3], b.v[3])};
+}
+inline Vec4 max(Vec4 a, Vec4 b) {
+    return {std::fmax(a.v[0], b.v[0]), std::fmax(a.v[1], b.v[1]),
+            std::fmax(a.v[2], b.v[2]), std::fmax(a.v[3], b.v[3])};
+}
+inline Vec4 multiplyAdd(Vec4 a, Vec4 b, Vec4 c) { return a * b + c; }
+template<int lane>
+inline Vec4 broadcast(Vec4 a) {
+    return Vec4::splat(a.v[lane]);
+}
+inline void transpose(Vec4 &a, Vec4 &b, Vec4 &c, Vec4 &d) {
+    Vec4 rows[4] = {a, b, c, d};
+    for (int i = 0; i < 4; i++) {
+        a.v[i] = rows[i].v[0];
+        b.v[i] = rows[i].v[1];
+        c.v[i] = rows[i].v[2];
+        d.v[i] = rows[i].v[3];
+    }
+}
+
+#endif
+
+inline Vec4 operator*(Vec4 a, float s) { return a * Vec4::splat(s); }
+inline Vec4 operator-(Vec4 a) { return Vec4::zero() - a; }
+
+// of the xyz components, w is ignored
+inline float dot3(Vec4 a, Vec4 b) {
+    Vec4 p = a * b;
+    return p[0] + p[1] + p[2];
+}
+inline Vec4 cross3(Vec4 a, Vec4 b) {
+    return {a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2],
+            a[0] * b[1] - a[1] * b[0], 0.0f};
+}
+inline Vec4 normalize3(Vec4 a) { return a * (1.0f / std::sqrt(dot3(a, a))); }
+
+inline Vec4 operator*(const Mat4 &m, Vec4 v) {
+    Vec4 r = m.columns[0] * broadcast<0>(v);
+    r = multiplyAdd(m.columns[1], broadcast<1>(v), r);
+    r = multiplyAdd(m.columns[2], broadcast<2>(v), r);
+    return multiplyAdd(m.columns[3], broadcast<3>(v), r);
+}
+inline Mat4 operator*(const Mat4 &a, const Mat4 &b) {
+    Mat4 m;
+    for (int i = 0; i < 4; i++) { m.columns[i] = a * b.columns[i]; }
+    return m;
+}
+
+// right handed view space, vulkan clip space: y down, depth from 0 to 1. y is
+// flipped, so that counterclockwise faces stay counterclockwise on screen
+Mat4 perspective(float fovY, float aspect, float near, float far);
+Mat4 lookAt(const Vec3 &eye, const Vec3 &center, const Vec3 &up);
+// left, right, top, bottom, near, far as xyz normal and w distance, pointing
+// inwards and normalized, so that distances compare with radii
+std::array<Vec4, 6> frustumPlanes(const Mat4 &viewProjection);
+
+// axis aligned boxes as a structure of arrays, a register holds the same
+// coordinate of several boxes
+struct AabbArray {
+    std::vector<float> minX, minY, minZ;
+    std::vector<float> maxX, maxY, maxZ;
+
+    size_t size() const { return minX.size(); }
+    void reserve(size_t count);
+    void push_back(const Vec3 &min, const Vec3 &max);
+};
+
+// write the indices of the boxes at least partly inside all planes to
+// visible, which has room for every box, and return how many there are. the
+// first tests several boxes per instruction, the second one at a time
+size_t cullAabbs(const std::array<Vec4, 6> &planes, const AabbArray &boxes,
+                 uint32_t *visible);
+size_t cullAabbsScalar(const std::array<Vec4, 6> &planes,
+                       const AabbArray &boxes, uint32_t *visible);
+
+const uint32_t kNoParent = ~0u;
+// nodes whose local matrices are built together before their world matrices
+// are, small enough for both to stay in the l1 cache
+const size_t kTransformBatchSize = 64;
+
+// local transforms as a structure of arrays, parents always before their
+// children, so that a single pass in order finds every parent's world matrix
+// already updated
+struct TransformHierarchy {
+    std::vector<uint32_t> parents;
+    std::vector<float> positionX, positionY, positionZ;
+    std::vector<float> rotationX, rotationY, rotationZ, rotationW;
+    // uniform
+    std::vector<float> scales;
+    std::vector<Mat4> world;
+
+    size_t size() const { return parents.size(); }
+    void reserve(size_t count);
+    // parent is kNoParent or a node added before
+    uint32_t add(uint32_t parent, const Vec3 &position, const Quat &rotation,
+                 float scale = 1.0f);
+    void setLocal(uint32_t node, const Vec3 &position, const Quat &rotation,
+                  float scale = 1.0f);
+
+    // recomputes every world matrix, building four local matrices at a time
+    void update();
+    // the same one node and one float at a time
+    void updateScalar();
+};
@@ -0,0 +1,180 @@
+#include "submission.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+bool enableTimelineSemaphores(vk::PhysicalDevice physicalDevice,
+                              vk::PhysicalDeviceVulkan12Features &features) {
+    if (physicalDevice.getProperties().apiVersion < VK_API_VERSION_1_2) {
+        return false;
+    }
+    auto chain = physicalDevice.getFeatures2<
+            vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features>();
+    if (!chain.get<vk::PhysicalDeviceVulkan12Features>().timelineSemaphore) {
+        return false;
+    }
+    features.setTimelineSemaphore(true);
+    return true;
+}
+
+SubmissionScheduler::SubmissionScheduler(vk::UniqueDevice &device,
+                                         uint32_t graphicsQueueFamilyIndex,
+                                         uint32_t computeQueueFamilyIndex,
+                                         uint32_t transferQueueFamilyIndex)
+    : device(*device) {
+    std::array<uint32_t, kQueueTypeCount> familyIndices = {
+            graphicsQueueFamilyIndex, computeQueueFamilyIndex,
+            transferQueueFamilyIndex};
+    for (uint32_t type = 0; type < kQueueTypeCount; type++) {
+        auto it = std::find_if(queues.begin(), queues.end(),
+                               [&](const Queue &queue) {
+                                   return queue.familyIndex ==
+                                          familyIndices[type];
+                               });
+        if (it != queues.end()) {
+            queueIndices[type] = static_cast<uint32_t>(it - queues.begin());
+            continue;
+        }
+        vk::SemaphoreTypeCreateInfo semaphoreTypeCreateInfo(
+                vk::SemaphoreType::eTimeline, 0);
+        vk::SemaphoreCreateInfo semaphoreCreateInfo;
+        semaphoreCreateInfo.pNext = &semaphoreTypeCreateInfo;
+        queueIndices[type] = static_cast<uint32_t>(queues.size());
+        queues.push_back({device->getQueue(familyIndices[type], 0),
+                          familyIndices[type],
+                          device->createSemaphoreUnique(semaphoreCreateInfo)});
+    }
+    pending.resize(queues.size());
+}
+
+SubmissionScheduler::~SubmissionScheduler() noexcept { waitIdle(); }
+
+TimelinePoint SubmissionScheduler::submit(const SubmissionTask &task) {
+    PendingTask pendingTask;
+    pendingTask.commandBuffers = task.commandBuffers;
+    pendingTask.dependencies.assign(queues.size(), 0);
+    // only the latest point per queue matters, earlier ones are implied
+    std::vector<vk::PipelineStageFlags> stages(queues.size());
+    for (const auto &wait : task.waits) {
+        const TimelinePoint &point = wait.first;
+        uint32_t index = queueIndices[static_cast<uint32_t>(point.queue)];
+        if (queues[index].queuedValue < point.value) {
+            throw std::runtime_error("waiting for a point never submitted");
+        }
+        uint64_t &dependency = pendingTask.dependencies[index];
+        dependency = std::max(dependency, point.value);
+        stages[index] |= wait.second;
+    }
+    for (uint32_t i = 0; i < queues.size(); i++) {
+        // a point that is already reached needs no semaphore wait
+        if (pendingTask.dependencies[i] <= queues[i].completedValue) {
+            continue;
+        }
+        pendingTask.waitSemaphores.push_back(*queues[i].timeline);
+        pendingTask.waitValues.push_back(pendingTask.dependencies[i]);
+        pendingTask.waitStages.push_back(stages[i]);
+    }
+    // values of binary semaphores are ignored, but the arrays must match
+    for (const auto &wait : task.semaphoreWaits) {
+        pendingTask.waitSemaphores.push_back(wait.first);
+        pendingTask.waitValues.push_back(0);
+        pendingTask.waitStages.push_back(wait.second);
+    }
+
+    Queue &queue = queueOf(task.queue);
+    TimelinePoint point{task.queue, ++queue.queuedValue};
+    pendingTask.signalSemaphores.push_back(*queue.timeline);
+    pendingTask.signalValues.push_back(point.value);
+    for (vk::Semaphore semaphore : task.semaphoreSignals) {
+        pendingTask.signalSemaphores.push_back(semaphore);
+        pendingTask.signalValues.push_back(0);
+    }
+    pending[queueIndices[static_cast<uint32_t>(task.queue)]].push_back(
+            std::move(pendingTask));
+    taskCount++;
+    return point;
+}
+
+void SubmissionScheduler::flush() {
+    // a task may only go out after the tasks signaling what it waits for,
+    // binary semaphores must not be waited on before their signal is
+    // submitted. every dependency was queued before its dependent, so each
+    // round submits at least the oldest task left
+    for (;;) {
+        bool progress = false;
+        bool remaining = false;
+        for (uint32_t i = 0; i < queues.size(); i++) {
+            std::vector<PendingTask> &tasks = pending[i];
+            size_t count = 0;
+            while (count < tasks.size()) {
+                const PendingTask &task = tasks[count];
+                bool ready = true;
+                for (uint32_t j = 0; j < queues.size(); j++) {
+                    ready &= j == i || task.dependencies[j] <=
+                                               queues[j].submittedValue;
+                }
+                if (!ready) { break; }
+                count++;
+            }
+            if (count < tasks.size()) { remaining = true; }
+            if (count == 0) { continue; }
+
+            std::vector<vk::TimelineSemaphoreSubmitInfo> timelineInfos;
+            std::vector<vk::SubmitInfo> submitInfos;
+            // the submit infos point into both
+            timelineInfos.reserve(count);
+            submitInfos.reserve(count);
+            for (size_t k = 0; k < count; k++) {
+                const PendingTask &task = tasks[k];
+                timelineInfos.emplace_back(task.waitValues,
+                                           task.signalValues);
+                submitInfos.emplace_back(task.waitSemaphores, task.waitStages,
+                                         task.commandBuffers,
+                                         task.signalSemaphores);
+                submitInfos.back().pNext = &timelineInfos.back();
+            }
+            queues[i].queue.submit(submitInfos, nullptr);
+            queues[i].submittedValue = tasks[count - 1].signalValues.front();
+            tasks.erase(tasks.begin(), tasks.begin() + count);
+            submitCount++;
+            progress = true;
+        }
+        if (!remaining) { return; }
+        if (!progress) {
+            throw std::runtime_error("circular submission dependencies");
+        }
+    }
+}
+
+bool SubmissionScheduler::isComplete(const TimelinePoint &point) {
+    Queue &queue = queueOf(point.queue);
+    if (point.value <= queue.completedValue) { return true; }
+    if (queue.submittedValue < point.value) { return false; }
+    queue.completedValue = device.getSemaphoreCounterValue(*queue.timeline);
+    return point.value <= queue.completedValue;
+}
+
+void SubmissionScheduler::wait(const TimelinePoint &point) {
+    Queue &queue = queueOf(point.queue);
+    if (point.value <= queue.completedValue) { return; }
+    if (queue.submittedValue < point.value) { flush(); }
+    vk::SemaphoreWaitInfo waitInfo(vk::SemaphoreWaitFlags(), 1,
+                                   &*queue.timeline, &point.value);
+    while (vk::Result::eTimeout ==
+           device.waitSemaphores(waitInfo,
+                                 std::numeric_limits<uint64_t>::max())) {}
+    queue.completedValue = std::max(queue.completedValue, point.value);
+}
+
+void SubmissionScheduler::waitIdle() {
+    for (uint32_t type = 0; type < kQueueTypeCount; type++) {
+        auto queueType = static_cast<QueueType>(type);
+        wait({queueType, queueOf(queueType).queuedValue});
+    }
+}
+
+void SubmissionScheduler::report(std::ostream &os) const {
+    os << "submission: " << taskCount << " tasks in " << submitCount
+       << " queue submits on " << queues.size() << " queues" << std::endl;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <array>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+enum class QueueType : uint32_t { eGraphics, eCompute, eTransfer };
+const uint32_t kQueueTypeCount = 3;
+
+// a value on the timeline of a queue, reached once every task submitted to
+// the queue up to the one that returned it finished. value 0 is reached from
+// the start, so a default point never blocks
+struct TimelinePoint {
+    QueueType queue{QueueType::eGraphics};
+    uint64_t value{0};
+};
+
+// work for one queue and what it has to wait for
+struct SubmissionTask {
+    QueueType queue{QueueType::eGraphics};
+    std::vector<vk::CommandBuffer> commandBuffers;
+    // points on any queue's timeline, waited for before the given stages
+    std::vector<std::pair<TimelinePoint, vk::PipelineStageFlags>> waits;
+    // binary semaphores, as the swapchain hands them out and takes them back
+    std::vector<std::pair<vk::Semaphore, vk::PipelineStageFlags>>
+            semaphoreWaits;
+    std::vector<vk::Semaphore> semaphoreSignals;
+};
+
+// timeline semaphores are core in vulkan 1.2 but have to be enabled, false
+// if the device lacks them. features goes into the pNext chain of the device
+// create info
+bool enableTimelineSemaphores(vk::PhysicalDevice physicalDevice,
+                              vk::PhysicalDeviceVulkan12Features &features);
+
+// owns the graphics, compute and transfer queues and a timeline semaphore
+// for each. tasks are queued with explicit dependencies on each other's
+// timeline points and go out on flush(), as one vkQueueSubmit per queue
+// whenever their dependencies allow it. the cpu waits for timeline values
+// instead of fences. types whose family is the same share a queue and a
+// timeline. not thread safe, submissions come from the frame loop
+struct SubmissionScheduler {
+    struct Queue {
+        vk::Queue queue;
+        uint32_t familyIndex;
+        vk::UniqueSemaphore timeline;
+        // signaled by the last task queued, submitted and known finished
+        uint64_t queuedValue{0};
+        uint64_t submittedValue{0};
+        uint64_t completedValue{0};
+    };
+
+    vk::Device device;
+    std::vector<Queue> queues;
+    // index into queues by QueueType
+    std::array<uint32_t, kQueueTypeCount> queueIndices;
+
+    // statistics
+    uint64_t taskCount{0};
+    uint64_t submitCount{0};
+
+    SubmissionScheduler(vk::UniqueDevice &device,
+                        uint32_t graphicsQueueFamilyIndex,
+                        uint32_t computeQueueFamilyIndex,
+                        uint32_t transferQueueFamilyIndex);
+    ~SubmissionScheduler() noexcept;
+    SubmissionScheduler(const SubmissionScheduler &) = delete;
+    SubmissionScheduler &operator=(const SubmissionScheduler &) = delete;
+
+    vk::Queue queue(QueueType type) const {
+        return queues[queueIndices[static_cast<uint32_t>(type)]].queue;
+    }
+    uint32_t familyIndex(QueueType type) const {
+        return queues[queueIndices[static_cast<uint32_t>(type)]].familyIndex;
+    }
+
+    // queues the task, it reaches the driver with the next flush. the
+    // command buffers must stay alive until the returned point is complete
+    TimelinePoint submit(const SubmissionTask &task);
+    // hands every queued task to the driver
+    void flush();
+    bool isComplete(const TimelinePoint &point);
+    // blocks until the point is reached, flushing first if it is still queued
+    void wait(const TimelinePoint &point);
+    // waits for everything queued so far on every queue
+    void waitIdle();
+
+    void report(std::ostream &os) const;
+
+private:
+    struct PendingTask {
+        std::vector<vk::CommandBuffer> commandBuffers;
+        std::vector<vk::Semaphore> waitSemaphores;
+        std::vector<uint64_t> waitValues;
+        std::vector<vk::PipelineStageFlags> waitStages;
+        std::vector<vk::Semaphore> signalSemaphores;
+        std::vector<uint64_t> signalValues;
+        // latest value of every queue's timeline the task waits for
+        std::vector<uint64_t> dependencies;
+    };
+
+    Queue &queueOf(QueueType type) {
+        return queues[queueIndices[static_cast<uint32_t>(type)]];
+    }
+
+    // per queue, in submission order
+    std::vector<std::vector<PendingTask>> pending;
+};
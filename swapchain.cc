@@ -0,0 +1,208 @@
+#include "swapchain.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+template<typename T>
+VULKAN_HPP_INLINE constexpr const T &clamp(const T &v, const T &low,
+                                           const T &height) {
+    return v < low ? low : height < v ? height : v;
+}
+
+}// namespace
+
+vk::PresentModeKHR
+choosePresentMode(const std::vector<vk::PresentModeKHR> &presentModes,
+                  PresentPolicy policy,
+                  std::optional<vk::PresentModeKHR> preferred) {
+    auto supported = [&presentModes](vk::PresentModeKHR mode) {
+        return std::find(presentModes.begin(), presentModes.end(), mode) !=
+               presentModes.end();
+    };
+    if (preferred && supported(*preferred)) { return *preferred; }
+
+    std::vector<vk::PresentModeKHR> candidates;
+    switch (policy) {
+        case PresentPolicy::eLowLatency:
+            // relaxed fifo tears on a missed vblank instead of waiting a
+            // whole frame for the next one
+            candidates = {vk::PresentModeKHR::eMailbox,
+                          vk::PresentModeKHR::eImmediate,
+                          vk::PresentModeKHR::eFifoRelaxed};
+            break;
+        case PresentPolicy::eThroughput:
+            candidates = {vk::PresentModeKHR::eImmediate,
+                          vk::PresentModeKHR::eMailbox,
+                          vk::PresentModeKHR::eFifoRelaxed};
+            break;
+        case PresentPolicy::eVsync: break;
+    }
+    for (auto mode : candidates) {
+        if (supported(mode)) { return mode; }
+    }
+    // FIFO present mode is guaranteed by the spec to be supported
+    return vk::PresentModeKHR::eFifo;
+}
+
+uint32_t chooseSwapchainImageCount(
+        const vk::SurfaceCapabilitiesKHR &surfaceCapabilities,
+        vk::PresentModeKHR presentMode, PresentPolicy policy) {
+    uint32_t imageCount = surfaceCapabilities.minImageCount;
+    if (presentMode == vk::PresentModeKHR::eMailbox) {
+        // one image on screen, one queued and one being rendered, otherwise
+        // mailbox degrades to waiting for the display like fifo
+        imageCount = std::max(imageCount, 3u);
+    } else if (policy != PresentPolicy::eLowLatency) {
+        // a spare image keeps the cpu going when a frame misses a vblank, at
+        // the cost of one more frame queued in front of the display
+        imageCount++;
+    }
+    // a maxImageCount of 0 means there is no limit
+    if (0 < surfaceCapabilities.maxImageCount) {
+        imageCount = std::min(imageCount, surfaceCapabilities.maxImageCount);
+    }
+    return imageCount;
+}
+
+SwapchainData::SwapchainData(
+        vk::PhysicalDevice physicalDevice, vk::UniqueDevice &device,
+        vk::SurfaceKHR surface, const vk::Extent2D &surfaceExtent,
+        uint32_t graphicsQueueFamilyIndex,
+        uint32_t presentQueueFamilyIndex, PresentPolicy policy,
+        std::optional<vk::PresentModeKHR> preferredPresentMode,
+        vk::ImageUsageFlags extraUsage, vk::SwapchainKHR oldSwapchain) {
+    // get the supported surface formats
+    std::vector<vk::SurfaceFormatKHR> formats =
+            physicalDevice.getSurfaceFormatsKHR(surface);
+    assert(!formats.empty());
+    format = (formats[0].format == vk::Format::eUndefined)
+                     ? vk::Format::eB8G8R8A8Unorm
+                     : formats[0].format;
+
+    vk::SurfaceCapabilitiesKHR surfaceCapabilities =
+            physicalDevice.getSurfaceCapabilitiesKHR(surface);
+    if (surfaceCapabilities.currentExtent.width ==
+        std::numeric_limits<uint32_t>::max()) {
+        // if the surface size is undefined, the size is set to the size of
+        // the images requested
+        extent.width = clamp(surfaceExtent.width,
+                             surfaceCapabilities.minImageExtent.width,
+                             surfaceCapabilities.maxImageExtent.width);
+        extent.height = clamp(surfaceExtent.height,
+                              surfaceCapabilities.minImageExtent.height,
+                              surfaceCapabilities.maxImageExtent.height);
+    } else {
+        // if the surface size is defined, the swap chain size must match
+        extent = surfaceCapabilities.currentExtent;
+    }
+    // e.g. transfer source for frame capture
+    if ((surfaceCapabilities.supportedUsageFlags & extraUsage) != extraUsage) {
+        throw std::runtime_error("swapchain does not support image usage " +
+                                 vk::to_string(extraUsage));
+    }
+
+    presentMode = choosePresentMode(
+            physicalDevice.getSurfacePresentModesKHR(surface), policy,
+            preferredPresentMode);
+    uint32_t imageCount =
+            chooseSwapchainImageCount(surfaceCapabilities, presentMode, policy);
+
+    vk::SurfaceTransformFlagBitsKHR transform =
+            (surfaceCapabilities.supportedTransforms &
+             vk::SurfaceTransformFlagBitsKHR::eIdentity)
+                    ? vk::SurfaceTransformFlagBitsKHR::eIdentity
+                    : surfaceCapabilities.currentTransform;
+
+    vk::CompositeAlphaFlagBitsKHR compositeAlpha =
+            (surfaceCapabilities.supportedCompositeAlpha &
+             vk::CompositeAlphaFlagBitsKHR::ePreMultiplied)
+                    ? vk::CompositeAlphaFlagBitsKHR::ePreMultiplied
+            : (surfaceCapabilities.supportedCompositeAlpha &
+               vk::CompositeAlphaFlagBitsKHR::ePostMultiplied)
+                    ? vk::CompositeAlphaFlagBitsKHR::ePostMultiplied
+            : (surfaceCapabilities.supportedCompositeAlpha &
+               vk::CompositeAlphaFlagBitsKHR::eInherit)
+                    ? vk::CompositeAlphaFlagBitsKHR::eInherit
+                    : vk::CompositeAlphaFlagBitsKHR::eOpaque;
+
+    vk::SwapchainCreateInfoKHR swapchainCreateInfo(
+            vk::SwapchainCreateFlagsKHR(), surface, imageCount,
+            format, vk::ColorSpaceKHR::eSrgbNonlinear, extent, 1,
+            vk::ImageUsageFlagBits::eColorAttachment | extraUsage,
+            vk::SharingMode::eExclusive, {}, transform, compositeAlpha,
+            presentMode, true, oldSwapchain);
+
+    uint32_t queueFamilyIndices[2] = {graphicsQueueFamilyIndex,
+                                      presentQueueFamilyIndex};
+    if (graphicsQueueFamilyIndex != presentQueueFamilyIndex) {
+        // if the graphics and present queues are from different queue
+        // families, we either have to explicitly transfer ownership of
+        // images between the queues, or we have to create the swapchain
+        // with imageSharingMode as VK_SHARING_MODE_CONCURRENT
+        swapchainCreateInfo.imageSharingMode = vk::SharingMode::eConcurrent;
+        swapchainCreateInfo.queueFamilyIndexCount = 2;
+        swapchainCreateInfo.pQueueFamilyIndices = queueFamilyIndices;
+    }
+
+    swapchain = device->createSwapchainKHRUnique(swapchainCreateInfo);
+
+    images = device->getSwapchainImagesKHR(swapchain.get());
+
+    imageViews.reserve(images.size());
+    vk::ComponentMapping componentMapping(
+            vk::ComponentSwizzle::eR, vk::ComponentSwizzle::eG,
+            vk::ComponentSwizzle::eB, vk::ComponentSwizzle::eA);
+    vk::ImageSubresourceRange subresourceRange(vk::ImageAspectFlagBits::eColor,
+                                               0, 1, 0, 1);
+    for (const auto &image : images) {
+        vk::ImageViewCreateInfo imageViewCreateInfo(
+                vk::ImageViewCreateFlags(), image, vk::ImageViewType::e2D,
+                format, componentMapping, subresourceRange);
+        imageViews.push_back(
+                device->createImageViewUnique(imageViewCreateInfo));
+    }
+}
+
+OffscreenData::OffscreenData(vk::PhysicalDevice physicalDevice,
+                             vk::UniqueDevice &device,
+                             DeviceAllocator &allocator, vk::Format format,
+                             const vk::Extent2D &extent, uint32_t imageCount)
+    : format(format), extent(extent) {
+    vk::FormatProperties formatProperties =
+            physicalDevice.getFormatProperties(format);
+    if (!(formatProperties.optimalTilingFeatures &
+          vk::FormatFeatureFlagBits::eColorAttachment)) {
+        throw std::runtime_error("offscreen format is not renderable");
+    }
+
+    vk::ComponentMapping componentMapping(
+            vk::ComponentSwizzle::eR, vk::ComponentSwizzle::eG,
+            vk::ComponentSwizzle::eB, vk::ComponentSwizzle::eA);
+    vk::ImageSubresourceRange subresourceRange(vk::ImageAspectFlagBits::eColor,
+                                               0, 1, 0, 1);
+    images.reserve(imageCount);
+    imageViews.reserve(imageCount);
+    for (uint32_t i = 0; i < imageCount; i++) {
+        // transfer source, so that rendered frames can be read back
+        vk::ImageCreateInfo imageCreateInfo(
+                vk::ImageCreateFlags(), vk::ImageType::e2D, format,
+                vk::Extent3D(extent, 1), 1, 1, vk::SampleCountFlagBits::e1,
+                vk::ImageTiling::eOptimal,
+                vk::ImageUsageFlagBits::eColorAttachment |
+                        vk::ImageUsageFlagBits::eTransferSrc,
+                vk::SharingMode::eExclusive, {}, vk::ImageLayout::eUndefined);
+        images.emplace_back(allocator, imageCreateInfo,
+                            vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+        vk::ImageViewCreateInfo imageViewCreateInfo(
+                vk::ImageViewCreateFlags(), *images.back().image,
+                vk::ImageViewType::e2D, format, componentMapping,
+                subresourceRange);
+        imageViews.push_back(
+                device->createImageViewUnique(imageViewCreateInfo));
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <optional>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "allocator.h"
+
+enum class PresentPolicy {
+    // shortest input-to-photon path, tear free when the driver allows it
+    eLowLatency,
+    // never block on the display, frames may tear
+    eThroughput,
+    // strictly vsynced, with enough images to ride out a missed vblank
+    eVsync,
+};
+
+// the policy's favourite mode the surface supports, preferred if it does
+vk::PresentModeKHR
+choosePresentMode(const std::vector<vk::PresentModeKHR> &presentModes,
+                  PresentPolicy policy,
+                  std::optional<vk::PresentModeKHR> preferred = std::nullopt);
+uint32_t chooseSwapchainImageCount(
+        const vk::SurfaceCapabilitiesKHR &surfaceCapabilities,
+        vk::PresentModeKHR presentMode, PresentPolicy policy);
+
+// a swapchain with a view per image. surfaceExtent is used when the surface
+// leaves the size to the swapchain
+struct SwapchainData {
+    vk::Format format;
+    vk::Extent2D extent;
+    vk::PresentModeKHR presentMode;
+    vk::UniqueSwapchainKHR swapchain;
+    std::vector<vk::Image> images;
+    std::vector<vk::UniqueImageView> imageViews;
+
+    SwapchainData(vk::PhysicalDevice physicalDevice,
+                  vk::UniqueDevice &device, vk::SurfaceKHR surface,
+                  const vk::Extent2D &surfaceExtent,
+                  uint32_t graphicsQueueFamilyIndex,
+                  uint32_t presentQueueFamilyIndex, PresentPolicy policy,
+                  std::optional<vk::PresentModeKHR> preferredPresentMode,
+                  vk::ImageUsageFlags extraUsage = {},
+                  vk::SwapchainKHR oldSwapchain = nullptr);
+};
+
+// offscreen stand-in for a swapchain: device-owned images that are rendered to
+// round robin, without a window, a surface or a presentation engine
+struct OffscreenData {
+    vk::Format format;
+    vk::Extent2D extent;
+    std::vector<ImageData> images;
+    std::vector<vk::UniqueImageView> imageViews;
+
+    OffscreenData(vk::PhysicalDevice physicalDevice, vk::UniqueDevice &device,
+                  DeviceAllocator &allocator, vk::Format format,
+                  const vk::Extent2D &extent, uint32_t imageCount);
+};
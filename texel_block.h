@@ -0,0 +1,71 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+
+#include <vulkan/vulkan_core.h>
+
+// header only, light_pack checks what it writes without linking light_core
+
+// the unit images are laid out in, a texel for uncompressed formats
+struct TexelBlock {
+    uint32_t bytes;
+    uint32_t width;
+    uint32_t height;
+};
+
+// the formats asset packs hold and large images are uploaded in
+inline std::optional<TexelBlock> texelBlock(VkFormat format) {
+    switch (format) {
+        case VK_FORMAT_R8_UNORM:
+        case VK_FORMAT_R8_SRGB:
+            return TexelBlock{1, 1, 1};
+        case VK_FORMAT_R8G8_UNORM:
+        case VK_FORMAT_R16_SFLOAT:
+            return TexelBlock{2, 1, 1};
+        case VK_FORMAT_R8G8B8A8_UNORM:
+        case VK_FORMAT_R8G8B8A8_SRGB:
+        case VK_FORMAT_B8G8R8A8_UNORM:
+        case VK_FORMAT_B8G8R8A8_SRGB:
+        case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+        case VK_FORMAT_R16G16_SFLOAT:
+        case VK_FORMAT_R32_SFLOAT:
+            return TexelBlock{4, 1, 1};
+        case VK_FORMAT_R16G16B16A16_SFLOAT:
+        case VK_FORMAT_R32G32_SFLOAT:
+            return TexelBlock{8, 1, 1};
+        case VK_FORMAT_R32G32B32A32_SFLOAT:
+            return TexelBlock{16, 1, 1};
+        case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+        case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+        case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+        case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+        case VK_FORMAT_BC4_UNORM_BLOCK:
+            return TexelBlock{8, 4, 4};
+        case VK_FORMAT_BC3_UNORM_BLOCK:
+        case VK_FORMAT_BC3_SRGB_BLOCK:
+        case VK_FORMAT_BC5_UNORM_BLOCK:
+        case VK_FORMAT_BC7_UNORM_BLOCK:
+        case VK_FORMAT_BC7_SRGB_BLOCK:
+            return TexelBlock{16, 4, 4};
+        default:
+            return std::nullopt;
+    }
+}
+
+inline uint32_t divideRoundingUp(uint32_t value, uint32_t divisor) {
+    return (value + divisor - 1) / divisor;
+}
+
+// bytes of level mip of a width by height image with tightly packed rows, as
+// copied from a buffer. none for formats texelBlock does not know
+inline std::optional<uint64_t> mipByteSize(VkFormat format, uint32_t width,
+                                           uint32_t height, uint32_t mip) {
+    std::optional<TexelBlock> block = texelBlock(format);
+    if (!block || 32 <= mip) { return std::nullopt; }
+    uint32_t mipWidth = std::max(1u, width >> mip);
+    uint32_t mipHeight = std::max(1u, height >> mip);
+    return uint64_t(divideRoundingUp(mipWidth, block->width)) *
+           divideRoundingUp(mipHeight, block->height) * block->bytes;
+}
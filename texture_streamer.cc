@@ -0,0 +1,228 @@
+#include "texture_streamer.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// coarsest level every texture keeps, the first whose larger side is at most
+// kStreamingTailSize
+uint32_t tailMip(const AssetTexture &texture) {
+    uint32_t mip = 0;
+    while (mip + 1 < texture.mipCount &&
+           kStreamingTailSize < std::max(texture.width >> mip,
+                                         texture.height >> mip)) {
+        mip++;
+    }
+    return mip;
+}
+
+}// namespace
+
+TextureStreamer::TextureStreamer(vk::UniqueDevice &device,
+                                 DeviceAllocator &allocator,
+                                 UploadEngine &uploadEngine,
+                                 const AssetPack &pack,
+                                 BindlessTable *bindlessTable,
+                                 uint32_t framesInFlight,
+                                 vk::DeviceSize budget)
+    : device(&device), allocator(&allocator), uploadEngine(&uploadEngine),
+      pack(&pack), bindlessTable(bindlessTable),
+      framesInFlight(framesInFlight), budget(budget),
+      textures(pack.header->textureCount) {
+    // the tails first, every texture has a view before any is refined
+    for (uint32_t i = 0; i < textures.size(); i++) {
+        textures[i].residentMip = tailMip(pack.textures[i]);
+        startUpload(i, textures[i].residentMip);
+    }
+    if (!textures.empty()) {
+        uint32_t memoryType =
+                textures[0].pending->image.allocation.memoryTypeIndex;
+        heapIndex =
+                allocator.memoryProperties.memoryTypes[memoryType].heapIndex;
+    }
+}
+
+void TextureStreamer::request(uint32_t texture, uint32_t mip) {
+    Texture &t = textures[texture];
+    mip = std::min(mip, pack->textures[texture].mipCount - 1);
+    t.requestedMip = std::min(t.requestedMip, mip);
+}
+
+uint32_t TextureStreamer::mipForProjectedSize(uint32_t texture,
+                                              float projectedSize) const {
+    const AssetTexture &asset = pack->textures[texture];
+    float size = static_cast<float>(std::max(asset.width, asset.height));
+    if (!(0.0f < projectedSize)) { return asset.mipCount - 1; }
+    // one texel per pixel, as the hardware picks the level for a quad
+    float lod = std::max(std::log2(size / projectedSize), 0.0f);
+    return std::min(static_cast<uint32_t>(lod), asset.mipCount - 1);
+}
+
+void TextureStreamer::update(uint64_t frameNumber) {
+    for (Texture &texture : textures) {
+        if (texture.requestedMip != kNoMipRequested) {
+            texture.lastUsedFrame = frameNumber;
+        }
+    }
+
+    while (!retired.empty() && retired.front().retireFrame <= frameNumber) {
+        retired.pop_front();
+    }
+    for (Texture &texture : textures) {
+        if (texture.pending &&
+            uploadEngine->isComplete(texture.pending->uploadBatch)) {
+            swap(texture, frameNumber);
+        }
+    }
+
+    // the heap budget moves with what other processes use, shrinking it
+    // below what is resident sheds the textures that were not looked at
+    vk::DeviceSize limit = currentLimit();
+    while (limit < targetBytes() && evictOne(frameNumber, ~0u)) {}
+
+    // the cheapest requests first, one large texture must not hold up many
+    // small ones
+    std::vector<uint32_t> candidates;
+    for (uint32_t i = 0; i < textures.size(); i++) {
+        const Texture &texture = textures[i];
+        if (!texture.pending && texture.requestedMip < texture.residentMip) {
+            candidates.push_back(i);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [this](uint32_t a, uint32_t b) {
+                  return chainBytes(a, textures[a].requestedMip) <
+                         chainBytes(b, textures[b].requestedMip);
+              });
+    vk::DeviceSize started = 0;
+    for (uint32_t i : candidates) {
+        Texture &texture = textures[i];
+        uint32_t mip = texture.requestedMip;
+        // one texture larger than the limit still gets through alone
+        if (0 < started &&
+            kStreamingBytesPerFrame < started + chainBytes(i, mip)) {
+            break;
+        }
+        // the current image goes away with the swap
+        auto fits = [&] {
+            return targetBytes() - chainBytes(i, texture.residentMip) +
+                           chainBytes(i, mip) <=
+                   limit;
+        };
+        while (!fits() && evictOne(frameNumber, i)) {}
+        // settle for less than requested rather than nothing
+        while (!fits() && mip < texture.residentMip) { mip++; }
+        if (mip == texture.residentMip) {
+            overBudget++;
+            continue;
+        }
+        started += chainBytes(i, mip);
+        startUpload(i, mip);
+        upgrades++;
+    }
+
+    for (Texture &texture : textures) {
+        texture.requestedMip = kNoMipRequested;
+    }
+}
+
+vk::DeviceSize TextureStreamer::targetBytes() const {
+    vk::DeviceSize bytes = 0;
+    for (uint32_t i = 0; i < textures.size(); i++) {
+        const Texture &texture = textures[i];
+        bytes += chainBytes(i, texture.pending ? texture.pendingMip
+                                               : texture.residentMip);
+    }
+    return bytes;
+}
+
+vk::DeviceSize TextureStreamer::residentBytes() const {
+    vk::DeviceSize bytes = 0;
+    for (const Texture &texture : textures) {
+        bytes += texture.data.image.allocation.size;
+        if (texture.pending) {
+            bytes += texture.pending->image.allocation.size;
+        }
+    }
+    for (const Retired &r : retired) { bytes += r.data.image.allocation.size; }
+    return bytes;
+}
+
+void TextureStreamer::report(std::ostream &os) const {
+    // how many textures are resident at each level, finest first
+    std::vector<uint32_t> levels(kMaxAssetMips);
+    for (const Texture &texture : textures) { levels[texture.residentMip]++; }
+    os << "textures: " << textures.size() << " streamed, "
+       << (residentBytes() >> 20) << " MiB resident of "
+       << (currentLimit() >> 20) << " MiB budget, "
+       << (streamedBytes >> 20) << " MiB uploaded, " << upgrades
+       << " upgrades, " << evictions << " evictions, " << overBudget
+       << " requests over budget, by finest mip:";
+    for (uint32_t count : levels) { os << ' ' << count; }
+    os << std::endl;
+}
+
+vk::DeviceSize TextureStreamer::chainBytes(uint32_t texture,
+                                           uint32_t mip) const {
+    const AssetTexture &asset = pack->textures[texture];
+    vk::DeviceSize bytes = 0;
+    for (uint32_t i = mip; i < asset.mipCount; i++) {
+        bytes += asset.mips[i].size;
+    }
+    return bytes;
+}
+
+vk::DeviceSize TextureStreamer::currentLimit() const {
+    // what is resident already counts as available, everything else has to
+    // come out of the heap's headroom
+    HeapStatistics heap = allocator->getHeapStatistics()[heapIndex];
+    vk::DeviceSize headroom =
+            heap.usage < heap.budget ? heap.budget - heap.usage : 0;
+    return std::min(budget, residentBytes() +
+                                    headroom * kStreamingHeadroomPercent / 100);
+}
+
+void TextureStreamer::startUpload(uint32_t texture, uint32_t mip) {
+    Texture &t = textures[texture];
+    t.pending = loadTexture(*pack, texture, *device, *allocator,
+                            *uploadEngine, mip);
+    t.pendingMip = mip;
+    streamedBytes += chainBytes(texture, mip);
+}
+
+bool TextureStreamer::evictOne(uint64_t frame, uint32_t keep) {
+    uint32_t victim = ~0u;
+    for (uint32_t i = 0; i < textures.size(); i++) {
+        const Texture &texture = textures[i];
+        if (i == keep || texture.pending || frame <= texture.lastUsedFrame ||
+            tailMip(pack->textures[i]) <= texture.residentMip) {
+            continue;
+        }
+        if (victim == ~0u ||
+            texture.lastUsedFrame < textures[victim].lastUsedFrame) {
+            victim = i;
+        }
+    }
+    if (victim == ~0u) { return false; }
+    // a level at a time, the texture may be wanted again soon
+    startUpload(victim, textures[victim].residentMip + 1);
+    evictions++;
+    return true;
+}
+
+void TextureStreamer::swap(Texture &texture, uint64_t frameNumber) {
+    // a slot read by frames in flight must not be rewritten, so the new view
+    // gets its own and the old one is released behind the pending frames
+    if (bindlessTable) {
+        if (texture.bindlessIndex != ~0u) {
+            bindlessTable->releaseSampledImage(texture.bindlessIndex);
+        }
+        texture.bindlessIndex =
+                bindlessTable->addSampledImage(*texture.pending->imageView);
+    }
+    retired.push_back({std::move(texture.data), frameNumber + framesInFlight});
+    texture.data = std::move(*texture.pending);
+    texture.pending.reset();
+    texture.residentMip = texture.pendingMip;
+}
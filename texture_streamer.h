@@ -0,0 +1,114 @@
+#pragma once
+
+#include <deque>
+#include <optional>
+#include <ostream>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "allocator.h"
+#include "asset_pack.h"
+#include "bindless.h"
+#include "upload.h"
+
+// textures start out with the mips no larger than this resident
+const uint32_t kStreamingTailSize = 64;
+// upload volume started per frame, keeps upgrades from starving the rest of
+// the staging ring
+const vk::DeviceSize kStreamingBytesPerFrame = 16ull << 20;
+// share of the heap's headroom the streamer allows itself, the rest is left
+// for allocations the driver and other resources make meanwhile
+const uint32_t kStreamingHeadroomPercent = 90;
+// the requested level of a texture nothing asked for
+const uint32_t kNoMipRequested = ~0u;
+
+// keeps the textures of an asset pack resident at the resolution they are
+// seen at, within a memory budget. every texture starts with its low mips and
+// is raised towards the finest level requested; when the budget is exceeded
+// the least recently used textures drop their finest level.
+//
+// requests come from the cpu, with the level mipForProjectedSize estimates
+// from how large a texture appears on screen. a change of residency builds a
+// new image holding the new mip range from the pack and swaps it in once
+// uploaded, so sampling never sees a partial chain
+struct TextureStreamer {
+    struct Texture {
+        // finest level of the pack's chain the view starts at
+        uint32_t residentMip{0};
+        TextureData data;
+        // slot of the view in the bindless table, if there is one
+        uint32_t bindlessIndex{~0u};
+        // finest level requested since the last update
+        uint32_t requestedMip{kNoMipRequested};
+        uint64_t lastUsedFrame{0};
+        // a replacement with a different mip range being uploaded
+        std::optional<TextureData> pending;
+        uint32_t pendingMip{0};
+    };
+
+    // images swapped out, alive until the frames sampling them finished
+    struct Retired {
+        TextureData data;
+        uint64_t retireFrame;
+    };
+
+    vk::UniqueDevice *device;
+    DeviceAllocator *allocator;
+    UploadEngine *uploadEngine;
+    const AssetPack *pack;
+    BindlessTable *bindlessTable;
+    uint32_t framesInFlight;
+    // upper bound set by the user, lowered to the heap budget every update
+    vk::DeviceSize budget;
+    // memory heap the textures live in
+    uint32_t heapIndex{0};
+    std::vector<Texture> textures;
+    std::deque<Retired> retired;
+
+    // statistics
+    vk::DeviceSize streamedBytes{0};
+    uint32_t upgrades{0};
+    uint32_t evictions{0};
+    // a request was refused because nothing could be evicted
+    uint32_t overBudget{0};
+
+    TextureStreamer(vk::UniqueDevice &device, DeviceAllocator &allocator,
+                    UploadEngine &uploadEngine, const AssetPack &pack,
+                    BindlessTable *bindlessTable, uint32_t framesInFlight,
+                    vk::DeviceSize budget);
+    TextureStreamer(const TextureStreamer &) = delete;
+    TextureStreamer &operator=(const TextureStreamer &) = delete;
+
+    vk::ImageView view(uint32_t texture) const {
+        return *textures[texture].data.imageView;
+    }
+    // the finest level the texture is seen at this frame, the finest of
+    // several requests wins
+    void request(uint32_t texture, uint32_t mip);
+    // the level a sample reads when the texture's full width is shown across
+    // projectedSize pixels
+    uint32_t mipForProjectedSize(uint32_t texture, float projectedSize) const;
+
+    // call after the frame's submission was waited for and the upload
+    // engine's acquire was recorded: takes the frame's requests, swaps in
+    // finished uploads, evicts and starts upgrades
+    void update(uint64_t frameNumber);
+
+    // bytes the textures will occupy once pending uploads are swapped in
+    vk::DeviceSize targetBytes() const;
+    // bytes allocated for textures, including pending and retired images
+    vk::DeviceSize residentBytes() const;
+    void report(std::ostream &os) const;
+
+private:
+    // size of the image holding the pack's chain from mip on
+    vk::DeviceSize chainBytes(uint32_t texture, uint32_t mip) const;
+    // the budget after clamping it to the heap's headroom
+    vk::DeviceSize currentLimit() const;
+    void startUpload(uint32_t texture, uint32_t mip);
+    // drops the finest level of the least recently used texture that was not
+    // used since frame, false if there is none
+    bool evictOne(uint64_t frame, uint32_t keep);
+    void swap(Texture &texture, uint64_t frameNumber);
+};
@@ -0,0 +1,166 @@
+// streams the textures of a small generated pack under a budget that holds
+// one of them at full resolution, and checks that looking at another one
+// evicts levels of the first. needs a vulkan device, lavapipe will do
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "asset_pack.h"
+#include "headless_context.h"
+#include "texture_streamer.h"
+
+const uint32_t kTextureCount = 4;
+const uint32_t kTextureSize = 256;
+// frames each texture is looked at before the next one
+const uint64_t kFramesPerTexture = 8;
+const uint64_t kFrameCount = kFramesPerTexture * kTextureCount * 2;
+
+uint64_t alignUp(uint64_t value) {
+    return (value + kAssetAlignment - 1) / kAssetAlignment * kAssetAlignment;
+}
+
+// square rgba8 textures with full chains, and no meshes
+void writePack(const std::string &path) {
+    AssetHeader header{};
+    header.magic = kAssetMagic;
+    header.version = kAssetVersion;
+    header.textureCount = kTextureCount;
+    header.meshTableOffset = alignUp(sizeof(AssetHeader));
+    header.textureTableOffset = header.meshTableOffset;
+
+    std::vector<AssetTexture> textures(kTextureCount);
+    uint64_t offset =
+            alignUp(header.textureTableOffset +
+                    kTextureCount * sizeof(AssetTexture));
+    for (uint32_t i = 0; i < kTextureCount; i++) {
+        AssetTexture &texture = textures[i];
+        snprintf(texture.name, kAssetNameLength, "texture%u", i);
+        texture.format = VK_FORMAT_R8G8B8A8_UNORM;
+        texture.width = kTextureSize;
+        texture.height = kTextureSize;
+        for (uint32_t size = kTextureSize; 0 < size; size >>= 1) {
+            AssetSection &mip = texture.mips[texture.mipCount++];
+            mip.offset = offset;
+            mip.size = uint64_t(size) * size * 4;
+            offset = alignUp(offset + mip.size);
+        }
+    }
+    header.fileSize = offset;
+
+    std::vector<uint8_t> file(offset, 0x80);
+    memcpy(file.data(), &header, sizeof(header));
+    memcpy(file.data() + header.textureTableOffset, textures.data(),
+           kTextureCount * sizeof(AssetTexture));
+    std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+    stream.write(reinterpret_cast<const char *>(file.data()), file.size());
+    if (!stream.flush()) {
+        throw std::runtime_error("could not write " + path);
+    }
+}
+
+vk::DeviceSize chainBytes(const AssetTexture &texture, uint32_t mip) {
+    vk::DeviceSize bytes = 0;
+    for (uint32_t i = mip; i < texture.mipCount; i++) {
+        bytes += texture.mips[i].size;
+    }
+    return bytes;
+}
+
+int main() {
+    std::string path = (std::filesystem::temp_directory_path() /
+                        "light_texture_streamer_test.pack")
+                               .string();
+    try {
+        writePack(path);
+
+        HeadlessContext context("light_texture_streamer_test");
+        vk::UniqueDevice &device = context.device;
+        SubmissionScheduler &scheduler = context.scheduler;
+        UploadEngine &uploadEngine = context.uploadEngine;
+        AssetPack pack(path);
+
+        // one texture at full resolution, half of that for a second one and
+        // the others at their tails
+        const AssetTexture &asset = pack.textures[0];
+        vk::DeviceSize full = chainBytes(asset, 0);
+        vk::DeviceSize tail = 0;
+        while (kStreamingTailSize < (kTextureSize >> tail)) { tail++; }
+        vk::DeviceSize budget = full + full / 2 +
+                                (kTextureCount - 1) * chainBytes(asset, tail);
+        TextureStreamer textureStreamer(device, context.allocator,
+                                        uploadEngine, pack, nullptr, 1,
+                                        budget);
+
+        vk::UniqueCommandPool commandPool = device->createCommandPoolUnique(
+                vk::CommandPoolCreateInfo(
+                        vk::CommandPoolCreateFlagBits::eTransient,
+                        context.families.graphics));
+        vk::UniqueCommandBuffer commandBuffer = std::move(
+                device->allocateCommandBuffersUnique(
+                              vk::CommandBufferAllocateInfo(
+                                      *commandPool,
+                                      vk::CommandBufferLevel::ePrimary, 1))
+                        .front());
+
+        uint32_t visible = 0;
+        for (uint64_t frameNumber = 1; frameNumber <= kFrameCount;
+             frameNumber++) {
+            // whatever was uploaded has finished, take it over so that the
+            // streamer can swap it in
+            uploadEngine.flush();
+            scheduler.flush();
+            scheduler.waitIdle();
+            device->resetCommandPool(*commandPool,
+                                     vk::CommandPoolResetFlags());
+            commandBuffer->begin(vk::CommandBufferBeginInfo(
+                    vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+            uploadEngine.acquire(*commandBuffer);
+            commandBuffer->end();
+            SubmissionTask task;
+            task.commandBuffers = {*commandBuffer};
+            scheduler.submit(task);
+            scheduler.flush();
+            scheduler.waitIdle();
+
+            visible = static_cast<uint32_t>(
+                    (frameNumber - 1) / kFramesPerTexture % kTextureCount);
+            textureStreamer.request(visible, 0);
+            textureStreamer.update(frameNumber);
+        }
+
+        textureStreamer.report(std::cout);
+        bool passed = true;
+        if (textureStreamer.evictions == 0) {
+            std::cerr << "texture streamer: nothing was evicted over budget"
+                      << std::endl;
+            passed = false;
+        }
+        if (budget < textureStreamer.targetBytes()) {
+            std::cerr << "texture streamer: " << textureStreamer.targetBytes()
+                      << " bytes targeted over a budget of " << budget
+                      << std::endl;
+            passed = false;
+        }
+        if (textureStreamer.textures[visible].residentMip != 0) {
+            std::cerr << "texture streamer: the texture looked at last is not "
+                         "at full resolution"
+                      << std::endl;
+            passed = false;
+        }
+        std::filesystem::remove(path);
+        return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+    } catch (vk::SystemError &err) {
+        std::cerr << "vk::SystemError: " << err.what() << std::endl;
+    } catch (std::exception &ex) {
+        std::cerr << "std::exception: " << ex.what() << std::endl;
+    }
+    std::filesystem::remove(path);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,354 @@
+#include "upload.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "texel_block.h"
+
+UploadEngine::UploadEngine(vk::PhysicalDevice physicalDevice,
+                           vk::UniqueDevice &device, DeviceAllocator &allocator,
+                           SubmissionScheduler &scheduler,
+                           vk::DeviceSize stagingSize)
+    : device(*device), scheduler(&scheduler),
+      transferQueueFamilyIndex(scheduler.familyIndex(QueueType::eTransfer)),
+      graphicsQueueFamilyIndex(scheduler.familyIndex(QueueType::eGraphics)),
+      staging(allocator, stagingSize, vk::BufferUsageFlagBits::eTransferSrc,
+              vk::MemoryPropertyFlagBits::eHostVisible |
+                      vk::MemoryPropertyFlagBits::eHostCoherent) {
+    // 16 keeps every texel block size and the 4 byte rule for images happy
+    copyAlignment = std::max<vk::DeviceSize>(
+            16, physicalDevice.getProperties()
+                        .limits.optimalBufferCopyOffsetAlignment);
+}
+
+UploadEngine::~UploadEngine() noexcept {
+    // the command pools must not go away under a pending submission
+    for (auto &batch : inFlight) { waitForBatch(*batch); }
+}
+
+void UploadEngine::waitForBatch(const Batch &batch) {
+    scheduler->wait(batch.submitted);
+}
+
+UploadEngine::Batch &UploadEngine::currentBatch() {
+    if (!current) {
+        if (freeBatches.empty()) {
+            current = std::make_unique<Batch>();
+            current->commandPool =
+                    device.createCommandPoolUnique(vk::CommandPoolCreateInfo(
+                            vk::CommandPoolCreateFlagBits::eTransient,
+                            transferQueueFamilyIndex));
+            current->commandBuffer = std::move(
+                    device.allocateCommandBuffersUnique(
+                                  vk::CommandBufferAllocateInfo(
+                                          *current->commandPool,
+                                          vk::CommandBufferLevel::ePrimary, 1))
+                            .front());
+        } else {
+            current = std::move(freeBatches.back());
+            freeBatches.pop_back();
+        }
+        current->id = nextBatchId++;
+    }
+    if (!current->recording) {
+        current->commandBuffer->begin(vk::CommandBufferBeginInfo(
+                vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+        current->recording = true;
+    }
+    return *current;
+}
+
+std::optional<vk::DeviceSize>
+UploadEngine::allocateStaging(vk::DeviceSize size) {
+    vk::DeviceSize capacity = staging.allocation.size;
+    vk::DeviceSize offset = (head + copyAlignment - 1) & ~(copyAlignment - 1);
+    // head == tail only ever means empty, so a full ring never closes the gap
+    if (tail <= head) {
+        // free space is [head, capacity) and [0, tail)
+        if (offset + size <= capacity) {
+            head = offset + size;
+            return offset;
+        }
+        if (size < tail) {
+            head = size;
+            return 0;
+        }
+    } else if (offset + size < tail) {
+        // free space is [head, tail)
+        head = offset + size;
+        return offset;
+    }
+    return std::nullopt;
+}
+
+vk::DeviceSize UploadEngine::reserveStaging(vk::DeviceSize size) {
+    if (staging.allocation.size <= size + copyAlignment) {
+        throw std::runtime_error("upload larger than the staging ring");
+    }
+    for (;;) {
+        if (inFlight.empty() && (!current || !current->recording)) {
+            // nothing in use, start over at the beginning of the ring
+            head = tail = 0;
+        }
+        if (auto offset = allocateStaging(size)) { return *offset; }
+        // the ring is full of pending copies, wait for the oldest batch
+        flush();
+        retire(true);
+    }
+}
+
+void UploadEngine::retire(bool block) {
+    while (!inFlight.empty()) {
+        Batch &batch = *inFlight.front();
+        if (block) {
+            waitForBatch(batch);
+            block = false;
+        } else if (!scheduler->isComplete(batch.submitted)) {
+            break;
+        }
+
+        tail = batch.ringEnd;
+        retiredBatchId = batch.id;
+        pendingBufferBarriers.insert(pendingBufferBarriers.end(),
+                                     batch.bufferBarriers.begin(),
+                                     batch.bufferBarriers.end());
+        pendingImageBarriers.insert(pendingImageBarriers.end(),
+                                    batch.imageBarriers.begin(),
+                                    batch.imageBarriers.end());
+        batch.bufferBarriers.clear();
+        batch.imageBarriers.clear();
+
+        device.resetCommandPool(*batch.commandPool,
+                                vk::CommandPoolResetFlags());
+        batch.recording = false;
+        freeBatches.push_back(std::move(inFlight.front()));
+        inFlight.pop_front();
+    }
+}
+
+uint64_t UploadEngine::uploadBuffer(vk::Buffer buffer, vk::DeviceSize offset,
+                                    const void *data, vk::DeviceSize size) {
+    if (size == 0) { return completedBatchId; }
+    // large uploads are split so they can stream through the ring while
+    // earlier chunks are still being copied
+    vk::DeviceSize chunkSize = staging.allocation.size / 4;
+    uint64_t batchId = 0;
+    for (vk::DeviceSize done = 0; done < size;) {
+        vk::DeviceSize n = std::min(size - done, chunkSize);
+        vk::DeviceSize stagingOffset = reserveStaging(n);
+        Batch &batch = currentBatch();
+        memcpy(static_cast<uint8_t *>(staging.allocation.mapped) +
+                       stagingOffset,
+               static_cast<const uint8_t *>(data) + done, n);
+        batch.commandBuffer->copyBuffer(
+                *staging.buffer, buffer,
+                vk::BufferCopy(stagingOffset, offset + done, n));
+        batchId = batch.id;
+        done += n;
+    }
+    uploadedBytes += size;
+
+    // the barrier goes into the last batch, earlier chunks precede it in
+    // submission order on the same queue
+    Batch &batch = *current;
+    if (ownershipTransfer()) {
+        vk::BufferMemoryBarrier release(
+                vk::AccessFlagBits::eTransferWrite, vk::AccessFlags(),
+                transferQueueFamilyIndex, graphicsQueueFamilyIndex, buffer,
+                offset, size);
+        batch.commandBuffer->pipelineBarrier(
+                vk::PipelineStageFlagBits::eTransfer,
+                vk::PipelineStageFlagBits::eBottomOfPipe,
+                vk::DependencyFlags(), nullptr, release, nullptr);
+        batch.bufferBarriers.emplace_back(
+                vk::AccessFlags(), vk::AccessFlagBits::eMemoryRead,
+                transferQueueFamilyIndex, graphicsQueueFamilyIndex, buffer,
+                offset, size);
+    } else {
+        vk::BufferMemoryBarrier barrier(
+                vk::AccessFlagBits::eTransferWrite,
+                vk::AccessFlagBits::eMemoryRead, VK_QUEUE_FAMILY_IGNORED,
+                VK_QUEUE_FAMILY_IGNORED, buffer, offset, size);
+        batch.commandBuffer->pipelineBarrier(
+                vk::PipelineStageFlagBits::eTransfer,
+                vk::PipelineStageFlagBits::eAllCommands,
+                vk::DependencyFlags(), nullptr, barrier, nullptr);
+    }
+    return batchId;
+}
+
+uint64_t
+UploadEngine::uploadImage(vk::Image image, vk::Format format,
+                          const vk::ImageSubresourceRange &subresourceRange,
+                          const std::vector<vk::BufferImageCopy> &regions,
+                          const void *data, vk::DeviceSize size,
+                          vk::ImageLayout finalLayout) {
+    uploadedBytes += size;
+    bool transitioned = false;
+    // copies n bytes into the ring and returns where they went, the layout
+    // transition goes in front of the first copy
+    auto stage = [&](const void *source, vk::DeviceSize n) {
+        vk::DeviceSize stagingOffset = reserveStaging(n);
+        Batch &batch = currentBatch();
+        memcpy(static_cast<uint8_t *>(staging.allocation.mapped) +
+                       stagingOffset,
+               source, n);
+        if (!transitioned) {
+            // previous contents of the uploaded subresources are discarded
+            vk::ImageMemoryBarrier toTransfer(
+                    vk::AccessFlags(), vk::AccessFlagBits::eTransferWrite,
+                    vk::ImageLayout::eUndefined,
+                    vk::ImageLayout::eTransferDstOptimal,
+                    VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, image,
+                    subresourceRange);
+            batch.commandBuffer->pipelineBarrier(
+                    vk::PipelineStageFlagBits::eTopOfPipe,
+                    vk::PipelineStageFlagBits::eTransfer,
+                    vk::DependencyFlags(), nullptr, nullptr, toTransfer);
+            transitioned = true;
+        }
+        return stagingOffset;
+    };
+
+    // large uploads are split like buffers, so they stream through the ring.
+    // the transition in the first batch orders the copies of later batches
+    // as well, they follow it in submission order on the same queue
+    vk::DeviceSize chunkSize = staging.allocation.size / 4;
+    if (size <= chunkSize) {
+        vk::DeviceSize stagingOffset = stage(data, size);
+        std::vector<vk::BufferImageCopy> copies = regions;
+        for (auto &copy : copies) { copy.bufferOffset += stagingOffset; }
+        current->commandBuffer->copyBufferToImage(
+                *staging.buffer, image, vk::ImageLayout::eTransferDstOptimal,
+                copies);
+    } else {
+        std::optional<TexelBlock> block =
+                texelBlock(static_cast<VkFormat>(format));
+        if (!block) {
+            throw std::runtime_error("upload larger than the staging ring "
+                                     "in a format it cannot split: " +
+                                     vk::to_string(format));
+        }
+        for (const vk::BufferImageCopy &region : regions) {
+            // the layout of the region in data, in rows of texel blocks
+            uint32_t rowLength = region.bufferRowLength
+                                         ? region.bufferRowLength
+                                         : region.imageExtent.width;
+            uint32_t imageHeight = region.bufferImageHeight
+                                           ? region.bufferImageHeight
+                                           : region.imageExtent.height;
+            vk::DeviceSize rowPitch =
+                    vk::DeviceSize(divideRoundingUp(rowLength, block->width)) *
+                    block->bytes;
+            vk::DeviceSize rowBytes =
+                    vk::DeviceSize(divideRoundingUp(region.imageExtent.width,
+                                                    block->width)) *
+                    block->bytes;
+            vk::DeviceSize slicePitch =
+                    divideRoundingUp(imageHeight, block->height) * rowPitch;
+            uint32_t rowCount =
+                    divideRoundingUp(region.imageExtent.height, block->height);
+            // depth slices of 3d images or array layers, one is always 1
+            uint32_t sliceCount = region.imageExtent.depth *
+                                  region.imageSubresource.layerCount;
+            // as many rows as fit a chunk, at least one
+            uint32_t bandRows = static_cast<uint32_t>(std::max<vk::DeviceSize>(
+                    1, std::min<vk::DeviceSize>(chunkSize / rowPitch,
+                                                rowCount)));
+
+            for (uint32_t slice = 0; slice < sliceCount; slice++) {
+                for (uint32_t row = 0; row < rowCount; row += bandRows) {
+                    uint32_t rows = std::min(bandRows, rowCount - row);
+                    const uint8_t *source = static_cast<const uint8_t *>(data) +
+                                            region.bufferOffset +
+                                            slice * slicePitch + row * rowPitch;
+                    vk::BufferImageCopy band = region;
+                    band.bufferOffset =
+                            stage(source, (rows - 1) * rowPitch + rowBytes);
+                    band.bufferRowLength = rowLength;
+                    band.bufferImageHeight = 0;
+                    if (1 < region.imageExtent.depth) {
+                        band.imageOffset.z += static_cast<int32_t>(slice);
+                        band.imageExtent.depth = 1;
+                    } else {
+                        band.imageSubresource.baseArrayLayer += slice;
+                        band.imageSubresource.layerCount = 1;
+                    }
+                    band.imageOffset.y +=
+                            static_cast<int32_t>(row * block->height);
+                    band.imageExtent.height =
+                            std::min(rows * block->height,
+                                     region.imageExtent.height -
+                                             row * block->height);
+                    current->commandBuffer->copyBufferToImage(
+                            *staging.buffer, image,
+                            vk::ImageLayout::eTransferDstOptimal, band);
+                }
+            }
+        }
+    }
+    Batch &batch = *current;
+
+    // both halves of an ownership transfer have to do the same transition
+    if (ownershipTransfer()) {
+        vk::ImageMemoryBarrier release(
+                vk::AccessFlagBits::eTransferWrite, vk::AccessFlags(),
+                vk::ImageLayout::eTransferDstOptimal, finalLayout,
+                transferQueueFamilyIndex, graphicsQueueFamilyIndex, image,
+                subresourceRange);
+        batch.commandBuffer->pipelineBarrier(
+                vk::PipelineStageFlagBits::eTransfer,
+                vk::PipelineStageFlagBits::eBottomOfPipe,
+                vk::DependencyFlags(), nullptr, nullptr, release);
+        batch.imageBarriers.emplace_back(
+                vk::AccessFlags(), vk::AccessFlagBits::eMemoryRead,
+                vk::ImageLayout::eTransferDstOptimal, finalLayout,
+                transferQueueFamilyIndex, graphicsQueueFamilyIndex, image,
+                subresourceRange);
+    } else {
+        vk::ImageMemoryBarrier barrier(
+                vk::AccessFlagBits::eTransferWrite,
+                vk::AccessFlagBits::eMemoryRead,
+                vk::ImageLayout::eTransferDstOptimal, finalLayout,
+                VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, image,
+                subresourceRange);
+        batch.commandBuffer->pipelineBarrier(
+                vk::PipelineStageFlagBits::eTransfer,
+                vk::PipelineStageFlagBits::eAllCommands,
+                vk::DependencyFlags(), nullptr, nullptr, barrier);
+    }
+    return batch.id;
+}
+
+void UploadEngine::flush() {
+    if (!current || !current->recording) { return; }
+    current->commandBuffer->end();
+    current->ringEnd = head;
+    SubmissionTask task;
+    task.queue = QueueType::eTransfer;
+    task.commandBuffers = {*current->commandBuffer};
+    current->submitted = scheduler->submit(task);
+    inFlight.push_back(std::move(current));
+}
+
+void UploadEngine::acquire(vk::CommandBuffer commandBuffer) {
+    retire(false);
+    if (!pendingBufferBarriers.empty() || !pendingImageBarriers.empty()) {
+        // the transfer queue finished before this is submitted, the host
+        // observed its timeline, so no semaphore is needed to order the halves
+        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe,
+                                      vk::PipelineStageFlagBits::eAllCommands,
+                                      vk::DependencyFlags(), nullptr,
+                                      pendingBufferBarriers,
+                                      pendingImageBarriers);
+        pendingBufferBarriers.clear();
+        pendingImageBarriers.clear();
+    }
+    completedBatchId = retiredBatchId;
+}
+
+void UploadEngine::wait(uint64_t batchId) {
+    if (current && current->id <= batchId) { flush(); }
+    while (retiredBatchId < batchId && !inFlight.empty()) { retire(true); }
+}
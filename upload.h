@@ -0,0 +1,97 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "allocator.h"
+#include "submission.h"
+
+// size of the persistently mapped staging ring
+const vk::DeviceSize kDefaultStagingSize = 32ull << 20;
+
+// streams buffer and image contents to the gpu through a mapped staging ring,
+// batching the copies into few submissions on a transfer queue. once a batch
+// completed, acquire() hands the resources over to the graphics queue, so
+// rendering never waits for an upload on the gpu
+struct UploadEngine {
+    struct Batch {
+        uint64_t id{0};
+        vk::UniqueCommandPool commandPool;
+        vk::UniqueCommandBuffer commandBuffer;
+        // on the transfer queue's timeline
+        TimelinePoint submitted;
+        // end of this batch's data in the staging ring
+        vk::DeviceSize ringEnd{0};
+        // the graphics queue side of each queue family ownership transfer
+        std::vector<vk::BufferMemoryBarrier> bufferBarriers;
+        std::vector<vk::ImageMemoryBarrier> imageBarriers;
+        bool recording{false};
+    };
+
+    vk::Device device;
+    SubmissionScheduler *scheduler;
+    uint32_t transferQueueFamilyIndex;
+    uint32_t graphicsQueueFamilyIndex;
+    BufferData staging;
+    vk::DeviceSize copyAlignment;
+    // next free byte and start of the oldest byte still in use
+    vk::DeviceSize head{0};
+    vk::DeviceSize tail{0};
+    std::unique_ptr<Batch> current;
+    std::deque<std::unique_ptr<Batch>> inFlight;
+    std::vector<std::unique_ptr<Batch>> freeBatches;
+    // acquiring barriers of retired batches, not yet recorded on graphics
+    std::vector<vk::BufferMemoryBarrier> pendingBufferBarriers;
+    std::vector<vk::ImageMemoryBarrier> pendingImageBarriers;
+    uint64_t nextBatchId{1};
+    // finished on the transfer queue
+    uint64_t retiredBatchId{0};
+    // finished and acquired by the graphics queue
+    uint64_t completedBatchId{0};
+    vk::DeviceSize uploadedBytes{0};
+
+    UploadEngine(vk::PhysicalDevice physicalDevice, vk::UniqueDevice &device,
+                 DeviceAllocator &allocator, SubmissionScheduler &scheduler,
+                 vk::DeviceSize stagingSize = kDefaultStagingSize);
+    ~UploadEngine() noexcept;
+
+    // both return the batch the copy went into, data is copied immediately
+    uint64_t uploadBuffer(vk::Buffer buffer, vk::DeviceSize offset,
+                          const void *data, vk::DeviceSize size);
+    // the image leaves in finalLayout, owned by the graphics queue family.
+    // bufferOffset in regions is relative to data. images larger than a
+    // quarter of the ring are copied in bands of rows, which needs a format
+    // the engine knows the texel block size of
+    uint64_t uploadImage(vk::Image image, vk::Format format,
+                         const vk::ImageSubresourceRange &subresourceRange,
+                         const std::vector<vk::BufferImageCopy> &regions,
+                         const void *data, vk::DeviceSize size,
+                         vk::ImageLayout finalLayout =
+                                 vk::ImageLayout::eShaderReadOnlyOptimal);
+    // queues the copies recorded so far on the transfer queue, they reach
+    // the driver with the scheduler's next flush
+    void flush();
+    // records the acquiring half of the ownership transfers for every batch
+    // that finished on the transfer queue into a graphics command buffer
+    void acquire(vk::CommandBuffer commandBuffer);
+    bool isComplete(uint64_t batchId) const {
+        return batchId <= completedBatchId;
+    }
+    // blocks until the batch finished on the transfer queue, it still has to
+    // be acquired before the graphics queue may use its resources
+    void wait(uint64_t batchId);
+
+private:
+    bool ownershipTransfer() const {
+        return transferQueueFamilyIndex != graphicsQueueFamilyIndex;
+    }
+    Batch &currentBatch();
+    std::optional<vk::DeviceSize> allocateStaging(vk::DeviceSize size);
+    vk::DeviceSize reserveStaging(vk::DeviceSize size);
+    void retire(bool block);
+    void waitForBatch(const Batch &batch);
+};
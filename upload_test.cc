@@ -0,0 +1,118 @@
+// uploads an image several times the size of the staging ring through the
+// upload engine and reads it back. needs a vulkan device, lavapipe will do
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "headless_context.h"
+
+// a quarter of the image, so that it has to be copied in bands
+const vk::DeviceSize kStagingSize = 1ull << 20;
+const uint32_t kImageWidth = 1024;
+const uint32_t kImageHeight = 1024;
+const vk::Format kImageFormat = vk::Format::eR8G8B8A8Unorm;
+
+int main() {
+    try {
+        HeadlessContext context("light_upload_test", {}, kStagingSize);
+        vk::UniqueDevice &device = context.device;
+        SubmissionScheduler &scheduler = context.scheduler;
+        DeviceAllocator &allocator = context.allocator;
+        UploadEngine &uploadEngine = context.uploadEngine;
+
+        // every texel holds its own coordinates
+        std::vector<uint32_t> texels(kImageWidth * kImageHeight);
+        for (uint32_t y = 0; y < kImageHeight; y++) {
+            for (uint32_t x = 0; x < kImageWidth; x++) {
+                texels[y * kImageWidth + x] = x | y << 16;
+            }
+        }
+        vk::DeviceSize size = texels.size() * sizeof(uint32_t);
+
+        ImageData image(
+                allocator,
+                vk::ImageCreateInfo(
+                        vk::ImageCreateFlags(), vk::ImageType::e2D,
+                        kImageFormat,
+                        vk::Extent3D(kImageWidth, kImageHeight, 1), 1, 1,
+                        vk::SampleCountFlagBits::e1,
+                        vk::ImageTiling::eOptimal,
+                        vk::ImageUsageFlagBits::eTransferDst |
+                                vk::ImageUsageFlagBits::eTransferSrc),
+                vk::MemoryPropertyFlagBits::eDeviceLocal);
+        vk::BufferImageCopy region(
+                0, 0, 0,
+                vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0,
+                                           0, 1),
+                vk::Offset3D(0, 0, 0),
+                vk::Extent3D(kImageWidth, kImageHeight, 1));
+        uint64_t batchId = uploadEngine.uploadImage(
+                *image.image, kImageFormat,
+                vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0,
+                                          1, 0, 1),
+                {region}, texels.data(), size,
+                vk::ImageLayout::eTransferSrcOptimal);
+        uploadEngine.wait(batchId);
+
+        // back through the graphics queue, which owns the image now
+        BufferData readback(allocator, size,
+                            vk::BufferUsageFlagBits::eTransferDst,
+                            vk::MemoryPropertyFlagBits::eHostVisible |
+                                    vk::MemoryPropertyFlagBits::eHostCoherent);
+        vk::UniqueCommandPool commandPool = device->createCommandPoolUnique(
+                vk::CommandPoolCreateInfo(
+                        vk::CommandPoolCreateFlagBits::eTransient,
+                        context.families.graphics));
+        vk::UniqueCommandBuffer commandBuffer = std::move(
+                device->allocateCommandBuffersUnique(
+                              vk::CommandBufferAllocateInfo(
+                                      *commandPool,
+                                      vk::CommandBufferLevel::ePrimary, 1))
+                        .front());
+        commandBuffer->begin(vk::CommandBufferBeginInfo(
+                vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+        uploadEngine.acquire(*commandBuffer);
+        commandBuffer->copyImageToBuffer(*image.image,
+                                         vk::ImageLayout::eTransferSrcOptimal,
+                                         *readback.buffer, region);
+        vk::BufferMemoryBarrier toHost(
+                vk::AccessFlagBits::eTransferWrite,
+                vk::AccessFlagBits::eHostRead, VK_QUEUE_FAMILY_IGNORED,
+                VK_QUEUE_FAMILY_IGNORED, *readback.buffer, 0, size);
+        commandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                       vk::PipelineStageFlagBits::eHost,
+                                       vk::DependencyFlags(), nullptr, toHost,
+                                       nullptr);
+        commandBuffer->end();
+        SubmissionTask task;
+        task.commandBuffers = {*commandBuffer};
+        TimelinePoint readbackDone = scheduler.submit(task);
+        scheduler.flush();
+        scheduler.wait(readbackDone);
+
+        uint64_t batchCount = uploadEngine.nextBatchId - 1;
+        if (memcmp(readback.allocation.mapped, texels.data(), size) != 0) {
+            std::cerr << "upload: image read back differs" << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (batchCount < 2) {
+            std::cerr << "upload: image fit a single batch, the ring was not "
+                         "streamed through"
+                      << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::cout << "upload: " << size << " bytes through a " << kStagingSize
+                  << " byte ring in " << batchCount << " batches" << std::endl;
+    } catch (vk::SystemError &err) {
+        std::cerr << "vk::SystemError: " << err.what() << std::endl;
+        return EXIT_FAILURE;
+    } catch (std::exception &ex) {
+        std::cerr << "std::exception: " << ex.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}